@@ -0,0 +1,681 @@
+// Emulation throughput benchmark: runs a set of synthetic instruction mix
+// ROMs, plus any ROMs given on the command line, for a fixed cycle budget and
+// reports emulated instructions per second and host ns per instruction.
+// Where perf_event_open is allowed it also counts host instructions, cache
+// misses and branch misses per emulated instruction.
+//
+// Results can be written out and later used as a baseline, the run then
+// fails if any ROM got slower than the threshold, which is how changes to
+// the cpu and bus hot paths are gated:
+//
+//     gbbench -o base.jsonl                       (before the change)
+//     gbbench --baseline base.jsonl --threshold 5 (after)
+//
+// --engine picks what runs the code: the interpreter alone, the block cache,
+// or the block cache plus the JIT (the default, where it's built).
+//
+// usage: gbbench [--cycles N] [--runs N] [-o results] [--baseline results]
+//                [--threshold pct] [--engine interp|blocks|jit] [rom...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <gb.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#define DEFAULT_CYCLES 100000000ULL
+#define DEFAULT_RUNS 3
+#define DEFAULT_THRESHOLD 5.0
+// T-cycles per second on hardware
+#define GB_CLOCK_HZ 4194304.0
+
+// **Synthetic ROMs**
+// Each one is a small loop at 0x150 (and optionally a subroutine at 0x200)
+// that never touches vram or io, so it runs with what the cpu implements
+// today for as long as the budget lasts.
+
+typedef struct {
+    const char *name;
+    const uint8_t *code;
+    size_t code_size;
+    const uint8_t *sub;
+    size_t sub_size;
+} synthetic_rom;
+
+// register to register arithmetic and logic, one jump per 20 instructions
+static const uint8_t ALU_CODE[] = {
+    0x31, 0xF0, 0xDF, // LD SP,DFF0
+    0x80,             // 153: ADD A,B
+    0x89,             // ADC A,C
+    0x92,             // SUB D
+    0x9B,             // SBC A,E
+    0xA4,             // AND H
+    0xB5,             // OR L
+    0xA8,             // XOR B
+    0xB9,             // CP C
+    0xC6, 0x13,       // ADD A,13
+    0x04,             // INC B
+    0x0D,             // DEC C
+    0x14,             // INC D
+    0x1D,             // DEC E
+    0x24,             // INC H
+    0x2D,             // DEC L
+    0x47,             // LD B,A
+    0x03,             // INC BC
+    0x1B,             // DEC DE
+    0x29,             // ADD HL,HL
+    0xEE, 0x5A,       // XOR 5A
+    0xD6, 0x07,       // SUB 7
+    0xC3, 0x53, 0x01, // JP 0153
+};
+
+// loads, stores and stack traffic over work ram
+static const uint8_t MEMORY_CODE[] = {
+    0x31, 0xF0, 0xDF, // LD SP,DFF0
+    0x21, 0x00, 0xC0, // LD HL,C000
+    0x11, 0x00, 0xC8, // LD DE,C800
+    0x7E,             // 159: LD A,(HL)
+    0x12,             // LD (DE),A
+    0x2C,             // INC L
+    0x1C,             // INC E
+    0x1A,             // LD A,(DE)
+    0xAE,             // XOR (HL)
+    0x77,             // LD (HL),A
+    0xE5,             // PUSH HL
+    0xC1,             // POP BC
+    0x0A,             // LD A,(BC)
+    0x02,             // LD (BC),A
+    0x2A,             // LD A,(HL+)
+    0x2B,             // DEC HL
+    0x46,             // LD B,(HL)
+    0xD5,             // PUSH DE
+    0xD1,             // POP DE
+    0xFA, 0x40, 0xC0, // LD A,(C040)
+    0xC3, 0x59, 0x01, // JP 0159
+};
+
+// data dependent conditional jumps, calls and returns
+static const uint8_t BRANCHY_CODE[] = {
+    0x31, 0xF0, 0xDF, // LD SP,DFF0
+    0x04,             // 153: INC B
+    0x78,             // LD A,B
+    0xE6, 0x03,       // AND 3
+    0x28, 0x04,       // JR Z,015D
+    0xCD, 0x00, 0x02, // CALL 0200
+    0x00,             // NOP
+    0xCB, 0x40,       // 15D: BIT 0,B
+    0x20, 0x02,       // JR NZ,0163
+    0x0C,             // INC C
+    0x0D,             // DEC C
+    0x79,             // 163: LD A,C
+    0xFE, 0x80,       // CP 80
+    0x38, 0xEB,       // JR C,0153
+    0x0E, 0x00,       // LD C,0
+    0xC3, 0x53, 0x01, // JP 0153
+};
+
+static const uint8_t BRANCHY_SUB[] = {
+    0x0C,             // 200: INC C
+    0x78,             // LD A,B
+    0xE6, 0x0C,       // AND 0C
+    0xC8,             // RET Z
+    0x0C,             // INC C
+    0xC9,             // RET
+};
+
+// rotates, shifts and bit ops, on registers and (HL)
+static const uint8_t CB_CODE[] = {
+    0x31, 0xF0, 0xDF, // LD SP,DFF0
+    0x21, 0x00, 0xC0, // LD HL,C000
+    0xCB, 0x00,       // 156: RLC B
+    0xCB, 0x19,       // RR C
+    0xCB, 0x22,       // SLA D
+    0xCB, 0x2B,       // SRA E
+    0xCB, 0x37,       // SWAP A
+    0xCB, 0x3F,       // SRL A
+    0xCB, 0x46,       // BIT 0,(HL)
+    0xCB, 0xC6,       // SET 0,(HL)
+    0xCB, 0x86,       // RES 0,(HL)
+    0xCB, 0x16,       // RL (HL)
+    0xCB, 0x7F,       // BIT 7,A
+    0xCB, 0xD0,       // SET 2,B
+    0xCB, 0x98,       // RES 3,B
+    0x04,             // INC B
+    0xC3, 0x56, 0x01, // JP 0156
+};
+
+#define ROM(name, code, sub) { name, code, sizeof(code), sub, sizeof(sub) }
+#define ROM_NO_SUB(name, code) { name, code, sizeof(code), NULL, 0 }
+
+static const synthetic_rom SYNTHETIC_ROMS[] = {
+    ROM_NO_SUB("alu", ALU_CODE),
+    ROM_NO_SUB("memory", MEMORY_CODE),
+    ROM("branchy", BRANCHY_CODE, BRANCHY_SUB),
+    ROM_NO_SUB("cb", CB_CODE),
+};
+
+#define SYNTHETIC_COUNT (sizeof(SYNTHETIC_ROMS) / sizeof(SYNTHETIC_ROMS[0]))
+
+static bool load_synthetic(gb_t *gb, const synthetic_rom *rom)
+{
+    static uint8_t data[0x8000];
+    memset(data, 0, sizeof(data));
+    // entry point: NOP, JP 0150
+    data[0x100] = 0x00;
+    data[0x101] = 0xC3;
+    data[0x102] = 0x50;
+    data[0x103] = 0x01;
+    snprintf((char *)&data[0x134], 16, "GBBENCH");
+    memcpy(&data[0x150], rom->code, rom->code_size);
+    if (rom->sub)
+    {
+        memcpy(&data[0x200], rom->sub, rom->sub_size);
+    }
+
+    char path[] = "/tmp/gbbench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool ok = write(fd, data, sizeof(data)) == sizeof(data);
+    close(fd);
+
+    ok = ok && gb_load_rom(gb, path);
+    unlink(path);
+    return ok;
+}
+
+// **Host counters**
+
+typedef enum {
+    COUNTER_INSTRUCTIONS,
+    COUNTER_CACHE_MISSES,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_COUNT
+} counter_id;
+
+typedef struct {
+    int fds[COUNTER_COUNT];
+    uint64_t values[COUNTER_COUNT];
+} counters;
+
+static void counters_open(counters *c)
+{
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        c->fds[i] = -1;
+    }
+
+#ifdef __linux__
+    static const uint64_t CONFIGS[COUNTER_COUNT] = {
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+    };
+
+    // each counter on its own so one the host doesn't have doesn't take the
+    // others with it. user space only, which most perf_event_paranoid
+    // settings allow
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = CONFIGS[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        c->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+}
+
+static bool counters_available(counters *c)
+{
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        if (c->fds[i] >= 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void counters_start(counters *c)
+{
+#ifdef __linux__
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        if (c->fds[i] >= 0)
+        {
+            ioctl(c->fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(c->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+static void counters_stop(counters *c)
+{
+#ifdef __linux__
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        c->values[i] = 0;
+        if (c->fds[i] >= 0)
+        {
+            ioctl(c->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(c->fds[i], &c->values[i], sizeof(uint64_t)) != sizeof(uint64_t))
+            {
+                c->values[i] = 0;
+            }
+        }
+    }
+#endif
+}
+
+static void counters_close(counters *c)
+{
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        if (c->fds[i] >= 0)
+        {
+            close(c->fds[i]);
+        }
+    }
+}
+
+// **Runs**
+
+typedef struct {
+    char name[64];
+    uint64_t cycles;
+    uint64_t instructions;
+    double seconds;
+    uint64_t counts[COUNTER_COUNT];
+    bool counted[COUNTER_COUNT];
+    bool faulted;
+    char fault[256];
+} bench_result;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// best of `runs` from power on, the fastest run is the one least disturbed
+// by whatever else the host is doing
+static void bench_rom(gb_t *gb, counters *c, uint64_t budget, int runs, bench_result *result)
+{
+    result->seconds = 0;
+    result->faulted = false;
+
+    // one untimed run first to warm up caches and branch predictors
+    gb_reset(gb);
+    gb_run_cycles(gb, budget / 10);
+
+    for (int run = 0; run < runs; run++)
+    {
+        gb_reset(gb);
+
+        counters_start(c);
+        double start = now();
+        uint64_t cycles = gb_run_cycles(gb, budget);
+        double seconds = now() - start;
+        counters_stop(c);
+
+        if (gb_fault_message(gb))
+        {
+            // the instance's message goes away with the next load
+            result->faulted = true;
+            snprintf(result->fault, sizeof(result->fault), "%s", gb_fault_message(gb));
+            return;
+        }
+
+        if (run == 0 || seconds < result->seconds)
+        {
+            result->seconds = seconds;
+            result->cycles = cycles;
+            result->instructions = gb_instruction_count(gb);
+            for (int i = 0; i < COUNTER_COUNT; i++)
+            {
+                result->counts[i] = c->values[i];
+                result->counted[i] = c->fds[i] >= 0;
+            }
+        }
+    }
+}
+
+static double ns_per_instruction(const bench_result *result)
+{
+    return result->instructions ? result->seconds * 1e9 / result->instructions : 0;
+}
+
+static void print_header(bool with_counters)
+{
+    printf("\n%-16s %12s %9s %9s %9s", "rom", "instructions", "MIPS", "ns/instr", "realtime");
+    if (with_counters)
+    {
+        printf(" %11s %13s %13s", "host instr", "cache miss/k", "branch miss/k");
+    }
+    printf("\n");
+}
+
+static void print_counter(const bench_result *result, counter_id id, double scale, int width)
+{
+    if (result->counted[id] && result->instructions)
+    {
+        printf(" %*.2f", width, result->counts[id] * scale / result->instructions);
+    }
+    else
+    {
+        printf(" %*s", width, "n/a");
+    }
+}
+
+static void print_result(const bench_result *result, bool with_counters)
+{
+    if (result->faulted)
+    {
+        printf("%-16s faulted: %s\n", result->name, result->fault);
+        return;
+    }
+
+    double mips = result->instructions / result->seconds / 1e6;
+    double realtime = result->cycles / GB_CLOCK_HZ / result->seconds;
+    printf("%-16s %12llu %9.2f %9.2f %8.1fx", result->name, (unsigned long long)result->instructions,
+        mips, ns_per_instruction(result), realtime);
+    if (with_counters)
+    {
+        // host instructions per emulated instruction, misses per thousand
+        print_counter(result, COUNTER_INSTRUCTIONS, 1, 11);
+        print_counter(result, COUNTER_CACHE_MISSES, 1000, 13);
+        print_counter(result, COUNTER_BRANCH_MISSES, 1000, 13);
+    }
+    printf("\n");
+}
+
+// **Results file**
+// One JSON object per line, the same shape gbbatch writes
+
+static void write_results(FILE *fp, const bench_result *results, int count)
+{
+    for (int r = 0; r < count; r++)
+    {
+        const bench_result *result = &results[r];
+        if (result->faulted)
+        {
+            continue;
+        }
+
+        fprintf(fp, "{\"rom\":\"");
+        for (const char *p = result->name; *p; p++)
+        {
+            if (*p == '"' || *p == '\\')
+            {
+                fputc('\\', fp);
+            }
+            fputc(*p, fp);
+        }
+        fprintf(fp, "\",\"cycles\":%llu,\"instructions\":%llu,\"seconds\":%.6f,\"ns_per_instr\":%.4f",
+            (unsigned long long)result->cycles, (unsigned long long)result->instructions,
+            result->seconds, ns_per_instruction(result));
+
+        static const char *NAMES[COUNTER_COUNT] = { "host_instructions", "cache_misses", "branch_misses" };
+        for (int i = 0; i < COUNTER_COUNT; i++)
+        {
+            if (result->counted[i])
+            {
+                fprintf(fp, ",\"%s\":%llu", NAMES[i], (unsigned long long)result->counts[i]);
+            }
+        }
+        fprintf(fp, "}\n");
+    }
+}
+
+// pulls "rom" and "ns_per_instr" back out of a line written above
+static bool parse_result_line(const char *line, char *name, size_t name_size, double *ns)
+{
+    const char *p = strstr(line, "\"rom\":\"");
+    const char *q = strstr(line, "\"ns_per_instr\":");
+    if (!p || !q)
+    {
+        return false;
+    }
+
+    p += strlen("\"rom\":\"");
+    size_t n = 0;
+    while (*p && *p != '"' && n + 1 < name_size)
+    {
+        if (*p == '\\' && p[1])
+        {
+            p++;
+        }
+        name[n++] = *p++;
+    }
+    name[n] = 0;
+
+    *ns = atof(q + strlen("\"ns_per_instr\":"));
+    return true;
+}
+
+// returns how many ROMs are more than `threshold` percent slower than in the
+// baseline, or -1 if the baseline can't be read
+static int compare_baseline(const char *path, const bench_result *results, int count, double threshold)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+    {
+        printf("Failed to open baseline: %s\n", path);
+        return -1;
+    }
+
+    printf("\nagainst %s (threshold %.1f%%)\n", path, threshold);
+    printf("%-16s %12s %12s %9s\n", "rom", "base ns", "now ns", "change");
+
+    int regressions = 0;
+    char line[2048];
+    while (fgets(line, sizeof(line), fp))
+    {
+        char name[64];
+        double base;
+        if (!parse_result_line(line, name, sizeof(name), &base) || base <= 0)
+        {
+            continue;
+        }
+
+        for (int r = 0; r < count; r++)
+        {
+            if (strcmp(results[r].name, name) != 0)
+            {
+                continue;
+            }
+
+            if (results[r].faulted)
+            {
+                printf("%-16s %12.2f %12s   REGRESSED (faulted)\n", name, base, "-");
+                regressions++;
+                break;
+            }
+
+            double current = ns_per_instruction(&results[r]);
+            double change = (current - base) / base * 100;
+            bool regressed = change > threshold;
+            printf("%-16s %12.2f %12.2f %+8.1f%%%s\n", name, base, current, change, regressed ? "  REGRESSED" : "");
+            regressions += regressed;
+            break;
+        }
+    }
+    fclose(fp);
+    return regressions;
+}
+
+static void usage()
+{
+    printf("usage: gbbench [--cycles N] [--runs N] [-o results] [--baseline results]\n");
+    printf("               [--threshold pct] [--engine interp|blocks|jit] [rom...]\n");
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t budget = DEFAULT_CYCLES;
+    int runs = DEFAULT_RUNS;
+    double threshold = DEFAULT_THRESHOLD;
+    const char *output = NULL;
+    const char *baseline = NULL;
+    const char *engine = "jit";
+
+    const char **roms = malloc(argc * sizeof(char *));
+    int rom_count = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--cycles") == 0 && has_value)
+        {
+            budget = strtoull(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "--runs") == 0 && has_value)
+        {
+            runs = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-o") == 0 && has_value)
+        {
+            output = argv[++i];
+        }
+        else if (strcmp(argv[i], "--baseline") == 0 && has_value)
+        {
+            baseline = argv[++i];
+        }
+        else if (strcmp(argv[i], "--threshold") == 0 && has_value)
+        {
+            threshold = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--engine") == 0 && has_value)
+        {
+            engine = argv[++i];
+        }
+        else if (argv[i][0] == '-')
+        {
+            usage();
+            return -1;
+        }
+        else
+        {
+            roms[rom_count++] = argv[i];
+        }
+    }
+    bool blocks = strcmp(engine, "interp") != 0;
+    bool jit = strcmp(engine, "jit") == 0;
+    if (budget == 0 || runs < 1 || (blocks && !jit && strcmp(engine, "blocks") != 0))
+    {
+        usage();
+        return -1;
+    }
+
+    int total = SYNTHETIC_COUNT + rom_count;
+    bench_result *results = calloc(total, sizeof(bench_result));
+    gb_t *gb = gb_create();
+    if (!results || !gb)
+    {
+        printf("Out of memory\n");
+        return -1;
+    }
+    gb_set_block_cache(gb, blocks);
+    gb_set_jit(gb, jit && jit_available() ? JIT_ON : JIT_OFF);
+    // every run starts from the same blank save ram
+    gb_set_save_mode(gb, SAVE_MEMORY);
+
+    counters c;
+    counters_open(&c);
+    bool with_counters = counters_available(&c);
+
+    printf("\n%llu T-cycles per run, best of %d, engine %s\n", (unsigned long long)budget, runs,
+        jit && !jit_available() ? "blocks (no jit in this build)" : engine);
+    if (!with_counters)
+    {
+        printf("perf_event_open not available, no host counters\n");
+    }
+    print_header(with_counters);
+
+    int count = 0;
+    for (int i = 0; i < total; i++)
+    {
+        bench_result *result = &results[count];
+        bool loaded;
+        if (i < SYNTHETIC_COUNT)
+        {
+            snprintf(result->name, sizeof(result->name), "%s", SYNTHETIC_ROMS[i].name);
+            loaded = load_synthetic(gb, &SYNTHETIC_ROMS[i]);
+        }
+        else
+        {
+            // real roms are named by file, so baselines survive moving them
+            const char *path = roms[i - SYNTHETIC_COUNT];
+            const char *slash = strrchr(path, '/');
+            snprintf(result->name, sizeof(result->name), "%s", slash ? slash + 1 : path);
+            loaded = gb_load_rom(gb, path);
+        }
+
+        if (!loaded)
+        {
+            printf("%-16s failed to load\n", result->name);
+            continue;
+        }
+
+        bench_rom(gb, &c, budget, runs, result);
+        print_result(result, with_counters);
+        count++;
+    }
+
+    counters_close(&c);
+    gb_destroy(gb);
+
+    int status = 0;
+    for (int r = 0; r < count; r++)
+    {
+        if (results[r].faulted)
+        {
+            status = 1;
+        }
+    }
+
+    if (output)
+    {
+        FILE *fp = fopen(output, "w");
+        if (!fp)
+        {
+            printf("Failed to open: %s\n", output);
+            status = -1;
+        }
+        else
+        {
+            write_results(fp, results, count);
+            fclose(fp);
+        }
+    }
+
+    if (baseline)
+    {
+        int regressions = compare_baseline(baseline, results, count, threshold);
+        if (regressions != 0)
+        {
+            status = 1;
+        }
+    }
+
+    free(results);
+    free(roms);
+    return status;
+}
@@ -0,0 +1,231 @@
+// Microbenchmark for the address bus: times the page table read/write path
+// against the old if/else range decode (kept below as legacy_read/write) over
+// the same address stream.
+//
+// usage: membench [accesses]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <cartridge.h>
+#include <cpu.h>
+#include <gb.h>
+#include <ram.h>
+
+#define ADDRESS_COUNT (1 << 16)
+
+static uint16_t addresses[ADDRESS_COUNT];
+static gb_t *gb;
+
+// the range decode read_address_bus used before the page table
+static uint8_t legacy_read(uint16_t address)
+{
+    if (address < 0x8000)
+    {
+        return read_cartridge(gb, address);
+    }
+    else if (address < 0xA000)
+    {
+        NO_IMPL
+    }
+    else if (address < 0xC000)
+    {
+        return read_cartridge(gb, address);
+    }
+    else if (address < 0xE000)
+    {
+        return read_wram(gb, address);
+    }
+    else if (address < 0xFE00)
+    {
+        return 0;
+    }
+    else if (address < 0xFEA0)
+    {
+        NO_IMPL
+    }
+    else if (address < 0xFF00)
+    {
+        return 0;
+    }
+    else if (address < 0xFF80)
+    {
+        NO_IMPL
+    }
+    else if (address < 0xFFFF)
+    {
+        return read_hram(gb, address);
+    }
+    return cpu_get_ie_register(gb);
+}
+
+static void legacy_write(uint16_t address, uint8_t value)
+{
+    if (address < 0x8000)
+    {
+        write_cartridge(gb, address, value);
+    }
+    else if (address < 0xA000)
+    {
+        NO_IMPL
+    }
+    else if (address < 0xC000)
+    {
+        write_cartridge(gb, address, value);
+    }
+    else if (address < 0xE000)
+    {
+        write_wram(gb, address, value);
+    }
+    else if (address < 0xFE00)
+    {
+        return;
+    }
+    else if (address < 0xFEA0)
+    {
+        NO_IMPL
+    }
+    else if (address < 0xFF00)
+    {
+        return;
+    }
+    else if (address < 0xFF80)
+    {
+        NO_IMPL
+    }
+    else if (address < 0xFFFF)
+    {
+        write_hram(gb, address, value);
+    }
+    else
+    {
+        cpu_set_ie_register(gb, value);
+    }
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// roughly what the cpu does: mostly ROM fetches, then WRAM, then HRAM.
+// when `runs` is set the fetches come in short sequential runs like real
+// instruction streams instead of being independently random
+static void make_addresses(bool writes, bool runs)
+{
+    srand(1234);
+    for (int i = 0; i < ADDRESS_COUNT; i++)
+    {
+        if (runs && i > 0 && rand() % 8 && (addresses[i - 1] & 0xFF) < 0xFE)
+        {
+            addresses[i] = addresses[i - 1] + 1;
+            continue;
+        }
+
+        int r = rand() % 100;
+        if (!writes && r < 70)
+        {
+            addresses[i] = rand() % 0x8000;
+        }
+        else if (r < 90)
+        {
+            addresses[i] = 0xC000 + rand() % 0x2000;
+        }
+        else
+        {
+            addresses[i] = 0xFF80 + rand() % 0x7F;
+        }
+    }
+}
+
+static bool load_test_rom()
+{
+    char path[] = "/tmp/membench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    static uint8_t rom[0x8000];
+    for (int i = 0; i < sizeof(rom); i++)
+    {
+        rom[i] = i * 7;
+    }
+    bool ok = write(fd, rom, sizeof(rom)) == sizeof(rom);
+    close(fd);
+
+    ok = ok && gb_load_rom(gb, path);
+    unlink(path);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    long accesses = argc > 1 ? atol(argv[1]) : 200000000;
+
+    gb = gb_create();
+    if (!gb || !load_test_rom())
+    {
+        printf("Failed to set up test rom\n");
+        return -1;
+    }
+
+    printf("\n%ld accesses per test, ns per access\n", accesses);
+    printf("  %-22s %8s %11s\n", "", "legacy", "page table");
+
+    struct {
+        const char *name;
+        bool writes;
+        bool runs;
+    } tests[] = {
+        { "random reads", false, false },
+        { "sequential run reads", false, true },
+        { "random writes", true, false },
+    };
+
+    uint32_t sum = 0;
+    for (int t = 0; t < sizeof(tests) / sizeof(tests[0]); t++)
+    {
+        make_addresses(tests[t].writes, tests[t].runs);
+
+        double start = now();
+        for (long i = 0; i < accesses; i++)
+        {
+            uint16_t address = addresses[i & (ADDRESS_COUNT - 1)];
+            if (tests[t].writes)
+            {
+                legacy_write(address, i);
+            }
+            else
+            {
+                sum += legacy_read(address);
+            }
+        }
+        double legacy_time = now() - start;
+
+        start = now();
+        for (long i = 0; i < accesses; i++)
+        {
+            uint16_t address = addresses[i & (ADDRESS_COUNT - 1)];
+            if (tests[t].writes)
+            {
+                write_address_bus(gb, address, i);
+            }
+            else
+            {
+                sum += read_address_bus(gb, address);
+            }
+        }
+        double page_time = now() - start;
+
+        printf("  %-22s %8.2f %11.2f   (%.2fx)\n", tests[t].name,
+            legacy_time * 1e9 / accesses, page_time * 1e9 / accesses, legacy_time / page_time);
+    }
+    printf("  (checksum %u)\n", sum);
+    gb_destroy(gb);
+    return 0;
+}
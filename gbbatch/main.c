@@ -0,0 +1,430 @@
+// Runs a manifest of ROMs (see manifest.h) across all cores, one emulator
+// instance per job, and writes one JSON result per ROM with its outcome,
+// wall time and emulated MIPS.
+//
+// usage: gbbatch <manifest> [-j threads] [-o results file] [-a]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <gb.h>
+#include "manifest.h"
+#include "workqueue.h"
+
+typedef enum {
+    OUTCOME_PASS,
+    // an expectation wasn't met
+    OUTCOME_FAIL,
+    // the emulator stopped on an error (gb_fault)
+    OUTCOME_FAULT,
+    // the rom couldn't be loaded
+    OUTCOME_ERROR,
+    OUTCOME_COUNT
+} batch_outcome;
+
+static const char *OUTCOME_NAMES[] = {
+    "pass",
+    "fail",
+    "fault",
+    "error",
+};
+
+typedef struct {
+    batch_outcome outcome;
+    char message[256];
+    double wall;
+    double run_time;
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t fb_hash;
+    // only with -a or an aphash to check
+    bool audio_hashed;
+    uint64_t audio_hash;
+    int worker;
+    bool stolen;
+} batch_result;
+
+typedef struct {
+    batch_job *jobs;
+    batch_result *results;
+    int job_count;
+    workqueue queue;
+
+    pthread_mutex_t print_lock;
+    int finished;
+} batch_context;
+
+typedef struct {
+    batch_context *batch;
+    int id;
+} batch_worker;
+
+// -a, hash every job's audio rather than only the ones with an aphash
+static bool hash_all_audio;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// `text` anywhere in the `length` bytes at `data`, which can have NULs in
+static bool contains(const char *data, size_t length, const char *text)
+{
+    size_t n = strlen(text);
+    for (size_t i = 0; i + n <= length; i++)
+    {
+        if (memcmp(data + i, text, n) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void check_expectations(gb_t *gb, const batch_job *job, batch_result *result)
+{
+    if (job->expect_fb_hash && result->fb_hash != job->fb_hash)
+    {
+        result->outcome = OUTCOME_FAIL;
+        snprintf(result->message, sizeof(result->message), "framebuffer hash %016llx, expected %016llx",
+            (unsigned long long)result->fb_hash, (unsigned long long)job->fb_hash);
+    }
+    else if (job->expect_audio_hash && result->audio_hash != job->audio_hash)
+    {
+        result->outcome = OUTCOME_FAIL;
+        snprintf(result->message, sizeof(result->message), "audio hash %016llx, expected %016llx",
+            (unsigned long long)result->audio_hash, (unsigned long long)job->audio_hash);
+    }
+    else if (job->expect_serial)
+    {
+        size_t length;
+        const char *output = gb_serial_output(gb, &length);
+        if (!contains(output, length, job->serial))
+        {
+            // the end of the output is where the test says what went wrong
+            size_t shown = length > 96 ? 96 : length;
+            char tail[97];
+            for (size_t i = 0; i < shown; i++)
+            {
+                char c = output[length - shown + i];
+                tail[i] = c >= 0x20 && c < 0x7F ? c : ' ';
+            }
+            tail[shown] = 0;
+            result->outcome = OUTCOME_FAIL;
+            snprintf(result->message, sizeof(result->message), "serial output has no \"%s\": \"%s\"",
+                job->serial, tail);
+        }
+    }
+}
+
+static void run_job(const batch_job *job, batch_result *result)
+{
+    double start = now();
+    result->outcome = OUTCOME_PASS;
+
+    gb_t *gb = gb_create();
+    if (gb)
+    {
+        // runs start from blank save ram and leave nothing behind, jobs
+        // for the same rom can run at once
+        gb_set_save_mode(gb, SAVE_MEMORY);
+    }
+    if (!gb || !gb_load_rom(gb, job->rom))
+    {
+        result->outcome = OUTCOME_ERROR;
+        snprintf(result->message, sizeof(result->message), "failed to load rom");
+        gb_destroy(gb);
+        result->wall = now() - start;
+        return;
+    }
+
+    // making samples costs, so only runs that look at them do
+    result->audio_hashed = job->expect_audio_hash || hash_all_audio;
+    if (result->audio_hashed)
+    {
+        gb_set_audio_rate(gb, MANIFEST_AUDIO_RATE);
+    }
+
+    // a test that only reports over serial is done as soon as it has said
+    // so. hashes are of the whole budget, those runs always go to the end
+    if (job->expect_serial && !job->expect_fb_hash && !job->expect_audio_hash)
+    {
+        gb_serial_stop_on(gb, job->serial);
+        gb_serial_stop_on(gb, MANIFEST_SERIAL_FAILED);
+    }
+
+    // only the screen at the end matters, so nothing is drawn until the
+    // last two frames. a frame is at most one frame away from starting, so
+    // the last whole frame of the run is always drawn
+    uint64_t tail = 2 * GB_FRAME_CYCLES;
+    uint64_t ran = 0;
+    double run_start = now();
+    if (job->budget > tail)
+    {
+        gb_set_render_interval(gb, 0);
+        ran = gb_run_cycles(gb, job->budget - tail);
+        gb_set_render_interval(gb, 1);
+    }
+    if (!gb_serial_stop_reason(gb))
+    {
+        gb_run_cycles(gb, job->budget - ran);
+    }
+    result->run_time = now() - run_start;
+
+    result->cycles = gb_ticks(gb);
+    result->instructions = gb_instruction_count(gb);
+    result->fb_hash = gb_framebuffer_hash(gb);
+    result->audio_hash = gb_audio_hash(gb);
+
+    const char *fault = gb_fault_message(gb);
+    if (fault)
+    {
+        result->outcome = OUTCOME_FAULT;
+        snprintf(result->message, sizeof(result->message), "%s", fault);
+    }
+    else
+    {
+        check_expectations(gb, job, result);
+    }
+
+    gb_destroy(gb);
+    result->wall = now() - start;
+}
+
+static void *worker_main(void *arg)
+{
+    batch_worker *worker = arg;
+    batch_context *batch = worker->batch;
+
+    int index;
+    bool stolen;
+    while (workqueue_take(&batch->queue, worker->id, &index, &stolen))
+    {
+        batch_result *result = &batch->results[index];
+        run_job(&batch->jobs[index], result);
+        result->worker = worker->id;
+        result->stolen = stolen;
+
+        pthread_mutex_lock(&batch->print_lock);
+        batch->finished++;
+        printf("[%d/%d] %-9s %8.2fs  %s\n", batch->finished, batch->job_count,
+            OUTCOME_NAMES[result->outcome], result->wall, batch->jobs[index].rom);
+        fflush(stdout);
+        pthread_mutex_unlock(&batch->print_lock);
+    }
+    return NULL;
+}
+
+static void write_json_string(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s; s++)
+    {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+        {
+            fprintf(fp, "\\%c", c);
+        }
+        else if (c < 0x20)
+        {
+            fprintf(fp, "\\u%04x", c);
+        }
+        else
+        {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+// one JSON object per line, in manifest order
+static bool write_results(batch_context *batch, const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+    {
+        printf("Failed to open: %s\n", path);
+        return false;
+    }
+
+    for (int i = 0; i < batch->job_count; i++)
+    {
+        const batch_job *job = &batch->jobs[i];
+        const batch_result *result = &batch->results[i];
+        double mips = result->run_time > 0 ? result->instructions / result->run_time / 1e6 : 0;
+
+        fprintf(fp, "{\"rom\":");
+        write_json_string(fp, job->rom);
+        fprintf(fp, ",\"line\":%d,\"outcome\":\"%s\",\"message\":", job->line, OUTCOME_NAMES[result->outcome]);
+        write_json_string(fp, result->message);
+        fprintf(fp, ",\"wall_ms\":%.3f,\"cycles\":%llu,\"instructions\":%llu,\"mips\":%.2f,\"fbhash\":\"%016llx\"",
+            result->wall * 1e3, (unsigned long long)result->cycles, (unsigned long long)result->instructions,
+            mips, (unsigned long long)result->fb_hash);
+        if (result->audio_hashed)
+        {
+            fprintf(fp, ",\"aphash\":\"%016llx\"", (unsigned long long)result->audio_hash);
+        }
+        fprintf(fp, ",\"worker\":%d,\"stolen\":%s}\n", result->worker, result->stolen ? "true" : "false");
+    }
+
+    bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+static batch_job *sort_jobs;
+
+// cheapest first, see the dealing in main
+static int compare_budget(const void *a, const void *b)
+{
+    uint64_t x = sort_jobs[*(const int *)a].budget;
+    uint64_t y = sort_jobs[*(const int *)b].budget;
+    return (x > y) - (x < y);
+}
+
+static void print_usage(char *prog)
+{
+    printf("Usage: %s <manifest> [-j threads] [-o results file] [-a]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    char *manifest = NULL;
+    char *output = "results.jsonl";
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            threads = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        else if (strcmp(argv[i], "-a") == 0)
+        {
+            hash_all_audio = true;
+        }
+        else if (!manifest)
+        {
+            manifest = argv[i];
+        }
+        else
+        {
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (!manifest || threads < 1)
+    {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    batch_context batch = {0};
+    batch.job_count = manifest_load(manifest, &batch.jobs);
+    if (batch.job_count < 0)
+    {
+        return -2;
+    }
+    if (batch.job_count == 0)
+    {
+        printf("No ROMs in %s\n", manifest);
+        free(batch.jobs);
+        return -2;
+    }
+    if (threads > batch.job_count)
+    {
+        threads = batch.job_count;
+    }
+
+    batch.results = calloc(batch.job_count, sizeof(batch_result));
+    int *order = malloc(batch.job_count * sizeof(int));
+    if (!batch.results || !order || !workqueue_init(&batch.queue, threads, batch.job_count))
+    {
+        printf("Out of memory\n");
+        return -2;
+    }
+    pthread_mutex_init(&batch.print_lock, NULL);
+
+    // deal the jobs out round robin, cheapest first. workers take from the
+    // bottom of their own deque so they start on their longest budgets and
+    // thieves pick up the short ones left at the top
+    for (int i = 0; i < batch.job_count; i++)
+    {
+        order[i] = i;
+    }
+    sort_jobs = batch.jobs;
+    qsort(order, batch.job_count, sizeof(int), compare_budget);
+    for (int i = 0; i < batch.job_count; i++)
+    {
+        workqueue_push(&batch.queue, i % threads, order[i]);
+    }
+
+    printf("Running %d ROMs on %ld threads\n", batch.job_count, threads);
+    double start = now();
+
+    pthread_t *thread_ids = malloc(threads * sizeof(pthread_t));
+    batch_worker *workers = malloc(threads * sizeof(batch_worker));
+    for (int i = 0; i < threads; i++)
+    {
+        workers[i] = (batch_worker){ &batch, i };
+        pthread_create(&thread_ids[i], NULL, worker_main, &workers[i]);
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(thread_ids[i], NULL);
+    }
+
+    double elapsed = now() - start;
+
+    int counts[OUTCOME_COUNT] = {0};
+    int steals = 0;
+    double busy = 0;
+    uint64_t instructions = 0;
+    for (int i = 0; i < batch.job_count; i++)
+    {
+        counts[batch.results[i].outcome]++;
+        steals += batch.results[i].stolen;
+        busy += batch.results[i].wall;
+        instructions += batch.results[i].instructions;
+    }
+
+    printf("\n");
+    for (int i = 0; i < OUTCOME_COUNT; i++)
+    {
+        if (counts[i])
+        {
+            printf("%-9s %d\n", OUTCOME_NAMES[i], counts[i]);
+        }
+    }
+    printf("%.2fs wall, %.2fs of emulation (%.1fx), %.1f MIPS overall, %d jobs stolen\n",
+        elapsed, busy, busy / elapsed, instructions / elapsed / 1e6, steals);
+
+    int result = counts[OUTCOME_PASS] == batch.job_count ? 0 : 1;
+    if (!write_results(&batch, output))
+    {
+        result = -3;
+    }
+    else
+    {
+        printf("Results written to %s\n", output);
+    }
+
+    workqueue_destroy(&batch.queue);
+    pthread_mutex_destroy(&batch.print_lock);
+    free(thread_ids);
+    free(workers);
+    free(order);
+    free(batch.results);
+    free(batch.jobs);
+    return result;
+}
\ No newline at end of file
@@ -0,0 +1,180 @@
+#include "manifest.h"
+#include <gb.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// splits off the next whitespace separated token, a value in double quotes
+// can contain spaces. returns NULL at the end of the line
+static char *next_token(char **cursor)
+{
+    char *p = *cursor;
+    while (isspace((unsigned char)*p))
+    {
+        p++;
+    }
+    if (!*p)
+    {
+        return NULL;
+    }
+
+    char *token = p;
+    char *out = p;
+    bool quoted = false;
+    while (*p && (quoted || !isspace((unsigned char)*p)))
+    {
+        if (*p == '"')
+        {
+            quoted = !quoted;
+            p++;
+            continue;
+        }
+        *out++ = *p++;
+    }
+    if (*p)
+    {
+        p++;
+    }
+    *out = 0;
+    *cursor = p;
+    return token;
+}
+
+static bool parse_u64(const char *text, int base, uint64_t *value)
+{
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(text, &end, base);
+    if (errno || end == text || *end)
+    {
+        return false;
+    }
+    *value = v;
+    return true;
+}
+
+static bool parse_option(batch_job *job, char *token)
+{
+    char *value = strchr(token, '=');
+    if (!value)
+    {
+        return false;
+    }
+    *value++ = 0;
+
+    uint64_t n;
+    if (strcmp(token, "cycles") == 0 && parse_u64(value, 10, &n) && n > 0)
+    {
+        job->budget = n;
+    }
+    else if (strcmp(token, "frames") == 0 && parse_u64(value, 10, &n) && n > 0)
+    {
+        job->budget = n * GB_FRAME_CYCLES;
+    }
+    else if (strcmp(token, "serial") == 0 && *value)
+    {
+        job->expect_serial = true;
+        snprintf(job->serial, sizeof(job->serial), "%s", value);
+    }
+    else if (strcmp(token, "fbhash") == 0 && parse_u64(value, 16, &n))
+    {
+        job->expect_fb_hash = true;
+        job->fb_hash = n;
+    }
+    else if (strcmp(token, "aphash") == 0 && parse_u64(value, 16, &n))
+    {
+        job->expect_audio_hash = true;
+        job->audio_hash = n;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+int manifest_load(const char *path, batch_job **jobs)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+    {
+        printf("Failed to open: %s\n", path);
+        return -1;
+    }
+
+    // roms are relative to the manifest
+    char dir[1024] = "";
+    const char *slash = strrchr(path, '/');
+    if (slash)
+    {
+        snprintf(dir, sizeof(dir), "%.*s/", (int)(slash - path), path);
+    }
+
+    int count = 0;
+    int capacity = 64;
+    *jobs = malloc(capacity * sizeof(batch_job));
+
+    char line[2048];
+    int line_number = 0;
+    while (*jobs && fgets(line, sizeof(line), fp))
+    {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment)
+        {
+            *comment = 0;
+        }
+
+        char *cursor = line;
+        char *rom = next_token(&cursor);
+        if (!rom)
+        {
+            continue;
+        }
+
+        if (count == capacity)
+        {
+            capacity *= 2;
+            batch_job *grown = realloc(*jobs, capacity * sizeof(batch_job));
+            if (!grown)
+            {
+                free(*jobs);
+                *jobs = NULL;
+                break;
+            }
+            *jobs = grown;
+        }
+
+        batch_job *job = &(*jobs)[count];
+        memset(job, 0, sizeof(*job));
+        job->line = line_number;
+        job->budget = (uint64_t)MANIFEST_DEFAULT_FRAMES * GB_FRAME_CYCLES;
+        snprintf(job->rom, sizeof(job->rom), "%s%s", rom[0] == '/' ? "" : dir, rom);
+
+        char *token;
+        while ((token = next_token(&cursor)))
+        {
+            char option[256];
+            snprintf(option, sizeof(option), "%s", token);
+            if (!parse_option(job, token))
+            {
+                printf("%s:%d: bad option '%s'\n", path, line_number, option);
+                fclose(fp);
+                free(*jobs);
+                *jobs = NULL;
+                return -1;
+            }
+        }
+        count++;
+    }
+    fclose(fp);
+
+    if (!*jobs)
+    {
+        printf("Out of memory reading %s\n", path);
+        return -1;
+    }
+    return count;
+}
\ No newline at end of file
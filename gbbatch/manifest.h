@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// **Manifest**
+// One ROM per line, then any number of key=value options:
+//
+//     # blargg cpu tests
+//     cpu_instrs/01-special.gb  frames=3000  serial=Passed
+//     tests/scroll.gb           cycles=20000000  fbhash=9e3779b97f4a7c15
+//
+// cycles=N / frames=N  how long to run for (default 3600 frames, ~1 minute)
+// serial=TEXT          the serial output has to contain TEXT, quote it if
+//                      it has spaces. the run ends as soon as TEXT or
+//                      MANIFEST_SERIAL_FAILED is sent, unless it has a hash
+//                      to check too
+// fbhash=HEX           hash of the final framebuffer
+// aphash=HEX           hash of all the audio, sampled at MANIFEST_AUDIO_RATE
+//
+// Relative ROM paths are relative to the manifest. Blank lines and
+// everything after a # are ignored.
+
+#define MANIFEST_DEFAULT_FRAMES 3600
+#define MANIFEST_AUDIO_RATE 48000
+// what blargg's tests (and most others) print when they fail
+#define MANIFEST_SERIAL_FAILED "Failed"
+
+typedef struct {
+    char rom[1024];
+    // line in the manifest, for messages
+    int line;
+
+    // T-cycles to run for
+    uint64_t budget;
+
+    bool expect_serial;
+    char serial[128];
+
+    bool expect_fb_hash;
+    uint64_t fb_hash;
+
+    bool expect_audio_hash;
+    uint64_t audio_hash;
+} batch_job;
+
+// returns the number of jobs (the array is malloc'd), or -1 after printing
+// what was wrong
+int manifest_load(const char *path, batch_job **jobs);
\ No newline at end of file
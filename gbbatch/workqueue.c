@@ -0,0 +1,93 @@
+#include "workqueue.h"
+#include <stdlib.h>
+
+bool workqueue_init(workqueue *wq, int worker_count, int capacity)
+{
+    wq->worker_count = worker_count;
+    wq->deques = calloc(worker_count, sizeof(work_deque));
+    if (!wq->deques)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        work_deque *dq = &wq->deques[i];
+        pthread_mutex_init(&dq->lock, NULL);
+        dq->items = malloc(capacity * sizeof(int));
+        if (!dq->items)
+        {
+            workqueue_destroy(wq);
+            return false;
+        }
+    }
+    return true;
+}
+
+void workqueue_destroy(workqueue *wq)
+{
+    if (!wq->deques)
+    {
+        return;
+    }
+    for (int i = 0; i < wq->worker_count; i++)
+    {
+        pthread_mutex_destroy(&wq->deques[i].lock);
+        free(wq->deques[i].items);
+    }
+    free(wq->deques);
+    wq->deques = NULL;
+}
+
+void workqueue_push(workqueue *wq, int worker, int item)
+{
+    work_deque *dq = &wq->deques[worker];
+    dq->items[dq->bottom++] = item;
+}
+
+static bool pop_bottom(work_deque *dq, int *item)
+{
+    bool found = false;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->top < dq->bottom)
+    {
+        *item = dq->items[--dq->bottom];
+        found = true;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+static bool steal_top(work_deque *dq, int *item)
+{
+    bool found = false;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->top < dq->bottom)
+    {
+        *item = dq->items[dq->top++];
+        found = true;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+bool workqueue_take(workqueue *wq, int worker, int *item, bool *stolen)
+{
+    *stolen = false;
+    if (pop_bottom(&wq->deques[worker], item))
+    {
+        return true;
+    }
+
+    // start with the next worker along so thieves spread out
+    for (int i = 1; i < wq->worker_count; i++)
+    {
+        int victim = (worker + i) % wq->worker_count;
+        if (steal_top(&wq->deques[victim], item))
+        {
+            *stolen = true;
+            return true;
+        }
+    }
+    return false;
+}
\ No newline at end of file
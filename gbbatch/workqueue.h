@@ -0,0 +1,37 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+
+// **Work stealing queue**
+// Each worker owns a deque of job indices. A worker takes work from the
+// bottom of its own deque and, once that's empty, steals from the top of
+// the others, so a worker stuck on one slow ROM doesn't hold up the jobs
+// that were dealt to it.
+//
+// Jobs are whole ROM runs (milliseconds to minutes each) so a mutex per
+// deque costs nothing measurable, and nothing adds work once the run has
+// started, so every deque being empty means we're done.
+
+typedef struct {
+    pthread_mutex_t lock;
+    int *items;
+    // items[top..bottom) are queued
+    int top;
+    int bottom;
+} work_deque;
+
+typedef struct {
+    int worker_count;
+    work_deque *deques;
+} workqueue;
+
+bool workqueue_init(workqueue *wq, int worker_count, int capacity);
+void workqueue_destroy(workqueue *wq);
+
+// only before the workers start
+void workqueue_push(workqueue *wq, int worker, int item);
+
+// takes the next job for `worker`, false once there is nothing left
+// anywhere. `stolen` is set if it came from another worker's deque
+bool workqueue_take(workqueue *wq, int worker, int *item, bool *stolen);
\ No newline at end of file
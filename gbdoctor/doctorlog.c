@@ -0,0 +1,236 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "doctorlog.h"
+
+// packed records read per fread
+#define READ_BATCH 4096
+
+struct doctor_log {
+    FILE *fp;
+    bool packed;
+    uint64_t position;
+    char error[128];
+
+    // packed logs only
+    doctor_record records[READ_BATCH];
+    size_t count;
+    size_t next;
+};
+
+// up to 4 hex digits, -1 if there aren't any
+static int parse_hex(const char **p)
+{
+    int value = 0;
+    int digits = 0;
+    while (digits < 4 && isxdigit((unsigned char)**p))
+    {
+        char c = *(*p)++;
+        value = value * 16 + (isdigit((unsigned char)c) ? c - '0' : (tolower((unsigned char)c) - 'a' + 10));
+        digits++;
+    }
+    return digits ? value : -1;
+}
+
+bool doctor_parse(const char *line, doctor_record *record)
+{
+    static const char *const KEYS[] = { "A", "F", "B", "C", "D", "E", "H", "L", "SP", "PC", "PCMEM" };
+    enum { KEY_COUNT = sizeof(KEYS) / sizeof(KEYS[0]) };
+    int values[KEY_COUNT + 3];
+    unsigned seen = 0;
+
+    const char *p = line;
+    while (*p)
+    {
+        while (*p && isspace((unsigned char)*p))
+        {
+            p++;
+        }
+        const char *key = p;
+        while (*p && *p != ':' && !isspace((unsigned char)*p))
+        {
+            p++;
+        }
+        if (*p != ':')
+        {
+            // not a field, skip the word
+            continue;
+        }
+        size_t length = p++ - key;
+
+        int k = 0;
+        while (k < KEY_COUNT && (strlen(KEYS[k]) != length || strncmp(KEYS[k], key, length) != 0))
+        {
+            k++;
+        }
+        if (k == KEY_COUNT)
+        {
+            continue;
+        }
+
+        if ((values[k] = parse_hex(&p)) < 0)
+        {
+            return false;
+        }
+        if (k == KEY_COUNT - 1)
+        {
+            // PCMEM is 4 bytes separated by commas
+            for (int i = 1; i < 4; i++)
+            {
+                if (*p++ != ',' || (values[k + i] = parse_hex(&p)) < 0)
+                {
+                    return false;
+                }
+            }
+        }
+        seen |= 1u << k;
+    }
+    if (seen != (1u << KEY_COUNT) - 1)
+    {
+        return false;
+    }
+
+    *record = (doctor_record){
+        .a = values[0],
+        .f = values[1],
+        .b = values[2],
+        .c = values[3],
+        .d = values[4],
+        .e = values[5],
+        .h = values[6],
+        .l = values[7],
+        .sp = values[8],
+        .pc = values[9],
+        .pcmem = { values[10], values[11], values[12], values[13] },
+    };
+    return true;
+}
+
+int doctor_format(const doctor_record *record, char *buf, size_t size)
+{
+    return snprintf(buf, size,
+        "A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X",
+        record->a, record->f, record->b, record->c, record->d, record->e, record->h, record->l,
+        record->sp, record->pc, record->pcmem[0], record->pcmem[1], record->pcmem[2], record->pcmem[3]);
+}
+
+doctor_log *doctor_log_open(const char *path)
+{
+    bool from_stdin = strcmp(path, "-") == 0;
+    FILE *fp = from_stdin ? stdin : fopen(path, "rb");
+    if (!fp)
+    {
+        printf("Failed to open: %s\n", path);
+        return NULL;
+    }
+
+    doctor_log *log = calloc(1, sizeof(doctor_log));
+    if (!log)
+    {
+        if (!from_stdin)
+        {
+            fclose(fp);
+        }
+        return NULL;
+    }
+    log->fp = fp;
+
+    // text logs start with "A:", so the magic can't be mistaken for one
+    doctor_file_header header;
+    if (!from_stdin && fread(&header, sizeof(header), 1, fp) == 1 &&
+        memcmp(header.magic, DOCTOR_MAGIC, sizeof(header.magic)) == 0)
+    {
+        if (header.version != DOCTOR_VERSION || header.record_size != sizeof(doctor_record))
+        {
+            printf("Unsupported packed log version %d (record size %d)\n", header.version, header.record_size);
+            doctor_log_close(log);
+            return NULL;
+        }
+        log->packed = true;
+    }
+    else if (!from_stdin)
+    {
+        rewind(fp);
+    }
+    return log;
+}
+
+bool doctor_log_next(doctor_log *log, doctor_record *record)
+{
+    if (log->packed)
+    {
+        if (log->next == log->count)
+        {
+            log->count = fread(log->records, sizeof(doctor_record), READ_BATCH, log->fp);
+            log->next = 0;
+            if (log->count == 0)
+            {
+                return false;
+            }
+        }
+        *record = log->records[log->next++];
+        log->position++;
+        return true;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), log->fp))
+    {
+        log->position++;
+        // blank lines are skipped, anything else has to be a whole record
+        const char *p = line;
+        while (isspace((unsigned char)*p))
+        {
+            p++;
+        }
+        if (!*p)
+        {
+            continue;
+        }
+        if (!doctor_parse(line, record))
+        {
+            snprintf(log->error, sizeof(log->error), "line %llu isn't a CPU log line",
+                (unsigned long long)log->position);
+            return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+const char *doctor_log_error(const doctor_log *log)
+{
+    return log->error[0] ? log->error : NULL;
+}
+
+uint64_t doctor_log_position(const doctor_log *log)
+{
+    return log->position;
+}
+
+void doctor_log_close(doctor_log *log)
+{
+    if (!log)
+    {
+        return;
+    }
+    if (log->fp != stdin)
+    {
+        fclose(log->fp);
+    }
+    free(log);
+}
+
+FILE *doctor_pack_open(const char *path)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+    {
+        printf("Failed to open: %s\n", path);
+        return NULL;
+    }
+    doctor_file_header header = { .version = DOCTOR_VERSION, .record_size = sizeof(doctor_record) };
+    memcpy(header.magic, DOCTOR_MAGIC, sizeof(header.magic));
+    fwrite(&header, sizeof(header), 1, fp);
+    return fp;
+}
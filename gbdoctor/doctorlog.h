@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// **Doctor logs**
+// Gameboy Doctor's CPU log format, one line per instruction with the state
+// before it runs:
+//
+//     A:01 F:B0 B:00 C:13 D:00 E:D8 H:01 L:4D SP:FFFE PC:0100 PCMEM:00,C3,13,02
+//
+// A whole test ROM is millions of lines, so logs can also be packed into
+// 16 byte records (gbdoctor --pack, or --record from this emulator) that are
+// read a batch at a time with no parsing. Packed logs start with a header
+// like trace files and are in host byte order.
+
+#define DOCTOR_MAGIC "GBDR"
+#define DOCTOR_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size;
+} doctor_file_header;
+
+typedef struct {
+    uint8_t a;
+    uint8_t f;
+    uint8_t b;
+    uint8_t c;
+    uint8_t d;
+    uint8_t e;
+    uint8_t h;
+    uint8_t l;
+    uint16_t sp;
+    uint16_t pc;
+    // the 4 bytes from PC on
+    uint8_t pcmem[4];
+} doctor_record;
+
+typedef struct doctor_log doctor_log;
+
+// text or packed, going by the header. "-" reads text from stdin
+doctor_log *doctor_log_open(const char *path);
+// false at the end of the log or on a line that doesn't parse
+bool doctor_log_next(doctor_log *log, doctor_record *record);
+// NULL if doctor_log_next() stopped at the end of the log
+const char *doctor_log_error(const doctor_log *log);
+// line (text) or record (packed) number of the last record read, from 1
+uint64_t doctor_log_position(const doctor_log *log);
+void doctor_log_close(doctor_log *log);
+
+// creates a packed log and writes its header, the records are fwrite()n
+// straight after it
+FILE *doctor_pack_open(const char *path);
+
+// one line of text, false if a field is missing
+bool doctor_parse(const char *line, doctor_record *record);
+// in the text format (without the newline)
+int doctor_format(const doctor_record *record, char *buf, size_t size);
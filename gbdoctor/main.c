@@ -0,0 +1,390 @@
+// Runs a ROM against a reference CPU log (see doctorlog.h) an instruction
+// at a time, comparing the registers and the bytes at PC before every
+// instruction, and stops at the first one that differs with the lines
+// leading up to it. Meant for checking interpreter changes against logs
+// from other emulators (Gameboy Doctor's blargg cpu_instrs logs) or against
+// a log recorded from a known good build.
+//
+// usage: gbdoctor <rom> <log> [--context N] [--real-ly]
+//        gbdoctor --record <rom> <packed log> [--count N] [--real-ly]
+//        gbdoctor --pack <text log> <packed log>
+//
+// The log's first record sets the registers, the emulator's own power on
+// state isn't the one the boot ROM leaves behind. LY reads 0x90 unless
+// --real-ly is given, like the emulators the reference logs come from.
+// Only the interpreter runs, the block cache and JIT go a block at a time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <gb.h>
+#include "doctorlog.h"
+
+// what LY reads while making Gameboy Doctor logs
+#define DOCTOR_LY 0x90
+// lines shown before the one that differs
+#define DEFAULT_CONTEXT 8
+#define MAX_CONTEXT 256
+#define DEFAULT_RECORD_COUNT 10000000
+// T-cycles without an instruction before a HALT counts as stuck, 10 frames
+#define STUCK_CYCLES (10 * GB_FRAME_CYCLES)
+
+typedef struct {
+    doctor_record records[MAX_CONTEXT];
+    uint64_t positions[MAX_CONTEXT];
+    int size;
+    int count;
+    int next;
+} context_ring;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_usage(const char *prog)
+{
+    printf("Usage: %s <rom> <log> [--context N] [--real-ly]\n", prog);
+    printf("       %s --record <rom> <packed log> [--count N] [--real-ly]\n", prog);
+    printf("       %s --pack <text log> <packed log>\n", prog);
+}
+
+static gb_t *load(const char *rom, bool real_ly)
+{
+    gb_t *gb = gb_create();
+    if (!gb)
+    {
+        return NULL;
+    }
+    gb_set_block_cache(gb, false);
+    gb_set_jit(gb, JIT_OFF);
+    gb_set_render_interval(gb, 0);
+    gb_set_save_mode(gb, SAVE_MEMORY);
+    if (!gb_load_rom(gb, rom))
+    {
+        printf("Failed to load ROM file: %s\n", rom);
+        gb_destroy(gb);
+        return NULL;
+    }
+    if (!real_ly)
+    {
+        gb_set_fixed_ly(gb, DOCTOR_LY);
+    }
+    return gb;
+}
+
+static void capture(gb_t *gb, doctor_record *record)
+{
+    const cpu_registers *regs = gb_regs(gb);
+    *record = (doctor_record){
+        .a = regs->a,
+        .f = regs->f,
+        .b = regs->b,
+        .c = regs->c,
+        .d = regs->d,
+        .e = regs->e,
+        .h = regs->h,
+        .l = regs->l,
+        .sp = regs->sp,
+        .pc = regs->pc,
+    };
+    for (int i = 0; i < 4; i++)
+    {
+        record->pcmem[i] = read_address_bus(gb, regs->pc + i);
+    }
+}
+
+// steps until an instruction runs, leaving `record` with the state before
+// it. interrupts and waking from HALT take steps of their own, the state
+// after those is what the next instruction starts from. false if the
+// instance stopped or halted for good
+static bool next_instruction(gb_t *gb, doctor_record *record)
+{
+    uint64_t instructions = gb_instruction_count(gb);
+    uint64_t start = gb_ticks(gb);
+    while (true)
+    {
+        capture(gb, record);
+        if (!gb_step(gb))
+        {
+            return false;
+        }
+        if (gb_instruction_count(gb) != instructions)
+        {
+            return true;
+        }
+        if (gb_ticks(gb) - start > STUCK_CYCLES)
+        {
+            return false;
+        }
+    }
+}
+
+static void seed(gb_t *gb, const doctor_record *record)
+{
+    cpu_registers *regs = cpu_get_regs(gb);
+    regs->a = record->a;
+    regs->f = record->f;
+    regs->b = record->b;
+    regs->c = record->c;
+    regs->d = record->d;
+    regs->e = record->e;
+    regs->h = record->h;
+    regs->l = record->l;
+    regs->sp = record->sp;
+    regs->pc = record->pc;
+}
+
+static void print_context(const context_ring *ring)
+{
+    char line[128];
+    for (int i = 0; i < ring->count; i++)
+    {
+        int slot = (ring->next - ring->count + i + ring->size) % ring->size;
+        doctor_format(&ring->records[slot], line, sizeof(line));
+        printf("  %10llu  %s\n", (unsigned long long)ring->positions[slot], line);
+    }
+}
+
+static void print_difference(const doctor_record *expected, const doctor_record *actual)
+{
+    char line[128];
+    doctor_format(expected, line, sizeof(line));
+    printf("  expected    %s\n", line);
+    doctor_format(actual, line, sizeof(line));
+    printf("  got         %s\n", line);
+
+    printf("  differs:");
+    static const char *const NAMES[] = { "A", "F", "B", "C", "D", "E", "H", "L" };
+    const uint8_t *e = &expected->a;
+    const uint8_t *a = &actual->a;
+    for (int i = 0; i < 8; i++)
+    {
+        if (e[i] != a[i])
+        {
+            printf(" %s", NAMES[i]);
+        }
+    }
+    if (expected->sp != actual->sp)
+    {
+        printf(" SP");
+    }
+    if (expected->pc != actual->pc)
+    {
+        printf(" PC");
+    }
+    if (memcmp(expected->pcmem, actual->pcmem, sizeof(expected->pcmem)) != 0)
+    {
+        printf(" PCMEM");
+    }
+    printf("\n");
+}
+
+static int check(const char *rom, const char *path, int context, bool real_ly)
+{
+    doctor_log *log = doctor_log_open(path);
+    if (!log)
+    {
+        return 2;
+    }
+    gb_t *gb = load(rom, real_ly);
+    if (!gb)
+    {
+        doctor_log_close(log);
+        return 2;
+    }
+
+    static context_ring ring;
+    ring.size = context > 0 ? context : 1;
+
+    doctor_record expected, actual;
+    uint64_t checked = 0;
+    int result = 0;
+    double start = now();
+    while (doctor_log_next(log, &expected))
+    {
+        if (checked == 0)
+        {
+            seed(gb, &expected);
+        }
+        if (!next_instruction(gb, &actual))
+        {
+            printf("The emulator stopped at line %llu of %s: %s\n", (unsigned long long)doctor_log_position(log),
+                path, gb_fault_message(gb) ? gb_fault_message(gb) : "halted with nothing to wake it");
+            print_context(&ring);
+            result = 1;
+            break;
+        }
+        if (memcmp(&expected, &actual, sizeof(expected)) != 0)
+        {
+            printf("Diverged at line %llu of %s, %llu instructions in (cycle %llu):\n",
+                (unsigned long long)doctor_log_position(log), path,
+                (unsigned long long)checked, (unsigned long long)gb_ticks(gb));
+            if (context > 0)
+            {
+                print_context(&ring);
+            }
+            print_difference(&expected, &actual);
+            result = 1;
+            break;
+        }
+
+        ring.records[ring.next] = actual;
+        ring.positions[ring.next] = doctor_log_position(log);
+        ring.next = (ring.next + 1) % ring.size;
+        if (ring.count < ring.size)
+        {
+            ring.count++;
+        }
+        checked++;
+    }
+
+    if (result == 0 && doctor_log_error(log))
+    {
+        printf("%s: %s\n", path, doctor_log_error(log));
+        result = 2;
+    }
+    else if (result == 0)
+    {
+        double wall = now() - start;
+        printf("Matched all %llu instructions in %.2fs (%.1f MIPS)\n", (unsigned long long)checked, wall,
+            wall > 0 ? checked / wall / 1e6 : 0);
+    }
+
+    gb_destroy(gb);
+    doctor_log_close(log);
+    return result;
+}
+
+static int record(const char *rom, const char *path, uint64_t count, bool real_ly)
+{
+    gb_t *gb = load(rom, real_ly);
+    if (!gb)
+    {
+        return 2;
+    }
+    FILE *fp = doctor_pack_open(path);
+    if (!fp)
+    {
+        gb_destroy(gb);
+        return 2;
+    }
+
+    doctor_record state;
+    uint64_t written = 0;
+    while (written < count && next_instruction(gb, &state))
+    {
+        fwrite(&state, sizeof(state), 1, fp);
+        written++;
+    }
+    printf("Recorded %llu instructions to %s\n", (unsigned long long)written, path);
+
+    fclose(fp);
+    gb_destroy(gb);
+    return 0;
+}
+
+static int pack(const char *in, const char *out)
+{
+    doctor_log *log = doctor_log_open(in);
+    if (!log)
+    {
+        return 2;
+    }
+    FILE *fp = doctor_pack_open(out);
+    if (!fp)
+    {
+        doctor_log_close(log);
+        return 2;
+    }
+
+    doctor_record state;
+    uint64_t written = 0;
+    while (doctor_log_next(log, &state))
+    {
+        fwrite(&state, sizeof(state), 1, fp);
+        written++;
+    }
+    int result = 0;
+    if (doctor_log_error(log))
+    {
+        printf("%s: %s\n", in, doctor_log_error(log));
+        result = 2;
+    }
+    else
+    {
+        printf("Packed %llu records into %s\n", (unsigned long long)written, out);
+    }
+
+    fclose(fp);
+    doctor_log_close(log);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    const char *paths[2] = { NULL, NULL };
+    int path_count = 0;
+    bool recording = false;
+    bool packing = false;
+    bool real_ly = false;
+    int context = DEFAULT_CONTEXT;
+    uint64_t count = DEFAULT_RECORD_COUNT;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--record") == 0)
+        {
+            recording = true;
+        }
+        else if (strcmp(argv[i], "--pack") == 0)
+        {
+            packing = true;
+        }
+        else if (strcmp(argv[i], "--real-ly") == 0)
+        {
+            real_ly = true;
+        }
+        else if (strcmp(argv[i], "--context") == 0 && i + 1 < argc)
+        {
+            context = atoi(argv[++i]);
+            if (context < 0 || context > MAX_CONTEXT)
+            {
+                printf("--context takes 0 to %d lines\n", MAX_CONTEXT);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+        {
+            count = strtoull(argv[++i], NULL, 10);
+        }
+        else if (path_count < 2)
+        {
+            paths[path_count++] = argv[i];
+        }
+        else
+        {
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (path_count != 2 || (recording && packing))
+    {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    if (packing)
+    {
+        return pack(paths[0], paths[1]);
+    }
+    if (recording)
+    {
+        return record(paths[0], paths[1], count, real_ly);
+    }
+    return check(paths[0], paths[1], context, real_ly);
+}
@@ -1,5 +1,5 @@
-#include <emu.h>
-
-int main(int argc, char **argv) {
-    return emu_run(argc, argv);
+#include <emu.h>
+
+int main(int argc, char **argv) {
+    return emu_run(argc, argv);
 }
\ No newline at end of file
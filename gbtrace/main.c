@@ -0,0 +1,72 @@
+// Renders a binary trace written by `gbemu --trace` as text, one line per
+// instruction in the same format the emulator used to print.
+//
+// usage: gbtrace <trace file> [output file]
+
+#include <stdio.h>
+#include <string.h>
+#include <trace.h>
+
+#define READ_BATCH 4096
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s <trace file> [output file]\n", argv[0]);
+        return -1;
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    if (!in)
+    {
+        printf("Failed to open: %s\n", argv[1]);
+        return -1;
+    }
+
+    FILE *out = stdout;
+    if (argc > 2)
+    {
+        out = fopen(argv[2], "w");
+        if (!out)
+        {
+            printf("Failed to open: %s\n", argv[2]);
+            fclose(in);
+            return -1;
+        }
+    }
+
+    trace_file_header header;
+    if (fread(&header, sizeof(header), 1, in) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0)
+    {
+        fprintf(stderr, "%s is not a trace file\n", argv[1]);
+        return -2;
+    }
+
+    if (header.version != TRACE_VERSION || header.record_size != sizeof(trace_record))
+    {
+        fprintf(stderr, "Unsupported trace version %d (record size %d)\n", header.version, header.record_size);
+        return -2;
+    }
+
+    static trace_record records[READ_BATCH];
+    char line[128];
+    size_t count;
+    while ((count = fread(records, sizeof(trace_record), READ_BATCH, in)) > 0)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            trace_format(&records[i], line, sizeof(line));
+            fputs(line, out);
+            fputc('\n', out);
+        }
+    }
+
+    fclose(in);
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    return 0;
+}
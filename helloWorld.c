@@ -1,7 +1,7 @@
-#include <stdio.h>
-
-int main(int argc, char **argv) 
-{
-    printf("Hello world!\n");
-    return 0;
+#include <stdio.h>
+
+int main(int argc, char **argv) 
+{
+    printf("Hello world!\n");
+    return 0;
 }
\ No newline at end of file
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <common.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <audio.h>
+
+// **APU**
+// The sound registers (NR10 - NR52, 0xFF10 - 0xFF26) and wave RAM
+// (0xFF30 - 0xFF3F). Nothing here ticks or schedules events: the APU keeps
+// the time it has caught up to, and runs forward from there when a sound
+// register is written, NR52 is read, or the host wants samples. Between
+// those the only things that change are the waveforms and the 512 Hz frame
+// sequencer (length, sweep and envelope), so catching up is a loop over the
+// frame sequencer steps in between, and within each the channels jump from
+// one waveform step to the next rather than going a cycle at a time.
+//
+// The frame sequencer is clocked by bit 12 of the timer's counter, so a
+// DIV write moves it (see apu_div_write()).
+//
+// **Synthesis**
+// Samples are only made with an output rate set (gb_set_audio_rate()),
+// otherwise catching up just keeps the registers right and skips the
+// waveforms (the noise LFSR isn't clocked, nothing but the samples can see
+// it). Each time a channel's output changes, the change is added to a
+// stereo buffer as a band-limited step: a windowed sinc picked by where
+// the change falls between two samples, added with SSE2/AVX2 where the
+// host has them (GBEMU_PPU_SIMD off uses the scalar version). Reading the
+// buffer out is a running sum with a slight high pass to take the DC out.
+// So the cost is per change in the output, not per cycle or per sample,
+// and there's no aliasing from sampling square waves.
+//
+// Finished samples are hashed (gb_audio_hash()) and pushed to the audio
+// sink if there is one. The synthesis buffer is host side like the PPU's
+// tile cache: forks and save states start from silence.
+
+#define APU_CHANNELS 4
+// 0xFF10 - 0xFF3F
+#define APU_REGISTERS 0x30
+#define WAVE_RAM_SIZE 16
+
+// the frame sequencer steps on every falling edge of the counter's bit 12
+#define FRAME_SEQUENCER_CYCLES 8192
+
+// output rates gb_set_audio_rate() takes, other than 0 for none
+#define APU_MIN_RATE 8000
+#define APU_MAX_RATE 192000
+
+typedef struct {
+    bool enabled;
+    bool length_enabled;
+    // steps left before the length counter turns the channel off
+    uint16_t length;
+    // T-cycles to the next waveform step
+    uint32_t timer;
+    // duty step (0 - 7) or wave sample (0 - 31)
+    uint8_t position;
+    uint8_t volume;
+    uint8_t envelope_timer;
+    // the wave sample being played
+    uint8_t sample;
+    uint16_t lfsr;
+    // the level last put out (0 - 15), what the mix has seen
+    uint8_t output;
+
+    // channel 1's frequency sweep
+    bool sweep_enabled;
+    uint8_t sweep_timer;
+    uint16_t shadow_frequency;
+} apu_channel;
+
+typedef struct {
+    // as written, reads mask in the bits that aren't there
+    uint8_t regs[APU_REGISTERS];
+    apu_channel channels[APU_CHANNELS];
+    bool power;
+    uint8_t frame_step;
+    uint64_t frame_next;
+    // the clock this state is at
+    uint64_t time;
+} apu_state;
+
+typedef struct apu_synth apu_synth;
+
+typedef struct {
+    apu_state state;
+
+    // host side, see synthesis above
+    uint32_t rate;
+    apu_synth *synth;
+    audio_sink *sink;
+    uint64_t hash;
+} apu_context;
+
+// power on state, after the timer (the frame sequencer follows its counter)
+void apu_init(gb_t *gb);
+void apu_release(gb_t *gb);
+// `child` starts out as a copy of `parent`'s apu_context
+void apu_fork(gb_t *parent, gb_t *child);
+// for when the state changed under the synthesis (save states), it starts
+// again from silence
+void apu_invalidate(gb_t *gb);
+
+uint8_t apu_read(gb_t *gb, uint16_t address);
+void apu_write(gb_t *gb, uint16_t address, uint8_t value);
+// called before DIV is reset, it restarts the frame sequencer's count
+void apu_div_write(gb_t *gb);
+
+// runs up to the current clock, making (and handing out) any samples
+void apu_catch_up(gb_t *gb);
+
+// 0 stops making samples, the hash starts over whenever the rate is set
+void apu_set_rate(gb_t *gb, uint32_t rate);
+void apu_set_sink(gb_t *gb, audio_sink *sink);
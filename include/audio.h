@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// **Audio sink**
+// Takes the APU's samples (interleaved 16 bit stereo frames) and writes
+// them to a file. Like the trace writer, the emulator only copies frames
+// into a ring (ringwriter.h) and a background thread does the file writes. WAV files get their header sizes filled in
+// on close, raw files are just the frames, little endian.
+
+typedef enum {
+    AUDIO_WAV,
+    AUDIO_RAW
+} audio_format;
+
+typedef struct audio_sink audio_sink;
+
+audio_sink *audio_sink_open(const char *path, audio_format format, uint32_t rate);
+uint32_t audio_sink_rate(const audio_sink *sink);
+// `count` stereo frames, waits for the writer thread if the ring is full
+void audio_sink_push(audio_sink *sink, const int16_t *frames, size_t count);
+// flushes everything still in the ring and closes the file
+void audio_sink_close(audio_sink *sink);
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <common.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <cpu.h>
+
+// **Block cache**
+// Straight line runs of code (up to the next jump, call, return or
+// interrupt enable/disable) are decoded once into a block of ops, each with
+// its generated handler and immediate operands already pulled out, so
+// running code that's been seen before skips the opcode and operand reads
+// and the handler lookup.
+//
+// Blocks are keyed by PC and by the host address of the code, which is
+// what tells ROM banks apart. They never cross a 256 byte bus page. ROM
+// can't change, so ROM blocks live until the next rom load. Blocks decoded
+// from anything writable remember their page's code_gen (see memorymap.h)
+// and are checked again when it moves (a write into the page, a remap or a
+// bank switch), they're only decoded again if their bytes changed. Pages
+// that keep getting code rewritten (self modifying code) are left to the
+// interpreter.
+//
+// A block that keeps getting run is handed to the JIT (see jit.h), after
+// that its native code runs instead of the ops whenever it can.
+//
+// Only built with GBEMU_BLOCK_CACHE (which needs the generated dispatch),
+// and the cache isn't used while tracing so every instruction gets traced.
+
+#define BLOCK_CACHE_SLOTS 2048
+#define BLOCK_MAX_OPS 16
+// recompiles a writable page gets before it's left to the interpreter
+#define BLOCK_MAX_RECOMPILES 32
+
+typedef struct {
+    BLOCK_PROC proc;
+    uint16_t imm;
+    uint8_t opcode;
+    // opcode plus immediate bytes
+    uint8_t length;
+} block_op;
+
+// runs a block's native code, `window` is how many T-cycles it may run for
+// (see jit.c). returns the number of ops it ran
+typedef uint32_t (*native_block)(gb_t *gb, uint64_t window);
+
+typedef struct {
+    // where the block's code is in host memory, NULL for an empty slot
+    const uint8_t *source;
+    uint16_t pc;
+    // code_gen of the page when decoded (or last found mapped, for rom),
+    // a block stops early if it moves under it
+    bool writable;
+    uint32_t gen;
+    uint8_t count;
+    block_op ops[BLOCK_MAX_OPS];
+
+    // times run through the ops, and the JIT's code once it's compiled
+    uint16_t runs;
+    native_block native;
+    // where other blocks' native code jumps in to go on into this one
+    const uint8_t *chain;
+} code_block;
+
+typedef struct block_cache block_cache;
+
+void blockcache_free(gb_t *gb);
+// calls `fn` on every cached block
+void blockcache_each(gb_t *gb, void (*fn)(code_block *block));
+// drops every block, the rom they came from may be gone
+void blockcache_clear(gb_t *gb);
+
+// runs the block at PC (decoding it first if needed), stopping early once
+// the clock reaches `until`. false if there's no block for PC and the
+// interpreter has to take the next instruction
+bool blockcache_run(gb_t *gb, uint64_t until);
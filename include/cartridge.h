@@ -1,27 +1,186 @@
-#pragma once
-
-#include <stdbool.h>
-#include <stdint.h>
-
-typedef struct {
-    uint8_t entry[4];
-    uint8_t logo[0x30];
-    char title[16]; // later cartridges reduce the size to 15 or 11
-    // manufacturer code
-    //cgb flag
-    uint16_t new_licensee_code;
-    uint8_t sgb_flag;
-    uint8_t cartridge_type;
-    uint8_t rom_size;
-    uint8_t ram_size;
-    uint8_t destination_code;
-    uint8_t old_licensee_code;
-    uint8_t mask_rom_version;
-    uint8_t header_checksum;
-    uint16_t global_checksum;
-} cartridge_header;
-
-bool load_cartridge(char *cartridge);
-
-uint8_t read_cartridge(uint16_t address);
-void write_cartridge(uint16_t address, uint8_t value);
\ No newline at end of file
+#pragma once
+
+#include <common.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <ram.h>
+
+typedef struct {
+    uint8_t entry[4];
+    uint8_t logo[0x30];
+    char title[16]; // later cartridges reduce the size to 15 or 11
+    // manufacturer code
+    //cgb flag
+    uint16_t new_licensee_code;
+    uint8_t sgb_flag;
+    uint8_t cartridge_type;
+    uint8_t rom_size;
+    uint8_t ram_size;
+    uint8_t destination_code;
+    uint8_t old_licensee_code;
+    uint8_t mask_rom_version;
+    uint8_t header_checksum;
+    uint16_t global_checksum;
+} cartridge_header;
+
+// header fields plus validation results, this is what the rom cache keeps
+// between launches
+typedef struct {
+    char title[17];
+    uint8_t cartridge_type;
+    uint8_t rom_size;
+    uint8_t ram_size;
+    uint8_t sgb_flag;
+    uint8_t licensee_code;
+    uint8_t mask_rom_version;
+    uint8_t header_checksum;
+    uint16_t global_checksum;
+    uint32_t file_size;
+    bool header_checksum_ok;
+    bool global_checksum_ok;
+} cartridge_info;
+
+// owns the rom image, refcounted so forked instances share one copy
+typedef struct cartridge_rom cartridge_rom;
+
+// **Mappers**
+// The bank registers only decide where the 0x0000, 0x4000 and 0xA000
+// windows point, so a bank switch works out the new offsets and calls
+// memorymap_map() for whichever window moved. Reads from the banks stay a
+// page table load like any other memory, only writes to the registers (and
+// MBC2 ram, the clock registers, banks past the end of the file) go
+// through read_cartridge()/write_cartridge().
+//
+// Cartridge ram is kept in ram_pages like work ram so forks share it until
+// they write to it. MBC3's clock runs on emulated time, it's caught up
+// from the cycle counter whenever it's read or written.
+
+typedef enum {
+    MBC_NONE,
+    MBC_1,
+    MBC_2,
+    MBC_3,
+    MBC_5
+} mbc_type;
+
+// the largest ram any of the mappers above can address (MBC5, 16 banks)
+#define CART_RAM_MAX 0x20000
+#define CART_RAM_PAGES (CART_RAM_MAX / RAM_PAGE_SIZE)
+#define CART_RAM_BANK 0x2000
+// MBC2's ram is 512 half bytes built into the mapper
+#define MBC2_RAM_SIZE 0x200
+
+// T-cycles per second, what MBC3's clock counts
+#define RTC_CYCLES 4194304
+
+typedef struct {
+    uint8_t seconds;
+    uint8_t minutes;
+    uint8_t hours;
+    uint8_t days_low;
+    // bit 0 is bit 8 of the days, bit 6 halts the clock, bit 7 is the
+    // days carry
+    uint8_t days_high;
+} rtc_registers;
+
+// the mapper's registers and what they decided, this is all save states
+// need besides the ram itself
+typedef struct {
+    bool ram_enabled;
+    // MBC1 only, 1 lets the upper bank bits apply to bank 0 and ram
+    uint8_t mode;
+    // the register values as written, MBC1's upper bits are in ram_bank
+    uint16_t rom_bank;
+    uint8_t ram_bank;
+
+    // offsets into the rom of the two rom windows and into ram of the ram
+    // window, -1 when the ram window isn't mapped to ram
+    uint32_t rom_offset[2];
+    int32_t ram_offset;
+
+    // MBC3 clock, `rtc` runs and `latched` is what reads see
+    rtc_registers rtc;
+    rtc_registers latched;
+    uint8_t latch_write;
+    // cycle count the clock was last caught up to
+    uint64_t rtc_updated;
+} mbc_state;
+
+// **Battery saves**
+// With SAVE_FILE, ram on a cartridge with a battery is kept in a .sav file
+// next to the rom (the rom's name with its extension swapped), mapped
+// shared so the ram pages are the file's pages. The game's writes land in
+// the page cache like any other store and the kernel writes them back, so
+// nothing is flushed on the hot path and a crash loses nothing.
+// cartridge_sync_save() waits for them to reach the disk, it's called on
+// unload and hosts can call it now and then (gbemu does every few
+// seconds). MBC3's clock is stored after the ram, in the 48 byte layout
+// other emulators use, whenever the file is synced.
+//
+// SAVE_MEMORY keeps it all in memory and starts from blank ram, for test
+// runs that shouldn't read or leave anything behind. Forks always get
+// their own copy of a save file's ram, only the instance that loaded the
+// rom writes to the file.
+
+typedef enum {
+    SAVE_MEMORY,
+    SAVE_FILE
+} save_mode;
+
+#define RTC_FOOTER_SIZE 48
+
+typedef struct 
+{
+    char file_name[1024];
+    // rom_data/rom_size are rom's, copied out since they're on the hot path
+    uint32_t rom_size;
+    uint8_t *rom_data;
+    cartridge_rom *rom;
+    // copy of the header since the rom itself can't be written to
+    cartridge_header header;
+    cartridge_info info;
+
+    mbc_type mbc_type;
+    bool has_rtc;
+    bool has_battery;
+    // banks in the file rounded up to a power of 2, less one
+    uint16_t rom_bank_mask;
+    uint32_t ram_size;
+    ram_page *ram[CART_RAM_PAGES];
+    mbc_state mbc;
+
+    // host side, the mapped save file the battery ram lives in (NULL in
+    // memory), not shared with forks
+    uint8_t *save_data;
+    size_t save_size;
+} cartridge_context;
+
+// battery ram goes in a save file or memory depending on `mode`
+bool load_cartridge(gb_t *gb, const char *cartridge, save_mode mode);
+// syncs and closes the save file
+void unload_cartridge(gb_t *gb);
+// `child` starts out as a copy of `parent`'s cartridge_context, false if
+// the child's copy of the save ram couldn't be allocated (the child then
+// holds no ram pages)
+bool cartridge_fork(gb_t *parent, gb_t *child);
+// waits for everything written to the save file to reach the disk, true
+// if there's no save file
+bool cartridge_sync_save(gb_t *gb);
+
+const cartridge_info *cartridge_get_info(gb_t *gb);
+
+uint8_t *cartridge_rom_data(gb_t *gb);
+uint32_t cartridge_rom_size(gb_t *gb);
+
+// back to the power on bank registers, the ram keeps its contents
+void cartridge_reset(gb_t *gb);
+// maps the rom and ram windows for the current banks
+void cartridge_map(gb_t *gb);
+
+// copies cartridge ram out to / back in from a flat CART_RAM_MAX buffer
+// (save states)
+void cartridge_save_ram(gb_t *gb, uint8_t *out);
+void cartridge_load_ram(gb_t *gb, const uint8_t *in);
+
+uint8_t read_cartridge(gb_t *gb, uint16_t address);
+void write_cartridge(gb_t *gb, uint16_t address, uint8_t value);
\ No newline at end of file
@@ -1,51 +1,185 @@
-#pragma once
-
-#include <common.h>
-#include <stdbool.h>
-#include <stdint.h>
-#include <instructions.h>
-
-typedef struct {
-    uint8_t a;
-    uint8_t f;
-    uint8_t b;
-    uint8_t c;
-    uint8_t d;
-    uint8_t e;
-    uint8_t h;
-    uint8_t l;
-    uint16_t pc;
-    uint16_t sp;
-} cpu_registers;
-
-typedef struct {
-    cpu_registers regs;
-    uint16_t fetched_data;
-    uint16_t memory_destination;
-    bool destination_is_memory;
-    uint8_t current_opcode;
-    instruction *current_instruction;
-    bool halted;
-    bool stepping;
-    bool master_interrupt_enabled;
-    uint8_t interrupt_enabled_register;
-} cpu_context;
-
-cpu_registers *cpu_get_regs();
-
-void cpu_init();
-bool cpu_step();
-
-uint16_t cpu_read_reg(reg_type rt);
-uint8_t cpu_read_reg8(reg_type rt);
-void cpu_set_reg(reg_type rt, uint16_t val);
-void cpu_set_reg8(reg_type rt,  uint8_t val);
-
-uint8_t cpu_get_ie_register();
-void cpu_set_ie_register(uint8_t val);
-
-typedef void (*IN_PROC)(cpu_context *);
-IN_PROC inst_get_processor(instruction_type type);
-
-#define CPU_FLAG_Z CHECK_BIT(ctx->regs.f, 7)
-#define CPU_FLAG_C CHECK_BIT(ctx->regs.f, 4)
\ No newline at end of file
+#pragma once
+
+#include <common.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <instructions.h>
+#include <trace.h>
+
+// a register pair and its halves, the first register is the high byte
+// whatever the host byte order, so `bc` is always (b << 8) | c
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define REG_PAIR(hi, lo) union { uint16_t hi##lo; struct { uint8_t hi; uint8_t lo; }; }
+#else
+#define REG_PAIR(hi, lo) union { uint16_t hi##lo; struct { uint8_t lo; uint8_t hi; }; }
+#endif
+
+typedef struct {
+    REG_PAIR(a, f);
+    REG_PAIR(b, c);
+    REG_PAIR(d, e);
+    REG_PAIR(h, l);
+    uint16_t pc;
+    uint16_t sp;
+} cpu_registers;
+
+#undef REG_PAIR
+
+// **Lazy flags**
+// Most flags are overwritten before anything looks at them, so the ALU ops
+// don't write F. They leave the result (with the carry in bit 8) and what
+// H is worked out from, and the flags are only computed when something
+// reads them: conditional jumps, ADC/SBC and the rotates through carry,
+// PUSH AF, or anything outside the cpu (cpu_sync_flags()).
+//
+//   Z = (uint8_t)result == 0
+//   N = n
+//   H = bit 4 of half ^ result (the operands xored for add/sub, ops with a
+//       fixed H store whatever gives it)
+//   C = bit 8 of result
+//
+// Only the flags in `pending` come from here, the rest of regs.f is current.
+
+#define FLAG_Z 0x80
+#define FLAG_N 0x40
+#define FLAG_H 0x20
+#define FLAG_C 0x10
+
+typedef struct {
+    uint8_t pending;
+    uint8_t n;
+    uint8_t half;
+    uint16_t result;
+} lazy_flags;
+
+// **Interrupts**
+// An interrupt is taken at an instruction boundary when IME is on and it's
+// set in both IE and IF: IME and its IF bit are cleared, PC is pushed and
+// the CPU jumps to 0x40 + 8 * bit, which takes 5 cycles. VBlank has the
+// highest priority (bit 0), joypad the lowest.
+//
+// - EI turns IME on after the instruction following it, so EI; DI never
+//   lets anything in. RETI turns it on straight away.
+// - HALT waits for IE & IF, whether IME is on or not. Nothing but an event
+//   can set IF while halted, so the clock goes straight to the next one
+//   instead of ticking up to it.
+// - HALT with IME off and an interrupt already waiting doesn't halt, and
+//   the byte after it is read twice (the HALT bug).
+//
+// interrupt_pending caches IME && (IE & IF) so checking for an interrupt
+// costs a single load, anything changing the three updates it through
+// cpu_update_interrupts().
+
+#define INTERRUPT_MASK 0x1F
+
+typedef enum {
+    IT_VBLANK = 1,
+    IT_LCD_STAT = 2,
+    IT_TIMER = 4,
+    IT_SERIAL = 8,
+    IT_JOYPAD = 16
+} interrupt_type;
+
+typedef struct {
+    // F may be behind `flags`, see above
+    cpu_registers regs;
+    lazy_flags flags;
+    uint16_t fetched_data;
+    uint16_t memory_destination;
+    bool destination_is_memory;
+    uint8_t current_opcode;
+    const instruction *current_instruction;
+    bool halted;
+    // IME && (IE & IF), see above
+    bool interrupt_pending;
+    // EI was the last instruction, IME goes on before the next one runs
+    bool enabling_ime;
+    // the next opcode fetch doesn't move PC
+    bool halt_bug;
+    bool stepping;
+    bool master_interrupt_enabled;
+    uint8_t interrupt_enabled_register;
+    // IF, set by the peripherals
+    uint8_t interrupt_flags;
+    trace_writer *trace;
+} cpu_context;
+
+cpu_registers *cpu_get_regs(gb_t *gb);
+
+void cpu_init(gb_t *gb);
+// works out any pending flags into regs.f
+void cpu_sync_flags(gb_t *gb);
+bool cpu_step(gb_t *gb);
+// steps until the clock reaches `until`, the instance stops or an event
+// breaks the run (gb_t.run_break)
+void cpu_run(gb_t *gb, uint64_t until);
+
+// NULL turns tracing off
+void cpu_set_trace(gb_t *gb, trace_writer *writer);
+
+uint16_t cpu_read_reg(gb_t *gb, reg_type rt);
+uint8_t cpu_read_reg8(gb_t *gb, reg_type rt);
+void cpu_set_reg(gb_t *gb, reg_type rt, uint16_t val);
+void cpu_set_reg8(gb_t *gb, reg_type rt,  uint8_t val);
+
+uint8_t cpu_get_ie_register(gb_t *gb);
+void cpu_set_ie_register(gb_t *gb, uint8_t val);
+
+uint8_t cpu_get_int_flags(gb_t *gb);
+void cpu_set_int_flags(gb_t *gb, uint8_t val);
+void cpu_request_interrupt(gb_t *gb, interrupt_type t);
+
+typedef void (*IN_PROC)(gb_t *);
+IN_PROC inst_get_processor(instruction_type type);
+
+// runs an instruction whose immediate operands (little endian) were
+// decoded ahead of time, the opcode fetch is already done
+typedef void (*BLOCK_PROC)(gb_t *, uint16_t imm);
+
+#ifdef GBEMU_SPECIALIZED_DISPATCH
+// one handler per opcode, generated at build time from instructions[]
+// by tools/gen_dispatch.c
+extern const IN_PROC cpu_opcode_handlers[0x100];
+extern const IN_PROC cpu_cb_handlers[0x100];
+// the same for the block cache, the CB ones take the place of the CB
+// prefix with the CB op resolved
+extern const BLOCK_PROC cpu_block_handlers[0x100];
+extern const BLOCK_PROC cpu_block_cb_handlers[0x100];
+#endif
+
+static inline void cpu_update_interrupts(cpu_context *ctx)
+{
+    ctx->interrupt_pending = ctx->master_interrupt_enabled &&
+        (ctx->interrupt_flags & ctx->interrupt_enabled_register & INTERRUPT_MASK);
+}
+
+#define CPU_FLAG_Z cpu_flag_z(ctx)
+#define CPU_FLAG_C cpu_flag_c(ctx)
+
+// F with the pending flags worked out
+static inline uint8_t cpu_flags_value(const cpu_context *ctx)
+{
+    const lazy_flags *lf = &ctx->flags;
+    uint8_t f = lf->n | ((uint8_t)lf->result == 0 ? FLAG_Z : 0) |
+        (((lf->half ^ lf->result) & 0x10) << 1) | ((lf->result >> 4) & FLAG_C);
+    return (ctx->regs.f & ~lf->pending) | (f & lf->pending);
+}
+
+// the two the conditions test, on their own
+static inline bool cpu_flag_z(const cpu_context *ctx)
+{
+    if (ctx->flags.pending & FLAG_Z)
+    {
+        return (uint8_t)ctx->flags.result == 0;
+    }
+    return ctx->regs.f & FLAG_Z;
+}
+
+static inline bool cpu_flag_c(const cpu_context *ctx)
+{
+    if (ctx->flags.pending & FLAG_C)
+    {
+        return ctx->flags.result & 0x100;
+    }
+    return ctx->regs.f & FLAG_C;
+}
\ No newline at end of file
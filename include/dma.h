@@ -0,0 +1,37 @@
+#pragma once
+
+#include <common.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// **OAM DMA**
+// Writing 0xFF46 copies the 160 bytes at (value << 8) into OAM, one byte per
+// M-cycle. Nothing can see OAM until the transfer is done: while it runs the
+// CPU can only get at HRAM and the I/O registers (everything else reads
+// 0xFF and ignores writes), and the PPU reads OAM as 0xFF so it finds no
+// sprites. So there's no per byte work, the whole copy is one memcpy when
+// the transfer finishes.
+//
+// Blocking the bus is just taking every page table pointer away for the
+// length of the transfer, so the fast paths pay nothing for it and the
+// handlers check a single flag.
+
+#define OAM_DMA_LENGTH 0xA0
+// the transfer starts a cycle after the write, and takes a cycle per byte
+#define DMA_START_CYCLES 4
+#define DMA_CYCLES (OAM_DMA_LENGTH * 4)
+
+typedef struct {
+    // the last value written to 0xFF46
+    uint8_t source;
+    // the write happened, the transfer starts at the next event
+    bool starting;
+    // the transfer is running and the CPU is off the bus
+    bool active;
+} dma_context;
+
+// power on state, registers the DMA event
+void dma_init(gb_t *gb);
+
+uint8_t dma_read(gb_t *gb);
+void dma_write(gb_t *gb, uint8_t value);
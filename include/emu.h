@@ -1,16 +1,27 @@
-#pragma once
-
-#include <stdbool.h>
-#include <stdint.h>
-
-typedef struct {
-    bool paused;
-    bool running;
-    uint64_t ticks;
-} emu_context;
-
-int emu_run(int argc, char **argv);
-
-emu_context * emu_get_context();
-
-void emu_cycles(int cpu_cycles);
\ No newline at end of file
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <gb.h>
+
+typedef struct {
+    bool paused;
+    volatile bool running;
+} emu_context;
+
+int emu_run(int argc, char **argv);
+
+emu_context * emu_get_context();
+
+// T-cycles since power on
+static inline uint64_t emu_get_ticks(gb_t *gb)
+{
+    return gb->scheduler.now;
+}
+
+// advances the clock by `cpu_cycles` M-cycles, running any events that come
+// due on the way
+static inline void emu_cycles(gb_t *gb, int cpu_cycles)
+{
+    scheduler_advance(gb, cpu_cycles * 4);
+}
\ No newline at end of file
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <common.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <apu.h>
+#include <audio.h>
+#include <blockcache.h>
+#include <cartridge.h>
+#include <cpu.h>
+#include <dma.h>
+#include <jit.h>
+#include <joypad.h>
+#include <link.h>
+#include <memorymap.h>
+#include <ppu.h>
+#include <ram.h>
+#include <scheduler.h>
+#include <serial.h>
+#include <timer.h>
+#include <trace.h>
+
+// **Emulator instance**
+// Everything one emulated Game Boy owns lives in a gb_t, the library keeps
+// no state of its own. Any number of instances can run side by side, as
+// long as each one is only driven by one thread at a time.
+//
+//     gb_t *gb = gb_create();
+//     if (gb_load_rom(gb, "tetris.gb"))
+//     {
+//         gb_run_frames(gb, 60);
+//     }
+//     gb_destroy(gb);
+//
+// Errors that used to exit the process (invalid opcodes, unimplemented
+// hardware) stop just the instance, see gb_fault().
+
+// T-cycles per frame, 154 lines of 456
+#define GB_FRAME_CYCLES 70224
+
+struct gb {
+    cpu_context cpu;
+    memorymap_context bus;
+    scheduler_context scheduler;
+    ram_context ram;
+    ppu_context ppu;
+    timer_context timer;
+    dma_context dma;
+    apu_context apu;
+    serial_context serial;
+    joypad_context joypad;
+    cartridge_context cart;
+
+    // instructions run since the rom was loaded
+    uint64_t instructions;
+
+    // set by gb_fault(), the run functions do nothing until the next load
+    bool stopped;
+    // set by an event that wants the current run to return early (a serial
+    // stop rule), cleared when the next one starts
+    bool run_break;
+    char fault[256];
+
+    // print cartridge info and faults to stdout
+    bool log;
+    // where battery backed cartridge ram is kept (see cartridge.h)
+    save_mode save_mode;
+
+    // host side, decoded code (see blockcache.h), allocated on first use
+    block_cache *blocks;
+    bool use_blocks;
+    // host side, native code for hot blocks (see jit.h)
+    jit_context *jit;
+    jit_mode jit_mode;
+};
+
+gb_t *gb_create();
+void gb_destroy(gb_t *gb);
+
+// a new instance in exactly the same state. rom and ram pages are shared
+// until one side writes to them, so a fork costs about a microsecond and
+// children only use memory for what they change. the parent and child can
+// run on different threads afterwards
+gb_t *gb_fork(gb_t *gb);
+
+// loads the rom and powers on, false if the rom couldn't be loaded
+bool gb_load_rom(gb_t *gb, const char *path);
+// powers back on with the rom that's already loaded
+void gb_reset(gb_t *gb);
+
+// runs one instruction, false once the instance has stopped
+bool gb_step(gb_t *gb);
+// runs for at least `t_cycles` T-cycles (it only stops between
+// instructions), returns how many actually ran
+uint64_t gb_run_cycles(gb_t *gb, uint64_t t_cycles);
+uint64_t gb_run_frames(gb_t *gb, uint32_t frames);
+
+// NULL turns tracing off, the writer isn't owned by the instance
+void gb_set_trace(gb_t *gb, trace_writer *writer);
+// on by default in builds with GBEMU_BLOCK_CACHE, off runs everything
+// through the interpreter (results are the same either way)
+void gb_set_block_cache(gb_t *gb, bool on);
+// JIT_ON by default where the JIT is built and the host can run it, it
+// only does anything with the block cache on. JIT_LOCKSTEP checks every
+// native block against the interpreter and faults on the first difference
+void gb_set_jit(gb_t *gb, jit_mode mode);
+void gb_set_logging(gb_t *gb, bool on);
+// SAVE_FILE by default, battery backed cartridge ram lives in a .sav file
+// next to the rom. SAVE_MEMORY keeps it in memory, for runs that shouldn't
+// touch the disk. takes effect at the next gb_load_rom()
+void gb_set_save_mode(gb_t *gb, save_mode mode);
+// waits for the save file to reach the disk, false if it couldn't be
+// written. it's synced on unload anyway, this is for hosts that want
+// progress on disk more often
+bool gb_sync_save(gb_t *gb);
+
+uint64_t gb_ticks(gb_t *gb);
+uint64_t gb_instruction_count(gb_t *gb);
+// frames the LCD has finished since power on
+uint64_t gb_frame_count(gb_t *gb);
+// the last frame drawn, LCD_WIDTH x LCD_HEIGHT ARGB pixels row by row, NULL
+// if it couldn't be allocated
+const uint32_t *gb_framebuffer(gb_t *gb);
+uint64_t gb_framebuffer_hash(gb_t *gb);
+
+// makes samples at `rate` Hz (0, the default, doesn't, the sound registers
+// work either way). the run functions hand out what they've made before
+// returning, see apu.h
+void gb_set_audio_rate(gb_t *gb, uint32_t rate);
+// NULL for none, the sink isn't owned by the instance
+void gb_set_audio_sink(gb_t *gb, audio_sink *sink);
+// FNV-1a over the samples made since the rate was last set
+uint64_t gb_audio_hash(gb_t *gb);
+
+// LCD timing and interrupts always run, but only every `interval`th frame
+// is drawn (1 is every frame and the default, 0 is only the frames asked
+// for). Headless runs that only look at the screen now and then should
+// turn this down, drawing is most of the cost of a frame
+void gb_set_render_interval(gb_t *gb, uint32_t interval);
+// draws frame `frame` whatever the interval, see ppu_request_frame()
+bool gb_request_frame(gb_t *gb, uint64_t frame);
+// what the game has sent over the serial port since power on, the last
+// SERIAL_CAPTURE_SIZE bytes of it. `length` can be NULL
+const char *gb_serial_output(gb_t *gb, size_t *length);
+// the run functions return as soon as the serial output ends in `text`
+// (test ROMs print "Passed" or "Failed"), see serial.h. NULL clears them
+bool gb_serial_stop_on(gb_t *gb, const char *text);
+// the stop text that ended the last run early, NULL if it ran its course
+const char *gb_serial_stop_reason(gb_t *gb);
+// plugs a link cable between two instances in this process, each has to be
+// run by its own thread from then on (see link.h). slack 0 is the default.
+// unlink an end that won't be run any more, the other waits for it otherwise
+bool gb_link(gb_t *a, gb_t *b, uint32_t slack);
+// one end of a cable to another process through shared memory `name`
+// ("/gblink"), side 0 makes it and side 1 joins
+bool gb_link_shared(gb_t *gb, const char *name, int side, uint32_t slack);
+void gb_unlink(gb_t *gb);
+
+// LY always reads `ly`, -1 (the default) for the real one. Gameboy Doctor
+// style CPU logs are made with it stuck at 0x90
+void gb_set_fixed_ly(gb_t *gb, int ly);
+const cpu_registers *gb_regs(gb_t *gb);
+const cartridge_info *gb_cartridge_info(gb_t *gb);
+
+// NULL unless the instance stopped on an error
+const char *gb_fault_message(gb_t *gb);
+
+// stops the instance, keeping the first message
+void gb_fault(gb_t *gb, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// **Hot paths**
+// inline since they run several times per instruction, they need the whole
+// instance layout so they live here rather than with their modules
+
+static inline uint8_t read_address_bus(gb_t *gb, uint16_t address)
+{
+    uint8_t *page = gb->bus.read[address >> BUS_PAGE_SHIFT];
+    if (page)
+    {
+        return page[address & BUS_PAGE_MASK];
+    }
+    return read_address_bus_handler(gb, address);
+}
+
+static inline void write_address_bus(gb_t *gb, uint16_t address, uint8_t value)
+{
+    uint8_t *page = gb->bus.write[address >> BUS_PAGE_SHIFT];
+    if (page)
+    {
+        page[address & BUS_PAGE_MASK] = value;
+        return;
+    }
+    write_address_bus_handler(gb, address, value);
+}
+
+static inline void scheduler_advance(gb_t *gb, uint32_t t_cycles)
+{
+    gb->scheduler.now += t_cycles;
+    if (gb->scheduler.now >= gb->scheduler.next)
+    {
+        scheduler_run_due(gb);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <common.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <blockcache.h>
+
+// **JIT**
+// Blocks from the block cache that have run JIT_HOT_RUNS times are
+// translated to x86-64. The SM83 registers stay in cpu_context and every
+// instruction works on them in place, so the native code can stop after
+// any instruction with the instance in exactly the state the interpreter
+// would have left it in.
+//
+// - Register to register instructions, immediate loads, 8 and 16 bit
+//   arithmetic, loads and stores through BC/DE/HL and the jumps are
+//   translated. Everything else calls the op's generated handler, so the
+//   semantics can't drift from the interpreter.
+// - Flags are only computed when something can see them: an instruction
+//   whose flags are all overwritten before anything reads them (or before
+//   the block could stop) doesn't compute any.
+// - The clock isn't touched per instruction. Each instruction's cycle
+//   offset into the block is known when it's compiled, so the clock is set
+//   once on the way out, or before calling out to a handler. Native code
+//   only runs while no event can come due, it stops at the last instruction
+//   boundary before one could (the ops then run up to it and the event
+//   fires on time).
+// - Loads and stores go straight to memory when the bus page is mapped and
+//   only call the bus handlers for I/O, HRAM, banking registers and pages
+//   holding decoded code.
+// - Code that writes over itself bumps its page's code_gen, which ends the
+//   block right after the write. The block cache then decodes it again, and
+//   pages that keep doing that are left to the interpreter.
+// - A block that runs to its end goes straight on into the native code of
+//   the block that ran after it last time, if PC is there again and the
+//   window still has room, without coming back out through the block
+//   cache. Short blocks in tight loops would spend more on getting in and
+//   out than on their instructions otherwise. Not after EI, HALT or STOP,
+//   the interpreter has to take the next step.
+// - Blocks that would mostly be handler calls aren't compiled, the ops run
+//   them for less.
+//
+// JIT_LOCKSTEP runs an interpreter-only copy of the instance alongside and
+// compares the two after every native block, the instance faults at the
+// first block that ends up somewhere the interpreter didn't.
+//
+// Compiled code is host side like the block cache, each instance has its
+// own and forks start without any. Only built with GBEMU_JIT (x86-64,
+// needs GBEMU_BLOCK_CACHE), elsewhere blocks just keep running their ops.
+
+typedef enum {
+    JIT_OFF,
+    JIT_ON,
+    JIT_LOCKSTEP
+} jit_mode;
+
+// runs through the ops before a block gets compiled
+#define JIT_HOT_RUNS 8
+// native code per instance, it's all thrown away when it fills up
+#define JIT_CODE_SIZE (1 << 20)
+// block exits that can be chained, likewise
+#define JIT_MAX_LINKS 16384
+
+typedef struct jit_context jit_context;
+
+// false if this build or host can't run native code
+bool jit_available(void);
+
+void jit_set_mode(gb_t *gb, jit_mode mode);
+// drops the compiled code (the blocks stay) and the lockstep copy
+void jit_reset(gb_t *gb);
+void jit_free(gb_t *gb);
+
+// leaves block->native NULL if the block can't be compiled
+void jit_compile(gb_t *gb, code_block *block);
+// runs (*block)->native if it can run at least one instruction before
+// `until` or the next event. *block is left at the block it stopped in
+// (the native code may have gone on into later ones), returns the number
+// of that block's ops it ran
+int jit_run(gb_t *gb, code_block **block, uint64_t until);
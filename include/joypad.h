@@ -0,0 +1,21 @@
+#pragma once
+
+#include <common.h>
+#include <stdint.h>
+
+// **Joypad**
+// P1 (0xFF00). Bits 4 and 5 pick the direction keys and the buttons (0 is
+// selected), the low nibble reads the picked keys with 0 for pressed. There
+// are no keys to press yet, so it always reads as nothing held down, which
+// is all a game polling it at boot needs.
+
+typedef struct {
+    // bits 4 and 5 as last written
+    uint8_t select;
+} joypad_context;
+
+// power on state, the boot rom leaves both lines selected
+void joypad_init(gb_t *gb);
+
+uint8_t joypad_read(gb_t *gb);
+void joypad_write(gb_t *gb, uint8_t value);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <common.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <serial.h>
+
+// **Link cable**
+// Connects the serial ports of two instances, either in this process or in
+// two processes sharing memory. There's no per bit lockstep: each end runs
+// freely up to `slack` T-cycles past the clock the other end last
+// published, and only waits there (an EVENT_LINK barrier).
+//
+// The end driving the clock sends its byte and the time the transfer ends
+// as soon as it starts. The other end waits there for the first end to get
+// that far too (so a transfer stopped or restarted on the way is seen), takes
+// the byte if its SC is waiting on the external clock then, and answers
+// with its own, which the first end waits for at the same time. A transfer
+// takes more than 7 bit times after it starts, so with slack up to
+// LINK_SAFE_SLACK the other end always hears about it before running past
+// its end (with room for an instruction running past the barrier), and every
+// run comes out the same whatever the host threads do. More slack means
+// fewer barriers, but a transfer can then land late on the other end.
+//
+// Both ends keep the same time from when they were connected. Each end
+// has to be run by its own thread (or process), a barrier blocks until the
+// other end catches up. An end that disconnects or says nothing for
+// LINK_TIMEOUT_MS counts as the cable being pulled out, transfers then
+// read 0xFF like nothing is plugged in.
+//
+// Ends both clocking a transfer at once get 0xFF, loading a ROM or a save
+// state pulls the cable out, and forks start unplugged. JIT_LOCKSTEP checks
+// against an unplugged copy, so the first byte through the cable shows up as
+// a difference.
+
+// the most slack that keeps transfers on time
+#define LINK_SAFE_SLACK (6 * SERIAL_BIT_CYCLES)
+#define LINK_DEFAULT_SLACK LINK_SAFE_SLACK
+#define LINK_TIMEOUT_MS 10000
+
+// power on state, unplugged. registers the link event
+void link_init(gb_t *gb);
+
+// both ends in this process. slack 0 is LINK_DEFAULT_SLACK
+bool link_connect(gb_t *a, gb_t *b, uint32_t slack);
+// one end in the POSIX shared memory object `name`, side 0 creates it and
+// side 1 (another process) joins, waiting up to LINK_TIMEOUT_MS for it
+bool link_connect_shared(gb_t *gb, const char *name, int side, uint32_t slack);
+// pulls this end out, the other end sees an empty socket from then on
+void link_disconnect(gb_t *gb);
+
+// called by the serial port
+// the transfer this end clocks ends at `when`, tells the other end
+void link_send(gb_t *gb, uint64_t when, uint8_t value);
+// the transfer this end was clocking stopped before it ended
+void link_cancel(gb_t *gb);
+// the other end's byte at the end of the transfer this end clocked
+uint8_t link_receive(gb_t *gb, uint64_t when);
+// waits for the other end to get to `when`, having handled everything it
+// sent before then. false if the cable was pulled out meanwhile
+bool link_sync(gb_t *gb, uint64_t when);
+// answers a transfer the other end clocked
+void link_reply(gb_t *gb, uint64_t when, uint8_t value);
+// lets the other end run up to this end's clock, after a run
+void link_publish(gb_t *gb);
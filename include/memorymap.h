@@ -1,10 +1,58 @@
-#pragma once
-
-#include <common.h>
-#include <stdint.h>
-
-uint8_t read_address_bus(uint16_t address);
-void write_address_bus(uint16_t address, uint8_t value);
-
-uint16_t read16_address_bus(uint16_t address);
-void write16_address_bus(uint16_t address, uint16_t value);
+#pragma once
+
+#include <common.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// **Page table**
+// The address space is split into 256 byte pages. Pages backed by plain
+// memory (ROM banks, WRAM) hold a direct host pointer so a bus access is a
+// single table index plus load. Pages that need side effects or aren't
+// memory (I/O, unmapped ranges, cartridge control writes) are left NULL and
+// go through the handlers below. Bank switching is just memorymap_map().
+
+#define BUS_PAGE_SHIFT 8
+#define BUS_PAGE_SIZE (1 << BUS_PAGE_SHIFT)
+#define BUS_PAGE_MASK (BUS_PAGE_SIZE - 1)
+#define BUS_PAGE_COUNT (0x10000 >> BUS_PAGE_SHIFT)
+
+// **Code pages**
+// The block cache (blockcache.h) decodes code ahead of time, so it has to
+// hear about writes to any page it decoded from. memorymap_protect_code()
+// takes such a page's direct write pointer away so the next write comes
+// through the handler, which bumps the page's code_gen (stale blocks check
+// it) and gives the pointer back. Remapping a page to other memory bumps it
+// too, that covers bank switches and copy on write. memorymap_remap() (OAM
+// DMA, forks) leaves pages that get the same pointers again alone, while
+// memorymap_init() bumps every page since the memory itself may have been
+// replaced behind the bus (power on, loading a state).
+
+typedef struct {
+    uint8_t *read[BUS_PAGE_COUNT];
+    uint8_t *write[BUS_PAGE_COUNT];
+
+    // pages holding decoded code, and the write pointers they gave up
+    bool code[BUS_PAGE_COUNT];
+    uint8_t *code_write[BUS_PAGE_COUNT];
+    uint32_t code_gen[BUS_PAGE_COUNT];
+} memorymap_context;
+
+// builds the page table from the loaded cartridge and ram
+void memorymap_init(gb_t *gb);
+// builds it again after a change to what's mapped where, keeping the code
+// state of the pages that come out the same
+void memorymap_remap(gb_t *gb);
+
+// points `page_count` pages starting at the one containing `address` at
+// `read`/`write` (either can be NULL to use the handler)
+void memorymap_map(gb_t *gb, uint16_t address, uint16_t page_count, uint8_t *read, uint8_t *write);
+
+void memorymap_protect_code(gb_t *gb, uint16_t address);
+
+// read_address_bus()/write_address_bus() are the inline fast paths, they
+// need the whole instance layout so they live in gb.h
+uint8_t read_address_bus_handler(gb_t *gb, uint16_t address);
+void write_address_bus_handler(gb_t *gb, uint16_t address, uint8_t value);
+
+uint16_t read16_address_bus(gb_t *gb, uint16_t address);
+void write16_address_bus(gb_t *gb, uint16_t address, uint16_t value);
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <common.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// **PPU**
+// VRAM, OAM and the LCD registers (0xFF40 - 0xFF4B), plus the renderer.
+//
+// The renderer works a scanline at a time instead of fetching a dot at a
+// time. Tiles are kept decoded (one color index per byte) in a cache, a
+// VRAM write to tile data only marks that tile dirty and it's decoded again
+// the next time a line uses it. A background line is then just 8 byte
+// copies out of the cache, sprites go on top, and the finished line of
+// color indices is expanded to ARGB through the palette with SSE2/AVX2
+// (picked at runtime, scalar elsewhere or with GBEMU_PPU_SIMD off).
+//
+// The tile cache and framebuffer are host side and allocated on first use,
+// so forks and save states don't carry them around. A fork starts with an
+// empty framebuffer and fills it in from its next rendered frame.
+//
+// **Frame skipping**
+// LCD timing and drawing are separate. The timing (modes 2/3/0 each line,
+// then vblank, LY, STAT and its interrupts) always runs, it's a handful of
+// events per line. The compositor only runs for frames someone is going to
+// look at: every render_interval'th frame (1, every frame, is the default,
+// 0 is none) plus any frame asked for with ppu_request_frame(). Whether a
+// frame is drawn is decided as it starts, and the framebuffer is double
+// buffered so it always holds the last whole frame that was drawn.
+
+#define LCD_WIDTH 160
+#define LCD_HEIGHT 144
+#define LCD_LINES 154
+// T-cycles per scanline
+#define LCD_LINE_CYCLES 456
+// mode 2 is fixed, mode 3 is this plus the fine scroll and sprite penalties,
+// mode 0 is whatever is left of the line
+#define LCD_OAM_CYCLES 80
+#define LCD_DRAW_CYCLES 172
+
+#define VRAM_SIZE 0x2000
+#define OAM_SIZE 0xA0
+// 0x8000 - 0x97FF, 16 bytes a tile
+#define PPU_TILE_COUNT 384
+
+// LCDC bits
+#define LCDC_BG_ENABLE 0x01
+#define LCDC_OBJ_ENABLE 0x02
+#define LCDC_OBJ_TALL 0x04
+#define LCDC_BG_MAP 0x08
+#define LCDC_TILE_DATA 0x10
+#define LCDC_WINDOW_ENABLE 0x20
+#define LCDC_WINDOW_MAP 0x40
+#define LCDC_LCD_ENABLE 0x80
+
+// STAT interrupt sources
+#define STAT_HBLANK_INT 0x08
+#define STAT_VBLANK_INT 0x10
+#define STAT_OAM_INT 0x20
+#define STAT_LYC_INT 0x40
+
+typedef enum {
+    MODE_HBLANK,
+    MODE_VBLANK,
+    MODE_OAM,
+    MODE_DRAW
+} lcd_mode;
+
+// frame numbers that can be waiting on ppu_request_frame() at once
+#define PPU_FRAME_REQUESTS 8
+
+typedef struct {
+    uint8_t lcdc;
+    uint8_t stat;
+    uint8_t scy;
+    uint8_t scx;
+    uint8_t ly;
+    uint8_t lyc;
+    uint8_t bgp;
+    uint8_t obp0;
+    uint8_t obp1;
+    uint8_t wy;
+    uint8_t wx;
+
+    // internal: the window's own line counter, it only moves on lines the
+    // window is actually drawn on
+    uint8_t window_line;
+    lcd_mode mode;
+    // length of this line's mode 3
+    uint16_t draw_cycles;
+    // the STAT interrupt fires when this goes from false to true
+    bool stat_line;
+    // frames finished since power on
+    uint64_t frames;
+} ppu_state;
+
+typedef struct ppu_cache ppu_cache;
+
+typedef struct {
+    uint8_t vram[VRAM_SIZE];
+    uint8_t oam[OAM_SIZE];
+    ppu_state state;
+
+    // host side, see frame skipping above
+    uint32_t render_interval;
+    uint64_t requests[PPU_FRAME_REQUESTS];
+    int request_count;
+    // the frame in progress is being drawn
+    bool rendering;
+    // LY reads as fixed_ly rather than the line, see ppu_set_fixed_ly()
+    bool ly_fixed;
+    uint8_t fixed_ly;
+
+    // decoded tiles and the framebuffer, see above
+    ppu_cache *cache;
+} ppu_context;
+
+// power on state, registers the LCD event
+void ppu_init(gb_t *gb);
+void ppu_release(gb_t *gb);
+// `child` starts out as a copy of `parent`'s ppu_context
+void ppu_fork(gb_t *parent, gb_t *child);
+
+// maps VRAM into the bus: reads are direct, tile data writes go through
+// write_vram() so the cache sees them
+void ppu_map(gb_t *gb);
+// for when VRAM changed without going through the bus (save states), this
+// also drops the frame in progress
+void ppu_invalidate(gb_t *gb);
+
+uint8_t read_vram(gb_t *gb, uint16_t address);
+void write_vram(gb_t *gb, uint16_t address, uint8_t value);
+uint8_t read_oam(gb_t *gb, uint16_t address);
+void write_oam(gb_t *gb, uint16_t address, uint8_t value);
+
+uint8_t ppu_read_io(gb_t *gb, uint16_t address);
+void ppu_write_io(gb_t *gb, uint16_t address, uint8_t value);
+
+void ppu_set_render_interval(gb_t *gb, uint32_t interval);
+// LY always reads `ly` (-1 for the real line), only the CPU's view changes,
+// the LCD keeps time as usual. for comparing against logs made that way
+void ppu_set_fixed_ly(gb_t *gb, int ly);
+// frame `frame` is the one that finishes as the frame count goes from
+// `frame` to `frame` + 1. false if it has already started or too many
+// requests are waiting
+bool ppu_request_frame(gb_t *gb, uint64_t frame);
+
+// the last frame drawn, LCD_WIDTH x LCD_HEIGHT ARGB pixels row by row
+const uint32_t *ppu_framebuffer(gb_t *gb);
+// FNV-1a over the pixels of ppu_framebuffer()
+uint64_t ppu_framebuffer_hash(gb_t *gb);
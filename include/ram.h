@@ -1,9 +1,60 @@
-#pragma once
-
-#include <stdint.h>
-
-uint8_t read_wram(uint16_t address);
-void write_wram(uint16_t address, uint8_t value);
-
-uint8_t read_hram(uint8_t address);
-void write_hram(uint16_t address, uint8_t value);
\ No newline at end of file
+#pragma once
+
+#include <common.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// **Shared pages**
+// Work ram is kept in refcounted 256 byte pages, the same size as a bus
+// page, so forked instances (gb_fork) can share every page they haven't
+// written to. A page only gets a direct write pointer in the page table
+// while one instance holds it, writes to a shared page land in
+// write_wram() which copies it first.
+
+#define RAM_PAGE_SIZE 256
+#define WRAM_PAGES (0x2000 / RAM_PAGE_SIZE)
+
+typedef struct ram_page ram_page;
+
+ram_page *ram_page_new();
+// a page over memory the caller owns and keeps alive (a mapped save file),
+// writes go straight to it
+ram_page *ram_page_wrap(uint8_t *data);
+// another reference to the same page
+ram_page *ram_page_share(ram_page *page);
+// what a fork should hold: another reference, or for a wrapped page a copy
+// so the fork never writes to the parent's memory (NULL if it couldn't be
+// made)
+ram_page *ram_page_fork(ram_page *page);
+void ram_page_release(ram_page *page);
+uint8_t *ram_page_data(ram_page *page);
+bool ram_page_is_shared(ram_page *page);
+// makes sure `*slot` is only held by the caller, copying it if it's shared,
+// and returns its data for writing (NULL if the copy couldn't be made)
+uint8_t *ram_page_own(ram_page **slot);
+
+typedef struct {
+    ram_page *wram[WRAM_PAGES];
+    uint8_t hram[0x80];
+} ram_context;
+
+bool ram_init(gb_t *gb);
+// zeroes everything, without writing to pages another instance still uses
+void ram_reset(gb_t *gb);
+void ram_release(gb_t *gb);
+// `child` starts out as a copy of `parent`'s ram_context, both end up
+// sharing every page
+void ram_fork(gb_t *parent, gb_t *child);
+
+// maps work ram into the bus, writable where the page isn't shared
+void ram_map(gb_t *gb);
+
+// copies work ram out to / back in from a flat 8 KB buffer (save states)
+void ram_save_wram(gb_t *gb, uint8_t *out);
+void ram_load_wram(gb_t *gb, const uint8_t *in);
+
+uint8_t read_wram(gb_t *gb, uint16_t address);
+void write_wram(gb_t *gb, uint16_t address, uint8_t value);
+
+uint8_t read_hram(gb_t *gb, uint16_t address);
+void write_hram(gb_t *gb, uint16_t address, uint8_t value);
\ No newline at end of file
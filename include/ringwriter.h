@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+
+// **Ring writer**
+// What the trace writer, the audio sink and the snapshot stream have in
+// common: the emulator thread fills fixed size slots of a lock-free single
+// producer/single consumer ring, and a background thread hands them on to
+// a write function (usually an fwrite) in order. The emulator only waits
+// when the ring is full.
+//
+//     trace_record *slot = ring_writer_reserve(ring);
+//     *slot = record;
+//     ring_writer_publish(ring);
+
+typedef struct ring_writer ring_writer;
+
+// runs on the writer thread with `count` slots in a row, never more than
+// the batch size
+typedef void (*ring_write_fn)(void *context, const void *slots, size_t count);
+
+// `slot_count` must be a power of 2, `batch` 0 is no limit. NULL if the
+// ring couldn't be allocated or the thread started
+ring_writer *ring_writer_open(size_t slot_size, size_t slot_count, size_t batch, ring_write_fn write, void *context);
+
+// the next slot to fill in, waits for the writer thread if the ring is
+// full. it isn't written out until it's published
+void *ring_writer_reserve(ring_writer *ring);
+// hands every slot reserved so far to the writer thread
+void ring_writer_publish(ring_writer *ring);
+
+// writes out everything published, stops the thread and frees the ring
+void ring_writer_close(ring_writer *ring);
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cartridge.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// **ROM cache**
+// Content addressed cache of parsed header info and validation results, so
+// launching the same rom again doesn't recompute (and reprint) any of it.
+// Entries are keyed on the global checksum plus the file size and header
+// checksum. The cache is off unless GBEMU_ROM_CACHE names a directory.
+
+#define ROMCACHE_ENV "GBEMU_ROM_CACHE"
+
+bool romcache_lookup(uint16_t global_checksum, uint32_t file_size, uint8_t header_checksum, cartridge_info *info);
+void romcache_store(const cartridge_info *info);
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <common.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// **Save states**
+// A snapshot is a header followed by one section per piece of emulated
+// state (cpu, scheduler, ram, ppu, ...). Each section is the module's context
+// copied as is (work ram page by page, since it's shared between forks), so
+// saving and restoring are a handful of memcpys and take about a
+// microsecond. Host side pointers in those contexts (trace writer,
+// event handlers, the page table) are never taken from a snapshot, they're
+// kept or rebuilt on restore.
+//
+// Since sections are raw structs a snapshot only loads into the same build
+// layout, every section carries its size and a mismatch is rejected rather
+// than misread. Bump SAVESTATE_VERSION when a section changes meaning
+// without changing size.
+//
+// Every snapshot from one build is savestate_size() bytes, whatever the
+// rom. A snapshot file is just snapshots back to back.
+
+#define SAVESTATE_MAGIC "GBSS"
+#define SAVESTATE_VERSION 4
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t section_count;
+    // whole snapshot, header included
+    uint32_t size;
+
+    // the rom it was taken with, it only loads back into the same one
+    uint32_t rom_size;
+    uint16_t rom_global_checksum;
+    uint8_t rom_header_checksum;
+    uint8_t reserved;
+
+    uint64_t ticks;
+    uint64_t instructions;
+} savestate_header;
+
+typedef struct {
+    char id[4];
+    uint32_t size;
+} savestate_section_header;
+
+size_t savestate_size();
+
+// returns the bytes written, 0 if `size` is too small
+size_t savestate_save(gb_t *gb, void *buffer, size_t size);
+// false (leaving the instance as it was) if the snapshot is damaged, from a
+// different build or for a different rom
+bool savestate_load(gb_t *gb, const void *buffer, size_t size);
+
+bool savestate_save_file(gb_t *gb, const char *path);
+// loads snapshot `index` from a snapshot file, negative counts from the end
+bool savestate_load_file(gb_t *gb, const char *path, long index);
+
+// **Snapshot stream**
+// Snapshots go straight into a ring of slots and a background thread
+// writes them out, the same single producer/single consumer setup as the
+// trace writer. Push only waits when the disk falls a whole ring behind.
+
+typedef struct savestate_writer savestate_writer;
+
+savestate_writer *savestate_writer_open(const char *path);
+void savestate_writer_push(savestate_writer *writer, gb_t *gb);
+// flushes everything still in the ring and closes the file
+void savestate_writer_close(savestate_writer *writer);
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <common.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// **Scheduler**
+// Owns the master clock (in T-cycles, 4 per M-cycle) and a min-heap of
+// timestamped events. The cpu advances the clock through emu_cycles() and
+// the only per cycle work is comparing against the earliest deadline, so
+// peripherals run only when one of their events is actually due.
+//
+// Each event type can be scheduled at most once at a time, rescheduling
+// just moves it.
+
+typedef enum {
+    EVENT_TIMER,
+    EVENT_LCD,
+    EVENT_DMA,
+    EVENT_SERIAL,
+    EVENT_SERIAL_PEER,
+    EVENT_LINK,
+    EVENT_COUNT
+} event_type;
+
+// called once the clock reaches `when` (the time it was scheduled for, the
+// clock itself may be a few cycles past it)
+typedef void (*event_handler)(gb_t *gb, uint64_t when);
+
+typedef struct {
+    uint64_t now;
+    // when of the earliest scheduled event, UINT64_MAX when there are none
+    uint64_t next;
+
+    int count;
+    event_type heap[EVENT_COUNT];
+    int heap_index[EVENT_COUNT];
+    uint64_t when[EVENT_COUNT];
+    event_handler handlers[EVENT_COUNT];
+} scheduler_context;
+
+void scheduler_init(gb_t *gb);
+
+void scheduler_set_handler(gb_t *gb, event_type type, event_handler handler);
+
+void scheduler_schedule(gb_t *gb, event_type type, uint64_t when);
+void scheduler_schedule_in(gb_t *gb, event_type type, uint64_t t_cycles);
+void scheduler_cancel(gb_t *gb, event_type type);
+bool scheduler_is_scheduled(gb_t *gb, event_type type);
+
+// runs every event that is due, in time order
+void scheduler_run_due(gb_t *gb);
+
+// scheduler_advance() is inline in gb.h
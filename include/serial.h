@@ -0,0 +1,82 @@
+#pragma once
+
+#include <common.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// **Serial port**
+// SB and SC (0xFF01, 0xFF02). A transfer on the internal clock shifts SB
+// out a bit per 512 T-cycles (on the falling edges of the timer counter's
+// bit 8), but nothing can see the bits go, so the whole byte is a single
+// event when the 8th edge comes: SB takes the byte coming in (0xFF with
+// nothing plugged in), SC's start bit clears and the serial interrupt is
+// requested. On the external clock a transfer waits for the other end,
+// which without a cable (link.h) never comes.
+//
+// **Capture**
+// Every byte sent is kept (the last SERIAL_CAPTURE_SIZE of them), which is
+// how test ROMs report their results. Stop rules end a run as soon as the
+// output has a given text in it ("Passed", "Failed"), so a test run only
+// takes as long as the test rather than a fixed budget. The output is host
+// side, loading a state doesn't change it and forks start with a copy.
+
+// T-cycles per bit on the internal clock (8192 Hz)
+#define SERIAL_BIT_CYCLES 512
+#define SERIAL_CAPTURE_SIZE 4096
+#define SERIAL_STOP_RULES 4
+#define SERIAL_STOP_TEXT 64
+
+#define SC_START 0x80
+#define SC_INTERNAL_CLOCK 0x01
+
+typedef struct link_port link_port;
+
+typedef struct {
+    uint8_t sb;
+    // only the start and clock bits
+    uint8_t sc;
+} serial_state;
+
+typedef struct {
+    serial_state state;
+
+    // host side, see capture above. NUL terminated, though the game could
+    // send NULs too
+    char output[SERIAL_CAPTURE_SIZE + 1];
+    size_t length;
+    // bytes sent since power on, including the ones dropped
+    uint64_t sent;
+    char stop_rules[SERIAL_STOP_RULES][SERIAL_STOP_TEXT];
+    int stop_rule_count;
+    // the rule that ended the last run, -1 for none
+    int stopped_by;
+
+    // host side too, the cable and a transfer the other end clocks that
+    // ends at peer_when
+    link_port *link;
+    bool peer_transfer;
+    uint8_t peer_byte;
+    uint64_t peer_when;
+} serial_context;
+
+// power on state, registers the serial events. the output and stop rules
+// are kept
+void serial_init(gb_t *gb);
+// the child starts unplugged
+void serial_fork(gb_t *parent, gb_t *child);
+
+uint8_t serial_read(gb_t *gb, uint16_t address);
+void serial_write(gb_t *gb, uint16_t address, uint8_t value);
+
+// from the cable, the other end clocks a transfer of `value` ending at
+// `when` (again, if it restarted one), or stopped the one it was clocking
+void serial_peer_transfer(gb_t *gb, uint64_t when, uint8_t value);
+void serial_peer_cancel(gb_t *gb);
+// ends the other end's transfer right away rather than at its event, for
+// link_receive() when both ends clock one at once
+void serial_peer_finish(gb_t *gb);
+
+// false if there are already SERIAL_STOP_RULES or `text` is too long, NULL
+// clears them
+bool serial_stop_on(gb_t *gb, const char *text);
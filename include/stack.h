@@ -1,9 +1,10 @@
-#pragma once
-
-#include <stdint.h>
-
-void stack_push(uint8_t data);
-void stack_push16(uint16_t data);
-
-uint8_t stack_pop();
-uint16_t stack_pop16();
\ No newline at end of file
+#pragma once
+
+#include <common.h>
+#include <stdint.h>
+
+void stack_push(gb_t *gb, uint8_t data);
+void stack_push16(gb_t *gb, uint16_t data);
+
+uint8_t stack_pop(gb_t *gb);
+uint16_t stack_pop16(gb_t *gb);
\ No newline at end of file
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <common.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// **Timer**
+// DIV, TIMA, TMA and TAC (0xFF04 - 0xFF07). Nothing here ticks: DIV is the
+// top byte of a 16 bit counter that's just the clock minus the point it was
+// last reset, and TIMA is its value at the last write plus the falling
+// edges of the counter bit TAC picks since then, both worked out when
+// they're read. The only event is the next overflow, which is known as soon
+// as TIMA, TAC or DIV is written, so a running timer costs two events per
+// overflow (the overflow, and the reload from TMA 4 cycles later with the
+// interrupt) rather than anything per cycle.
+//
+// The falling edge counting also gets the glitches right: writing DIV or
+// changing TAC while the selected bit is set ticks TIMA once.
+
+typedef struct {
+    // the internal counter counts T-cycles from here, DIV is its top byte
+    uint64_t div_base;
+    // TIMA was `tima` at `tima_base`
+    uint64_t tima_base;
+    uint8_t tima;
+    uint8_t tma;
+    uint8_t tac;
+    // TIMA overflowed and reads 0 until the reload
+    bool reloading;
+} timer_context;
+
+// power on state, registers the timer event
+void timer_init(gb_t *gb);
+
+uint8_t timer_read(gb_t *gb, uint16_t address);
+void timer_write(gb_t *gb, uint16_t address, uint8_t value);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// **Instruction tracing**
+// Tracing is off unless a trace_writer is attached to the cpu. When it is on,
+// the cpu pushes one fixed size record per instruction into a lock-free
+// single producer/single consumer ring buffer, and a background thread drains
+// the ring into a binary trace file. gbtrace renders those files back into
+// the text format cpu_step used to print.
+
+#define TRACE_MAGIC "GBTR"
+#define TRACE_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size;
+} trace_file_header;
+
+// state at the start of an instruction, before it executes
+typedef struct {
+    uint64_t ticks;
+    uint16_t pc;
+    uint16_t sp;
+    uint8_t opcode;
+    uint8_t operands[2];
+    uint8_t a;
+    uint8_t f;
+    uint8_t b;
+    uint8_t c;
+    uint8_t d;
+    uint8_t e;
+    uint8_t h;
+    uint8_t l;
+} trace_record;
+
+typedef struct trace_writer trace_writer;
+
+trace_writer *trace_open(const char *path);
+void trace_push(trace_writer *writer, const trace_record *record);
+// flushes everything still in the ring and closes the file
+void trace_close(trace_writer *writer);
+
+// formats a record like the old per instruction printf (without the newline)
+int trace_format(const trace_record *record, char *buf, size_t size);
@@ -0,0 +1,825 @@
+#include <apu.h>
+#include <gb.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && !defined(GBEMU_NO_SIMD)
+#include <immintrin.h>
+#define APU_X86_SIMD
+#endif
+
+// register offsets from 0xFF10, channel n's five registers start at n * 5
+#define NR50 0x14
+#define NR51 0x15
+#define NR52 0x16
+#define WAVE_RAM 0x20
+
+#define NR52_POWER 0x80
+
+// bits that aren't there read as 1, everything past NR52 reads 0xFF
+static const uint8_t READ_MASK[WAVE_RAM] = {
+    0x80, 0x3F, 0x00, 0xFF, 0xBF,
+    0xFF, 0x3F, 0x00, 0xFF, 0xBF,
+    0x7F, 0xFF, 0x9F, 0xFF, 0xBF,
+    0xFF, 0xFF, 0x00, 0x00, 0xBF,
+    0x00, 0x00, 0x70,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+#define CLOCK_HZ 4194304
+
+// what the boot rom leaves, its sound has faded out but channel 1 is still on
+static const uint8_t POWER_ON[NR52 + 1] = {
+    0x80, 0xBF, 0xF3, 0xFF, 0xBF,
+    0xFF, 0x3F, 0x00, 0xFF, 0xBF,
+    0x7F, 0xFF, 0x9F, 0xFF, 0xBF,
+    0xFF, 0xFF, 0x00, 0x00, 0xBF,
+    0x77, 0xF3, 0xF1,
+};
+
+// the 8 steps of each duty cycle, 12.5%, 25%, 50% and 75%
+static const uint8_t DUTY[4] = { 0x01, 0x81, 0x87, 0x7E };
+
+// NR32's output level is a right shift: mute, 100%, 50%, 25%
+static const uint8_t WAVE_SHIFT[4] = { 4, 0, 1, 2 };
+
+// a channel's 0 - 15 output times this times the (1 - 8) master volume is
+// what goes into the mix, four channels at full volume come to 30720
+#define MIX_SCALE 64
+
+// **Band-limited synthesis**
+
+// taps in each step, and the number of positions between two samples the
+// step can be at
+#define SYNTH_TAPS 16
+#define SYNTH_PHASE_BITS 6
+#define SYNTH_PHASES (1 << SYNTH_PHASE_BITS)
+// each phase of the kernel adds up to this
+#define SYNTH_UNIT_BITS 15
+// stereo frames the buffer holds. catching up reads it out after every
+// frame sequencer step, which is at most 375 frames at APU_MAX_RATE
+#define SYNTH_BUFFER 1024
+// the high pass takes 1/2^this of the sum away each sample, about 15 Hz at
+// 48 kHz
+#define SYNTH_HIGH_PASS 9
+
+// adds a step of dl/dr, `kernel` holds each tap twice (left, right)
+typedef void (*add_step_fn)(int32_t *out, const int16_t *kernel, int dl, int dr);
+
+struct apu_synth {
+    // stereo, interleaved. sample 0 is the first one not read out yet
+    int32_t buffer[(SYNTH_BUFFER + SYNTH_TAPS) * 2];
+    int16_t kernel[SYNTH_PHASES][SYNTH_TAPS * 2];
+    add_step_fn add_step;
+
+    // output samples per T-cycle, 32.32 fixed point
+    uint64_t step;
+    // the clock at sample 0 of the output
+    uint64_t origin;
+    // samples read out since then
+    uint64_t read;
+    int64_t sum[2];
+    int16_t out[SYNTH_BUFFER * 2];
+};
+
+#ifdef APU_X86_SIMD
+
+// 16 x 16 bit multiplies, the low and high halves interleaved back into
+// 32 bit products, 8 at a time
+static void add_step_sse2(int32_t *out, const int16_t *kernel, int dl, int dr)
+{
+    __m128i d = _mm_setr_epi16(dl, dr, dl, dr, dl, dr, dl, dr);
+    for (int i = 0; i < SYNTH_TAPS * 2; i += 8)
+    {
+        __m128i k = _mm_loadu_si128((const __m128i *)(kernel + i));
+        __m128i lo = _mm_mullo_epi16(k, d);
+        __m128i hi = _mm_mulhi_epi16(k, d);
+        __m128i *o = (__m128i *)(out + i);
+        _mm_storeu_si128(o, _mm_add_epi32(_mm_loadu_si128(o), _mm_unpacklo_epi16(lo, hi)));
+        _mm_storeu_si128(o + 1, _mm_add_epi32(_mm_loadu_si128(o + 1), _mm_unpackhi_epi16(lo, hi)));
+    }
+}
+
+__attribute__((target("avx2")))
+static void add_step_avx2(int32_t *out, const int16_t *kernel, int dl, int dr)
+{
+    __m256i d = _mm256_setr_epi32(dl, dr, dl, dr, dl, dr, dl, dr);
+    for (int i = 0; i < SYNTH_TAPS * 2; i += 8)
+    {
+        __m256i k = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(kernel + i)));
+        __m256i *o = (__m256i *)(out + i);
+        _mm256_storeu_si256(o, _mm256_add_epi32(_mm256_loadu_si256(o), _mm256_mullo_epi32(k, d)));
+    }
+}
+
+#else
+
+static void add_step_scalar(int32_t *out, const int16_t *kernel, int dl, int dr)
+{
+    for (int i = 0; i < SYNTH_TAPS * 2; i += 2)
+    {
+        out[i] += kernel[i] * dl;
+        out[i + 1] += kernel[i + 1] * dr;
+    }
+}
+
+#endif
+
+static add_step_fn pick_add_step()
+{
+#ifdef APU_X86_SIMD
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return add_step_avx2;
+    }
+    return add_step_sse2;
+#else
+    return add_step_scalar;
+#endif
+}
+
+// a Blackman windowed sinc cut off a little under the output's Nyquist
+// frequency, for a step `phase / SYNTH_PHASES` of a sample past the
+// middle. each phase is rounded to add up to exactly SYNTH_UNIT so a step
+// comes out at exactly its height
+static void build_kernel(apu_synth *synth)
+{
+    const double cutoff = 0.9;
+    for (int phase = 0; phase < SYNTH_PHASES; phase++)
+    {
+        double taps[SYNTH_TAPS];
+        double total = 0;
+        for (int i = 0; i < SYNTH_TAPS; i++)
+        {
+            double x = i - (SYNTH_TAPS / 2 - 1) - (double)phase / SYNTH_PHASES;
+            double w = (x + SYNTH_TAPS / 2) / SYNTH_TAPS;
+            double window = 0.42 - 0.5 * cos(2 * M_PI * w) + 0.08 * cos(4 * M_PI * w);
+            double sinc = x == 0 ? 1 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+            taps[i] = sinc * window;
+            total += taps[i];
+        }
+
+        int sum = 0;
+        int peak = 0;
+        for (int i = 0; i < SYNTH_TAPS; i++)
+        {
+            int tap = (int)lround(taps[i] / total * (1 << SYNTH_UNIT_BITS));
+            synth->kernel[phase][i * 2] = tap;
+            sum += tap;
+            if (tap > synth->kernel[phase][peak * 2])
+            {
+                peak = i;
+            }
+        }
+        synth->kernel[phase][peak * 2] += (1 << SYNTH_UNIT_BITS) - sum;
+        for (int i = 0; i < SYNTH_TAPS; i++)
+        {
+            synth->kernel[phase][i * 2 + 1] = synth->kernel[phase][i * 2];
+        }
+    }
+}
+
+static void synth_reset(apu_context *apu)
+{
+    apu_synth *synth = apu->synth;
+    memset(synth->buffer, 0, sizeof(synth->buffer));
+    synth->step = ((uint64_t)apu->rate << 32) / CLOCK_HZ;
+    synth->origin = apu->state.time;
+    synth->read = 0;
+    synth->sum[0] = 0;
+    synth->sum[1] = 0;
+}
+
+static apu_synth *get_synth(gb_t *gb)
+{
+    apu_context *apu = &gb->apu;
+    if (!apu->synth)
+    {
+        apu->synth = malloc(sizeof(apu_synth));
+        if (!apu->synth)
+        {
+            // runs on without sound
+            apu->rate = 0;
+            return NULL;
+        }
+        build_kernel(apu->synth);
+        apu->synth->add_step = pick_add_step();
+        apu_invalidate(gb);
+    }
+    return apu->synth;
+}
+
+// where `when` falls in the samples not read out yet (32.32)
+static inline uint64_t sample_position(apu_synth *synth, uint64_t when)
+{
+    unsigned __int128 position = (unsigned __int128)(when - synth->origin) * synth->step;
+    return (uint64_t)(position - ((unsigned __int128)synth->read << 32));
+}
+
+static void synth_add(apu_synth *synth, uint64_t when, int dl, int dr)
+{
+    uint64_t position = sample_position(synth, when);
+    int index = position >> 32;
+    int phase = (position >> (32 - SYNTH_PHASE_BITS)) & (SYNTH_PHASES - 1);
+    synth->add_step(synth->buffer + index * 2, synth->kernel[phase], dl, dr);
+}
+
+// FNV-1a, over the samples as little endian bytes
+static uint64_t hash_samples(uint64_t hash, const int16_t *samples, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        uint16_t s = samples[i];
+        hash = (hash ^ (s & 0xFF)) * 0x100000001B3ull;
+        hash = (hash ^ (s >> 8)) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// every sample before `when` is done (nothing after it can add to them),
+// sums them into the output
+static void synth_read(apu_context *apu, uint64_t when)
+{
+    apu_synth *synth = apu->synth;
+    int count = sample_position(synth, when) >> 32;
+    if (count <= 0)
+    {
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        for (int side = 0; side < 2; side++)
+        {
+            synth->sum[side] += synth->buffer[i * 2 + side];
+            int64_t sample = synth->sum[side] >> SYNTH_UNIT_BITS;
+            synth->sum[side] -= synth->sum[side] >> SYNTH_HIGH_PASS;
+            synth->out[i * 2 + side] = sample > INT16_MAX ? INT16_MAX : sample < INT16_MIN ? INT16_MIN : sample;
+        }
+    }
+
+    // the tails of the last steps move down to the start
+    memmove(synth->buffer, synth->buffer + count * 2, SYNTH_TAPS * 2 * sizeof(int32_t));
+    memset(synth->buffer + SYNTH_TAPS * 2, 0, count * 2 * sizeof(int32_t));
+    synth->read += count;
+
+    apu->hash = hash_samples(apu->hash, synth->out, count * 2);
+    if (apu->sink)
+    {
+        audio_sink_push(apu->sink, synth->out, count);
+    }
+}
+
+// **Channels**
+
+static inline uint8_t *channel_regs(apu_state *s, int ch)
+{
+    return &s->regs[ch * 5];
+}
+
+static bool dac_on(apu_state *s, int ch)
+{
+    if (ch == 2)
+    {
+        return s->regs[0x0A] & 0x80;
+    }
+    // volume 0 and decreasing is off
+    return channel_regs(s, ch)[2] & 0xF8;
+}
+
+static uint16_t frequency(apu_state *s, int ch)
+{
+    uint8_t *r = channel_regs(s, ch);
+    return r[3] | (r[4] & 0x07) << 8;
+}
+
+// T-cycles per waveform step, 0 for a noise clock that never ticks
+static uint32_t period(apu_state *s, int ch)
+{
+    if (ch == 3)
+    {
+        uint8_t nr43 = s->regs[0x12];
+        int shift = nr43 >> 4;
+        int divisor = nr43 & 0x07;
+        return shift >= 14 ? 0 : (divisor ? divisor * 16 : 8) << shift;
+    }
+    return (2048 - frequency(s, ch)) * (ch == 2 ? 2 : 4);
+}
+
+static uint8_t level(apu_state *s, int ch)
+{
+    apu_channel *c = &s->channels[ch];
+    if (!c->enabled)
+    {
+        return 0;
+    }
+    switch (ch)
+    {
+        case 0:
+        case 1:
+            return (DUTY[channel_regs(s, ch)[1] >> 6] >> (7 - c->position) & 1) ? c->volume : 0;
+        case 2:
+            return c->sample >> WAVE_SHIFT[(s->regs[0x0C] >> 5) & 0x03];
+        default:
+            return (~c->lfsr & 1) ? c->volume : 0;
+    }
+}
+
+// what one level step of the channel adds to a side of the mix
+static int weight(apu_state *s, int ch, int side)
+{
+    uint8_t nr50 = s->regs[NR50];
+    uint8_t nr51 = s->regs[NR51];
+    if (side == 0)
+    {
+        return (nr51 >> (ch + 4) & 1) ? (((nr50 >> 4) & 0x07) + 1) * MIX_SCALE : 0;
+    }
+    return (nr51 >> ch & 1) ? ((nr50 & 0x07) + 1) * MIX_SCALE : 0;
+}
+
+// the channel's output at `when` is whatever its state says now
+static void update_output(gb_t *gb, int ch, uint64_t when)
+{
+    apu_state *s = &gb->apu.state;
+    apu_channel *c = &s->channels[ch];
+    int now = level(s, ch);
+    if (now == c->output)
+    {
+        return;
+    }
+    if (gb->apu.synth && gb->apu.rate)
+    {
+        int d = now - c->output;
+        synth_add(gb->apu.synth, when, d * weight(s, ch, 0), d * weight(s, ch, 1));
+    }
+    c->output = now;
+}
+
+static void update_outputs(gb_t *gb, uint64_t when)
+{
+    for (int ch = 0; ch < APU_CHANNELS; ch++)
+    {
+        update_output(gb, ch, when);
+    }
+}
+
+// takes every channel out of the mix (-1) or puts it back (1), around a
+// change to the panning or master volume
+static void mix_all(gb_t *gb, int sign)
+{
+    apu_state *s = &gb->apu.state;
+    if (!gb->apu.synth || !gb->apu.rate)
+    {
+        return;
+    }
+    for (int ch = 0; ch < APU_CHANNELS; ch++)
+    {
+        int v = sign * s->channels[ch].output;
+        if (v)
+        {
+            synth_add(gb->apu.synth, s->time, v * weight(s, ch, 0), v * weight(s, ch, 1));
+        }
+    }
+}
+
+static void waveform_step(apu_state *s, int ch)
+{
+    apu_channel *c = &s->channels[ch];
+    switch (ch)
+    {
+        case 0:
+        case 1:
+            c->position = (c->position + 1) & 7;
+            break;
+        case 2:
+            c->position = (c->position + 1) & 31;
+            c->sample = s->regs[WAVE_RAM + c->position / 2] >> ((c->position & 1) ? 0 : 4) & 0x0F;
+            break;
+        default:
+        {
+            uint16_t bit = (c->lfsr ^ (c->lfsr >> 1)) & 1;
+            c->lfsr = (c->lfsr >> 1) | (bit << 14);
+            if (s->regs[0x12] & 0x08)
+            {
+                // 7 bit mode
+                c->lfsr = (c->lfsr & ~0x40) | (bit << 6);
+            }
+            break;
+        }
+    }
+}
+
+// runs a channel's waveform from the state's time to `to`. with no synth
+// only the steps are counted, the noise LFSR doesn't move
+static void run_channel(gb_t *gb, int ch, uint64_t to, bool synth)
+{
+    apu_state *s = &gb->apu.state;
+    apu_channel *c = &s->channels[ch];
+    uint32_t p = period(s, ch);
+    if (!c->enabled || p == 0)
+    {
+        return;
+    }
+
+    uint64_t span = to - s->time;
+    if (span < c->timer)
+    {
+        c->timer -= span;
+        return;
+    }
+
+    if (!synth)
+    {
+        span -= c->timer;
+        uint64_t steps = 1 + span / p;
+        c->timer = p - span % p;
+        if (ch < 2)
+        {
+            c->position = (c->position + steps) & 7;
+        }
+        else if (ch == 2)
+        {
+            c->position = (c->position + steps - 1) & 31;
+            waveform_step(s, ch);
+        }
+        c->output = level(s, ch);
+        return;
+    }
+
+    uint64_t when = s->time + c->timer;
+    while (when <= to)
+    {
+        waveform_step(s, ch);
+        update_output(gb, ch, when);
+        c->timer = p;
+        when += p;
+    }
+    c->timer = when - to;
+}
+
+static uint16_t sweep_target(apu_state *s)
+{
+    apu_channel *c = &s->channels[0];
+    uint8_t nr10 = s->regs[0x00];
+    uint16_t delta = c->shadow_frequency >> (nr10 & 0x07);
+    return (nr10 & 0x08) ? c->shadow_frequency - delta : c->shadow_frequency + delta;
+}
+
+static void sweep(apu_state *s)
+{
+    apu_channel *c = &s->channels[0];
+    if (c->sweep_timer == 0 || --c->sweep_timer > 0)
+    {
+        return;
+    }
+
+    uint8_t nr10 = s->regs[0x00];
+    int pace = (nr10 >> 4) & 0x07;
+    c->sweep_timer = pace ? pace : 8;
+    if (!c->sweep_enabled || !pace)
+    {
+        return;
+    }
+
+    uint16_t target = sweep_target(s);
+    if (target > 2047)
+    {
+        c->enabled = false;
+        return;
+    }
+    if (nr10 & 0x07)
+    {
+        c->shadow_frequency = target;
+        s->regs[0x03] = target & 0xFF;
+        s->regs[0x04] = (s->regs[0x04] & ~0x07) | (target >> 8);
+        // and again with the new frequency, only to see if it overflows
+        if (sweep_target(s) > 2047)
+        {
+            c->enabled = false;
+        }
+    }
+}
+
+static void envelope(apu_state *s, int ch)
+{
+    apu_channel *c = &s->channels[ch];
+    uint8_t nrx2 = channel_regs(s, ch)[2];
+    int pace = nrx2 & 0x07;
+    if (!c->enabled || !pace || --c->envelope_timer > 0)
+    {
+        return;
+    }
+    c->envelope_timer = pace;
+    if ((nrx2 & 0x08) && c->volume < 15)
+    {
+        c->volume++;
+    }
+    else if (!(nrx2 & 0x08) && c->volume > 0)
+    {
+        c->volume--;
+    }
+}
+
+// length counters on even steps, the sweep on 2 and 6, envelopes on 7
+static void frame_sequencer(gb_t *gb, uint64_t when)
+{
+    apu_state *s = &gb->apu.state;
+    int step = s->frame_step;
+    s->frame_step = (step + 1) & 7;
+
+    if (!(step & 1))
+    {
+        for (int ch = 0; ch < APU_CHANNELS; ch++)
+        {
+            apu_channel *c = &s->channels[ch];
+            if (c->length_enabled && c->length > 0 && --c->length == 0)
+            {
+                c->enabled = false;
+            }
+        }
+    }
+    if (step == 2 || step == 6)
+    {
+        sweep(s);
+    }
+    if (step == 7)
+    {
+        envelope(s, 0);
+        envelope(s, 1);
+        envelope(s, 3);
+    }
+    update_outputs(gb, when);
+}
+
+static void trigger(gb_t *gb, int ch)
+{
+    apu_state *s = &gb->apu.state;
+    apu_channel *c = &s->channels[ch];
+    uint8_t *r = channel_regs(s, ch);
+
+    c->enabled = dac_on(s, ch);
+    if (c->length == 0)
+    {
+        c->length = ch == 2 ? 256 : 64;
+    }
+    c->timer = period(s, ch);
+    if (ch != 2)
+    {
+        c->volume = r[2] >> 4;
+        c->envelope_timer = (r[2] & 0x07) ? (r[2] & 0x07) : 8;
+    }
+    if (ch == 2)
+    {
+        c->position = 0;
+    }
+    if (ch == 3)
+    {
+        c->lfsr = 0x7FFF;
+    }
+    if (ch == 0)
+    {
+        int pace = (r[0] >> 4) & 0x07;
+        c->shadow_frequency = frequency(s, 0);
+        c->sweep_timer = pace ? pace : 8;
+        c->sweep_enabled = pace || (r[0] & 0x07);
+        if ((r[0] & 0x07) && sweep_target(s) > 2047)
+        {
+            c->enabled = false;
+        }
+    }
+}
+
+static void set_power(gb_t *gb, bool on)
+{
+    apu_state *s = &gb->apu.state;
+    if (on == s->power)
+    {
+        return;
+    }
+    if (!on)
+    {
+        // every register but wave RAM is cleared and stays 0 until power
+        // comes back
+        for (int ch = 0; ch < APU_CHANNELS; ch++)
+        {
+            s->channels[ch].enabled = false;
+        }
+        update_outputs(gb, s->time);
+        memset(s->regs, 0, NR52);
+        memset(s->channels, 0, sizeof(s->channels));
+    }
+    else
+    {
+        s->frame_step = 0;
+    }
+    s->power = on;
+}
+
+// **Catching up**
+
+void apu_catch_up(gb_t *gb)
+{
+    apu_context *apu = &gb->apu;
+    apu_state *s = &apu->state;
+    uint64_t now = gb->scheduler.now;
+    bool synth = apu->rate && get_synth(gb);
+
+    while (s->time < now)
+    {
+        uint64_t end = now < s->frame_next ? now : s->frame_next;
+        if (s->power)
+        {
+            for (int ch = 0; ch < APU_CHANNELS; ch++)
+            {
+                run_channel(gb, ch, end, synth);
+            }
+        }
+        s->time = end;
+
+        if (end == s->frame_next)
+        {
+            if (s->power)
+            {
+                frame_sequencer(gb, end);
+            }
+            s->frame_next += FRAME_SEQUENCER_CYCLES;
+        }
+        if (synth)
+        {
+            synth_read(apu, s->time);
+        }
+    }
+}
+
+void apu_div_write(gb_t *gb)
+{
+    apu_catch_up(gb);
+    apu_state *s = &gb->apu.state;
+
+    // resetting the counter with bit 12 set is a falling edge too
+    uint64_t counter = gb->scheduler.now - gb->timer.div_base;
+    if ((counter & (FRAME_SEQUENCER_CYCLES / 2)) && s->power)
+    {
+        frame_sequencer(gb, s->time);
+    }
+    s->frame_next = gb->scheduler.now + FRAME_SEQUENCER_CYCLES;
+}
+
+// **Registers**
+
+uint8_t apu_read(gb_t *gb, uint16_t address)
+{
+    apu_state *s = &gb->apu.state;
+    int reg = address - 0xFF10;
+    if (reg >= WAVE_RAM)
+    {
+        return s->regs[reg];
+    }
+    if (reg == NR52)
+    {
+        // the only register that changes on its own
+        apu_catch_up(gb);
+        uint8_t status = s->power ? NR52_POWER : 0;
+        for (int ch = 0; ch < APU_CHANNELS; ch++)
+        {
+            status |= s->channels[ch].enabled << ch;
+        }
+        return status | READ_MASK[reg];
+    }
+    return s->regs[reg] | READ_MASK[reg];
+}
+
+void apu_write(gb_t *gb, uint16_t address, uint8_t value)
+{
+    apu_catch_up(gb);
+    apu_state *s = &gb->apu.state;
+    int reg = address - 0xFF10;
+
+    if (reg >= WAVE_RAM)
+    {
+        s->regs[reg] = value;
+        return;
+    }
+    if (reg == NR52)
+    {
+        set_power(gb, value & NR52_POWER);
+        return;
+    }
+    if (!s->power || reg > NR52)
+    {
+        return;
+    }
+
+    if (reg == NR50 || reg == NR51)
+    {
+        mix_all(gb, -1);
+        s->regs[reg] = value;
+        mix_all(gb, 1);
+        return;
+    }
+
+    s->regs[reg] = value;
+    int ch = reg / 5;
+    apu_channel *c = &s->channels[ch];
+    switch (reg % 5)
+    {
+        case 0:
+            if (ch == 2 && !dac_on(s, ch))
+            {
+                c->enabled = false;
+            }
+            break;
+        case 1:
+            c->length = ch == 2 ? 256 - value : 64 - (value & 0x3F);
+            break;
+        case 2:
+            if (ch != 2 && !dac_on(s, ch))
+            {
+                c->enabled = false;
+            }
+            break;
+        case 4:
+            c->length_enabled = value & 0x40;
+            if (value & 0x80)
+            {
+                trigger(gb, ch);
+            }
+            break;
+    }
+    update_outputs(gb, s->time);
+}
+
+// **Setup**
+
+void apu_init(gb_t *gb)
+{
+    apu_context *apu = &gb->apu;
+    apu_state *s = &apu->state;
+    *s = (apu_state){0};
+    memcpy(s->regs, POWER_ON, sizeof(POWER_ON));
+    s->power = true;
+    s->channels[0].enabled = true;
+    s->channels[0].envelope_timer = 3;
+    s->channels[0].timer = period(s, 0);
+
+    // the next falling edge of the timer counter's bit 12
+    uint64_t now = gb->scheduler.now;
+    uint64_t counter = now - gb->timer.div_base;
+    s->time = now;
+    s->frame_next = now + FRAME_SEQUENCER_CYCLES - counter % FRAME_SEQUENCER_CYCLES;
+
+    apu_invalidate(gb);
+}
+
+void apu_release(gb_t *gb)
+{
+    free(gb->apu.synth);
+    gb->apu.synth = NULL;
+}
+
+void apu_fork(gb_t *parent, gb_t *child)
+{
+    // the sink belongs to the parent, the child makes its own samples
+    child->apu.synth = NULL;
+    child->apu.sink = NULL;
+}
+
+void apu_invalidate(gb_t *gb)
+{
+    apu_context *apu = &gb->apu;
+    if (apu->synth)
+    {
+        synth_reset(apu);
+    }
+    // the mix starts from silence, so does what the channels have put out
+    for (int ch = 0; ch < APU_CHANNELS; ch++)
+    {
+        apu->state.channels[ch].output = 0;
+    }
+    update_outputs(gb, apu->state.time);
+}
+
+void apu_set_rate(gb_t *gb, uint32_t rate)
+{
+    apu_context *apu = &gb->apu;
+    if (rate && rate < APU_MIN_RATE)
+    {
+        rate = APU_MIN_RATE;
+    }
+    if (rate > APU_MAX_RATE)
+    {
+        rate = APU_MAX_RATE;
+    }
+
+    apu_catch_up(gb);
+    apu->rate = rate;
+    apu->hash = 0xCBF29CE484222325ull;
+    apu_invalidate(gb);
+}
+
+void apu_set_sink(gb_t *gb, audio_sink *sink)
+{
+    apu_catch_up(gb);
+    gb->apu.sink = sink;
+}
@@ -0,0 +1,143 @@
+#include <audio.h>
+#include <ringwriter.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// stereo frames, must be a power of 2
+#define AUDIO_RING_SIZE (1 << 16)
+
+// how many frames the writer thread hands to fwrite at once
+#define AUDIO_BATCH 4096
+
+#define WAV_HEADER_SIZE 44
+
+struct audio_sink {
+    ring_writer *ring;
+    FILE *fp;
+    audio_format format;
+    uint32_t rate;
+    // frames written, by the writer thread
+    uint64_t written;
+};
+
+static void put16(uint8_t *out, uint16_t value)
+{
+    out[0] = value;
+    out[1] = value >> 8;
+}
+
+static void put32(uint8_t *out, uint32_t value)
+{
+    put16(out, value);
+    put16(out + 2, value >> 16);
+}
+
+// 16 bit stereo PCM, `frames` long
+static void wav_header(uint8_t *out, uint32_t rate, uint64_t frames)
+{
+    uint32_t data = frames * 4 > UINT32_MAX - WAV_HEADER_SIZE ? UINT32_MAX - WAV_HEADER_SIZE : frames * 4;
+    memcpy(out, "RIFF", 4);
+    put32(out + 4, data + WAV_HEADER_SIZE - 8);
+    memcpy(out + 8, "WAVEfmt ", 8);
+    put32(out + 16, 16);
+    put16(out + 20, 1);
+    put16(out + 22, 2);
+    put32(out + 24, rate);
+    put32(out + 28, rate * 4);
+    put16(out + 32, 4);
+    put16(out + 34, 16);
+    memcpy(out + 36, "data", 4);
+    put32(out + 40, data);
+}
+
+static void write_frames(void *context, const void *slots, size_t count)
+{
+    audio_sink *sink = context;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    const int16_t (*frames)[2] = slots;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint8_t bytes[4];
+        put16(bytes, frames[i][0]);
+        put16(bytes + 2, frames[i][1]);
+        fwrite(bytes, 1, 4, sink->fp);
+    }
+#else
+    fwrite(slots, 4, count, sink->fp);
+#endif
+    sink->written += count;
+}
+
+audio_sink *audio_sink_open(const char *path, audio_format format, uint32_t rate)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+    {
+        printf("Failed to open audio file: %s\n", path);
+        return NULL;
+    }
+
+    if (format == AUDIO_WAV)
+    {
+        // the sizes are filled in on close
+        uint8_t header[WAV_HEADER_SIZE];
+        wav_header(header, rate, 0);
+        fwrite(header, 1, sizeof(header), fp);
+    }
+
+    audio_sink *sink = calloc(1, sizeof(audio_sink));
+    if (!sink)
+    {
+        fclose(fp);
+        return NULL;
+    }
+    sink->fp = fp;
+    sink->format = format;
+    sink->rate = rate;
+
+    sink->ring = ring_writer_open(sizeof(int16_t) * 2, AUDIO_RING_SIZE, AUDIO_BATCH, write_frames, sink);
+    if (!sink->ring)
+    {
+        printf("Failed to start audio writer thread\n");
+        fclose(fp);
+        free(sink);
+        return NULL;
+    }
+    return sink;
+}
+
+uint32_t audio_sink_rate(const audio_sink *sink)
+{
+    return sink->rate;
+}
+
+void audio_sink_push(audio_sink *sink, const int16_t *frames, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        int16_t *slot = ring_writer_reserve(sink->ring);
+        slot[0] = frames[i * 2];
+        slot[1] = frames[i * 2 + 1];
+    }
+    ring_writer_publish(sink->ring);
+}
+
+void audio_sink_close(audio_sink *sink)
+{
+    if (!sink)
+    {
+        return;
+    }
+
+    ring_writer_close(sink->ring);
+
+    if (sink->format == AUDIO_WAV && fseek(sink->fp, 0, SEEK_SET) == 0)
+    {
+        uint8_t header[WAV_HEADER_SIZE];
+        wav_header(header, sink->rate, sink->written);
+        fwrite(header, 1, sizeof(header), sink->fp);
+    }
+    fclose(sink->fp);
+    free(sink);
+}
@@ -0,0 +1,312 @@
+#include <blockcache.h>
+#include <emu.h>
+#include <gb.h>
+#include <instructions.h>
+#include <jit.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct block_cache {
+    code_block slots[BLOCK_CACHE_SLOTS];
+    // times each page's blocks were decoded again after going stale
+    uint16_t recompiles[BUS_PAGE_COUNT];
+};
+
+#ifdef GBEMU_BLOCK_CACHE
+
+static block_cache *get_cache(gb_t *gb)
+{
+    if (!gb->blocks)
+    {
+        gb->blocks = calloc(1, sizeof(block_cache));
+    }
+    return gb->blocks;
+}
+
+// immediate operand bytes after the opcode
+static int operand_length(const instruction *inst)
+{
+    switch (inst->mode)
+    {
+        case AM_R_N8:
+        case AM_N8:
+        case AM_R_A8:
+        case AM_A8_R:
+        case AM_HL_SPR:
+        case AM_MR_N8:
+            return 1;
+        case AM_R_N16:
+        case AM_N16:
+        case AM_N16_R:
+        case AM_A16_R:
+        case AM_R_A16:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+// instructions that end a block: anything that can change PC other than
+// by falling through, or changes when interrupts can be taken
+static bool ends_block(instruction_type type)
+{
+    switch (type)
+    {
+        case IN_JP:
+        case IN_JR:
+        case IN_CALL:
+        case IN_RET:
+        case IN_RETI:
+        case IN_RST:
+        case IN_JPHL:
+        case IN_HALT:
+        case IN_STOP:
+        case IN_DI:
+        case IN_EI:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static code_block *slot_for(block_cache *cache, uint16_t pc, const uint8_t *source)
+{
+    // the source address tells banks apart, mix its upper bits in
+    uintptr_t key = (uintptr_t)source ^ ((uintptr_t)source >> 14);
+    uint32_t hash = (uint32_t)(pc ^ key * 0x9E3779B1u);
+    return &cache->slots[(hash ^ (hash >> 16)) & (BLOCK_CACHE_SLOTS - 1)];
+}
+
+// decodes from `source` (PC's page offset in host memory) up to the end of
+// the block or page, false if not even one instruction fits
+static bool decode_block(gb_t *gb, code_block *block, uint16_t pc, const uint8_t *source)
+{
+    int offset = pc & BUS_PAGE_MASK;
+    int count = 0;
+
+    while (count < BLOCK_MAX_OPS)
+    {
+        uint8_t opcode = source[0];
+        const instruction *inst = get_instruction_by_opcode(opcode);
+        int length = operand_length(inst);
+
+        // invalid opcodes and ones split across pages go to the interpreter
+        if (inst->type == IN_NONE || offset + 1 + length > BUS_PAGE_SIZE)
+        {
+            break;
+        }
+
+        block_op *op = &block->ops[count++];
+        op->opcode = opcode;
+        op->length = 1 + length;
+        op->imm = 0;
+        for (int i = 0; i < length; i++)
+        {
+            op->imm |= source[1 + i] << (i * 8);
+        }
+        op->proc = inst->type == IN_CB ? cpu_block_cb_handlers[op->imm & 0xFF] : cpu_block_handlers[opcode];
+
+        source += 1 + length;
+        offset += 1 + length;
+        if (ends_block(inst->type) || offset >= BUS_PAGE_SIZE)
+        {
+            break;
+        }
+    }
+
+    block->count = count;
+    return count > 0;
+}
+
+// the bytes the block was decoded from are still there: its page was only
+// mapped again (OAM DMA takes every page away while it runs) or written
+// somewhere else
+static bool same_code(const code_block *block, const uint8_t *source)
+{
+    for (int i = 0; i < block->count; i++)
+    {
+        const block_op *op = &block->ops[i];
+        if (source[0] != op->opcode)
+        {
+            return false;
+        }
+        for (int b = 1; b < op->length; b++)
+        {
+            if (source[b] != ((op->imm >> ((b - 1) * 8)) & 0xFF))
+            {
+                return false;
+            }
+        }
+        source += op->length;
+    }
+    return true;
+}
+
+static code_block *lookup(gb_t *gb)
+{
+    memorymap_context *bus = &gb->bus;
+    uint16_t pc = gb->cpu.regs.pc;
+    uint16_t page = pc >> BUS_PAGE_SHIFT;
+
+    // code in I/O, HRAM and anything else behind a handler isn't cached
+    uint8_t *memory = bus->read[page];
+    if (!memory)
+    {
+        return NULL;
+    }
+    const uint8_t *source = memory + (pc & BUS_PAGE_MASK);
+
+    block_cache *cache = get_cache(gb);
+    if (!cache)
+    {
+        return NULL;
+    }
+
+    code_block *block = slot_for(cache, pc, source);
+    bool writable = pc >= 0x8000;
+    if (block->source == source && block->pc == pc)
+    {
+        if (block->gen == bus->code_gen[page])
+        {
+            return block;
+        }
+        if (!writable)
+        {
+            // rom doesn't change, the page was just mapped again (a bank
+            // switch away and back)
+            block->gen = bus->code_gen[page];
+            return block;
+        }
+        if (same_code(block, source))
+        {
+            // nothing to decode (or compile) again, only the page has to be
+            // watched again
+            memorymap_protect_code(gb, pc);
+            block->gen = bus->code_gen[page];
+            return block;
+        }
+        cache->recompiles[page]++;
+    }
+
+    if (writable && cache->recompiles[page] >= BLOCK_MAX_RECOMPILES)
+    {
+        return NULL;
+    }
+
+    if (!decode_block(gb, block, pc, source))
+    {
+        block->source = NULL;
+        return NULL;
+    }
+    block->source = source;
+    block->pc = pc;
+    block->writable = writable;
+    block->runs = 0;
+    block->native = NULL;
+    block->chain = NULL;
+    if (writable)
+    {
+        memorymap_protect_code(gb, pc);
+    }
+    block->gen = bus->code_gen[page];
+    return block;
+}
+
+// stop where the interpreter would, as soon as an interrupt can be taken,
+// or if the block's page just changed under it (it wrote over its own code
+// or switched its own bank out)
+static inline bool must_stop(gb_t *gb, const code_block *block, uint64_t until)
+{
+    return gb->scheduler.now >= until || gb->stopped || gb->run_break || gb->cpu.interrupt_pending ||
+        gb->bus.code_gen[block->pc >> BUS_PAGE_SHIFT] != block->gen;
+}
+
+// runs the ops from `first` on
+static void run_ops(gb_t *gb, code_block *block, int first, uint64_t until)
+{
+    cpu_context *ctx = &gb->cpu;
+    for (int i = first; i < block->count; i++)
+    {
+        const block_op *op = &block->ops[i];
+
+        // the same steps as the interpreter, minus the reads
+        ctx->current_opcode = op->opcode;
+        ctx->regs.pc++;
+        emu_cycles(gb, 1);
+        op->proc(gb, op->imm);
+        gb->instructions++;
+
+        if (must_stop(gb, block, until))
+        {
+            return;
+        }
+    }
+}
+
+bool blockcache_run(gb_t *gb, uint64_t until)
+{
+    code_block *block = lookup(gb);
+    if (!block)
+    {
+        return false;
+    }
+
+    if (block->native)
+    {
+        // the native code stops short of anything it can't time exactly
+        // (an event coming due, the end of the run), the ops take it
+        // from there, in whichever block it got to
+        int done = jit_run(gb, &block, until);
+        if (done == block->count || (done > 0 && must_stop(gb, block, until)))
+        {
+            return true;
+        }
+        run_ops(gb, block, done, until);
+        return true;
+    }
+
+    run_ops(gb, block, 0, until);
+    if (++block->runs == JIT_HOT_RUNS)
+    {
+        jit_compile(gb, block);
+    }
+    return true;
+}
+
+#else
+
+bool blockcache_run(gb_t *gb, uint64_t until)
+{
+    return false;
+}
+
+#endif
+
+void blockcache_free(gb_t *gb)
+{
+    free(gb->blocks);
+    gb->blocks = NULL;
+}
+
+void blockcache_each(gb_t *gb, void (*fn)(code_block *block))
+{
+    if (!gb->blocks)
+    {
+        return;
+    }
+    for (int i = 0; i < BLOCK_CACHE_SLOTS; i++)
+    {
+        if (gb->blocks->slots[i].source)
+        {
+            fn(&gb->blocks->slots[i]);
+        }
+    }
+}
+
+void blockcache_clear(gb_t *gb)
+{
+    if (gb->blocks)
+    {
+        memset(gb->blocks, 0, sizeof(block_cache));
+    }
+}
@@ -1,367 +1,1181 @@
-#include <cartridge.h>
-#include <stdio.h>
-#include <stdlib.h>
-
-typedef struct 
-{
-    char file_name[1024];
-    uint32_t rom_size;
-    uint8_t *rom_data;
-    cartridge_header *header;
-
-} cartridge_context;
-
-static cartridge_context ctx;
-
-static const char *CARTRIDGE_TYPES[] = {
-    "ROM ONLY",
-    "MBC1",
-    "MBC1+RAM",
-    "MBC1+RAM+BATTERY",
-    "0x04 ???",
-    "MBC2",
-    "MBC2+BATTERY",
-    "0x07 ???",
-    "ROM+RAM",
-    "ROM+RAM+BATTERY",
-    "0x0A ???",
-    "MMM01",
-    "MMM01+RAM",
-    "MMM01+RAM+BATTERY",
-    "0x0E ???",
-    "MBC3+TIMER+BATTERY",
-    "MBC3+TIMER+RAM+BATTERY",
-    "MBC3",
-    "MBC3+RAM 2",
-    "MBC3+RAM+BATTERY",
-    "0x14 ???",
-    "0x15 ???",
-    "0x16 ???",
-    "0x17 ???",
-    "0x18 ???",
-    "MBC5",
-    "MBC5+RAM",
-    "MBC5+RAM+BATTERY",
-    "MBC5+RUMBLE",
-    "MBC5+RUMBLE+RAM",
-    "MBC5+RUMBLE+RAM+BATTERY",
-    "0x1F ???",
-    "MBC6",
-    "0x21 ???",
-    "MBC7+SENSOR+RUMBLE+RAM+BATTERY",
-    "POCKET CAMERA",
-    "BANDAI TAMA5",
-    "HuC3",
-    "HuC1+RAM+BATTERY"
-};
-
-static const char *OLD_LICENSEE_CODE[0x100] = {
-    [0x00] = "None",
-    [0x01] = "Nintendo",
-    [0x08] = "Capcom",
-    [0x09] = "HOT-B",
-    [0x0A] = "Jaleco",
-    [0x0B] = "Coconuts Japan",
-    [0x0C] = "Elite Systems",
-    [0x13] = "EA (Electronic Arts)",
-    [0x18] = "Hudson Soft",
-    [0x19] = "ITC Entertainment",
-    [0x1A] = "Yanoman",
-    [0x1D] = "Japan Clary",
-    [0x1F] = "Virgin Games Ltd.",
-    [0x24] = "PCM Complete",
-    [0x25] = "San-X",
-    [0x28] = "Kemco",
-    [0x29] = "SETA Corporation",
-    [0x30] = "Infogrames",
-    [0x31] = "Nintendo",
-    [0x32] = "Bandai",
-    [0x33] = "Indicates that the New licensee code should be used instead.",
-    [0x34] = "Konami",
-    [0x35] = "HectorSoft",
-    [0x38] = "Capcom",
-    [0x39] = "Banpresto",
-    [0x3C] = "Entertainment Interactive",
-    [0x3E] = "Gremlin",
-    [0x41] = "Ubi Soft",
-    [0x42] = "Atlus",
-    [0x44] = "Malibu Interactive",
-    [0x46] = "Angel",
-    [0x47] = "Spectrum HoloByte",
-    [0x49] = "Irem",
-    [0x4A] = "Virgin Games Ltd.",
-    [0x4D] = "Malibu Interactive",
-    [0x4F] = "U.S. Gold",
-    [0x50] = "Absolute",
-    [0x51] = "Acclaim Entertainment",
-    [0x52] = "Activision",
-    [0x53] = "Sammy USA Corporation",
-    [0x54] = "GameTek",
-    [0x55] = "Park Place",
-    [0x56] = "LJN",
-    [0x57] = "Matchbox",
-    [0x59] = "Milton Bradley Company",
-    [0x5A] = "Mindscape",
-    [0x5B] = "Romstar",
-    [0x5C] = "Naxat Soft",
-    [0x5D] = "Tradewest",
-    [0x60] = "Titus Interactive",
-    [0x61] = "Virgin Games Ltd.",
-    [0x67] = "Ocean Software",
-    [0x69] = "EA (Electronic Arts)",
-    [0x6E] = "Elite Systems",
-    [0x6F] = "Electro Brain",
-    [0x70] = "Infogrames",
-    [0x71] = "Interplay Entertainment",
-    [0x72] = "Broderbund",
-    [0x73] = "Sculptured Software",
-    [0x75] = "The Sales Curve Limited",
-    [0x78] = "THQ",
-    [0x79] = "Accolade15",
-    [0x7A] = "Triffix Entertainment",
-    [0x7C] = "MicroProse",
-    [0x7F] = "Kemco",
-    [0x80] = "Misawa Entertainment",
-    [0x83] = "LOZC G.",
-    [0x86] = "Tokuma Shoten",
-    [0x8B] = "Bullet-Proof Software",
-    [0x8C] = "Vic Tokai Corp.",
-    [0x8E] = "Ape Inc.",
-    [0x8F] = "I’Max",
-    [0x91] = "Chunsoft Co.",
-    [0x92] = "Video System",
-    [0x93] = "Tsubaraya Productions",
-    [0x95] = "Varie",
-    [0x96] = "Yonezawa19/S’Pal",
-    [0x97] = "Kemco",
-    [0x99] = "Arc",
-    [0x9A] = "Nihon Bussan",
-    [0x9B] = "Tecmo",
-    [0x9C] = "Imagineer",
-    [0x9D] = "Banpresto",
-    [0x9F] = "Nova",
-    [0xA1] = "Hori Electric",
-    [0xA2] = "Bandai",
-    [0xA4] = "Konami",
-    [0xA6] = "Kawada",
-    [0xA7] = "Takara",
-    [0xA9] = "Technos Japan",
-    [0xAA] = "Broderbund",
-    [0xAC] = "Toei Animation",
-    [0xAD] = "Toho",
-    [0xAF] = "Namco",
-    [0xB0] = "Acclaim Entertainment",
-    [0xB1] = "ASCII Corporation or Nexsoft",
-    [0xB2] = "Bandai",
-    [0xB4] = "Square Enix",
-    [0xB6] = "HAL Laboratory",
-    [0xB7] = "SNK",
-    [0xB9] = "Pony Canyon",
-    [0xBA] = "Culture Brain",
-    [0xBB] = "Sunsoft",
-    [0xBD] = "Sony Imagesoft",
-    [0xBF] = "Sammy Corporation",
-    [0xC0] = "Taito",
-    [0xC2] = "Kemco",
-    [0xC3] = "Square",
-    [0xC4] = "Tokuma Shoten",
-    [0xC5] = "Data East",
-    [0xC6] = "Tonkin House",
-    [0xC8] = "Koei",
-    [0xC9] = "UFL",
-    [0xCA] = "Ultra Games",
-    [0xCB] = "VAP, Inc.",
-    [0xCC] = "Use Corporation",
-    [0xCD] = "Meldac",
-    [0xCE] = "Pony Canyon",
-    [0xCF] = "Angel",
-    [0xD0] = "Taito",
-    [0xD1] = "SOFEL (Software Engineering Lab)",
-    [0xD2] = "Quest",
-    [0xD3] = "Sigma Enterprises",
-    [0xD4] = "ASK Kodansha Co.",
-    [0xD6] = "Naxat Soft",
-    [0xD7] = "Copya System",
-    [0xD9] = "Banpresto",
-    [0xDA] = "Tomy",
-    [0xDB] = "LJN",
-    [0xDD] = "Nippon Computer Systems",
-    [0xDE] = "Human Ent.",
-    [0xDF] = "Altron",
-    [0xE0] = "Jaleco",
-    [0xE1] = "Towa Chiki",
-    [0xE2] = "Yutaka # Needs more info",
-    [0xE3] = "Varie",
-    [0xE5] = "Epoch",
-    [0xE7] = "Athena",
-    [0xE8] = "Asmik Ace Entertainment",
-    [0xE9] = "Natsume",
-    [0xEA] = "King Records",
-    [0xEB] = "Atlus",
-    [0xEC] = "Epic/Sony Records",
-    [0xEE] = "IGS",
-    [0xF0] = "A Wave",
-    [0xF3] = "Extreme Entertainment",
-    [0xFF] = "LJN"
-};
-
-static const char *NEW_LICENSEE_CODE[0xA5] = {
-    [0x00] = "None",
-    [0x01] = "Nintendo Research & Development 1",
-    [0x08] = "Capcom",
-    [0x13] = "Electronic Arts",
-    [0x18] = "Hudson Soft",
-    [0x19] = "B-AI",
-    [0x20] = "KSS",
-    [0x22] = "Planning Office WADA",
-    [0x24] = "PCM Complete",
-    [0x25] = "San-X",
-    [0x28] = "Kemco",
-    [0x29] = "SETA Corporation",
-    [0x30] = "Viacom",
-    [0x31] = "Nintendo",
-    [0x32] = "Bandai",
-    [0x33] = "Ocean Software/Acclaim Entertainment",
-    [0x34] = "Konami",
-    [0x35] = "HectorSoft",
-    [0x37] = "Taito",
-    [0x38] = "Hudson Soft",
-    [0x39] = "Banpresto",
-    [0x41] = "Ubi Soft",
-    [0x42] = "Atlus",
-    [0x44] = "Malibu Interactive",
-    [0x46] = "Angel",
-    [0x47] = "Bullet-Proof Software",
-    [0x49] = "Irem",
-    [0x50] = "Absolute",
-    [0x51] = "Acclaim Entertainment",
-    [0x52] = "Activision",
-    [0x53] = "Sammy USA Corporation",
-    [0x54] = "Konami",
-    [0x55] = "Hi Tech Expressions",
-    [0x56] = "LJN",
-    [0x57] = "Matchbox",
-    [0x58] = "Mattel",
-    [0x59] = "Milton Bradley Company",
-    [0x60] = "Titus Interactive",
-    [0x61] = "Virgin Games Ltd",
-    [0x64] = "Lucasfilm Games",
-    [0x67] = "Ocean Software",
-    [0x69] = "Electronic Arts",
-    [0x70] = "Infogrames",
-    [0x71] = "Interplay Entertainment",
-    [0x72] = "Broderbund",
-    [0x73] = "Sculptured Software",
-    [0x75] = "The Sales Curve Limited",
-    [0x78] = "THQ",
-    [0x79] = "Accolade",
-    [0x80] = "Misawa Entertainment",
-    [0x83] = "lozc",
-    [0x86] = "Tokuma Shoten",
-    [0x87] = "Tsukuda Original",
-    [0x91] = "Chunsoft",
-    [0x92] = "Video System",
-    [0x93] = "Ocean Software/Acclaim Entertainment",
-    [0x95] = "Varie",
-    [0x96] = "Yonezawa/s’pal",
-    [0x97] = "Kaneko",
-    [0x99] = "Pack-In-Video",
-    //[0xA4] = "Konami (Yu-Gi-Oh!)"
-};
-
-uint8_t get_new_licensee_code_value()
-{
-    // use new licensee code and convert the 2 bytes of hex value into ascii 
-    // and put the values together to get the code
-    uint8_t hex_ascii_codes[2] = {ctx.header->new_licensee_code & 0xFF, ctx.header->new_licensee_code >> 8};
-
-    // since values are only 0 - 9 mod 16 is good enough to convert the char back into hex
-    uint8_t high = (char)hex_ascii_codes[0] % 16;
-    uint8_t low = (char)hex_ascii_codes[1] % 16; 
-
-    return (high * 16) + low;
-}
-
-const char *cartridge_licensee_name() 
-{   
-    if (ctx.header->old_licensee_code > 0xFF)
-    {
-        return "UNKNOWN";
-    }
-    if (ctx.header->old_licensee_code != 0x33)
-    {
-        return OLD_LICENSEE_CODE[ctx.header->old_licensee_code];
-    } 
-    return NEW_LICENSEE_CODE[get_new_licensee_code_value()];
-}
-
-const char *cartridge_type_name()
-{
-    if (ctx.header->cartridge_type <= 0xFF)
-    {
-        return CARTRIDGE_TYPES[ctx.header->cartridge_type];
-    }
-    return "UNKNOWN";
-}
-
-bool load_cartridge(char *cartridge)
-{
-    snprintf(ctx.file_name, sizeof(ctx.file_name), "%s", cartridge);
-
-    FILE *fp = fopen(cartridge, "r");
-
-    if (!fp) 
-    {
-        printf("Failed to open: %s\n", cartridge);
-        return false;
-    }
-    printf("Opened file name: %s\n", ctx.file_name);
-
-    fseek(fp, 0, SEEK_END);
-    ctx.rom_size = ftell(fp);
-
-    rewind(fp);
-
-    ctx.rom_data = malloc(ctx.rom_size);
-    fread(ctx.rom_data, ctx.rom_size, 1, fp);
-    fclose(fp);
-
-    // 0x100 is the start of the header information
-    ctx.header = (cartridge_header *)(ctx.rom_data + 0x100);
-    ctx.header->title[15] = 0;
-
-    uint8_t licensee_code = ctx.header->old_licensee_code == 0x33 ? get_new_licensee_code_value() : ctx.header->old_licensee_code;
-
-    printf("Cartridge Loaded:\n");
-    printf("\t Title         : %s\n", ctx.header->title);
-    printf("\t Type          : %2.2X (%s)\n", ctx.header->cartridge_type, cartridge_type_name());
-    printf("\t SGB Flag      : %2.2X\n", ctx.header->sgb_flag);
-    printf("\t ROM Size      : %d KB\n", 32 << ctx.header->rom_size);
-    printf("\t RAM Size      : %2.2X\n", ctx.header->ram_size);
-    printf("\t Licensee Code : %2.2X (%s)\n", licensee_code, cartridge_licensee_name());
-    printf("\t ROM Version   : %2.2X\n", ctx.header->mask_rom_version);
-
-    uint8_t checksum = 0;
-    for (uint16_t address = 0x0134; address <= 0x014C; address++) 
-    {
-        checksum = checksum - ctx.rom_data[address] - 1;
-    }
-
-    // If the byte at $014D does not match the lower 8 bits of checksum, 
-    // the boot ROM will lock up and the program in the cartridge won’t run.
-    // so why not (checksum & 0xFF) == (ctx.header->header_checksum & 0xFF) 
-    // instead of just getting the lower 8 bits of checksum?
-    printf("\t Checksum      : %2.2X (%s)\n", ctx.header->header_checksum, (checksum & 0xFF) ? "PASSED" : "FAILED");
-
-    return true;
-}
-
-uint8_t read_cartridge(uint16_t address)
-{
-    return ctx.rom_data[address];
-}
-
-void write_cartridge(uint16_t address, uint8_t value)
-{
-    return;
-}
\ No newline at end of file
+#include <cartridge.h>
+#include <gb.h>
+#include <romcache.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+struct cartridge_rom {
+    atomic_int refs;
+    uint32_t size;
+    uint8_t *data;
+    // data is a read only mapping of the file rather than a malloc'd copy
+    bool mapped;
+};
+
+static const char *CARTRIDGE_TYPES[] = {
+    "ROM ONLY",
+    "MBC1",
+    "MBC1+RAM",
+    "MBC1+RAM+BATTERY",
+    "0x04 ???",
+    "MBC2",
+    "MBC2+BATTERY",
+    "0x07 ???",
+    "ROM+RAM",
+    "ROM+RAM+BATTERY",
+    "0x0A ???",
+    "MMM01",
+    "MMM01+RAM",
+    "MMM01+RAM+BATTERY",
+    "0x0E ???",
+    "MBC3+TIMER+BATTERY",
+    "MBC3+TIMER+RAM+BATTERY",
+    "MBC3",
+    "MBC3+RAM 2",
+    "MBC3+RAM+BATTERY",
+    "0x14 ???",
+    "0x15 ???",
+    "0x16 ???",
+    "0x17 ???",
+    "0x18 ???",
+    "MBC5",
+    "MBC5+RAM",
+    "MBC5+RAM+BATTERY",
+    "MBC5+RUMBLE",
+    "MBC5+RUMBLE+RAM",
+    "MBC5+RUMBLE+RAM+BATTERY",
+    "0x1F ???",
+    "MBC6",
+    "0x21 ???",
+    "MBC7+SENSOR+RUMBLE+RAM+BATTERY",
+    "POCKET CAMERA",
+    "BANDAI TAMA5",
+    "HuC3",
+    "HuC1+RAM+BATTERY"
+};
+
+static const char *OLD_LICENSEE_CODE[0x100] = {
+    [0x00] = "None",
+    [0x01] = "Nintendo",
+    [0x08] = "Capcom",
+    [0x09] = "HOT-B",
+    [0x0A] = "Jaleco",
+    [0x0B] = "Coconuts Japan",
+    [0x0C] = "Elite Systems",
+    [0x13] = "EA (Electronic Arts)",
+    [0x18] = "Hudson Soft",
+    [0x19] = "ITC Entertainment",
+    [0x1A] = "Yanoman",
+    [0x1D] = "Japan Clary",
+    [0x1F] = "Virgin Games Ltd.",
+    [0x24] = "PCM Complete",
+    [0x25] = "San-X",
+    [0x28] = "Kemco",
+    [0x29] = "SETA Corporation",
+    [0x30] = "Infogrames",
+    [0x31] = "Nintendo",
+    [0x32] = "Bandai",
+    [0x33] = "Indicates that the New licensee code should be used instead.",
+    [0x34] = "Konami",
+    [0x35] = "HectorSoft",
+    [0x38] = "Capcom",
+    [0x39] = "Banpresto",
+    [0x3C] = "Entertainment Interactive",
+    [0x3E] = "Gremlin",
+    [0x41] = "Ubi Soft",
+    [0x42] = "Atlus",
+    [0x44] = "Malibu Interactive",
+    [0x46] = "Angel",
+    [0x47] = "Spectrum HoloByte",
+    [0x49] = "Irem",
+    [0x4A] = "Virgin Games Ltd.",
+    [0x4D] = "Malibu Interactive",
+    [0x4F] = "U.S. Gold",
+    [0x50] = "Absolute",
+    [0x51] = "Acclaim Entertainment",
+    [0x52] = "Activision",
+    [0x53] = "Sammy USA Corporation",
+    [0x54] = "GameTek",
+    [0x55] = "Park Place",
+    [0x56] = "LJN",
+    [0x57] = "Matchbox",
+    [0x59] = "Milton Bradley Company",
+    [0x5A] = "Mindscape",
+    [0x5B] = "Romstar",
+    [0x5C] = "Naxat Soft",
+    [0x5D] = "Tradewest",
+    [0x60] = "Titus Interactive",
+    [0x61] = "Virgin Games Ltd.",
+    [0x67] = "Ocean Software",
+    [0x69] = "EA (Electronic Arts)",
+    [0x6E] = "Elite Systems",
+    [0x6F] = "Electro Brain",
+    [0x70] = "Infogrames",
+    [0x71] = "Interplay Entertainment",
+    [0x72] = "Broderbund",
+    [0x73] = "Sculptured Software",
+    [0x75] = "The Sales Curve Limited",
+    [0x78] = "THQ",
+    [0x79] = "Accolade15",
+    [0x7A] = "Triffix Entertainment",
+    [0x7C] = "MicroProse",
+    [0x7F] = "Kemco",
+    [0x80] = "Misawa Entertainment",
+    [0x83] = "LOZC G.",
+    [0x86] = "Tokuma Shoten",
+    [0x8B] = "Bullet-Proof Software",
+    [0x8C] = "Vic Tokai Corp.",
+    [0x8E] = "Ape Inc.",
+    [0x8F] = "I’Max",
+    [0x91] = "Chunsoft Co.",
+    [0x92] = "Video System",
+    [0x93] = "Tsubaraya Productions",
+    [0x95] = "Varie",
+    [0x96] = "Yonezawa19/S’Pal",
+    [0x97] = "Kemco",
+    [0x99] = "Arc",
+    [0x9A] = "Nihon Bussan",
+    [0x9B] = "Tecmo",
+    [0x9C] = "Imagineer",
+    [0x9D] = "Banpresto",
+    [0x9F] = "Nova",
+    [0xA1] = "Hori Electric",
+    [0xA2] = "Bandai",
+    [0xA4] = "Konami",
+    [0xA6] = "Kawada",
+    [0xA7] = "Takara",
+    [0xA9] = "Technos Japan",
+    [0xAA] = "Broderbund",
+    [0xAC] = "Toei Animation",
+    [0xAD] = "Toho",
+    [0xAF] = "Namco",
+    [0xB0] = "Acclaim Entertainment",
+    [0xB1] = "ASCII Corporation or Nexsoft",
+    [0xB2] = "Bandai",
+    [0xB4] = "Square Enix",
+    [0xB6] = "HAL Laboratory",
+    [0xB7] = "SNK",
+    [0xB9] = "Pony Canyon",
+    [0xBA] = "Culture Brain",
+    [0xBB] = "Sunsoft",
+    [0xBD] = "Sony Imagesoft",
+    [0xBF] = "Sammy Corporation",
+    [0xC0] = "Taito",
+    [0xC2] = "Kemco",
+    [0xC3] = "Square",
+    [0xC4] = "Tokuma Shoten",
+    [0xC5] = "Data East",
+    [0xC6] = "Tonkin House",
+    [0xC8] = "Koei",
+    [0xC9] = "UFL",
+    [0xCA] = "Ultra Games",
+    [0xCB] = "VAP, Inc.",
+    [0xCC] = "Use Corporation",
+    [0xCD] = "Meldac",
+    [0xCE] = "Pony Canyon",
+    [0xCF] = "Angel",
+    [0xD0] = "Taito",
+    [0xD1] = "SOFEL (Software Engineering Lab)",
+    [0xD2] = "Quest",
+    [0xD3] = "Sigma Enterprises",
+    [0xD4] = "ASK Kodansha Co.",
+    [0xD6] = "Naxat Soft",
+    [0xD7] = "Copya System",
+    [0xD9] = "Banpresto",
+    [0xDA] = "Tomy",
+    [0xDB] = "LJN",
+    [0xDD] = "Nippon Computer Systems",
+    [0xDE] = "Human Ent.",
+    [0xDF] = "Altron",
+    [0xE0] = "Jaleco",
+    [0xE1] = "Towa Chiki",
+    [0xE2] = "Yutaka # Needs more info",
+    [0xE3] = "Varie",
+    [0xE5] = "Epoch",
+    [0xE7] = "Athena",
+    [0xE8] = "Asmik Ace Entertainment",
+    [0xE9] = "Natsume",
+    [0xEA] = "King Records",
+    [0xEB] = "Atlus",
+    [0xEC] = "Epic/Sony Records",
+    [0xEE] = "IGS",
+    [0xF0] = "A Wave",
+    [0xF3] = "Extreme Entertainment",
+    [0xFF] = "LJN"
+};
+
+static const char *NEW_LICENSEE_CODE[0xA5] = {
+    [0x00] = "None",
+    [0x01] = "Nintendo Research & Development 1",
+    [0x08] = "Capcom",
+    [0x13] = "Electronic Arts",
+    [0x18] = "Hudson Soft",
+    [0x19] = "B-AI",
+    [0x20] = "KSS",
+    [0x22] = "Planning Office WADA",
+    [0x24] = "PCM Complete",
+    [0x25] = "San-X",
+    [0x28] = "Kemco",
+    [0x29] = "SETA Corporation",
+    [0x30] = "Viacom",
+    [0x31] = "Nintendo",
+    [0x32] = "Bandai",
+    [0x33] = "Ocean Software/Acclaim Entertainment",
+    [0x34] = "Konami",
+    [0x35] = "HectorSoft",
+    [0x37] = "Taito",
+    [0x38] = "Hudson Soft",
+    [0x39] = "Banpresto",
+    [0x41] = "Ubi Soft",
+    [0x42] = "Atlus",
+    [0x44] = "Malibu Interactive",
+    [0x46] = "Angel",
+    [0x47] = "Bullet-Proof Software",
+    [0x49] = "Irem",
+    [0x50] = "Absolute",
+    [0x51] = "Acclaim Entertainment",
+    [0x52] = "Activision",
+    [0x53] = "Sammy USA Corporation",
+    [0x54] = "Konami",
+    [0x55] = "Hi Tech Expressions",
+    [0x56] = "LJN",
+    [0x57] = "Matchbox",
+    [0x58] = "Mattel",
+    [0x59] = "Milton Bradley Company",
+    [0x60] = "Titus Interactive",
+    [0x61] = "Virgin Games Ltd",
+    [0x64] = "Lucasfilm Games",
+    [0x67] = "Ocean Software",
+    [0x69] = "Electronic Arts",
+    [0x70] = "Infogrames",
+    [0x71] = "Interplay Entertainment",
+    [0x72] = "Broderbund",
+    [0x73] = "Sculptured Software",
+    [0x75] = "The Sales Curve Limited",
+    [0x78] = "THQ",
+    [0x79] = "Accolade",
+    [0x80] = "Misawa Entertainment",
+    [0x83] = "lozc",
+    [0x86] = "Tokuma Shoten",
+    [0x87] = "Tsukuda Original",
+    [0x91] = "Chunsoft",
+    [0x92] = "Video System",
+    [0x93] = "Ocean Software/Acclaim Entertainment",
+    [0x95] = "Varie",
+    [0x96] = "Yonezawa/s’pal",
+    [0x97] = "Kaneko",
+    [0x99] = "Pack-In-Video",
+    //[0xA4] = "Konami (Yu-Gi-Oh!)"
+};
+
+uint8_t get_new_licensee_code_value(cartridge_context *ctx)
+{
+    // use new licensee code and convert the 2 bytes of hex value into ascii 
+    // and put the values together to get the code
+    uint8_t hex_ascii_codes[2] = {ctx->header.new_licensee_code & 0xFF, ctx->header.new_licensee_code >> 8};
+
+    // since values are only 0 - 9 mod 16 is good enough to convert the char back into hex
+    uint8_t high = (char)hex_ascii_codes[0] % 16;
+    uint8_t low = (char)hex_ascii_codes[1] % 16; 
+
+    return (high * 16) + low;
+}
+
+const char *cartridge_licensee_name(cartridge_context *ctx) 
+{   
+    const char *name = NULL;
+    if (ctx->header.old_licensee_code != 0x33)
+    {
+        name = OLD_LICENSEE_CODE[ctx->header.old_licensee_code];
+    }
+    else
+    {
+        // junk in the header can make any byte, the table stops at 0xA4
+        uint8_t code = get_new_licensee_code_value(ctx);
+        if (code < sizeof(NEW_LICENSEE_CODE) / sizeof(NEW_LICENSEE_CODE[0]))
+        {
+            name = NEW_LICENSEE_CODE[code];
+        }
+    }
+    return name ? name : "UNKNOWN";
+}
+
+const char *cartridge_type_name(cartridge_context *ctx)
+{
+    if (ctx->header.cartridge_type < sizeof(CARTRIDGE_TYPES) / sizeof(CARTRIDGE_TYPES[0]))
+    {
+        return CARTRIDGE_TYPES[ctx->header.cartridge_type];
+    }
+    return "UNKNOWN";
+}
+
+// drops a reference, the last one unmaps (or frees) the data
+static void release_rom(cartridge_rom *rom)
+{
+    if (!rom || atomic_fetch_sub_explicit(&rom->refs, 1, memory_order_acq_rel) != 1)
+    {
+        return;
+    }
+
+    if (rom->mapped)
+    {
+        munmap(rom->data, rom->size);
+    }
+    else
+    {
+        free(rom->data);
+    }
+    free(rom);
+}
+
+// maps the rom file read only so every emulator running the same rom shares
+// the page cache copy, falls back to reading it for things mmap can't handle
+static cartridge_rom *map_rom_file(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("Failed to open: %s\n", path);
+        return NULL;
+    }
+
+    struct stat st;
+    cartridge_rom *rom = NULL;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 || st.st_size > 0x800000 || !(rom = calloc(1, sizeof(cartridge_rom))))
+    {
+        printf("Invalid ROM file: %s\n", path);
+        close(fd);
+        return NULL;
+    }
+    atomic_init(&rom->refs, 1);
+    rom->size = st.st_size;
+
+    void *data = mmap(NULL, rom->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED)
+    {
+        rom->data = data;
+        rom->mapped = true;
+        close(fd);
+        return rom;
+    }
+
+    rom->data = malloc(rom->size);
+    uint32_t total = 0;
+    while (rom->data && total < rom->size)
+    {
+        ssize_t n = read(fd, rom->data + total, rom->size - total);
+        if (n <= 0)
+        {
+            break;
+        }
+        total += n;
+    }
+    close(fd);
+
+    if (!rom->data || total != rom->size)
+    {
+        printf("Failed to read: %s\n", path);
+        release_rom(rom);
+        return NULL;
+    }
+    return rom;
+}
+
+// works out everything we report about the rom, this touches every byte
+// for the global checksum so it's the part the rom cache lets us skip
+static void validate_cartridge(cartridge_context *ctx)
+{
+    cartridge_info *info = &ctx->info;
+
+    memcpy(info->title, ctx->header.title, sizeof(ctx->header.title));
+    info->title[sizeof(ctx->header.title)] = 0;
+    info->cartridge_type = ctx->header.cartridge_type;
+    info->rom_size = ctx->header.rom_size;
+    info->ram_size = ctx->header.ram_size;
+    info->sgb_flag = ctx->header.sgb_flag;
+    info->licensee_code = ctx->header.old_licensee_code == 0x33 ? get_new_licensee_code_value(ctx) : ctx->header.old_licensee_code;
+    info->mask_rom_version = ctx->header.mask_rom_version;
+    info->header_checksum = ctx->header.header_checksum;
+    info->global_checksum = (ctx->rom_data[0x14E] << 8) | ctx->rom_data[0x14F];
+    info->file_size = ctx->rom_size;
+
+    uint8_t checksum = 0;
+    for (uint16_t address = 0x0134; address <= 0x014C; address++) 
+    {
+        checksum = checksum - ctx->rom_data[address] - 1;
+    }
+    // If the byte at $014D does not match the lower 8 bits of checksum, 
+    // the boot ROM will lock up and the program in the cartridge won’t run.
+    info->header_checksum_ok = checksum == ctx->header.header_checksum;
+
+    // the global checksum is every byte except the checksum itself, real
+    // hardware never checks it
+    uint16_t global = 0;
+    for (uint32_t address = 0; address < ctx->rom_size; address++)
+    {
+        if (address != 0x14E && address != 0x14F)
+        {
+            global += ctx->rom_data[address];
+        }
+    }
+    info->global_checksum_ok = global == info->global_checksum;
+}
+
+// **Mapper setup**
+
+// header ram size codes
+static const uint32_t RAM_SIZES[] = { 0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000 };
+
+// the supported types with a battery
+static bool has_battery(uint8_t type)
+{
+    switch (type)
+    {
+        case 0x03: case 0x06: case 0x09: case 0x0F: case 0x10: case 0x13: case 0x1B: case 0x1E:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put32(uint8_t *p, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        p[i] = value >> (i * 8);
+    }
+}
+
+// the clock footer is the live registers then the latched ones, 4 bytes
+// each, then the time it was written
+static void load_rtc_footer(cartridge_context *ctx)
+{
+    const uint8_t *footer = ctx->save_data + ctx->ram_size;
+    rtc_registers *sets[2] = { &ctx->mbc.rtc, &ctx->mbc.latched };
+    for (int i = 0; i < 2; i++)
+    {
+        sets[i]->seconds = get32(footer + 0) & 0x3F;
+        sets[i]->minutes = get32(footer + 4) & 0x3F;
+        sets[i]->hours = get32(footer + 8) & 0x1F;
+        sets[i]->days_low = get32(footer + 12);
+        sets[i]->days_high = get32(footer + 16) & 0xC1;
+        footer += 20;
+    }
+}
+
+// maps the .sav next to the rom, creating it if it isn't there. on failure
+// the ram just stays in memory
+static bool map_save_file(gb_t *gb)
+{
+    cartridge_context *ctx = &gb->cart;
+    char path[sizeof(ctx->file_name) + 8];
+    snprintf(path, sizeof(path), "%s", ctx->file_name);
+    char *dot = strrchr(path, '.');
+    char *slash = strrchr(path, '/');
+    size_t length = dot && (!slash || dot > slash) ? (size_t)(dot - path) : strlen(path);
+    snprintf(path + length, sizeof(path) - length, ".sav");
+
+    size_t size = ctx->ram_size + (ctx->has_rtc ? RTC_FOOTER_SIZE : 0);
+    struct stat st;
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || fstat(fd, &st) != 0 || (st.st_size < (off_t)size && ftruncate(fd, size) != 0))
+    {
+        printf("Failed to open save file %s, the game can't save\n", path);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return false;
+    }
+
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        printf("Failed to map save file %s, the game can't save\n", path);
+        return false;
+    }
+    ctx->save_data = data;
+    ctx->save_size = size;
+
+    // some emulators leave the timestamp at 4 bytes, the registers are all
+    // that's read back
+    if (ctx->has_rtc && st.st_size >= (off_t)(ctx->ram_size + 40))
+    {
+        load_rtc_footer(ctx);
+    }
+    if (gb->log)
+    {
+        printf("Save file: %s\n", path);
+    }
+    return true;
+}
+
+// works out the mapper from the cartridge type and allocates its ram, false
+// if the ram couldn't be allocated
+static bool setup_mapper(gb_t *gb, save_mode mode)
+{
+    cartridge_context *ctx = &gb->cart;
+    uint8_t type = ctx->header.cartridge_type;
+
+    switch (type)
+    {
+        case 0x01: case 0x02: case 0x03:
+            ctx->mbc_type = MBC_1;
+            break;
+        case 0x05: case 0x06:
+            ctx->mbc_type = MBC_2;
+            break;
+        case 0x0F: case 0x10:
+            ctx->has_rtc = true;
+            ctx->mbc_type = MBC_3;
+            break;
+        case 0x11: case 0x12: case 0x13:
+            ctx->mbc_type = MBC_3;
+            break;
+        case 0x19: case 0x1A: case 0x1B: case 0x1C: case 0x1D: case 0x1E:
+            ctx->mbc_type = MBC_5;
+            break;
+        default:
+            // MMM01, MBC6/7, HuC and the rest run as if they were plain rom
+            if (type != 0x00 && type != 0x08 && type != 0x09 && gb->log)
+            {
+                printf("Mapper %2.2X (%s) isn't emulated, running as ROM ONLY\n", type, cartridge_type_name(ctx));
+            }
+            ctx->mbc_type = MBC_NONE;
+            break;
+    }
+
+    uint32_t banks = 2;
+    while (banks * 0x4000 < ctx->rom_size)
+    {
+        banks *= 2;
+    }
+    ctx->rom_bank_mask = banks - 1;
+
+    if (ctx->mbc_type == MBC_2)
+    {
+        ctx->ram_size = MBC2_RAM_SIZE;
+    }
+    else if (ctx->header.ram_size < sizeof(RAM_SIZES) / sizeof(RAM_SIZES[0]))
+    {
+        ctx->ram_size = RAM_SIZES[ctx->header.ram_size];
+    }
+
+    ctx->has_battery = has_battery(type);
+    if (ctx->has_battery && ctx->ram_size && mode == SAVE_FILE)
+    {
+        map_save_file(gb);
+    }
+
+    for (uint32_t i = 0; i < ctx->ram_size / RAM_PAGE_SIZE; i++)
+    {
+        ctx->ram[i] = ctx->save_data ? ram_page_wrap(ctx->save_data + i * RAM_PAGE_SIZE) : ram_page_new();
+        if (!ctx->ram[i])
+        {
+            printf("Failed to allocate cartridge RAM\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool load_cartridge(gb_t *gb, const char *cartridge, save_mode mode)
+{
+    cartridge_context *ctx = &gb->cart;
+    unload_cartridge(gb);
+    snprintf(ctx->file_name, sizeof(ctx->file_name), "%s", cartridge);
+
+    ctx->rom = map_rom_file(cartridge);
+    if (!ctx->rom)
+    {
+        return false;
+    }
+    ctx->rom_data = ctx->rom->data;
+    ctx->rom_size = ctx->rom->size;
+
+    if (ctx->rom_size < 0x150)
+    {
+        printf("ROM file too small to have a header: %s\n", cartridge);
+        unload_cartridge(gb);
+        return false;
+    }
+
+    // 0x100 is the start of the header information
+    memcpy(&ctx->header, ctx->rom_data + 0x100, sizeof(ctx->header));
+    ctx->header.title[15] = 0;
+
+    if (!setup_mapper(gb, mode))
+    {
+        unload_cartridge(gb);
+        return false;
+    }
+
+    uint16_t global_checksum = (ctx->rom_data[0x14E] << 8) | ctx->rom_data[0x14F];
+    if (romcache_lookup(global_checksum, ctx->rom_size, ctx->header.header_checksum, &ctx->info) &&
+        strncmp(ctx->info.title, ctx->header.title, sizeof(ctx->header.title)) == 0)
+    {
+        if (gb->log)
+        {
+            printf("Cartridge Loaded: %s (%s, cached)\n", ctx->info.title, cartridge_type_name(ctx));
+        }
+        return true;
+    }
+
+    validate_cartridge(ctx);
+    romcache_store(&ctx->info);
+
+    if (!gb->log)
+    {
+        return true;
+    }
+
+    printf("Opened file name: %s\n", ctx->file_name);
+    printf("Cartridge Loaded:\n");
+    printf("\t Title         : %s\n", ctx->info.title);
+    printf("\t Type          : %2.2X (%s)\n", ctx->info.cartridge_type, cartridge_type_name(ctx));
+    printf("\t SGB Flag      : %2.2X\n", ctx->info.sgb_flag);
+    printf("\t ROM Size      : %d KB\n", 32 << ctx->info.rom_size);
+    printf("\t RAM Size      : %2.2X\n", ctx->info.ram_size);
+    printf("\t Licensee Code : %2.2X (%s)\n", ctx->info.licensee_code, cartridge_licensee_name(ctx));
+    printf("\t ROM Version   : %2.2X\n", ctx->info.mask_rom_version);
+    printf("\t Checksum      : %2.2X (%s)\n", ctx->info.header_checksum, ctx->info.header_checksum_ok ? "PASSED" : "FAILED");
+    printf("\t Global Check  : %4.4X (%s)\n", ctx->info.global_checksum, ctx->info.global_checksum_ok ? "PASSED" : "FAILED");
+    return true;
+}
+
+void unload_cartridge(gb_t *gb)
+{
+    cartridge_context *ctx = &gb->cart;
+    if (ctx->save_data && !cartridge_sync_save(gb))
+    {
+        printf("Failed to write save file for %s\n", ctx->file_name);
+    }
+
+    release_rom(ctx->rom);
+    ctx->rom = NULL;
+    ctx->rom_data = NULL;
+    ctx->rom_size = 0;
+
+    for (int i = 0; i < CART_RAM_PAGES; i++)
+    {
+        ram_page_release(ctx->ram[i]);
+        ctx->ram[i] = NULL;
+    }
+    if (ctx->save_data)
+    {
+        munmap(ctx->save_data, ctx->save_size);
+    }
+    ctx->save_data = NULL;
+    ctx->save_size = 0;
+    ctx->ram_size = 0;
+    ctx->mbc_type = MBC_NONE;
+    ctx->has_rtc = false;
+    ctx->has_battery = false;
+    memset(&ctx->mbc, 0, sizeof(ctx->mbc));
+}
+
+bool cartridge_fork(gb_t *parent, gb_t *child)
+{
+    cartridge_context *ctx = &child->cart;
+    if (ctx->rom)
+    {
+        atomic_fetch_add_explicit(&ctx->rom->refs, 1, memory_order_relaxed);
+    }
+
+    // the save file stays the parent's, its pages are copied
+    ctx->save_data = NULL;
+    ctx->save_size = 0;
+    bool ok = true;
+    for (int i = 0; i < CART_RAM_PAGES; i++)
+    {
+        if (ctx->ram[i])
+        {
+            ctx->ram[i] = ok ? ram_page_fork(ctx->ram[i]) : NULL;
+            ok = ctx->ram[i] != NULL;
+        }
+    }
+    return ok;
+}
+
+const cartridge_info *cartridge_get_info(gb_t *gb)
+{
+    return &gb->cart.info;
+}
+
+uint8_t *cartridge_rom_data(gb_t *gb)
+{
+    return gb->cart.rom_data;
+}
+
+uint32_t cartridge_rom_size(gb_t *gb)
+{
+    return gb->cart.rom_size;
+}
+
+// **Bank mapping**
+
+static void map_rom_window(gb_t *gb, uint16_t address, uint32_t offset)
+{
+    cartridge_context *ctx = &gb->cart;
+    uint32_t available = offset < ctx->rom_size ? ctx->rom_size - offset : 0;
+    uint16_t pages = (available < 0x4000 ? available : 0x4000) >> BUS_PAGE_SHIFT;
+    memorymap_map(gb, address, pages, ctx->rom_data + (pages ? offset : 0), NULL);
+
+    // past the end of the file reads open bus through the handler
+    memorymap_map(gb, address + pages * BUS_PAGE_SIZE, (0x4000 >> BUS_PAGE_SHIFT) - pages, NULL, NULL);
+}
+
+static void map_ram_window(gb_t *gb)
+{
+    cartridge_context *ctx = &gb->cart;
+    for (int i = 0; i < CART_RAM_BANK / RAM_PAGE_SIZE; i++)
+    {
+        uint16_t address = 0xA000 + i * RAM_PAGE_SIZE;
+        if (ctx->mbc.ram_offset < 0)
+        {
+            memorymap_map(gb, address, 1, NULL, NULL);
+            continue;
+        }
+
+        // ram smaller than the window repeats through it
+        uint32_t offset = (ctx->mbc.ram_offset + i * RAM_PAGE_SIZE) % ctx->ram_size;
+        ram_page *page = ctx->ram[offset / RAM_PAGE_SIZE];
+        uint8_t *data = ram_page_data(page);
+        memorymap_map(gb, address, 1, data, ram_page_is_shared(page) ? NULL : data);
+    }
+}
+
+void cartridge_map(gb_t *gb)
+{
+    map_rom_window(gb, 0x0000, gb->cart.mbc.rom_offset[0]);
+    map_rom_window(gb, 0x4000, gb->cart.mbc.rom_offset[1]);
+    map_ram_window(gb);
+}
+
+// works out the windows from the registers and remaps the ones that moved
+static void update_banks(gb_t *gb)
+{
+    cartridge_context *ctx = &gb->cart;
+    mbc_state *mbc = &ctx->mbc;
+    uint32_t rom0 = 0;
+    uint32_t rom1 = mbc->rom_bank;
+    uint32_t ram_bank = 0;
+    bool ram = mbc->ram_enabled && ctx->ram_size;
+
+    switch (ctx->mbc_type)
+    {
+        case MBC_NONE:
+            rom1 = 1;
+            ram = ctx->ram_size != 0;
+            break;
+        case MBC_1:
+            // the 2 bit register is the top of the rom bank, in mode 1 it
+            // also picks bank 0's bank and the ram bank
+            rom1 |= mbc->ram_bank << 5;
+            if (mbc->mode)
+            {
+                rom0 = mbc->ram_bank << 5;
+                ram_bank = mbc->ram_bank;
+            }
+            break;
+        case MBC_2:
+            // its ram is half bytes, always through the handler
+            ram = false;
+            break;
+        case MBC_3:
+            // 0x08 - 0x0C select the clock registers instead
+            ram = ram && mbc->ram_bank <= 0x03;
+            ram_bank = mbc->ram_bank;
+            break;
+        case MBC_5:
+            ram_bank = mbc->ram_bank;
+            break;
+    }
+
+    uint32_t rom_offset[2] = {
+        (rom0 & ctx->rom_bank_mask) * 0x4000,
+        (rom1 & ctx->rom_bank_mask) * 0x4000
+    };
+    int32_t ram_offset = ram ? (ram_bank * CART_RAM_BANK) % ctx->ram_size : -1;
+
+    if (rom_offset[0] != mbc->rom_offset[0])
+    {
+        mbc->rom_offset[0] = rom_offset[0];
+        map_rom_window(gb, 0x0000, rom_offset[0]);
+    }
+    if (rom_offset[1] != mbc->rom_offset[1])
+    {
+        mbc->rom_offset[1] = rom_offset[1];
+        map_rom_window(gb, 0x4000, rom_offset[1]);
+    }
+    if (ram_offset != mbc->ram_offset)
+    {
+        mbc->ram_offset = ram_offset;
+        map_ram_window(gb);
+    }
+}
+
+void cartridge_reset(gb_t *gb)
+{
+    mbc_state *mbc = &gb->cart.mbc;
+
+    // the clock has its own battery, it keeps its time through a reset
+    rtc_registers rtc = mbc->rtc;
+    rtc_registers latched = mbc->latched;
+    memset(mbc, 0, sizeof(mbc_state));
+    mbc->rtc = rtc;
+    mbc->latched = latched;
+    mbc->latch_write = 0xFF;
+    mbc->rtc_updated = gb->scheduler.now;
+
+    mbc->rom_bank = 1;
+    mbc->rom_offset[1] = 0x4000;
+    mbc->ram_offset = -1;
+    update_banks(gb);
+}
+
+// **MBC3 clock**
+
+// brings the clock up to the current cycle
+static void rtc_catch_up(gb_t *gb)
+{
+    mbc_state *mbc = &gb->cart.mbc;
+    rtc_registers *rtc = &mbc->rtc;
+    uint64_t now = gb->scheduler.now;
+
+    if ((rtc->days_high & 0x40) || now < mbc->rtc_updated)
+    {
+        // halted, or the cycle count was reset under it
+        mbc->rtc_updated = now;
+        return;
+    }
+
+    uint64_t elapsed = (now - mbc->rtc_updated) / RTC_CYCLES;
+    if (elapsed == 0)
+    {
+        return;
+    }
+    // the part of a second left over carries on to the next catch up
+    mbc->rtc_updated += elapsed * RTC_CYCLES;
+
+    uint64_t seconds = rtc->seconds + elapsed;
+    uint64_t minutes = rtc->minutes + seconds / 60;
+    uint64_t hours = rtc->hours + minutes / 60;
+    uint64_t days = ((rtc->days_high & 0x01) << 8 | rtc->days_low) + hours / 24;
+    rtc->seconds = seconds % 60;
+    rtc->minutes = minutes % 60;
+    rtc->hours = hours % 24;
+    if (days > 0x1FF)
+    {
+        rtc->days_high |= 0x80;
+    }
+    rtc->days_low = days & 0xFF;
+    rtc->days_high = (rtc->days_high & 0xFE) | ((days >> 8) & 0x01);
+}
+
+static uint8_t rtc_read(gb_t *gb)
+{
+    const rtc_registers *rtc = &gb->cart.mbc.latched;
+    switch (gb->cart.mbc.ram_bank)
+    {
+        case 0x08: return rtc->seconds;
+        case 0x09: return rtc->minutes;
+        case 0x0A: return rtc->hours;
+        case 0x0B: return rtc->days_low;
+        case 0x0C: return rtc->days_high;
+        default: return 0xFF;
+    }
+}
+
+static void rtc_write(gb_t *gb, uint8_t value)
+{
+    mbc_state *mbc = &gb->cart.mbc;
+    rtc_registers *rtc = &mbc->rtc;
+    rtc_catch_up(gb);
+    switch (mbc->ram_bank)
+    {
+        case 0x08:
+            rtc->seconds = value & 0x3F;
+            // writing the seconds starts the second over
+            mbc->rtc_updated = gb->scheduler.now;
+            break;
+        case 0x09:
+            rtc->minutes = value & 0x3F;
+            break;
+        case 0x0A:
+            rtc->hours = value & 0x1F;
+            break;
+        case 0x0B:
+            rtc->days_low = value;
+            break;
+        case 0x0C:
+            rtc->days_high = value & 0xC1;
+            break;
+    }
+}
+
+// **Save file**
+
+bool cartridge_sync_save(gb_t *gb)
+{
+    cartridge_context *ctx = &gb->cart;
+    if (!ctx->save_data)
+    {
+        return true;
+    }
+
+    if (ctx->has_rtc)
+    {
+        rtc_catch_up(gb);
+        uint8_t *footer = ctx->save_data + ctx->ram_size;
+        const rtc_registers *sets[2] = { &ctx->mbc.rtc, &ctx->mbc.latched };
+        for (int i = 0; i < 2; i++)
+        {
+            put32(footer + 0, sets[i]->seconds);
+            put32(footer + 4, sets[i]->minutes);
+            put32(footer + 8, sets[i]->hours);
+            put32(footer + 12, sets[i]->days_low);
+            put32(footer + 16, sets[i]->days_high);
+            footer += 20;
+        }
+        uint64_t stamp = time(NULL);
+        put32(footer, stamp);
+        put32(footer + 4, stamp >> 32);
+    }
+    return msync(ctx->save_data, ctx->save_size, MS_SYNC) == 0;
+}
+
+// **Registers**
+
+static void write_register(gb_t *gb, uint16_t address, uint8_t value)
+{
+    cartridge_context *ctx = &gb->cart;
+    mbc_state *mbc = &ctx->mbc;
+
+    switch (ctx->mbc_type)
+    {
+        case MBC_NONE:
+            return;
+
+        case MBC_1:
+            if (address < 0x2000)
+            {
+                mbc->ram_enabled = (value & 0x0F) == 0x0A;
+            }
+            else if (address < 0x4000)
+            {
+                // bank 0 can't be picked here, it reads as bank 1
+                mbc->rom_bank = (value & 0x1F) ? value & 0x1F : 1;
+            }
+            else if (address < 0x6000)
+            {
+                mbc->ram_bank = value & 0x03;
+            }
+            else
+            {
+                mbc->mode = value & 0x01;
+            }
+            break;
+
+        case MBC_2:
+            if (address >= 0x4000)
+            {
+                return;
+            }
+            // address bit 8 picks between the two registers
+            if (address & 0x0100)
+            {
+                mbc->rom_bank = (value & 0x0F) ? value & 0x0F : 1;
+            }
+            else
+            {
+                mbc->ram_enabled = (value & 0x0F) == 0x0A;
+            }
+            break;
+
+        case MBC_3:
+            if (address < 0x2000)
+            {
+                mbc->ram_enabled = (value & 0x0F) == 0x0A;
+            }
+            else if (address < 0x4000)
+            {
+                mbc->rom_bank = (value & 0x7F) ? value & 0x7F : 1;
+            }
+            else if (address < 0x6000)
+            {
+                mbc->ram_bank = value;
+            }
+            else
+            {
+                // writing 0 then 1 copies the running clock to what reads see
+                if (ctx->has_rtc && mbc->latch_write == 0x00 && value == 0x01)
+                {
+                    rtc_catch_up(gb);
+                    mbc->latched = mbc->rtc;
+                }
+                mbc->latch_write = value;
+                return;
+            }
+            break;
+
+        case MBC_5:
+            if (address < 0x2000)
+            {
+                mbc->ram_enabled = value == 0x0A;
+            }
+            else if (address < 0x3000)
+            {
+                // 9 bit bank, and bank 0 really is bank 0
+                mbc->rom_bank = (mbc->rom_bank & 0x100) | value;
+            }
+            else if (address < 0x4000)
+            {
+                mbc->rom_bank = (mbc->rom_bank & 0xFF) | (value & 0x01) << 8;
+            }
+            else if (address < 0x6000)
+            {
+                // bit 3 is the rumble motor on carts that have one
+                mbc->ram_bank = value & 0x0F;
+            }
+            else
+            {
+                return;
+            }
+            break;
+    }
+    update_banks(gb);
+}
+
+// a cartridge ram byte for writing, copying its page first if a fork still
+// shares it
+static uint8_t *own_ram(gb_t *gb, uint32_t offset)
+{
+    cartridge_context *ctx = &gb->cart;
+    ram_page **slot = &ctx->ram[offset / RAM_PAGE_SIZE];
+    bool shared = ram_page_is_shared(*slot);
+    uint8_t *data = ram_page_own(slot);
+    if (!data)
+    {
+        gb_fault(gb, "out of memory copying a ram page");
+        return NULL;
+    }
+    if (shared)
+    {
+        // the window may show the page more than once, remap all of it
+        map_ram_window(gb);
+    }
+    return data + offset % RAM_PAGE_SIZE;
+}
+
+// only what isn't mapped ends up here: rom past the end of the file, MBC2
+// ram, the clock registers and disabled ram
+uint8_t read_cartridge(gb_t *gb, uint16_t address)
+{
+    cartridge_context *ctx = &gb->cart;
+    if (address < 0x8000)
+    {
+        uint32_t offset = ctx->mbc.rom_offset[address >> 14] + (address & 0x3FFF);
+        // open bus
+        return offset < ctx->rom_size ? ctx->rom_data[offset] : 0xFF;
+    }
+
+    if (ctx->mbc.ram_offset >= 0)
+    {
+        // a mapped page a fork still shares
+        uint32_t offset = (ctx->mbc.ram_offset + (address - 0xA000)) % ctx->ram_size;
+        return ram_page_data(ctx->ram[offset / RAM_PAGE_SIZE])[offset % RAM_PAGE_SIZE];
+    }
+    if (!ctx->mbc.ram_enabled)
+    {
+        return 0xFF;
+    }
+    if (ctx->mbc_type == MBC_2)
+    {
+        // 512 half bytes repeated through the window, the top half floats
+        uint32_t offset = address & (MBC2_RAM_SIZE - 1);
+        return 0xF0 | ram_page_data(ctx->ram[offset / RAM_PAGE_SIZE])[offset % RAM_PAGE_SIZE];
+    }
+    if (ctx->has_rtc && ctx->mbc.ram_bank >= 0x08)
+    {
+        return rtc_read(gb);
+    }
+    return 0xFF;
+}
+
+void write_cartridge(gb_t *gb, uint16_t address, uint8_t value)
+{
+    cartridge_context *ctx = &gb->cart;
+    if (address < 0x8000)
+    {
+        write_register(gb, address, value);
+        return;
+    }
+
+    if (ctx->mbc_type == MBC_2)
+    {
+        uint8_t *data = ctx->mbc.ram_enabled ? own_ram(gb, address & (MBC2_RAM_SIZE - 1)) : NULL;
+        if (data)
+        {
+            *data = value & 0x0F;
+        }
+    }
+    else if (ctx->has_rtc && ctx->mbc.ram_enabled && ctx->mbc.ram_bank >= 0x08)
+    {
+        rtc_write(gb, value);
+    }
+    else if (ctx->mbc.ram_offset >= 0)
+    {
+        // a page shared with a fork, the copy gets mapped writable
+        uint8_t *data = own_ram(gb, (ctx->mbc.ram_offset + (address - 0xA000)) % ctx->ram_size);
+        if (data)
+        {
+            *data = value;
+        }
+    }
+}
+
+void cartridge_save_ram(gb_t *gb, uint8_t *out)
+{
+    cartridge_context *ctx = &gb->cart;
+    for (uint32_t i = 0; i < ctx->ram_size / RAM_PAGE_SIZE; i++)
+    {
+        memcpy(out + i * RAM_PAGE_SIZE, ram_page_data(ctx->ram[i]), RAM_PAGE_SIZE);
+    }
+    memset(out + ctx->ram_size, 0, CART_RAM_MAX - ctx->ram_size);
+}
+
+void cartridge_load_ram(gb_t *gb, const uint8_t *in)
+{
+    cartridge_context *ctx = &gb->cart;
+    for (uint32_t i = 0; i < ctx->ram_size / RAM_PAGE_SIZE; i++)
+    {
+        const uint8_t *src = in + i * RAM_PAGE_SIZE;
+        if (memcmp(ram_page_data(ctx->ram[i]), src, RAM_PAGE_SIZE) == 0)
+        {
+            // unchanged pages stay shared
+            continue;
+        }
+
+        uint8_t *data = ram_page_own(&ctx->ram[i]);
+        if (!data)
+        {
+            gb_fault(gb, "out of memory copying a ram page");
+            return;
+        }
+        memcpy(data, src, RAM_PAGE_SIZE);
+    }
+}
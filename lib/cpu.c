@@ -1,199 +1,236 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <cpu.h>
-#include <emu.h>
-#include <instructions.h>
-#include <memorymap.h>
-
-cpu_context ctx = {0};
-
-void cpu_init() 
-{
-    ctx.regs.pc = 0x100;
-    ctx.regs.a = 0x01;
-}
-
-static void fetch_instruction()
-{
-    ctx.current_opcode = read_address_bus(ctx.regs.pc++);
-    ctx.current_instruction = get_instruction_by_opcode(ctx.current_opcode);
-}
-
-static void fetch_data()
-{   
-    if (ctx.current_instruction == NULL)
-    {
-        return;
-    }
-
-    ctx.memory_destination = 0;
-    ctx.destination_is_memory = false;
-    switch(ctx.current_instruction->mode)
-    {
-        case AM_IMP:
-            return;
-        case AM_R:
-            ctx.fetched_data = cpu_read_reg(ctx.current_instruction->reg_1);
-            return;
-        case AM_R_R:
-            ctx.fetched_data = cpu_read_reg(ctx.current_instruction->reg_2);
-            return;
-        case AM_R_N8:
-            ctx.fetched_data = read_address_bus(ctx.regs.pc);
-            emu_cycles(1);
-            ctx.regs.pc++;
-            return;
-        case AM_R_N16:
-        case AM_N16: 
-            uint16_t lo = read_address_bus(ctx.regs.pc);
-            emu_cycles(1);
-
-            uint16_t hi = read_address_bus(ctx.regs.pc + 1);
-            emu_cycles(1);
-
-            ctx.fetched_data = lo | (hi << 8);
-            ctx.regs.pc += 2;
-            return;
-        case AM_MR_R:
-            ctx.fetched_data = cpu_read_reg(ctx.current_instruction->reg_2);
-            ctx.memory_destination = cpu_read_reg(ctx.current_instruction->reg_1);
-            ctx.destination_is_memory = true;
-            if (ctx.current_instruction->reg_1 == RT_C)
-            {
-                // special case for LDH [C], A
-                ctx.memory_destination |= 0xFF00;
-            }
-            return;
-        case AM_R_MR:
-            uint16_t addr = cpu_read_reg(ctx.current_instruction->reg_2);
-            if (ctx.current_instruction->reg_2 == RT_C)
-            {
-                // special case for LDH A, [C] 
-                addr |= 0xFF00;
-            }
-            ctx.fetched_data = read_address_bus(addr);
-            emu_cycles(1);
-            return;
-        case AM_R_HLI:
-            ctx.fetched_data = read_address_bus(cpu_read_reg(ctx.current_instruction->reg_2));
-            emu_cycles(1);
-            cpu_set_reg(RT_HL, cpu_read_reg(RT_HL) + 1);
-            return;
-        case AM_R_HLD:
-            ctx.fetched_data = read_address_bus(cpu_read_reg(ctx.current_instruction->reg_2));
-            emu_cycles(1);
-            cpu_set_reg(RT_HL, cpu_read_reg(RT_HL) - 1);
-            return;
-        case AM_HLI_R:
-            ctx.fetched_data = cpu_read_reg(ctx.current_instruction->reg_2);
-            ctx.memory_destination = ctx.current_instruction->reg_1;
-            ctx.destination_is_memory = true;
-            cpu_set_reg(RT_HL, cpu_read_reg(RT_HL) + 1);
-            return;
-        case AM_HLD_R:
-            ctx.fetched_data = cpu_read_reg(ctx.current_instruction->reg_2);
-            ctx.memory_destination = ctx.current_instruction->reg_1;
-            ctx.destination_is_memory = true;
-            cpu_set_reg(RT_HL, cpu_read_reg(RT_HL) - 1);
-            return;
-        case AM_N8:
-        case AM_R_A8:
-            //ctx.fetched_data = read_address_bus(ctx.regs.pc);
-            ctx.fetched_data = read_address_bus(ctx.regs.pc) | 0xFF00;
-            emu_cycles(1);
-            ctx.regs.pc++;
-            return;
-        case AM_A8_R:
-            ctx.fetched_data = cpu_read_reg(ctx.current_instruction->reg_2);
-            ctx.memory_destination  = read_address_bus(ctx.regs.pc) | 0xFF00;
-            ctx.destination_is_memory = true;
-            emu_cycles(1);
-            ctx.regs.pc++;
-            return;
-        case AM_HL_SPR:
-            // special case for op:0xE8 -  LD HL, SP+e8
-            ctx.fetched_data = read_address_bus(ctx.regs.pc);
-            emu_cycles(1);
-            ctx.regs.pc++;
-            return;
-        case AM_N16_R:
-        case AM_A16_R:
-            ctx.fetched_data = cpu_read_reg(ctx.current_instruction->reg_2);
-            emu_cycles(2);
-            ctx.regs.pc += 2;
-            ctx.memory_destination = read16_address_bus(ctx.regs.pc);
-            ctx.destination_is_memory = true;  
-            return;
-        case AM_R_A16:
-            uint16_t address = read16_address_bus(ctx.regs.pc);
-            emu_cycles(2);
-            ctx.regs.pc += 2;
-            ctx.fetched_data = read_address_bus(address);
-            emu_cycles(1);
-            return;
-        case AM_MR_N8:
-            ctx.fetched_data = read_address_bus(ctx.regs.pc);
-            emu_cycles(1);
-            ctx.regs.pc++;
-            ctx.memory_destination = cpu_read_reg(ctx.current_instruction->reg_1);
-            ctx.destination_is_memory = true;
-            return;
-        case AM_MR:
-            ctx.memory_destination = cpu_read_reg(ctx.current_instruction->reg_1);
-            ctx.destination_is_memory = true;
-            ctx.fetched_data = read_address_bus(ctx.current_instruction->reg_1);
-            emu_cycles(1);
-            return;
-        default:
-            printf("Unknown Addressing Mode! %d (%02X)\n", ctx.current_instruction->mode, ctx.current_opcode);
-            exit(-7);
-    }
-}
-
-static void execute() 
-{
-    IN_PROC proc = inst_get_processor(ctx.current_instruction->type);
-    if (!proc) 
-    {
-        NO_IMPL
-    }
-    proc(&ctx);
-}
-
-bool cpu_step()
-{
-    if (!ctx.halted) 
-    {
-        uint16_t pc = ctx.regs.pc;
-        fetch_instruction();
-        fetch_data();
-
-        char flags[16];
-        sprintf(flags, "%c%c%c%c", 
-            ctx.regs.f & (1 << 7) ? 'Z' : '-',
-            ctx.regs.f & (1 << 6) ? 'N' : '-',
-            ctx.regs.f & (1 << 5) ? 'H' : '-',
-            ctx.regs.f & (1 << 4) ? 'C' : '-' 
-        ); 
-
-        printf("%08lX - %04X: %-7s (%02X %02X %02X) A: %02X F: %s BC: %02X%02X DE: %02X%02X HL: %02X%02X\n", 
-            emu_get_context()->ticks, 
-            pc, get_instruction_name(ctx.current_instruction->type), ctx.current_opcode,
-            read_address_bus(pc + 1), read_address_bus(pc + 2), ctx.regs.a, flags, ctx.regs.b, ctx.regs.c,
-            ctx.regs.d, ctx.regs.e, ctx.regs.h, ctx.regs.l);
-
-        if (ctx.current_instruction == NULL)
-        {
-            printf("Unknown Instruction! %02X\n", ctx.current_opcode);
-            exit(-7);
-        }
-
-        execute();
-    }
-    return true;
-}
-
-cpu_registers *cpu_get_regs()
-{
-    return &ctx.regs;
-}
\ No newline at end of file
+#include <stdio.h>
+#include <stdlib.h>
+#include <cpu.h>
+#include <emu.h>
+#include <gb.h>
+#include <instructions.h>
+#include <stack.h>
+#include "cpu_exec.h"
+
+// the longest a halted step moves the clock, a frame
+#define HALT_MAX_CYCLES 17556
+
+void cpu_init(gb_t *gb) 
+{
+    cpu_context *ctx = &gb->cpu;
+    trace_writer *trace = ctx->trace;
+
+    *ctx = (cpu_context){0};
+    ctx->regs.pc = 0x100;
+    ctx->regs.a = 0x01;
+    ctx->trace = trace;
+}
+
+void cpu_set_trace(gb_t *gb, trace_writer *writer)
+{
+    gb->cpu.trace = writer;
+}
+
+// only called when a trace writer is attached, so untraced runs pay for
+// nothing but the NULL check
+static void trace_step(gb_t *gb, uint16_t pc)
+{
+    cpu_context *ctx = &gb->cpu;
+    trace_record record = {
+        .ticks = emu_get_ticks(gb),
+        .pc = pc,
+        .sp = ctx->regs.sp,
+        .opcode = ctx->current_opcode,
+        .operands = { read_address_bus(gb, pc + 1), read_address_bus(gb, pc + 2) },
+        .a = ctx->regs.a,
+        .f = cpu_flags_value(ctx),
+        .b = ctx->regs.b,
+        .c = ctx->regs.c,
+        .d = ctx->regs.d,
+        .e = ctx->regs.e,
+        .h = ctx->regs.h,
+        .l = ctx->regs.l,
+    };
+    trace_push(ctx->trace, &record);
+}
+
+#ifdef GBEMU_SPECIALIZED_DISPATCH
+
+// the generated handler for each opcode does its own operand fetch with the
+// addressing mode, registers and condition already resolved
+static inline void execute(gb_t *gb)
+{
+    cpu_opcode_handlers[gb->cpu.current_opcode](gb);
+}
+
+#else
+
+static inline void execute(gb_t *gb) 
+{
+    cpu_context *ctx = &gb->cpu;
+    fetch_data(gb, ctx->current_instruction);
+
+    IN_PROC proc = inst_get_processor(ctx->current_instruction->type);
+    if (!proc) 
+    {
+        gb_fault(gb, "no processor for %s", get_instruction_name(ctx->current_instruction->type));
+        return;
+    }
+    proc(gb);
+}
+
+#endif
+
+// runs the instruction at PC, `advance` is only false for the HALT bug
+static inline void run_instruction(gb_t *gb, bool advance)
+{
+    cpu_context *ctx = &gb->cpu;
+    uint16_t pc = ctx->regs.pc;
+    ctx->current_opcode = read_address_bus(gb, pc);
+    ctx->regs.pc = advance ? pc + 1 : pc;
+#ifndef GBEMU_SPECIALIZED_DISPATCH
+    ctx->current_instruction = get_instruction_by_opcode(ctx->current_opcode);
+#endif
+
+    if (ctx->trace)
+    {
+        trace_step(gb, pc);
+    }
+
+    emu_cycles(gb, 1);
+
+    execute(gb);
+    gb->instructions++;
+}
+
+// pushes PC and jumps to the highest priority interrupt in IE & IF
+static void take_interrupt(gb_t *gb)
+{
+    cpu_context *ctx = &gb->cpu;
+    int bit = __builtin_ctz(ctx->interrupt_flags & ctx->interrupt_enabled_register & INTERRUPT_MASK);
+    ctx->interrupt_flags &= ~(1 << bit);
+    ctx->master_interrupt_enabled = false;
+    cpu_update_interrupts(ctx);
+
+    // 2 idle cycles, the pushes, then the jump
+    emu_cycles(gb, 2);
+    stack_push(gb, ctx->regs.pc >> 8);
+    emu_cycles(gb, 1);
+    stack_push(gb, ctx->regs.pc & 0xFF);
+    emu_cycles(gb, 1);
+    ctx->regs.pc = 0x40 + bit * 8;
+    emu_cycles(gb, 1);
+}
+
+// halted with nothing in IE & IF: only an event can change that, so move
+// the clock to the next one (or to `until`) in one go. it lands on the
+// same cycle ticking there would have
+static void halt_until_event(gb_t *gb, uint64_t until)
+{
+    uint64_t now = gb->scheduler.now;
+    uint64_t target = gb->scheduler.next < until ? gb->scheduler.next : until;
+    uint64_t m_cycles = 1;
+    if (target > now && target != UINT64_MAX)
+    {
+        m_cycles = (target - now + 3) / 4;
+    }
+    // nothing scheduled and no end to the run, go a frame at a time
+    if (m_cycles > HALT_MAX_CYCLES)
+    {
+        m_cycles = HALT_MAX_CYCLES;
+    }
+    scheduler_advance(gb, m_cycles * 4);
+}
+
+// anything but plainly running the next instruction
+static inline bool needs_service(const cpu_context *ctx)
+{
+    return ctx->halted | ctx->interrupt_pending | ctx->enabling_ime | ctx->halt_bug;
+}
+
+// HALT, interrupts, EI's delay and the HALT bug, false if that used up
+// the step
+static bool service(gb_t *gb, uint64_t until)
+{
+    cpu_context *ctx = &gb->cpu;
+    if (ctx->halted)
+    {
+        if (!(ctx->interrupt_flags & ctx->interrupt_enabled_register & INTERRUPT_MASK))
+        {
+            halt_until_event(gb, until);
+            return false;
+        }
+        // waking up takes a cycle, the interrupt (if IME is on) is taken
+        // on the next step
+        ctx->halted = false;
+        emu_cycles(gb, 1);
+        return false;
+    }
+
+    if (ctx->interrupt_pending)
+    {
+        take_interrupt(gb);
+        return false;
+    }
+
+    if (ctx->enabling_ime)
+    {
+        // the instruction after EI still runs before anything is taken
+        ctx->enabling_ime = false;
+        ctx->master_interrupt_enabled = true;
+        cpu_update_interrupts(ctx);
+    }
+
+    if (ctx->halt_bug)
+    {
+        ctx->halt_bug = false;
+        run_instruction(gb, false);
+        return false;
+    }
+    return true;
+}
+
+static inline void step(gb_t *gb, uint64_t until)
+{
+    if (needs_service(&gb->cpu) && !service(gb, until))
+    {
+        return;
+    }
+    run_instruction(gb, true);
+}
+
+bool cpu_step(gb_t *gb)
+{
+    if (!gb->stopped)
+    {
+        step(gb, UINT64_MAX);
+    }
+    return !gb->stopped;
+}
+
+void cpu_run(gb_t *gb, uint64_t until)
+{
+#ifdef GBEMU_BLOCK_CACHE
+    if (gb->use_blocks)
+    {
+        while (gb->scheduler.now < until && !gb->stopped && !gb->run_break)
+        {
+            // interrupts, HALT, traced runs and code the cache won't take
+            // are stepped. blocks stop as soon as an interrupt is pending
+            if (needs_service(&gb->cpu) || gb->cpu.trace || !blockcache_run(gb, until))
+            {
+                step(gb, until);
+            }
+        }
+        return;
+    }
+#endif
+
+    // the loop lives here rather than in gb.c so step() inlines into it
+    while (gb->scheduler.now < until && !gb->stopped && !gb->run_break)
+    {
+        step(gb, until);
+    }
+}
+
+cpu_registers *cpu_get_regs(gb_t *gb)
+{
+    // callers see (and may change) F directly
+    cpu_sync_flags(gb);
+    return &gb->cpu.regs;
+}
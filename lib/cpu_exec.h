@@ -0,0 +1,888 @@
+#pragma once
+
+// Instruction semantics shared by the table-driven interpreter (cpu_proc.c)
+// and the generated per-opcode handlers (see tools/gen_dispatch.c).
+//
+// Everything in here is forced inline and takes the instruction as a
+// parameter rather than reading ctx->current_instruction. When the
+// instruction is a compile-time constant (the generated handlers) the
+// addressing mode, register and condition switches all fold away, and when
+// it isn't (the table path) we get the same code as before.
+
+#include <common.h>
+#include <gb.h>
+#include <cpu.h>
+#include <emu.h>
+#include <stack.h>
+#include <stddef.h>
+
+#define CPU_INLINE static inline __attribute__((always_inline))
+
+// the registers in the order the opcodes number them (bits 0-2 of most
+// ops, 6 is (HL))
+static const reg_type rt_lookup[] = {
+    RT_B,
+    RT_C,
+    RT_D,
+    RT_E,
+    RT_H,
+    RT_L,
+    RT_HL,
+    RT_A
+};
+
+CPU_INLINE reg_type decode_reg(uint8_t reg)
+{
+    return rt_lookup[reg & 0b111];
+}
+
+CPU_INLINE bool is_16_bit(reg_type rt)
+{
+    return rt >= RT_AF;
+}
+
+// **Register access**
+// Every register and pair is a field of cpu_registers, so access is just
+// its offset from this table. With a constant reg_type (the generated
+// handlers) it folds down to a plain load or store.
+
+static const uint8_t reg_offsets[] = {
+    [RT_A] = offsetof(cpu_registers, a),
+    [RT_F] = offsetof(cpu_registers, f),
+    [RT_B] = offsetof(cpu_registers, b),
+    [RT_C] = offsetof(cpu_registers, c),
+    [RT_D] = offsetof(cpu_registers, d),
+    [RT_E] = offsetof(cpu_registers, e),
+    [RT_H] = offsetof(cpu_registers, h),
+    [RT_L] = offsetof(cpu_registers, l),
+    [RT_AF] = offsetof(cpu_registers, af),
+    [RT_BC] = offsetof(cpu_registers, bc),
+    [RT_DE] = offsetof(cpu_registers, de),
+    [RT_HL] = offsetof(cpu_registers, hl),
+    [RT_SP] = offsetof(cpu_registers, sp),
+    [RT_PC] = offsetof(cpu_registers, pc),
+};
+
+CPU_INLINE uint8_t *reg8_ptr(cpu_context *ctx, reg_type rt)
+{
+    return (uint8_t *)&ctx->regs + reg_offsets[rt];
+}
+
+CPU_INLINE uint16_t *reg16_ptr(cpu_context *ctx, reg_type rt)
+{
+    return (uint16_t *)((uint8_t *)&ctx->regs + reg_offsets[rt]);
+}
+
+CPU_INLINE uint16_t ctx_read_reg(cpu_context *ctx, reg_type rt)
+{
+    switch(rt)
+    {
+        case RT_NONE:
+            return 0;
+        case RT_F:
+            return cpu_flags_value(ctx);
+        case RT_AF:
+            return (ctx->regs.a << 8) | cpu_flags_value(ctx);
+        default:
+            return is_16_bit(rt) ? *reg16_ptr(ctx, rt) : *reg8_ptr(ctx, rt);
+    }
+}
+
+CPU_INLINE void ctx_set_reg(cpu_context *ctx, reg_type rt, uint16_t val)
+{
+    switch(rt)
+    {
+        case RT_NONE:
+            return;
+        case RT_F:
+        case RT_AF:
+            // F is set outright, nothing is pending anymore
+            ctx->flags.pending = 0;
+            break;
+        default:
+            break;
+    }
+
+    if (is_16_bit(rt))
+    {
+        *reg16_ptr(ctx, rt) = val;
+    }
+    else
+    {
+        *reg8_ptr(ctx, rt) = val & 0xFF;
+    }
+}
+
+// the 8 bit operand of a CB op, RT_HL is (HL)
+CPU_INLINE uint8_t ctx_read_reg8(gb_t *gb, reg_type rt)
+{
+    cpu_context *ctx = &gb->cpu;
+    if (rt == RT_HL)
+    {
+        return read_address_bus(gb, ctx->regs.hl);
+    }
+    if (rt == RT_NONE || rt == RT_F || is_16_bit(rt))
+    {
+        gb_fault(gb, "invalid reg8: %d", rt);
+        return 0xFF;
+    }
+    return *reg8_ptr(ctx, rt);
+}
+
+CPU_INLINE void ctx_set_reg8(gb_t *gb, reg_type rt, uint8_t val)
+{
+    cpu_context *ctx = &gb->cpu;
+    if (rt == RT_HL)
+    {
+        write_address_bus(gb, ctx->regs.hl, val);
+        return;
+    }
+    if (rt == RT_NONE || rt == RT_F || is_16_bit(rt))
+    {
+        gb_fault(gb, "invalid reg8: %d", rt);
+        return;
+    }
+    *reg8_ptr(ctx, rt) = val;
+}
+
+// **Operand fetch**
+
+// immediate operand byte `offset` after the opcode, straight from the
+// instruction stream or, for `decoded` block cache ops, out of `imm`
+#define IMM8(offset) (decoded ? (uint8_t)(imm >> ((offset) * 8)) : read_address_bus(gb, ctx->regs.pc + (offset)))
+
+CPU_INLINE void fetch_operands(gb_t *gb, const instruction *inst, bool decoded, uint16_t imm)
+{
+    cpu_context *ctx = &gb->cpu;
+    ctx->memory_destination = 0;
+    ctx->destination_is_memory = false;
+    switch(inst->mode)
+    {
+        case AM_IMP:
+            return;
+        case AM_R:
+            ctx->fetched_data = ctx_read_reg(ctx, inst->reg_1);
+            return;
+        case AM_R_R:
+            ctx->fetched_data = ctx_read_reg(ctx, inst->reg_2);
+            return;
+        case AM_R_N8:
+            ctx->fetched_data = IMM8(0);
+            emu_cycles(gb, 1);
+            ctx->regs.pc++;
+            return;
+        case AM_R_N16:
+        case AM_N16: {
+            uint16_t lo = IMM8(0);
+            emu_cycles(gb, 1);
+
+            uint16_t hi = IMM8(1);
+            emu_cycles(gb, 1);
+
+            ctx->fetched_data = lo | (hi << 8);
+            ctx->regs.pc += 2;
+        } return;
+        case AM_MR_R:
+            ctx->fetched_data = ctx_read_reg(ctx, inst->reg_2);
+            ctx->memory_destination = ctx_read_reg(ctx, inst->reg_1);
+            ctx->destination_is_memory = true;
+            if (inst->reg_1 == RT_C)
+            {
+                // special case for LDH [C], A
+                ctx->memory_destination |= 0xFF00;
+            }
+            return;
+        case AM_R_MR: {
+            uint16_t addr = ctx_read_reg(ctx, inst->reg_2);
+            if (inst->reg_2 == RT_C)
+            {
+                // special case for LDH A, [C]
+                addr |= 0xFF00;
+            }
+            ctx->fetched_data = read_address_bus(gb, addr);
+            emu_cycles(gb, 1);
+        } return;
+        case AM_R_HLI:
+            ctx->fetched_data = read_address_bus(gb, ctx_read_reg(ctx, inst->reg_2));
+            emu_cycles(gb, 1);
+            ctx_set_reg(ctx, RT_HL, ctx_read_reg(ctx, RT_HL) + 1);
+            return;
+        case AM_R_HLD:
+            ctx->fetched_data = read_address_bus(gb, ctx_read_reg(ctx, inst->reg_2));
+            emu_cycles(gb, 1);
+            ctx_set_reg(ctx, RT_HL, ctx_read_reg(ctx, RT_HL) - 1);
+            return;
+        case AM_HLI_R:
+            ctx->fetched_data = ctx_read_reg(ctx, inst->reg_2);
+            ctx->memory_destination = ctx_read_reg(ctx, inst->reg_1);
+            ctx->destination_is_memory = true;
+            ctx_set_reg(ctx, RT_HL, ctx_read_reg(ctx, RT_HL) + 1);
+            return;
+        case AM_HLD_R:
+            ctx->fetched_data = ctx_read_reg(ctx, inst->reg_2);
+            ctx->memory_destination = ctx_read_reg(ctx, inst->reg_1);
+            ctx->destination_is_memory = true;
+            ctx_set_reg(ctx, RT_HL, ctx_read_reg(ctx, RT_HL) - 1);
+            return;
+        case AM_N8:
+        case AM_R_A8:
+            ctx->fetched_data = IMM8(0) | 0xFF00;
+            emu_cycles(gb, 1);
+            ctx->regs.pc++;
+            return;
+        case AM_A8_R:
+            ctx->fetched_data = ctx_read_reg(ctx, inst->reg_2);
+            ctx->memory_destination  = IMM8(0) | 0xFF00;
+            ctx->destination_is_memory = true;
+            emu_cycles(gb, 1);
+            ctx->regs.pc++;
+            return;
+        case AM_HL_SPR:
+            // special case for op:0xE8 -  LD HL, SP+e8
+            ctx->fetched_data = IMM8(0);
+            emu_cycles(gb, 1);
+            ctx->regs.pc++;
+            return;
+        case AM_N16_R:
+        case AM_A16_R:
+            // the address is the operand, read before PC moves past it
+            ctx->fetched_data = ctx_read_reg(ctx, inst->reg_2);
+            ctx->memory_destination = IMM8(0) | (IMM8(1) << 8);
+            emu_cycles(gb, 2);
+            ctx->regs.pc += 2;
+            ctx->destination_is_memory = true;
+            return;
+        case AM_R_A16: {
+            uint16_t address = IMM8(0) | (IMM8(1) << 8);
+            emu_cycles(gb, 2);
+            ctx->regs.pc += 2;
+            ctx->fetched_data = read_address_bus(gb, address);
+            emu_cycles(gb, 1);
+        } return;
+        case AM_MR_N8:
+            ctx->fetched_data = IMM8(0);
+            emu_cycles(gb, 1);
+            ctx->regs.pc++;
+            ctx->memory_destination = ctx_read_reg(ctx, inst->reg_1);
+            ctx->destination_is_memory = true;
+            return;
+        case AM_MR:
+            ctx->memory_destination = ctx_read_reg(ctx, inst->reg_1);
+            ctx->destination_is_memory = true;
+            ctx->fetched_data = read_address_bus(gb, ctx->memory_destination);
+            emu_cycles(gb, 1);
+            return;
+        default:
+            gb_fault(gb, "unknown addressing mode %d (%02X)", inst->mode, ctx->current_opcode);
+            return;
+    }
+}
+
+#undef IMM8
+
+CPU_INLINE void fetch_data(gb_t *gb, const instruction *inst)
+{
+    fetch_operands(gb, inst, false, 0);
+}
+
+// **Processors**
+
+CPU_INLINE bool check_condition(cpu_context *ctx, const instruction *inst)
+{
+    bool z = CPU_FLAG_Z;
+    bool c = CPU_FLAG_C;
+
+    switch(inst->cond)
+    {
+        case CT_NONE:
+            return true;
+        case CT_C:
+            return c;
+        case CT_NC:
+            return !c;
+        case CT_Z:
+            return z;
+        case CT_NZ:
+            return !z;
+    }
+    return false;
+}
+
+CPU_INLINE void ctx_sync_flags(cpu_context *ctx)
+{
+    ctx->regs.f = cpu_flags_value(ctx);
+    ctx->flags.pending = 0;
+}
+
+// sets flags straight into F, -1 leaves one as it is
+CPU_INLINE void cpu_set_flags(cpu_context *ctx, char z, char n, char h, char c)
+{
+    if (z == -1 || n == -1 || h == -1 || c == -1)
+    {
+        // the ones left alone may still be pending
+        ctx_sync_flags(ctx);
+    }
+    ctx->flags.pending = 0;
+
+    if (z != -1)
+    {
+        SET_BIT(ctx->regs.f, 7, z);
+    }
+    if (n != -1)
+    {
+        SET_BIT(ctx->regs.f, 6, n);
+    }
+    if (h != -1)
+    {
+        SET_BIT(ctx->regs.f, 5, h);
+    }
+    if (c != -1)
+    {
+        SET_BIT(ctx->regs.f, 4, c);
+    }
+}
+
+// records an op that sets the `pending` flags, see lazy_flags in cpu.h.
+// the others keep their value
+CPU_INLINE void cpu_set_lazy_flags(cpu_context *ctx, uint8_t pending, uint8_t n, uint8_t half, uint16_t result)
+{
+    // anything the last op left pending that this one doesn't set has to be
+    // worked out before its inputs are gone
+    uint8_t keep = ctx->flags.pending & ~pending;
+    if (keep)
+    {
+        ctx->regs.f = (ctx->regs.f & ~keep) | (cpu_flags_value(ctx) & keep);
+    }
+    ctx->flags.pending = pending;
+    ctx->flags.n = n;
+    ctx->flags.half = half;
+    ctx->flags.result = result;
+}
+
+#define ALL_FLAGS (FLAG_Z | FLAG_N | FLAG_H | FLAG_C)
+
+CPU_INLINE void goto_addr(gb_t *gb, const instruction *inst, uint16_t addr, bool pushpc)
+{
+    cpu_context *ctx = &gb->cpu;
+    if (!check_condition(ctx, inst))
+    {
+        return;
+    }
+
+    if (pushpc)
+    {
+        emu_cycles(gb, 2);
+        stack_push16(gb, ctx->regs.pc);
+    }
+    ctx->regs.pc = addr;
+    emu_cycles(gb, 1);
+}
+
+CPU_INLINE void proc_none(gb_t *gb, const instruction *inst)
+{
+    gb_fault(gb, "invalid instruction %02X at %04X", gb->cpu.current_opcode, (uint16_t)(gb->cpu.regs.pc - 1));
+}
+
+CPU_INLINE void proc_nop(gb_t *gb, const instruction *inst)
+{
+    // nop doesn't do anything
+}
+
+CPU_INLINE void proc_jp(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    goto_addr(gb, inst, ctx->fetched_data, false);
+}
+
+CPU_INLINE void proc_jr(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    int8_t rel = (int8_t)(ctx->fetched_data & 0xFF);
+    uint16_t addr = ctx->regs.pc + rel;
+    goto_addr(gb, inst, addr, false);
+}
+
+CPU_INLINE void proc_call(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    goto_addr(gb, inst, ctx->fetched_data, true);
+}
+
+CPU_INLINE void proc_rst(gb_t *gb, const instruction *inst)
+{
+    goto_addr(gb, inst, inst->param, true);
+}
+
+CPU_INLINE void proc_ret(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    if (inst->cond != CT_NONE)
+    {
+        // see page 121 of https://gekkio.fi/files/gb-docs/gbctr.pdf
+        emu_cycles(gb, 1);
+    }
+
+    if (check_condition(ctx, inst))
+    {
+        // 2 stack_pop instead of 1 stack_pop16 for cycle accuracy
+        uint16_t lo = stack_pop(gb);
+        emu_cycles(gb, 1);
+        uint16_t hi = stack_pop(gb);
+        emu_cycles(gb, 1);
+        uint16_t n = (hi << 8) | lo;
+        ctx->regs.pc = n;
+        emu_cycles(gb, 1);
+    }
+}
+
+CPU_INLINE void proc_reti(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    ctx->master_interrupt_enabled = true;
+    cpu_update_interrupts(ctx);
+    proc_ret(gb, inst);
+}
+
+CPU_INLINE void proc_di(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    ctx->master_interrupt_enabled = false;
+    ctx->enabling_ime = false;
+    cpu_update_interrupts(ctx);
+}
+
+CPU_INLINE void proc_ei(gb_t *gb, const instruction *inst)
+{
+    // IME goes on once the next instruction has started, see step() in cpu.c
+    gb->cpu.enabling_ime = true;
+}
+
+CPU_INLINE void proc_halt(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    if (!ctx->master_interrupt_enabled &&
+        (ctx->interrupt_flags & ctx->interrupt_enabled_register & INTERRUPT_MASK))
+    {
+        // the HALT bug: it doesn't halt and the next opcode is read twice
+        ctx->halt_bug = true;
+        return;
+    }
+    ctx->halted = true;
+}
+
+CPU_INLINE void proc_ld(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    if (ctx->destination_is_memory)
+    {
+        // LD (BC), A
+        if (is_16_bit(inst->reg_2))
+        {
+            emu_cycles(gb, 1);
+            write16_address_bus(gb, ctx->memory_destination, ctx->fetched_data);
+        }
+        else
+        {
+            write_address_bus(gb, ctx->memory_destination, ctx->fetched_data);
+        }
+        emu_cycles(gb, 1);
+        return;
+    }
+
+    if (inst->mode == AM_HL_SPR)
+    {
+        // LD HL, SP+e8
+        /*
+        This way looks more in line with the docs but not exactly sure if it works
+        uint8_t carry_bit = (cpu_read_reg(ctx->current_instruction->reg_2) & 0xFF) +
+            (ctx->fetched_data & 0xFF);
+        //for h flag docs say carry_bit[3] so do I shift over 3 times? i think 4 will match below
+        uint8_t h = CHECK_BIT(carry_bit, 4); 3 or 4?
+        // for c flag docs say carry_bit[7]
+        uint8_t c = CHECK_BIT(carry_bit, 8); 7 or 8?
+        */
+        uint8_t h = (ctx_read_reg(ctx, inst->reg_2) & 0xF) +
+            (ctx->fetched_data & 0xF) >= 0x10;
+        uint8_t c = (ctx_read_reg(ctx, inst->reg_2) & 0xFF) +
+            (ctx->fetched_data & 0xFF) >= 0x100;
+        cpu_set_flags(ctx, 0, 0, h, c);
+        ctx_set_reg(ctx, inst->reg_1,
+            ctx_read_reg(ctx, inst->reg_2) + (int8_t)ctx->fetched_data);
+        return;
+    }
+
+    ctx_set_reg(ctx, inst->reg_1, ctx->fetched_data);
+}
+
+CPU_INLINE void proc_ldh(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    // LDH commands always use register A, either in pos 1 or pos 2
+    if (inst->reg_1 == RT_A)
+    {
+        ctx_set_reg(ctx, inst->reg_1, read_address_bus(gb, ctx->fetched_data));
+    }
+    else
+    {
+        write_address_bus(gb, ctx->memory_destination, ctx->regs.a);
+    }
+    emu_cycles(gb, 1);
+}
+
+CPU_INLINE void proc_pop(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    uint16_t lo = stack_pop(gb);
+    emu_cycles(gb, 1);
+    uint16_t hi = stack_pop(gb);
+    emu_cycles(gb, 1);
+
+    uint16_t n = (hi << 8) | lo;
+    ctx_set_reg(ctx, inst->reg_1, n);
+
+    // why is this the case? shouldn't POP AF completely replace the F register value?
+    // check https://gekkio.fi/files/gb-docs/gbctr.pdf page 44
+    /*if (ctx->current_instruction->reg_1 == RT_AF)
+    {
+        cpu_set_reg(ctx->current_instruction->reg_1, n & 0xFFF0);
+    }*/
+}
+
+CPU_INLINE void proc_push(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    uint8_t hi = (ctx_read_reg(ctx, inst->reg_1) >> 8) & 0xFF;
+    emu_cycles(gb, 1);
+    stack_push(gb, hi);
+
+    uint8_t lo = ctx_read_reg(ctx, inst->reg_1) & 0xFF;
+    emu_cycles(gb, 1);
+    stack_push(gb, lo);
+
+    emu_cycles(gb, 1);
+}
+
+CPU_INLINE void proc_add(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    uint16_t reg = ctx_read_reg(ctx, inst->reg_1);
+    uint32_t val = reg + ctx->fetched_data;
+
+    bool is_16bit = is_16_bit(inst->reg_1);
+
+    if (is_16bit)
+    {
+        emu_cycles(gb, 1);
+    }
+
+    // special case Add to stack point (relative) opcode = 0xE8: ADD SP, e8
+    if (inst->reg_1 == RT_SP)
+    {
+        val = reg + (int8_t)ctx->fetched_data;
+        int h = (reg & 0xF) + (ctx->fetched_data & 0xF) >= 0x10;
+        int c = (int)(reg & 0xFF) + (int)(ctx->fetched_data & 0xFF) >= 0x100;
+        ctx_set_reg(ctx, inst->reg_1, val & 0xFFFF);
+        cpu_set_flags(ctx, 0, 0, h, c);
+        return;
+    }
+
+    ctx_set_reg(ctx, inst->reg_1, val & 0xFFFF);
+    if (is_16bit)
+    {
+        // ADD HL, rr leaves Z alone, H and C are the carries out of bits 11
+        // and 15 so the top byte is enough for both
+        cpu_set_lazy_flags(ctx, FLAG_N | FLAG_H | FLAG_C, 0, (reg ^ ctx->fetched_data) >> 8, val >> 8);
+        return;
+    }
+    cpu_set_lazy_flags(ctx, ALL_FLAGS, 0, reg ^ ctx->fetched_data, val);
+}
+
+CPU_INLINE void proc_adc(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    uint16_t u = ctx->fetched_data;
+    uint16_t a = ctx->regs.a;
+    uint16_t c = CPU_FLAG_C;
+
+    ctx->regs.a = (a + u + c) & 0xFF;
+    cpu_set_lazy_flags(ctx, ALL_FLAGS, 0, a ^ u, a + u + c);
+}
+
+CPU_INLINE void proc_sub(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    uint16_t reg = ctx_read_reg(ctx, inst->reg_1);
+    uint16_t val = reg - ctx->fetched_data;
+    ctx_set_reg(ctx, inst->reg_1, val);
+    // a borrow leaves bit 8 set
+    cpu_set_lazy_flags(ctx, ALL_FLAGS, FLAG_N, reg ^ ctx->fetched_data, val);
+}
+
+CPU_INLINE void proc_sbc(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    uint16_t reg = ctx_read_reg(ctx, inst->reg_1);
+    uint16_t val = reg - ctx->fetched_data - CPU_FLAG_C;
+    ctx_set_reg(ctx, inst->reg_1, val & 0xFF);
+    cpu_set_lazy_flags(ctx, ALL_FLAGS, FLAG_N, reg ^ ctx->fetched_data, val);
+}
+
+CPU_INLINE void proc_inc(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    uint16_t old = ctx_read_reg(ctx, inst->reg_1);
+    uint16_t val = old + 1;
+
+    if (is_16_bit(inst->reg_1))
+    {
+        emu_cycles(gb, 1);
+    }
+
+    // HL is the only reg that has an instruction with AM_MR
+    if (inst->reg_1 == RT_HL && inst->mode == AM_MR)
+    {
+        // (HL) was read by the fetch
+        old = ctx->fetched_data;
+        val = (old + 1) & 0xFF;
+        write_address_bus(gb, ctx->memory_destination, val);
+    }
+    else
+    {
+        // why do we need to reread the value after setting it?
+        ctx_set_reg(ctx, inst->reg_1, val);
+        val = ctx_read_reg(ctx, inst->reg_1);
+    }
+
+    // the 16 bit INC rr op codes (x3) do not set the flags
+    if (is_16_bit(inst->reg_1) && inst->mode != AM_MR)
+    {
+        return;
+    }
+
+    // H is the carry out of bit 3, (val & 0x0F) == 0
+    cpu_set_lazy_flags(ctx, FLAG_Z | FLAG_N | FLAG_H, 0, old ^ 1, val);
+}
+
+CPU_INLINE void proc_dec(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    uint16_t old = ctx_read_reg(ctx, inst->reg_1);
+    uint16_t val = old - 1;
+
+    if (is_16_bit(inst->reg_1))
+    {
+        emu_cycles(gb, 1);
+    }
+
+    // HL is the only reg that has an instruction with AM_MR
+    if (inst->reg_1 == RT_HL && inst->mode == AM_MR)
+    {
+        // (HL) was read by the fetch
+        old = ctx->fetched_data;
+        val = old - 1;
+        write_address_bus(gb, ctx->memory_destination, val);
+    }
+    else
+    {
+        // why do we need to reread the value after setting it?
+        ctx_set_reg(ctx, inst->reg_1, val);
+        val = ctx_read_reg(ctx, inst->reg_1);
+    }
+
+    // the 16 bit DEC rr op codes (xB) do not set the flags
+    if (is_16_bit(inst->reg_1) && inst->mode != AM_MR)
+    {
+        return;
+    }
+
+    // H is the borrow into bit 3, (val & 0x0F) == 0x0F
+    cpu_set_lazy_flags(ctx, FLAG_Z | FLAG_N | FLAG_H, FLAG_N, old ^ 1, val);
+}
+
+CPU_INLINE void proc_and(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    ctx->regs.a &= ctx->fetched_data;
+    // H is always set
+    cpu_set_lazy_flags(ctx, ALL_FLAGS, 0, ctx->regs.a ^ 0x10, ctx->regs.a);
+}
+
+CPU_INLINE void proc_or(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    ctx->regs.a |= ctx->fetched_data & 0xFF;
+    cpu_set_lazy_flags(ctx, ALL_FLAGS, 0, ctx->regs.a, ctx->regs.a);
+}
+
+CPU_INLINE void proc_xor(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    ctx->regs.a ^= ctx->fetched_data & 0xFF;
+    cpu_set_lazy_flags(ctx, ALL_FLAGS, 0, ctx->regs.a, ctx->regs.a);
+}
+
+// this is basically the sam eas SUB r but does not update register A
+CPU_INLINE void proc_cp(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    uint16_t val = ctx->regs.a - ctx->fetched_data;
+    cpu_set_lazy_flags(ctx, ALL_FLAGS, FLAG_N, ctx->regs.a ^ ctx->fetched_data, val);
+}
+
+// executes the CB prefixed instruction `op`, the generated CB handlers call
+// this with a constant so only the one bit operation is left behind
+CPU_INLINE void cb_exec(gb_t *gb, uint8_t op)
+{
+    cpu_context *ctx = &gb->cpu;
+    reg_type reg = decode_reg(op & 0b111);
+    uint8_t bit = (op >> 3) & 0b111;
+    uint8_t bit_op = (op >> 6) & 0b111;
+    uint8_t reg_val = ctx_read_reg8(gb, reg);
+
+    if (reg == RT_HL)
+    {
+        emu_cycles(gb, 2);
+    }
+
+    switch(bit_op)
+    {
+        case 1:
+            // BIT
+            // Z is the bit inverted, H is set and C is left alone
+            cpu_set_lazy_flags(ctx, FLAG_Z | FLAG_N | FLAG_H, 0, (reg_val & (1 << bit)) ^ 0x10, reg_val & (1 << bit));
+            return;
+        case 2:
+            //RES
+            reg_val &= ~(1 << bit);
+            ctx_set_reg8(gb, reg, reg_val);
+            return;
+        case 3:
+            //SET
+            reg_val |= (1 << bit);
+            ctx_set_reg8(gb, reg, reg_val);
+            return;
+    }
+
+    bool flagC = CPU_FLAG_C;
+    switch(bit)
+    {
+        case 0: {
+            //RLC - Rotate Left old bit 7 to carry flag
+            bool setC = false;
+            uint8_t result = (reg_val << 1) & 0xFF;
+
+            // if bit 7 is not set on reg_val
+            if ((reg_val & (1 << 7)) != 0)
+            {
+                result |= 1;
+                setC = true;
+            }
+            ctx_set_reg8(gb, reg, result);
+            cpu_set_lazy_flags(ctx, ALL_FLAGS, 0, result, result | (setC << 8));
+        } return;
+
+        case 1: {
+            //RRC - Rotate Right old bit 0 to carry flag
+            uint8_t old = reg_val;
+            reg_val >>= 1;
+            reg_val |= (old << 7);
+            ctx_set_reg8(gb, reg, reg_val);
+            cpu_set_lazy_flags(ctx, ALL_FLAGS, 0, reg_val, reg_val | ((old & 1) << 8));
+
+        } return;
+
+        case 2: {
+            //RL - Rotate Left
+            uint8_t old = reg_val;
+            reg_val <<= 1;
+            reg_val |= flagC;
+            ctx_set_reg8(gb, reg, reg_val);
+            // old bit 7 goes to the carry in bit 8
+            cpu_set_lazy_flags(ctx, ALL_FLAGS, 0, reg_val, reg_val | ((old & 0x80) << 1));
+        } return;
+
+        case 3: {
+            //RR - Rotate Right
+            uint8_t old = reg_val;
+            reg_val >>= 1;
+            reg_val |= (flagC << 7);
+            ctx_set_reg8(gb, reg, reg_val);
+            cpu_set_lazy_flags(ctx, ALL_FLAGS, 0, reg_val, reg_val | ((old & 1) << 8));
+        } return;
+
+        case 4: {
+            //SLA - Shift Left And carry
+            uint8_t old = reg_val;
+            reg_val <<= 1;
+            ctx_set_reg8(gb, reg, reg_val);
+            cpu_set_lazy_flags(ctx, ALL_FLAGS, 0, reg_val, reg_val | ((old & 0x80) << 1));
+        } return;
+
+        case 5: {
+            //SRA - Shift Right And carry
+            uint8_t u = (int8_t)reg_val >> 1;
+            ctx_set_reg8(gb, reg, u);
+            cpu_set_lazy_flags(ctx, ALL_FLAGS, 0, u, u | ((reg_val & 1) << 8));
+        } return;
+
+        case 6: {
+            //SWAP - swap high and low nibbles
+            reg_val = ((reg_val & 0xF0) >> 4) | ((reg_val & 0xF) << 4);
+            ctx_set_reg8(gb, reg, reg_val);
+            cpu_set_lazy_flags(ctx, ALL_FLAGS, 0, reg_val, reg_val);
+        } return;
+
+        case 7: {
+            //SRL
+            uint8_t u = reg_val >> 1;
+            ctx_set_reg8(gb, reg, u);
+            cpu_set_lazy_flags(ctx, ALL_FLAGS, 0, u, u | ((reg_val & 1) << 8));
+        } return;
+    }
+
+    gb_fault(gb, "invalid cb: %02X", op);
+}
+
+CPU_INLINE void proc_cb(gb_t *gb, const instruction *inst)
+{
+    cpu_context *ctx = &gb->cpu;
+    cb_exec(gb, ctx->fetched_data);
+}
+
+// **Execute**
+
+// runs the processor for `inst`, operands must already be fetched
+CPU_INLINE void cpu_execute(gb_t *gb, const instruction *inst)
+{
+    switch(inst->type)
+    {
+        case IN_NONE: proc_none(gb, inst); return;
+        case IN_NOP: proc_nop(gb, inst); return;
+        case IN_LD: proc_ld(gb, inst); return;
+        case IN_LDH: proc_ldh(gb, inst); return;
+        case IN_JP: proc_jp(gb, inst); return;
+        case IN_JR: proc_jr(gb, inst); return;
+        case IN_CALL: proc_call(gb, inst); return;
+        case IN_RST: proc_rst(gb, inst); return;
+        case IN_RET: proc_ret(gb, inst); return;
+        case IN_RETI: proc_reti(gb, inst); return;
+        case IN_DI: proc_di(gb, inst); return;
+        case IN_EI: proc_ei(gb, inst); return;
+        case IN_HALT: proc_halt(gb, inst); return;
+        case IN_POP: proc_pop(gb, inst); return;
+        case IN_PUSH: proc_push(gb, inst); return;
+        case IN_ADD: proc_add(gb, inst); return;
+        case IN_ADC: proc_adc(gb, inst); return;
+        case IN_INC: proc_inc(gb, inst); return;
+        case IN_DEC: proc_dec(gb, inst); return;
+        case IN_SUB: proc_sub(gb, inst); return;
+        case IN_SBC: proc_sbc(gb, inst); return;
+        case IN_AND: proc_and(gb, inst); return;
+        case IN_OR: proc_or(gb, inst); return;
+        case IN_XOR: proc_xor(gb, inst); return;
+        case IN_CP: proc_cp(gb, inst); return;
+        case IN_CB: proc_cb(gb, inst); return;
+        default:
+            gb_fault(gb, "instruction not implemented: %s", get_instruction_name(inst->type));
+    }
+}
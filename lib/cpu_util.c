@@ -1,170 +1,58 @@
-#include <common.h>
-#include <cpu.h>
-#include <memorymap.h>
-
-extern cpu_context ctx;
-
-uint16_t reverse(uint16_t n)
-{
-    return ((n & 0xFF00) >> 8) | ((n & 0x00FF) << 8);
-}
-
-uint16_t cpu_read_reg(reg_type rt)
-{
-    switch(rt)
-    {
-        case RT_A:
-            return ctx.regs.a;
-        case RT_F:
-            return ctx.regs.f;
-        case RT_B:
-            return ctx.regs.b;
-        case RT_C:
-            return ctx.regs.c;
-        case RT_D:
-            return ctx.regs.d;
-        case RT_E:
-            return ctx.regs.e;
-        case RT_H:
-            return ctx.regs.h;
-        case RT_L:
-            return ctx.regs.l;
-        // not sure why these need to be reversed
-        // is it big-endian vs little-endian?
-        case RT_AF:
-            return reverse(*((uint16_t *)&ctx.regs.a));
-        case RT_BC:
-            return reverse(*((uint16_t *)&ctx.regs.b));
-        case RT_DE:
-            return reverse(*((uint16_t *)&ctx.regs.d));
-        case RT_HL:
-            return reverse(*((uint16_t *)&ctx.regs.h));
-        case RT_PC:
-            return ctx.regs.pc;
-        case RT_SP:
-            return ctx.regs.sp;
-        default:
-            return 0;
-    }
-}
-
-uint8_t cpu_read_reg8(reg_type rt)
-{
-    switch(rt)
-    {
-        case RT_A:
-            return ctx.regs.a;
-        case RT_B:
-            return ctx.regs.b;
-        case RT_C:
-            return ctx.regs.c;
-        case RT_D:
-            return ctx.regs.d;
-        case RT_E:
-            return ctx.regs.e;
-        case RT_H:
-            return ctx.regs.h;
-        case RT_L:
-            return ctx.regs.l;
-        case RT_HL:
-            return read_address_bus(cpu_read_reg(RT_HL));
-        default:
-            printf("**ERR INVALID REG8: %d\n", rt);
-            NO_IMPL
-    }
-}
-
-void cpu_set_reg(reg_type rt, uint16_t val)
-{
-    switch(rt)
-    {
-        case RT_A:
-            ctx.regs.a = val & 0xFF;
-            break;
-        case RT_F:
-            ctx.regs.f = val & 0xFF;
-            break;
-        case RT_B:
-            ctx.regs.b = val & 0xFF;
-            break;
-        case RT_C:
-            ctx.regs.c = val & 0xFF;
-            break;
-        case RT_D:
-            ctx.regs.d = val & 0xFF;
-            break;
-        case RT_E:
-            ctx.regs.e = val & 0xFF;
-            break;
-        case RT_H:
-            ctx.regs.h = val & 0xFF;
-            break;
-        case RT_L:
-            ctx.regs.l = val & 0xFF;
-            break;
-        case RT_AF: 
-            *((uint16_t *)&ctx.regs.a) = reverse(val);
-            break;
-        case RT_BC: 
-            *((uint16_t *)&ctx.regs.b) = reverse(val);
-            break;
-        case RT_DE: 
-            *((uint16_t *)&ctx.regs.d) = reverse(val);
-            break;
-        case RT_HL: 
-            *((uint16_t *)&ctx.regs.h) = reverse(val);
-            break;
-        case RT_PC:
-            ctx.regs.pc = val;
-            break;
-        case RT_SP:
-            ctx.regs.sp = val;
-            break;
-        case RT_NONE:
-            break;
-    }
-}
-
-void cpu_set_reg8(reg_type rt,  uint8_t val)
-{
-    switch(rt)
-    {
-        case RT_A:
-            ctx.regs.a = val & 0xFF;
-            break;
-        case RT_B:
-            ctx.regs.b = val & 0xFF;
-            break;
-        case RT_C:
-            ctx.regs.c = val & 0xFF;
-            break;
-        case RT_D:
-            ctx.regs.d = val & 0xFF;
-            break;
-        case RT_E:
-            ctx.regs.e = val & 0xFF;
-            break;
-        case RT_H:
-            ctx.regs.h = val & 0xFF;
-            break;
-        case RT_L:
-            ctx.regs.l = val & 0xFF;
-            break;
-        case RT_HL:
-            write_address_bus(cpu_read_reg(RT_HL), val);
-            break;
-        default:
-            printf("**ERR INVALID REG8: %d\n", rt);
-            NO_IMPL
-    }
-}
-
-uint8_t cpu_get_ie_register()
-{
-    return ctx.interrupt_enabled_register;
-}
-
-void cpu_set_ie_register(uint8_t val)
-{
-    ctx.interrupt_enabled_register = val;
+#include <common.h>
+#include <cpu.h>
+#include <gb.h>
+#include "cpu_exec.h"
+
+uint16_t cpu_read_reg(gb_t *gb, reg_type rt)
+{
+    return ctx_read_reg(&gb->cpu, rt);
+}
+
+uint8_t cpu_read_reg8(gb_t *gb, reg_type rt)
+{
+    return ctx_read_reg8(gb, rt);
+}
+
+void cpu_set_reg(gb_t *gb, reg_type rt, uint16_t val)
+{
+    ctx_set_reg(&gb->cpu, rt, val);
+}
+
+void cpu_set_reg8(gb_t *gb, reg_type rt,  uint8_t val)
+{
+    ctx_set_reg8(gb, rt, val);
+}
+
+void cpu_sync_flags(gb_t *gb)
+{
+    ctx_sync_flags(&gb->cpu);
+}
+
+uint8_t cpu_get_ie_register(gb_t *gb)
+{
+    return gb->cpu.interrupt_enabled_register;
+}
+
+void cpu_set_ie_register(gb_t *gb, uint8_t val)
+{
+    gb->cpu.interrupt_enabled_register = val;
+    cpu_update_interrupts(&gb->cpu);
+}
+
+uint8_t cpu_get_int_flags(gb_t *gb)
+{
+    // the top 3 bits aren't wired and read as 1
+    return 0xE0 | gb->cpu.interrupt_flags;
+}
+
+void cpu_set_int_flags(gb_t *gb, uint8_t val)
+{
+    gb->cpu.interrupt_flags = val & INTERRUPT_MASK;
+    cpu_update_interrupts(&gb->cpu);
+}
+
+void cpu_request_interrupt(gb_t *gb, interrupt_type t)
+{
+    gb->cpu.interrupt_flags |= t;
+    cpu_update_interrupts(&gb->cpu);
 }
\ No newline at end of file
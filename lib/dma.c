@@ -0,0 +1,71 @@
+#include <dma.h>
+#include <gb.h>
+#include <string.h>
+
+// the source page as the DMA sees it, above WRAM it reads WRAM again like
+// echo RAM does
+static uint8_t source_page(dma_context *d)
+{
+    return d->source >= 0xE0 ? d->source - 0x20 : d->source;
+}
+
+static void copy_to_oam(gb_t *gb)
+{
+    uint16_t address = source_page(&gb->dma) << 8;
+    const uint8_t *page = gb->bus.read[address >> BUS_PAGE_SHIFT];
+    if (page)
+    {
+        memcpy(gb->ppu.oam, page, OAM_DMA_LENGTH);
+        return;
+    }
+
+    // cartridge ram behind a handler (disabled, MBC2, the RTC)
+    for (int i = 0; i < OAM_DMA_LENGTH; i++)
+    {
+        gb->ppu.oam[i] = read_address_bus_handler(gb, address + i);
+    }
+}
+
+static void dma_event(gb_t *gb, uint64_t when)
+{
+    dma_context *d = &gb->dma;
+    if (d->starting)
+    {
+        d->starting = false;
+        if (!d->active)
+        {
+            d->active = true;
+            memorymap_remap(gb);
+        }
+        scheduler_schedule(gb, EVENT_DMA, when + DMA_CYCLES);
+        return;
+    }
+
+    // the bus comes back first so the source reads like it normally does
+    d->active = false;
+    memorymap_remap(gb);
+    copy_to_oam(gb);
+}
+
+void dma_init(gb_t *gb)
+{
+    dma_context *d = &gb->dma;
+    *d = (dma_context){0};
+    d->source = 0xFF;
+    scheduler_set_handler(gb, EVENT_DMA, dma_event);
+    scheduler_cancel(gb, EVENT_DMA);
+}
+
+uint8_t dma_read(gb_t *gb)
+{
+    return gb->dma.source;
+}
+
+void dma_write(gb_t *gb, uint8_t value)
+{
+    // a write during a transfer starts it over, the bus stays blocked
+    dma_context *d = &gb->dma;
+    d->source = value;
+    d->starting = true;
+    scheduler_schedule_in(gb, EVENT_DMA, DMA_START_CYCLES);
+}
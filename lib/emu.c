@@ -1,60 +1,282 @@
-#include <stdio.h>
-#include <emu.h>
-#include <cpu.h>
-#include <cartridge.h>
-
-static emu_context ctx;
-
-emu_context *emu_get_context() 
-{
-    return &ctx;
-}
-
-void delay(uint32_t ms) 
-{
-    //SDL delay?
-}
-
-int emu_run(int argc, char**argv) 
-{
-    if (argc < 2) 
-    {
-        printf("Error: Need to provide a rom file\n");
-        return -1;
-    }
-
-    if (!load_cartridge(argv[1]))
-    {
-        printf("Failed to load ROM file: %s\n", argv[1]);
-    }
-
-    printf("Cartridge loaded..\n");
-    
-    cpu_init();
-
-    ctx.running = true;
-    ctx.paused = false;
-    ctx.ticks = 0;
-
-    while(ctx.running) 
-    {
-        if (ctx.paused) 
-        {
-            //delay 10 ms
-            delay(10);
-            continue;
-        }
-
-        if (!cpu_step())
-        {
-            printf("CPU Stopped\n");
-            return -3;
-        }
-        ctx.ticks++;
-    }
-}
-
-void emu_cycles(int cpu_cycles)
-{
-    // TODO...
-}
\ No newline at end of file
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <audio.h>
+#include <emu.h>
+#include <gb.h>
+#include <savestate.h>
+#include <trace.h>
+
+static emu_context ctx;
+
+// the rate --audio records at
+#define AUDIO_RATE 48000
+
+// frames between save file syncs, about 10 seconds of play
+#define SAVE_SYNC_FRAMES 600
+
+// --serial stops at either
+#define SERIAL_PASSED "Passed"
+#define SERIAL_FAILED "Failed"
+
+emu_context *emu_get_context() 
+{
+    return &ctx;
+}
+
+void delay(uint32_t ms) 
+{
+    //SDL delay?
+}
+
+static void handle_stop_signal(int sig)
+{
+    // let the main loop finish so the trace file gets flushed
+    ctx.running = false;
+}
+
+// what the game sent since the last call, as it comes
+static void print_serial(gb_t *gb, uint64_t *printed)
+{
+    size_t length;
+    const char *output = gb_serial_output(gb, &length);
+    uint64_t fresh = gb->serial.sent - *printed;
+    if (fresh > length)
+    {
+        fresh = length;
+    }
+    fwrite(output + length - fresh, 1, fresh, stdout);
+    fflush(stdout);
+    *printed = gb->serial.sent;
+}
+
+static void print_usage(char *prog)
+{
+    printf("Usage: %s <rom file> [--trace <trace file>] [--load-state <file>] [--save-state <file>]\n", prog);
+    printf("       [--audio <wav file>] [--audio-raw <pcm file>] [--serial] [--no-jit] [--jit-lockstep] [--no-save]\n");
+    printf("       [--link-host <name> | --link-join <name>] [--link-slack <T-cycles>]\n");
+}
+
+int emu_run(int argc, char**argv) 
+{
+    char *rom_file = NULL;
+    char *trace_file = NULL;
+    char *load_state = NULL;
+    char *save_state = NULL;
+    char *audio_file = NULL;
+    audio_format format = AUDIO_WAV;
+    bool no_jit = false;
+    bool jit_lockstep = false;
+    bool no_save = false;
+    bool serial = false;
+    char *link_name = NULL;
+    int link_side = 0;
+    uint32_t link_slack = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--trace") == 0 || strcmp(argv[i], "-t") == 0) && i + 1 < argc)
+        {
+            trace_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--load-state") == 0 && i + 1 < argc)
+        {
+            load_state = argv[++i];
+        }
+        else if (strcmp(argv[i], "--save-state") == 0 && i + 1 < argc)
+        {
+            save_state = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--audio") == 0 || strcmp(argv[i], "--audio-raw") == 0) && i + 1 < argc)
+        {
+            format = strcmp(argv[i], "--audio") == 0 ? AUDIO_WAV : AUDIO_RAW;
+            audio_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-jit") == 0)
+        {
+            no_jit = true;
+        }
+        else if (strcmp(argv[i], "--jit-lockstep") == 0)
+        {
+            jit_lockstep = true;
+        }
+        else if (strcmp(argv[i], "--no-save") == 0)
+        {
+            no_save = true;
+        }
+        else if (strcmp(argv[i], "--serial") == 0)
+        {
+            serial = true;
+        }
+        else if ((strcmp(argv[i], "--link-host") == 0 || strcmp(argv[i], "--link-join") == 0) && i + 1 < argc)
+        {
+            link_side = strcmp(argv[i], "--link-host") == 0 ? 0 : 1;
+            link_name = argv[++i];
+        }
+        else if (strcmp(argv[i], "--link-slack") == 0 && i + 1 < argc)
+        {
+            link_slack = strtoul(argv[++i], NULL, 10);
+        }
+        else if (!rom_file)
+        {
+            rom_file = argv[i];
+        }
+        else
+        {
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (!rom_file) 
+    {
+        printf("Error: Need to provide a rom file\n");
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    gb_t *gb = gb_create();
+    if (!gb)
+    {
+        return -2;
+    }
+    gb_set_logging(gb, true);
+    // there's no display to show frames on yet, so the LCD only keeps time
+    gb_set_render_interval(gb, 0);
+    if (no_jit || !jit_available())
+    {
+        gb_set_jit(gb, JIT_OFF);
+    }
+    else if (jit_lockstep)
+    {
+        // checks every native block against the interpreter, slow
+        gb_set_jit(gb, JIT_LOCKSTEP);
+    }
+    if (no_save)
+    {
+        // battery ram starts blank and is thrown away on exit
+        gb_set_save_mode(gb, SAVE_MEMORY);
+    }
+
+    if (!gb_load_rom(gb, rom_file))
+    {
+        printf("Failed to load ROM file: %s\n", rom_file);
+        gb_destroy(gb);
+        return -2;
+    }
+
+    printf("Cartridge loaded..\n");
+
+    // picks up from the last snapshot in the file
+    if (load_state && !savestate_load_file(gb, load_state, -1))
+    {
+        gb_destroy(gb);
+        return -5;
+    }
+
+    // after loading, which would pull the cable out again
+    if (link_name)
+    {
+        if (!gb_link_shared(gb, link_name, link_side, link_slack))
+        {
+            gb_destroy(gb);
+            return -7;
+        }
+        printf("Linked through %s\n", link_name);
+    }
+
+    trace_writer *trace = NULL;
+    if (trace_file)
+    {
+        trace = trace_open(trace_file);
+        if (!trace)
+        {
+            gb_destroy(gb);
+            return -4;
+        }
+        printf("Tracing to %s\n", trace_file);
+    }
+    gb_set_trace(gb, trace);
+
+    audio_sink *audio = NULL;
+    if (audio_file)
+    {
+        audio = audio_sink_open(audio_file, format, AUDIO_RATE);
+        if (!audio)
+        {
+            gb_set_trace(gb, NULL);
+            trace_close(trace);
+            gb_destroy(gb);
+            return -4;
+        }
+        printf("Recording audio to %s\n", audio_file);
+        gb_set_audio_rate(gb, AUDIO_RATE);
+        gb_set_audio_sink(gb, audio);
+    }
+
+    if (serial)
+    {
+        // test ROMs end with one or the other
+        gb_serial_stop_on(gb, SERIAL_PASSED);
+        gb_serial_stop_on(gb, SERIAL_FAILED);
+    }
+
+    signal(SIGINT, handle_stop_signal);
+    signal(SIGTERM, handle_stop_signal);
+
+    ctx.running = true;
+    ctx.paused = false;
+
+    int result = 0;
+    uint64_t frames = 0;
+    uint64_t printed = 0;
+    while(ctx.running) 
+    {
+        if (ctx.paused) 
+        {
+            //delay 10 ms
+            delay(10);
+            continue;
+        }
+
+        // a frame at a time, signals get a look in between
+        gb_run_frames(gb, 1);
+        if (serial)
+        {
+            print_serial(gb, &printed);
+            const char *reason = gb_serial_stop_reason(gb);
+            if (reason)
+            {
+                printf("\n");
+                result = strcmp(reason, SERIAL_PASSED) == 0 ? 0 : -6;
+                break;
+            }
+        }
+        if (gb->stopped)
+        {
+            printf("CPU Stopped\n");
+            result = -3;
+            break;
+        }
+
+        // the game's saves are in the page cache already, this just
+        // bounds how much a power cut could lose
+        if (++frames % SAVE_SYNC_FRAMES == 0)
+        {
+            gb_sync_save(gb);
+        }
+    }
+
+    gb_set_trace(gb, NULL);
+    trace_close(trace);
+    gb_set_audio_sink(gb, NULL);
+    audio_sink_close(audio);
+
+    if (save_state && !savestate_save_file(gb, save_state))
+    {
+        printf("Failed to save state to %s\n", save_state);
+    }
+    gb_destroy(gb);
+    return result;
+}
@@ -0,0 +1,301 @@
+#include <gb.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+gb_t *gb_create()
+{
+    gb_t *gb = calloc(1, sizeof(gb_t));
+    if (!gb)
+    {
+        return NULL;
+    }
+    if (!ram_init(gb))
+    {
+        gb_destroy(gb);
+        return NULL;
+    }
+
+    scheduler_init(gb);
+    gb_set_render_interval(gb, 1);
+    gb->use_blocks = true;
+    gb->jit_mode = jit_available() ? JIT_ON : JIT_OFF;
+    gb->save_mode = SAVE_FILE;
+    // nothing to run until a rom is loaded
+    gb->stopped = true;
+    return gb;
+}
+
+void gb_destroy(gb_t *gb)
+{
+    if (!gb)
+    {
+        return;
+    }
+    link_disconnect(gb);
+    unload_cartridge(gb);
+    ram_release(gb);
+    ppu_release(gb);
+    apu_release(gb);
+    jit_free(gb);
+    blockcache_free(gb);
+    free(gb);
+}
+
+gb_t *gb_fork(gb_t *gb)
+{
+    gb_t *child = malloc(sizeof(gb_t));
+    if (!child)
+    {
+        return NULL;
+    }
+
+    // everything but the pages and rom is small enough to just copy, those
+    // get another reference and are copied on write
+    memcpy(child, gb, sizeof(gb_t));
+
+    // the trace writer belongs to the parent, the child decodes its own
+    // blocks and compiles its own code
+    child->cpu.trace = NULL;
+    child->blocks = NULL;
+    child->jit = NULL;
+
+    ram_fork(gb, child);
+    ppu_fork(gb, child);
+    apu_fork(gb, child);
+    serial_fork(gb, child);
+    if (!cartridge_fork(gb, child))
+    {
+        gb_destroy(child);
+        return NULL;
+    }
+
+    // every ram page is shared now, so neither side can write through the
+    // page table until it has its own copy
+    memorymap_remap(gb);
+    memorymap_remap(child);
+    return child;
+}
+
+static void power_on(gb_t *gb)
+{
+    // the rom may have been replaced at the same address
+    blockcache_clear(gb);
+    jit_reset(gb);
+    ram_reset(gb);
+    scheduler_init(gb);
+    timer_init(gb);
+    dma_init(gb);
+    apu_init(gb);
+    serial_init(gb);
+    link_init(gb);
+    joypad_init(gb);
+    cartridge_reset(gb);
+    ppu_init(gb);
+    memorymap_init(gb);
+    cpu_init(gb);
+
+    gb->instructions = 0;
+    gb->stopped = false;
+    gb->fault[0] = 0;
+}
+
+bool gb_load_rom(gb_t *gb, const char *path)
+{
+    if (!load_cartridge(gb, path, gb->save_mode))
+    {
+        gb->stopped = true;
+        return false;
+    }
+    power_on(gb);
+    return true;
+}
+
+void gb_reset(gb_t *gb)
+{
+    if (gb->cart.rom_data)
+    {
+        power_on(gb);
+    }
+}
+
+bool gb_step(gb_t *gb)
+{
+    return cpu_step(gb);
+}
+
+uint64_t gb_run_cycles(gb_t *gb, uint64_t t_cycles)
+{
+    uint64_t start = gb->scheduler.now;
+    gb->run_break = false;
+    gb->serial.stopped_by = -1;
+    cpu_run(gb, start + t_cycles);
+    if (gb->serial.link)
+    {
+        // the other end doesn't have to wait for the next barrier
+        link_publish(gb);
+    }
+    if (gb->apu.rate)
+    {
+        apu_catch_up(gb);
+    }
+    return gb->scheduler.now - start;
+}
+
+uint64_t gb_run_frames(gb_t *gb, uint32_t frames)
+{
+    return gb_run_cycles(gb, (uint64_t)frames * GB_FRAME_CYCLES);
+}
+
+void gb_set_trace(gb_t *gb, trace_writer *writer)
+{
+    cpu_set_trace(gb, writer);
+}
+
+void gb_set_block_cache(gb_t *gb, bool on)
+{
+    gb->use_blocks = on;
+}
+
+void gb_set_jit(gb_t *gb, jit_mode mode)
+{
+    jit_set_mode(gb, mode);
+}
+
+void gb_set_logging(gb_t *gb, bool on)
+{
+    gb->log = on;
+}
+
+void gb_set_save_mode(gb_t *gb, save_mode mode)
+{
+    gb->save_mode = mode;
+}
+
+bool gb_sync_save(gb_t *gb)
+{
+    return cartridge_sync_save(gb);
+}
+
+uint64_t gb_ticks(gb_t *gb)
+{
+    return gb->scheduler.now;
+}
+
+uint64_t gb_instruction_count(gb_t *gb)
+{
+    return gb->instructions;
+}
+
+uint64_t gb_frame_count(gb_t *gb)
+{
+    return gb->ppu.state.frames;
+}
+
+const uint32_t *gb_framebuffer(gb_t *gb)
+{
+    return ppu_framebuffer(gb);
+}
+
+uint64_t gb_framebuffer_hash(gb_t *gb)
+{
+    return ppu_framebuffer_hash(gb);
+}
+
+void gb_set_audio_rate(gb_t *gb, uint32_t rate)
+{
+    apu_set_rate(gb, rate);
+}
+
+void gb_set_audio_sink(gb_t *gb, audio_sink *sink)
+{
+    apu_set_sink(gb, sink);
+}
+
+uint64_t gb_audio_hash(gb_t *gb)
+{
+    return gb->apu.hash;
+}
+
+void gb_set_render_interval(gb_t *gb, uint32_t interval)
+{
+    ppu_set_render_interval(gb, interval);
+}
+
+bool gb_request_frame(gb_t *gb, uint64_t frame)
+{
+    return ppu_request_frame(gb, frame);
+}
+
+const char *gb_serial_output(gb_t *gb, size_t *length)
+{
+    if (length)
+    {
+        *length = gb->serial.length;
+    }
+    return gb->serial.output;
+}
+
+bool gb_serial_stop_on(gb_t *gb, const char *text)
+{
+    return serial_stop_on(gb, text);
+}
+
+const char *gb_serial_stop_reason(gb_t *gb)
+{
+    int rule = gb->serial.stopped_by;
+    return rule >= 0 ? gb->serial.stop_rules[rule] : NULL;
+}
+
+bool gb_link(gb_t *a, gb_t *b, uint32_t slack)
+{
+    return link_connect(a, b, slack);
+}
+
+bool gb_link_shared(gb_t *gb, const char *name, int side, uint32_t slack)
+{
+    return link_connect_shared(gb, name, side, slack);
+}
+
+void gb_unlink(gb_t *gb)
+{
+    link_disconnect(gb);
+}
+
+void gb_set_fixed_ly(gb_t *gb, int ly)
+{
+    ppu_set_fixed_ly(gb, ly);
+}
+
+const cpu_registers *gb_regs(gb_t *gb)
+{
+    return cpu_get_regs(gb);
+}
+
+const cartridge_info *gb_cartridge_info(gb_t *gb)
+{
+    return cartridge_get_info(gb);
+}
+
+const char *gb_fault_message(gb_t *gb)
+{
+    return gb->fault[0] ? gb->fault : NULL;
+}
+
+void gb_fault(gb_t *gb, const char *fmt, ...)
+{
+    if (!gb->fault[0])
+    {
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(gb->fault, sizeof(gb->fault), fmt, args);
+        va_end(args);
+
+        if (gb->log)
+        {
+            printf("%s\n", gb->fault);
+        }
+    }
+    gb->stopped = true;
+}
\ No newline at end of file
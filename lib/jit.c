@@ -0,0 +1,1466 @@
+#include <jit.h>
+#include <emu.h>
+#include <gb.h>
+#include <instructions.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef GBEMU_JIT
+#include <cpuid.h>
+#include <sys/mman.h>
+#endif
+
+// a block exit that goes straight on into the block last run after it, at
+// `pc`, through that block's chain entry (see emit_chain_entry())
+typedef struct {
+    const uint8_t *entry;
+    uint16_t pc;
+} jit_link;
+
+struct jit_context {
+    uint8_t *code;
+    size_t used;
+    jit_link links[JIT_MAX_LINKS];
+    int link_count;
+    // the exit the last native code left through without a block to go on
+    // into, the next block run gets linked to it
+    jit_link *pending;
+
+    // the block being run, for the helpers the native code calls. the
+    // native code changes them as it goes from block to block
+    code_block *block;
+    uint64_t until;
+    const uint32_t *gen;
+    uint32_t expected;
+    // T-cycles past the native code's base time it can run up to, 0 once
+    // it has to stop
+    uint64_t window;
+
+    // interpreter only copy for JIT_LOCKSTEP
+    gb_t *shadow;
+};
+
+void jit_set_mode(gb_t *gb, jit_mode mode)
+{
+    gb->jit_mode = mode;
+    if (mode != JIT_LOCKSTEP && gb->jit && gb->jit->shadow)
+    {
+        gb_destroy(gb->jit->shadow);
+        gb->jit->shadow = NULL;
+    }
+}
+
+#ifdef GBEMU_JIT
+
+// **Runtime**
+
+static uint64_t window_from(gb_t *gb, jit_context *jit, uint64_t base)
+{
+    // an interrupt is taken by the interpreter at the next boundary
+    if (gb->stopped || gb->run_break || gb->cpu.interrupt_pending || *jit->gen != jit->expected)
+    {
+        return 0;
+    }
+
+    // an event fires as soon as the clock reaches it, native code has to be
+    // done before then
+    uint64_t limit = gb->scheduler.next - 1;
+    if (jit->until < limit)
+    {
+        limit = jit->until;
+    }
+    int64_t window = (int64_t)(limit - base);
+    return window > 0 ? window : 0;
+}
+
+// called from native code for bus pages without a direct pointer, they can
+// stop the instance or schedule something, so the window is worked out
+// again after
+static uint32_t jit_read(gb_t *gb, uint32_t address, uint64_t base)
+{
+    uint8_t value = read_address_bus_handler(gb, address);
+    gb->jit->window = window_from(gb, gb->jit, base);
+    return value;
+}
+
+static void jit_write(gb_t *gb, uint32_t address, uint32_t value, uint64_t base)
+{
+    write_address_bus_handler(gb, address, value);
+    gb->jit->window = window_from(gb, gb->jit, base);
+}
+
+// runs an op that isn't translated through its handler, the same steps as
+// the block cache. returns the new base time: the clock as if the op had
+// taken `next_start` cycles since the old one
+static uint64_t jit_call(gb_t *gb, uint32_t op, BLOCK_PROC proc, uint32_t next_start)
+{
+    cpu_context *ctx = &gb->cpu;
+    ctx->current_opcode = op & 0xFF;
+    ctx->regs.pc++;
+    emu_cycles(gb, 1);
+    proc(gb, op >> 8);
+    cpu_sync_flags(gb);
+
+    uint64_t base = gb->scheduler.now - next_start;
+    gb->jit->window = window_from(gb, gb->jit, base);
+    return base;
+}
+
+bool jit_available(void)
+{
+    // the flags come out of LAHF, which the first x86-64 chips didn't have
+    unsigned int eax, ebx, ecx, edx;
+    return __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) && (ecx & 1);
+}
+
+static jit_context *get_context(gb_t *gb)
+{
+    if (gb->jit)
+    {
+        return gb->jit;
+    }
+
+    jit_context *jit = calloc(1, sizeof(jit_context));
+    if (!jit)
+    {
+        return NULL;
+    }
+    // writable while compiling, executable while running
+    jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED)
+    {
+        free(jit);
+        return NULL;
+    }
+    gb->jit = jit;
+    return jit;
+}
+
+static void drop_native(code_block *block)
+{
+    block->native = NULL;
+    block->chain = NULL;
+    block->runs = 0;
+}
+
+// the links go with the code that jumps through them
+static void drop_code(jit_context *jit)
+{
+    jit->used = 0;
+    jit->link_count = 0;
+    jit->pending = NULL;
+}
+
+void jit_reset(gb_t *gb)
+{
+    jit_context *jit = gb->jit;
+    if (!jit)
+    {
+        return;
+    }
+    blockcache_each(gb, drop_native);
+    drop_code(jit);
+    if (jit->shadow)
+    {
+        gb_destroy(jit->shadow);
+        jit->shadow = NULL;
+    }
+}
+
+void jit_free(gb_t *gb)
+{
+    if (!gb->jit)
+    {
+        return;
+    }
+    jit_reset(gb);
+    munmap(gb->jit->code, JIT_CODE_SIZE);
+    free(gb->jit);
+    gb->jit = NULL;
+}
+
+// **Lockstep**
+
+static bool same_memory(gb_t *a, gb_t *b)
+{
+    for (int page = 0; page < BUS_PAGE_COUNT; page++)
+    {
+        uint8_t *x = a->bus.read[page];
+        uint8_t *y = b->bus.read[page];
+        if (x && y && x != y && memcmp(x, y, BUS_PAGE_SIZE) != 0)
+        {
+            return false;
+        }
+    }
+    return memcmp(a->ram.hram, b->ram.hram, sizeof(a->ram.hram)) == 0;
+}
+
+static void print_regs(const char *name, gb_t *gb)
+{
+    const cpu_registers *r = &gb->cpu.regs;
+    printf("  %-8s PC:%04X SP:%04X A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X ticks:%llu instructions:%llu\n",
+        name, r->pc, r->sp, r->a, r->f, r->b, r->c, r->d, r->e, r->h, r->l,
+        (unsigned long long)gb->scheduler.now, (unsigned long long)gb->instructions);
+}
+
+// brings the shadow up to the same instruction and compares. interrupts
+// and HALT take steps without running an instruction, so it goes on to the
+// same cycle as well
+static void lockstep_check(gb_t *gb, const code_block *block, int done)
+{
+    gb_t *shadow = gb->jit->shadow;
+    while (!shadow->stopped && shadow->scheduler.now <= gb->scheduler.now &&
+        (shadow->instructions < gb->instructions || shadow->scheduler.now < gb->scheduler.now))
+    {
+        cpu_step(shadow);
+    }
+    cpu_sync_flags(shadow);
+
+    const cpu_context *a = &gb->cpu;
+    const cpu_context *b = &shadow->cpu;
+    const char *what = NULL;
+    if (memcmp(&a->regs, &b->regs, sizeof(cpu_registers)) != 0)
+    {
+        what = "registers";
+    }
+    else if (gb->scheduler.now != shadow->scheduler.now)
+    {
+        what = "clocks";
+    }
+    else if (gb->instructions != shadow->instructions)
+    {
+        what = "instruction counts";
+    }
+    else if (gb->stopped != shadow->stopped)
+    {
+        what = "fault states";
+    }
+    else if (a->halted != b->halted || a->master_interrupt_enabled != b->master_interrupt_enabled ||
+        a->enabling_ime != b->enabling_ime || a->halt_bug != b->halt_bug ||
+        a->interrupt_flags != b->interrupt_flags ||
+        a->interrupt_enabled_register != b->interrupt_enabled_register)
+    {
+        what = "interrupt states";
+    }
+    else if (!same_memory(gb, shadow))
+    {
+        what = "memory";
+    }
+
+    if (what)
+    {
+        if (gb->log)
+        {
+            printf("jit lockstep: %s differ after the block at %04X (%d of %d ops native)\n",
+                what, block->pc, done, block->count);
+            print_regs("jit", gb);
+            print_regs("interp", shadow);
+        }
+        gb_fault(gb, "jit lockstep: %s differ after the block at %04X", what, block->pc);
+    }
+}
+
+int jit_run(gb_t *gb, code_block **current, uint64_t until)
+{
+    code_block *block = *current;
+    jit_context *jit = gb->jit;
+    if (gb->jit_mode == JIT_OFF || !jit)
+    {
+        return 0;
+    }
+
+    if (gb->jit_mode == JIT_LOCKSTEP && !jit->shadow)
+    {
+        // the copy starts from here and catches up at each check, this
+        // block just runs through the interpreter this time
+        jit->shadow = gb_fork(gb);
+        if (jit->shadow)
+        {
+            jit->shadow->use_blocks = false;
+            jit->shadow->jit_mode = JIT_OFF;
+            jit->shadow->log = false;
+        }
+        return 0;
+    }
+
+    if (jit->pending)
+    {
+        // the last native code came here, next time it comes straight in
+        jit->pending->pc = block->pc;
+        jit->pending->entry = block->chain;
+        jit->pending = NULL;
+    }
+
+    jit->block = block;
+    jit->until = until;
+    jit->gen = &gb->bus.code_gen[block->pc >> BUS_PAGE_SHIFT];
+    jit->expected = block->gen;
+    uint64_t window = window_from(gb, jit, gb->scheduler.now);
+    if (window == 0)
+    {
+        return 0;
+    }
+
+    cpu_sync_flags(gb);
+    int done = block->native(gb, window);
+    *current = jit->block;
+    if (jit->shadow)
+    {
+        lockstep_check(gb, jit->block, done);
+    }
+    return done;
+}
+
+// **Assembler**
+// Just enough x86-64 encoding for the templates below. The native code
+// keeps these in callee saved registers:
+//   rbx  the instance, every SM83 register is [rbx + offset]
+//   r12  flag_table
+//   r13  base time, each op's cycle offset is from here
+//   r14  the jit_context
+//   r15  the window, T-cycles past r13 the code can run up to
+// eax, ecx, edx and esi are scratch.
+
+enum { EAX, ECX, EDX, EBX, ESP, EBP, ESI, EDI };
+
+// condition codes for jcc
+enum { CC_B = 0x2, CC_Z = 0x4, CC_NZ = 0x5 };
+
+#define OFFSET(field) ((int32_t)offsetof(gb_t, field))
+
+typedef struct {
+    uint8_t *p;
+    uint8_t *end;
+    bool overflow;
+} asm_buf;
+
+static void emit8(asm_buf *a, uint8_t v)
+{
+    if (a->p >= a->end)
+    {
+        a->overflow = true;
+        return;
+    }
+    *a->p++ = v;
+}
+
+static void emit16(asm_buf *a, uint16_t v)
+{
+    emit8(a, v & 0xFF);
+    emit8(a, v >> 8);
+}
+
+static void emit32(asm_buf *a, uint32_t v)
+{
+    emit16(a, v & 0xFFFF);
+    emit16(a, v >> 16);
+}
+
+static void emit64(asm_buf *a, uint64_t v)
+{
+    emit32(a, v & 0xFFFFFFFF);
+    emit32(a, v >> 32);
+}
+
+static void emit_bytes(asm_buf *a, const char *bytes, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        emit8(a, bytes[i]);
+    }
+}
+
+#define EMIT(a, ...) emit_bytes(a, (const char[]){ __VA_ARGS__ }, sizeof((const char[]){ __VA_ARGS__ }))
+
+// ModRM for [rbx + disp32] with `reg` in the reg field
+static void mem(asm_buf *a, int reg, int32_t disp)
+{
+    emit8(a, 0x80 | (reg << 3) | EBX);
+    emit32(a, disp);
+}
+
+// rel32 jump, returns where the offset goes so it can be patched
+static uint8_t *jump(asm_buf *a, int cc)
+{
+    if (cc < 0)
+    {
+        emit8(a, 0xE9);
+    }
+    else
+    {
+        EMIT(a, 0x0F, 0x80 | cc);
+    }
+    uint8_t *fixup = a->p;
+    emit32(a, 0);
+    return fixup;
+}
+
+static void patch(asm_buf *a, uint8_t *fixup, const uint8_t *target)
+{
+    if (a->overflow)
+    {
+        return;
+    }
+    int32_t rel = (int32_t)(target - (fixup + 4));
+    memcpy(fixup, &rel, 4);
+}
+
+static void jump_to(asm_buf *a, const uint8_t *target)
+{
+    patch(a, jump(a, -1), target);
+}
+
+static void call(asm_buf *a, const void *fn)
+{
+    // movabs rax, fn; call rax
+    EMIT(a, 0x48, 0xB8);
+    emit64(a, (uint64_t)(uintptr_t)fn);
+    EMIT(a, 0xFF, 0xD0);
+}
+
+// **Registers**
+
+static int32_t reg8_offset(reg_type rt)
+{
+    switch (rt)
+    {
+        case RT_A: return OFFSET(cpu.regs.a);
+        case RT_F: return OFFSET(cpu.regs.f);
+        case RT_B: return OFFSET(cpu.regs.b);
+        case RT_C: return OFFSET(cpu.regs.c);
+        case RT_D: return OFFSET(cpu.regs.d);
+        case RT_E: return OFFSET(cpu.regs.e);
+        case RT_H: return OFFSET(cpu.regs.h);
+        case RT_L: return OFFSET(cpu.regs.l);
+        default: return -1;
+    }
+}
+
+static bool is_reg8(reg_type rt)
+{
+    return rt != RT_F && reg8_offset(rt) >= 0;
+}
+
+// BC, DE, HL and SP
+static bool is_reg16(reg_type rt)
+{
+    return rt == RT_BC || rt == RT_DE || rt == RT_HL || rt == RT_SP;
+}
+
+// pairs are little endian uint16_t fields on x86-64, the same as SP
+static int32_t reg16_offset(reg_type rt)
+{
+    switch (rt)
+    {
+        case RT_BC: return OFFSET(cpu.regs.bc);
+        case RT_DE: return OFFSET(cpu.regs.de);
+        case RT_HL: return OFFSET(cpu.regs.hl);
+        default: return OFFSET(cpu.regs.sp);
+    }
+}
+
+// movzx r32, byte [reg]
+static void load8(asm_buf *a, int r, reg_type rt)
+{
+    EMIT(a, 0x0F, 0xB6);
+    mem(a, r, reg8_offset(rt));
+}
+
+// mov byte [reg], r8
+static void store8(asm_buf *a, reg_type rt, int r)
+{
+    emit8(a, 0x88);
+    mem(a, r, reg8_offset(rt));
+}
+
+static void store8_imm(asm_buf *a, reg_type rt, uint8_t value)
+{
+    emit8(a, 0xC6);
+    mem(a, 0, reg8_offset(rt));
+    emit8(a, value);
+}
+
+// movzx r32, word [reg]
+static void load16(asm_buf *a, int r, reg_type rt)
+{
+    EMIT(a, 0x0F, 0xB7);
+    mem(a, r, reg16_offset(rt));
+}
+
+// mov word [reg], r16
+static void store16(asm_buf *a, reg_type rt, int r)
+{
+    EMIT(a, 0x66, 0x89);
+    mem(a, r, reg16_offset(rt));
+}
+
+static void store16_imm(asm_buf *a, reg_type rt, uint16_t value)
+{
+    EMIT(a, 0x66, 0xC7);
+    mem(a, 0, reg16_offset(rt));
+    emit16(a, value);
+}
+
+static void mov_imm(asm_buf *a, int r, uint32_t value)
+{
+    emit8(a, 0xB8 | r);
+    emit32(a, value);
+}
+
+// **Flags**
+// Native code keeps F itself up to date rather than the interpreter's lazy
+// flags (see cpu.h), anything pending is worked out on the way in and after
+// each handler call
+
+#define FLAG_ALL (FLAG_Z | FLAG_N | FLAG_H | FLAG_C)
+
+// LAHF's ZF, AF and CF (bits 6, 4 and 0) moved to Z, H and C. x86 AF is the
+// carry/borrow out of bit 3, which is exactly H for the 8 bit ops
+#define LAHF_FLAGS(ah) ((((ah) & 0x40) << 1) | (((ah) & 0x10) << 1) | (((ah) & 0x01) << 4))
+#define LAHF_4(x) LAHF_FLAGS(x), LAHF_FLAGS(x + 1), LAHF_FLAGS(x + 2), LAHF_FLAGS(x + 3)
+#define LAHF_16(x) LAHF_4(x), LAHF_4(x + 4), LAHF_4(x + 8), LAHF_4(x + 12)
+#define LAHF_64(x) LAHF_16(x), LAHF_16(x + 16), LAHF_16(x + 32), LAHF_16(x + 48)
+
+static const uint8_t flag_table[256] = { LAHF_64(0), LAHF_64(64), LAHF_64(128), LAHF_64(192) };
+
+// F = (F & keep) | (x86 flags & from_x86) | set, straight after the x86 op
+static void x86_flags(asm_buf *a, uint8_t from_x86, uint8_t set, uint8_t keep)
+{
+    // lahf; movzx eax, ah; movzx eax, byte [r12 + rax]
+    EMIT(a, 0x9F, 0x0F, 0xB6, 0xC4, 0x41, 0x0F, 0xB6, 0x04, 0x04);
+    EMIT(a, 0x24, from_x86);
+    if (set)
+    {
+        EMIT(a, 0x0C, set);
+    }
+    load8(a, ECX, RT_F);
+    // and ecx, keep; or al, cl
+    EMIT(a, 0x83, 0xE1, keep, 0x08, 0xC8);
+    store8(a, RT_F, EAX);
+}
+
+// **Translation**
+
+typedef struct {
+    const block_op *op;
+    const instruction *inst;
+    // translated, otherwise the op's handler is called
+    bool native;
+    // native and goes through the bus, which can call a handler
+    bool access;
+    // flags it writes and reads
+    uint8_t defs;
+    uint8_t uses;
+    uint16_t pc;
+    // cycle offset from the base time, and the most it can take
+    uint32_t start;
+    uint32_t cycles;
+    // cycles in when the bus access happens
+    uint32_t access_at;
+    // computes its flags (they're needed)
+    bool flags;
+    // every flag is up to date in F before this op, the code can stop here
+    bool safe;
+} op_info;
+
+// an op's handler never takes longer than CALL
+#define HANDLER_MAX_CYCLES 24
+
+static bool is_alu(instruction_type type)
+{
+    switch (type)
+    {
+        case IN_ADD:
+        case IN_ADC:
+        case IN_SUB:
+        case IN_SBC:
+        case IN_AND:
+        case IN_OR:
+        case IN_XOR:
+        case IN_CP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// (BC), (DE), (HL) and (C)
+static bool is_pointer(reg_type rt)
+{
+    return rt == RT_BC || rt == RT_DE || rt == RT_HL || rt == RT_C;
+}
+
+// which ops get translated, with the cycles the interpreter would charge
+// for them (opcode fetch included)
+static void classify(op_info *o)
+{
+    const instruction *inst = o->inst;
+    o->native = true;
+    o->access = false;
+    o->defs = 0;
+    o->uses = 0;
+    o->cycles = 4;
+
+    switch (inst->type)
+    {
+        case IN_NOP:
+            return;
+        case IN_LD:
+            switch (inst->mode)
+            {
+                case AM_R_R:
+                    if (is_reg8(inst->reg_1) && is_reg8(inst->reg_2))
+                    {
+                        return;
+                    }
+                    break;
+                case AM_R_N8:
+                    if (is_reg8(inst->reg_1))
+                    {
+                        o->cycles = 8;
+                        return;
+                    }
+                    break;
+                case AM_R_N16:
+                    if (is_reg16(inst->reg_1))
+                    {
+                        o->cycles = 12;
+                        return;
+                    }
+                    break;
+                case AM_R_MR:
+                    if (is_reg8(inst->reg_1) && is_pointer(inst->reg_2))
+                    {
+                        o->access = true;
+                        o->access_at = 4;
+                        o->cycles = 8;
+                        return;
+                    }
+                    break;
+                case AM_MR_R:
+                    if (is_pointer(inst->reg_1) && is_reg8(inst->reg_2))
+                    {
+                        o->access = true;
+                        o->access_at = 4;
+                        o->cycles = 8;
+                        return;
+                    }
+                    break;
+                case AM_R_HLI:
+                case AM_R_HLD:
+                    if (is_reg8(inst->reg_1))
+                    {
+                        o->access = true;
+                        o->access_at = 4;
+                        o->cycles = 8;
+                        return;
+                    }
+                    break;
+                case AM_MR_N8:
+                    if (is_reg16(inst->reg_1) && inst->reg_1 != RT_SP)
+                    {
+                        o->access = true;
+                        o->access_at = 8;
+                        o->cycles = 12;
+                        return;
+                    }
+                    break;
+                case AM_R_A16:
+                    if (is_reg8(inst->reg_1))
+                    {
+                        o->access = true;
+                        o->access_at = 12;
+                        o->cycles = 16;
+                        return;
+                    }
+                    break;
+                default:
+                    break;
+            }
+            break;
+        case IN_INC:
+        case IN_DEC:
+            if (inst->mode == AM_R && is_reg8(inst->reg_1))
+            {
+                o->defs = FLAG_Z | FLAG_N | FLAG_H;
+                return;
+            }
+            if (inst->mode == AM_R && is_reg16(inst->reg_1))
+            {
+                o->cycles = 8;
+                return;
+            }
+            break;
+        case IN_JP:
+        case IN_JR:
+            if ((inst->type == IN_JP && inst->mode == AM_N16) || (inst->type == IN_JR && inst->mode == AM_N8))
+            {
+                o->uses = inst->cond == CT_Z || inst->cond == CT_NZ ? FLAG_Z :
+                    inst->cond == CT_C || inst->cond == CT_NC ? FLAG_C : 0;
+                // taken
+                o->cycles = inst->type == IN_JP ? 16 : 12;
+                return;
+            }
+            break;
+        default:
+            if (!is_alu(inst->type))
+            {
+                break;
+            }
+            if (inst->type == IN_ADD && inst->reg_1 == RT_HL && inst->mode == AM_R_R && is_reg16(inst->reg_2))
+            {
+                o->defs = FLAG_N | FLAG_H | FLAG_C;
+                o->cycles = 8;
+                return;
+            }
+            if (inst->reg_1 != RT_A)
+            {
+                break;
+            }
+            o->defs = FLAG_ALL;
+            o->uses = inst->type == IN_ADC || inst->type == IN_SBC ? FLAG_C : 0;
+            if (inst->mode == AM_R_R && is_reg8(inst->reg_2))
+            {
+                return;
+            }
+            if (inst->mode == AM_R_N8)
+            {
+                o->cycles = 8;
+                return;
+            }
+            if (inst->mode == AM_R_MR && inst->reg_2 == RT_HL)
+            {
+                o->access = true;
+                o->access_at = 4;
+                o->cycles = 8;
+                return;
+            }
+            break;
+    }
+
+    o->native = false;
+    o->defs = 0;
+    o->uses = FLAG_ALL;
+    o->cycles = HANDLER_MAX_CYCLES;
+}
+
+// flag elision: an op computes its flags only if one of them can be seen,
+// by a later op reading it or by the block stopping before it's written
+// again. The block can stop at its end, after anything that calls out, and
+// at boundaries where F is up to date (`safe`)
+static void plan_flags(op_info *ops, int count)
+{
+    uint8_t live = FLAG_ALL;
+    for (int i = count - 1; i >= 0; i--)
+    {
+        op_info *o = &ops[i];
+        if (!o->native || o->access)
+        {
+            live = FLAG_ALL;
+        }
+        o->flags = (o->defs & live) != 0;
+        live = (live & ~o->defs) | o->uses;
+    }
+
+    uint8_t stale = 0;
+    for (int i = 0; i < count; i++)
+    {
+        ops[i].safe = stale == 0;
+        stale = ops[i].flags ? stale & ~ops[i].defs : stale | ops[i].defs;
+    }
+}
+
+typedef enum {
+    STUB_STOP,
+    STUB_READ,
+    STUB_WRITE,
+    STUB_TAKEN
+} stub_kind;
+
+// out of line code, emitted after the block
+typedef struct {
+    stub_kind kind;
+    int index;
+    uint8_t *fixup;
+    uint8_t *resume;
+} stub;
+
+#define MAX_STUBS (BLOCK_MAX_OPS * 2 + 1)
+
+typedef struct {
+    asm_buf *a;
+    jit_context *jit;
+    const code_block *block;
+    op_info ops[BLOCK_MAX_OPS + 1];
+    stub stubs[MAX_STUBS];
+    int stub_count;
+    uint8_t *epilogue;
+} translation;
+
+static void add_stub(translation *t, stub_kind kind, int index, uint8_t *fixup)
+{
+    stub *s = &t->stubs[t->stub_count++];
+    s->kind = kind;
+    s->index = index;
+    s->fixup = fixup;
+    s->resume = t->a->p;
+}
+
+// puts the clock at base + `cycles`
+static void set_clock(asm_buf *a, uint32_t cycles)
+{
+    // lea rax, [r13 + cycles]; mov [now], rax
+    EMIT(a, 0x49, 0x8D, 0x85);
+    emit32(a, cycles);
+    emit8(a, 0x48);
+    emit8(a, 0x89);
+    mem(a, EAX, OFFSET(scheduler.now));
+}
+
+static void set_pc(asm_buf *a, uint16_t pc)
+{
+    EMIT(a, 0x66, 0xC7);
+    mem(a, 0, OFFSET(cpu.regs.pc));
+    emit16(a, pc);
+}
+
+static void set_opcode(asm_buf *a, uint8_t opcode)
+{
+    emit8(a, 0xC6);
+    mem(a, 0, OFFSET(cpu.current_opcode));
+    emit8(a, opcode);
+}
+
+static void add_instructions(asm_buf *a, uint32_t count)
+{
+    EMIT(a, 0x48, 0x81);
+    mem(a, 0, OFFSET(instructions));
+    emit32(a, count);
+}
+
+// goes on into the block last seen after this exit if PC is where that
+// block is, leaves (with eax ops done) otherwise. the exits after a jump
+// always go to the same place, ones after a handler (a call or return) can
+// go anywhere
+static void emit_link(translation *t, uint16_t pc)
+{
+    asm_buf *a = t->a;
+    jit_link *link = &t->jit->links[t->jit->link_count++];
+    link->entry = NULL;
+    link->pc = pc;
+
+    // movabs rcx, link; movzx edx, word [pc]; cmp dx, [rcx + pc]; jne out
+    // mov rdx, [rcx]; test rdx, rdx; jz out; jmp rdx
+    EMIT(a, 0x48, 0xB9);
+    emit64(a, (uint64_t)(uintptr_t)link);
+    EMIT(a, 0x0F, 0xB7);
+    mem(a, EDX, OFFSET(cpu.regs.pc));
+    EMIT(a, 0x66, 0x3B, 0x51, offsetof(jit_link, pc), 0x75, 0x0A);
+    EMIT(a, 0x48, 0x8B, 0x11, 0x48, 0x85, 0xD2, 0x74, 0x02, 0xFF, 0xE2);
+    // out: mov [r14 + pending], rcx
+    EMIT(a, 0x49, 0x89, 0x8E);
+    emit32(a, offsetof(jit_context, pending));
+}
+
+// leaves with `ran` ops done, pc and the clock where the interpreter would
+// have them. having run the whole block it can go on into the next one
+static void emit_exit(translation *t, int ran, uint16_t pc, uint32_t cycles)
+{
+    asm_buf *a = t->a;
+    if (ran > 0)
+    {
+        set_pc(a, pc);
+        set_clock(a, cycles);
+        add_instructions(a, ran);
+        set_opcode(a, t->ops[ran - 1].op->opcode);
+    }
+    mov_imm(a, EAX, ran);
+    if (ran == t->block->count)
+    {
+        emit_link(t, pc);
+    }
+    jump_to(a, t->epilogue);
+}
+
+// where another block's exit jumps in, with the instance as that block
+// left it. this block can only go on if it's still the one compiled here
+// and current for its page, and the window has room for the cycles the
+// other block ran since its base time. otherwise it leaves with the other
+// block's eax
+static void emit_chain_entry(translation *t, const uint8_t *code)
+{
+    asm_buf *a = t->a;
+    const code_block *block = t->block;
+    int32_t code_gen = OFFSET(bus.code_gen) + (block->pc >> BUS_PAGE_SHIFT) * 4;
+
+    // movabs rdx, block; mov ecx, [rdx + gen]; cmp ecx, [code_gen]; jne out
+    EMIT(a, 0x48, 0xBA);
+    emit64(a, (uint64_t)(uintptr_t)block);
+    EMIT(a, 0x8B, 0x8A);
+    emit32(a, offsetof(code_block, gen));
+    emit8(a, 0x3B);
+    mem(a, ECX, code_gen);
+    patch(a, jump(a, CC_NZ), t->epilogue);
+    // movabs rsi, code; cmp [rdx + native], rsi; jne out
+    EMIT(a, 0x48, 0xBE);
+    emit64(a, (uint64_t)(uintptr_t)code);
+    EMIT(a, 0x48, 0x39, 0xB2);
+    emit32(a, offsetof(code_block, native));
+    patch(a, jump(a, CC_NZ), t->epilogue);
+
+    // mov rsi, [now]; mov rcx, rsi; sub rcx, r13; sub r15, rcx; jb out
+    EMIT(a, 0x48, 0x8B);
+    mem(a, ESI, OFFSET(scheduler.now));
+    EMIT(a, 0x48, 0x89, 0xF1, 0x4C, 0x29, 0xE9, 0x49, 0x29, 0xCF);
+    patch(a, jump(a, CC_B), t->epilogue);
+    // mov r13, rsi, then the helpers' view of the block:
+    // mov [r14 + block], rdx; mov ecx, [rdx + gen]; mov [r14 + expected], ecx
+    // lea rcx, [code_gen]; mov [r14 + gen], rcx
+    EMIT(a, 0x49, 0x89, 0xF5, 0x49, 0x89, 0x96);
+    emit32(a, offsetof(jit_context, block));
+    EMIT(a, 0x8B, 0x8A);
+    emit32(a, offsetof(code_block, gen));
+    EMIT(a, 0x41, 0x89, 0x8E);
+    emit32(a, offsetof(jit_context, expected));
+    EMIT(a, 0x48, 0x8D);
+    mem(a, ECX, code_gen);
+    EMIT(a, 0x49, 0x89, 0x8E);
+    emit32(a, offsetof(jit_context, gen));
+}
+
+// the rest of the instance catches up on anything that isn't in registers
+// before a handler sees it
+static void sync_for_handler(translation *t, int index)
+{
+    const op_info *o = &t->ops[index];
+    set_pc(t->a, o->pc + o->op->length);
+    set_opcode(t->a, o->op->opcode);
+    set_clock(t->a, o->start + o->access_at);
+}
+
+// eax = byte at ecx
+static void emit_read(translation *t, int index)
+{
+    asm_buf *a = t->a;
+    // mov edx, ecx; shr edx, 8; mov rax, [rbx + rdx * 8 + read]; test rax, rax
+    EMIT(a, 0x89, 0xCA, 0xC1, 0xEA, 0x08, 0x48, 0x8B, 0x84, 0xD3);
+    emit32(a, OFFSET(bus.read));
+    EMIT(a, 0x48, 0x85, 0xC0);
+    uint8_t *slow = jump(a, CC_Z);
+    // movzx ecx, cl; movzx eax, byte [rax + rcx]
+    EMIT(a, 0x0F, 0xB6, 0xC9, 0x0F, 0xB6, 0x04, 0x08);
+    add_stub(t, STUB_READ, index, slow);
+}
+
+// byte at ecx = edx
+static void emit_write(translation *t, int index)
+{
+    asm_buf *a = t->a;
+    // mov esi, ecx; shr esi, 8; mov rax, [rbx + rsi * 8 + write]; test rax, rax
+    EMIT(a, 0x89, 0xCE, 0xC1, 0xEE, 0x08, 0x48, 0x8B, 0x84, 0xF3);
+    emit32(a, OFFSET(bus.write));
+    EMIT(a, 0x48, 0x85, 0xC0);
+    uint8_t *slow = jump(a, CC_Z);
+    // movzx ecx, cl; mov [rax + rcx], dl
+    EMIT(a, 0x0F, 0xB6, 0xC9, 0x88, 0x14, 0x08);
+    add_stub(t, STUB_WRITE, index, slow);
+}
+
+// ecx = address a pointer register points at
+static void load_pointer(asm_buf *a, reg_type rt)
+{
+    if (rt == RT_C)
+    {
+        // LD A, (C) and LD (C), A
+        load8(a, ECX, RT_C);
+        EMIT(a, 0x81, 0xC9);
+        emit32(a, 0xFF00);
+        return;
+    }
+    load16(a, ECX, rt);
+}
+
+static void emit_ld(translation *t, int index)
+{
+    asm_buf *a = t->a;
+    const op_info *o = &t->ops[index];
+    const instruction *inst = o->inst;
+    uint16_t imm = o->op->imm;
+
+    switch (inst->mode)
+    {
+        case AM_R_R:
+            load8(a, EAX, inst->reg_2);
+            store8(a, inst->reg_1, EAX);
+            break;
+        case AM_R_N8:
+            store8_imm(a, inst->reg_1, imm);
+            break;
+        case AM_R_N16:
+            store16_imm(a, inst->reg_1, imm);
+            break;
+        case AM_R_MR:
+            load_pointer(a, inst->reg_2);
+            emit_read(t, index);
+            store8(a, inst->reg_1, EAX);
+            break;
+        case AM_MR_R:
+            load_pointer(a, inst->reg_1);
+            load8(a, EDX, inst->reg_2);
+            emit_write(t, index);
+            break;
+        case AM_R_HLI:
+        case AM_R_HLD:
+            load16(a, ECX, RT_HL);
+            emit_read(t, index);
+            store8(a, inst->reg_1, EAX);
+            // inc/dec word [hl]
+            EMIT(a, 0x66, 0xFF);
+            mem(a, inst->mode == AM_R_HLI ? 0 : 1, reg16_offset(RT_HL));
+            break;
+        case AM_MR_N8:
+            load_pointer(a, inst->reg_1);
+            mov_imm(a, EDX, imm & 0xFF);
+            emit_write(t, index);
+            break;
+        case AM_R_A16:
+            mov_imm(a, ECX, imm);
+            emit_read(t, index);
+            store8(a, inst->reg_1, EAX);
+            break;
+        default:
+            break;
+    }
+}
+
+static void emit_inc_dec(translation *t, int index)
+{
+    asm_buf *a = t->a;
+    const op_info *o = &t->ops[index];
+    bool inc = o->inst->type == IN_INC;
+    reg_type rt = o->inst->reg_1;
+
+    if (is_reg8(rt))
+    {
+        // inc/dec byte [reg], CF is left alone
+        emit8(a, 0xFE);
+        mem(a, inc ? 0 : 1, reg8_offset(rt));
+        if (o->flags)
+        {
+            x86_flags(a, FLAG_Z | FLAG_H, inc ? 0 : FLAG_N, 0x1F);
+        }
+        return;
+    }
+
+    // inc/dec word [reg]
+    EMIT(a, 0x66, 0xFF);
+    mem(a, inc ? 0 : 1, reg16_offset(rt));
+}
+
+static void emit_add_hl(translation *t, int index)
+{
+    asm_buf *a = t->a;
+    const op_info *o = &t->ops[index];
+
+    load16(a, ECX, RT_HL);
+    load16(a, EDX, o->inst->reg_2);
+    // lea eax, [rcx + rdx]
+    EMIT(a, 0x8D, 0x04, 0x11);
+    store16(a, RT_HL, EAX);
+    if (!o->flags)
+    {
+        return;
+    }
+
+    // H is the carry out of bit 11 and C out of bit 15, Z stays:
+    // xor ecx, edx; xor ecx, eax; shr ecx, 7; and ecx, 0x20
+    // shr eax, 12; and eax, 0x10; or ecx, eax
+    EMIT(a, 0x31, 0xD1, 0x31, 0xC1, 0xC1, 0xE9, 0x07, 0x83, 0xE1, 0x20);
+    EMIT(a, 0xC1, 0xE8, 0x0C, 0x83, 0xE0, 0x10, 0x09, 0xC1);
+    load8(a, EAX, RT_F);
+    // and eax, 0x8F; or eax, ecx
+    EMIT(a, 0x25, 0x8F, 0x00, 0x00, 0x00, 0x09, 0xC8);
+    store8(a, RT_F, EAX);
+}
+
+static void emit_alu(translation *t, int index)
+{
+    asm_buf *a = t->a;
+    const op_info *o = &t->ops[index];
+    const instruction *inst = o->inst;
+
+    if (inst->type == IN_ADD && inst->reg_1 == RT_HL)
+    {
+        emit_add_hl(t, index);
+        return;
+    }
+
+    // edx = operand
+    switch (inst->mode)
+    {
+        case AM_R_R:
+            load8(a, EDX, inst->reg_2);
+            break;
+        case AM_R_N8:
+            mov_imm(a, EDX, o->op->imm & 0xFF);
+            break;
+        default:
+            load16(a, ECX, RT_HL);
+            emit_read(t, index);
+            // mov edx, eax
+            EMIT(a, 0x89, 0xC2);
+            break;
+    }
+    load8(a, EAX, RT_A);
+
+    uint8_t opcode;
+    switch (inst->type)
+    {
+        case IN_ADD: opcode = 0x00; break;
+        case IN_ADC: opcode = 0x10; break;
+        case IN_SUB: opcode = 0x28; break;
+        case IN_SBC: opcode = 0x18; break;
+        case IN_AND: opcode = 0x20; break;
+        case IN_OR: opcode = 0x08; break;
+        case IN_XOR: opcode = 0x30; break;
+        default: opcode = 0x38; break;
+    }
+    if (inst->type == IN_ADC || inst->type == IN_SBC)
+    {
+        // CF = C: bt ecx, 4
+        load8(a, ECX, RT_F);
+        EMIT(a, 0x0F, 0xBA, 0xE1, 0x04);
+    }
+    // op al, dl
+    EMIT(a, opcode, 0xD0);
+    if (inst->type != IN_CP)
+    {
+        store8(a, RT_A, EAX);
+    }
+    if (!o->flags)
+    {
+        return;
+    }
+
+    switch (inst->type)
+    {
+        case IN_ADD:
+        case IN_ADC:
+            x86_flags(a, FLAG_Z | FLAG_H | FLAG_C, 0, 0x0F);
+            break;
+        case IN_SUB:
+        case IN_SBC:
+        case IN_CP:
+            x86_flags(a, FLAG_Z | FLAG_H | FLAG_C, FLAG_N, 0x0F);
+            break;
+        case IN_AND:
+            x86_flags(a, FLAG_Z, FLAG_H, 0x0F);
+            break;
+        default:
+            x86_flags(a, FLAG_Z, 0, 0x0F);
+            break;
+    }
+}
+
+// JP/JR, always the last op
+static void emit_jump(translation *t, int index)
+{
+    asm_buf *a = t->a;
+    const op_info *o = &t->ops[index];
+    const instruction *inst = o->inst;
+    bool jp = inst->type == IN_JP;
+    uint16_t next = o->pc + o->op->length;
+
+    if (inst->cond != CT_NONE)
+    {
+        // test byte [f], flag
+        emit8(a, 0xF6);
+        mem(a, 0, reg8_offset(RT_F));
+        emit8(a, o->uses);
+        bool when_set = inst->cond == CT_Z || inst->cond == CT_C;
+        add_stub(t, STUB_TAKEN, index, jump(a, when_set ? CC_NZ : CC_Z));
+        // not taken: a cycle less
+        emit_exit(t, index + 1, next, o->start + o->cycles - 4);
+        return;
+    }
+
+    uint16_t target = jp ? o->op->imm : (uint16_t)(next + (int8_t)o->op->imm);
+    emit_exit(t, index + 1, target, o->start + o->cycles);
+}
+
+// the interpreter has something to do before the next instruction (see
+// cpu_run()), the native code can't go on into the next block
+static bool needs_service_after(instruction_type type)
+{
+    return type == IN_EI || type == IN_HALT || type == IN_STOP;
+}
+
+static void emit_handler_call(translation *t, int index, int count)
+{
+    asm_buf *a = t->a;
+    const op_info *o = &t->ops[index];
+
+    set_pc(a, o->pc);
+    set_clock(a, o->start);
+    // jit_call(gb, opcode | imm << 8, proc, next start)
+    EMIT(a, 0x48, 0x89, 0xDF);
+    mov_imm(a, ESI, o->op->opcode | (uint32_t)o->op->imm << 8);
+    EMIT(a, 0x48, 0xBA);
+    emit64(a, (uint64_t)(uintptr_t)o->op->proc);
+    mov_imm(a, ECX, o->start + o->cycles);
+    call(a, jit_call);
+
+    // mov r13, rax; mov r15, [r14 + window]
+    EMIT(a, 0x49, 0x89, 0xC5, 0x4D, 0x8B, 0xBE);
+    emit32(a, offsetof(jit_context, window));
+
+    if (index == count - 1)
+    {
+        // the handler left pc, the clock and the opcode where they go
+        add_instructions(a, count);
+        mov_imm(a, EAX, count);
+        if (!needs_service_after(o->inst->type))
+        {
+            emit_link(t, o->pc + o->op->length);
+        }
+        jump_to(a, t->epilogue);
+    }
+}
+
+static void emit_stub(translation *t, const stub *s)
+{
+    asm_buf *a = t->a;
+    const op_info *o = &t->ops[s->index];
+    patch(a, s->fixup, a->p);
+
+    switch (s->kind)
+    {
+        case STUB_STOP:
+            emit_exit(t, s->index, o->pc, o->start);
+            return;
+        case STUB_TAKEN: {
+            uint16_t next = o->pc + o->op->length;
+            uint16_t target = o->inst->type == IN_JP ? o->op->imm : (uint16_t)(next + (int8_t)o->op->imm);
+            emit_exit(t, s->index + 1, target, o->start + o->cycles);
+        } return;
+        case STUB_READ:
+        case STUB_WRITE:
+            sync_for_handler(t, s->index);
+            // mov rdi, rbx; mov esi, ecx
+            EMIT(a, 0x48, 0x89, 0xDF, 0x89, 0xCE);
+            if (s->kind == STUB_READ)
+            {
+                // mov rdx, r13
+                EMIT(a, 0x4C, 0x89, 0xEA);
+                call(a, jit_read);
+            }
+            else
+            {
+                // mov rcx, r13
+                EMIT(a, 0x4C, 0x89, 0xE9);
+                call(a, jit_write);
+            }
+            // mov r15, [r14 + window]
+            EMIT(a, 0x4D, 0x8B, 0xBE);
+            emit32(a, offsetof(jit_context, window));
+            jump_to(a, s->resume);
+            return;
+    }
+}
+
+// a handler call through the native code costs more than running the op
+// from the block, blocks that are mostly those stay with the ops. one more
+// is fine, that's a block of a lone CALL or RET (or a few ops and one) that
+// other blocks can chain through
+static bool worth_compiling(const op_info *ops, int count)
+{
+    int native = 0;
+    for (int i = 0; i < count; i++)
+    {
+        native += ops[i].native;
+    }
+    return count - native <= native + 1;
+}
+
+// `chain` is left at the block's chain entry
+static bool translate(gb_t *gb, const code_block *block, asm_buf *a, const uint8_t **chain)
+{
+    translation t = { .a = a, .jit = gb->jit, .block = block };
+    const uint8_t *code = a->p;
+    int count = block->count;
+
+    uint16_t pc = block->pc;
+    uint32_t start = 0;
+    for (int i = 0; i < count; i++)
+    {
+        op_info *o = &t.ops[i];
+        o->op = &block->ops[i];
+        o->inst = get_instruction_by_opcode(o->op->opcode);
+        o->pc = pc;
+        o->start = start;
+        classify(o);
+        pc += o->op->length;
+        start += o->cycles;
+    }
+    // a sentinel for the end of the block
+    t.ops[count].pc = pc;
+    t.ops[count].start = start;
+    t.ops[count].safe = true;
+    if (!worth_compiling(t.ops, count))
+    {
+        return false;
+    }
+    plan_flags(t.ops, count);
+
+    // push rbx, r12 - r15 (that leaves the stack aligned for calls)
+    EMIT(a, 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57);
+    // mov rbx, rdi; mov r15, rsi; mov r13, [now]
+    EMIT(a, 0x48, 0x89, 0xFB, 0x49, 0x89, 0xF7, 0x4C, 0x8B);
+    mem(a, 5, OFFSET(scheduler.now));
+    // movabs r12, flag_table; movabs r14, jit
+    EMIT(a, 0x49, 0xBC);
+    emit64(a, (uint64_t)(uintptr_t)flag_table);
+    EMIT(a, 0x49, 0xBE);
+    emit64(a, (uint64_t)(uintptr_t)gb->jit);
+    // the epilogue goes up front so exits can jump back to it
+    uint8_t *body = jump(a, -1);
+    t.epilogue = a->p;
+    EMIT(a, 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3);
+    *chain = a->p;
+    emit_chain_entry(&t, code);
+    patch(a, body, a->p);
+
+    bool ended = false;
+    for (int i = 0; i < count; i++)
+    {
+        op_info *o = &t.ops[i];
+        if (o->safe)
+        {
+            // stop here unless everything up to the next place it could
+            // stop fits: cmp r15, cycles; jb stop
+            int next = i + 1;
+            while (!t.ops[next].safe)
+            {
+                next++;
+            }
+            EMIT(a, 0x49, 0x81, 0xFF);
+            emit32(a, t.ops[next].start);
+            add_stub(&t, STUB_STOP, i, jump(a, CC_B));
+        }
+
+        if (!o->native)
+        {
+            emit_handler_call(&t, i, count);
+            ended = i == count - 1;
+            continue;
+        }
+
+        switch (o->inst->type)
+        {
+            case IN_NOP:
+                break;
+            case IN_LD:
+                emit_ld(&t, i);
+                break;
+            case IN_INC:
+            case IN_DEC:
+                emit_inc_dec(&t, i);
+                break;
+            case IN_JP:
+            case IN_JR:
+                emit_jump(&t, i);
+                ended = true;
+                break;
+            default:
+                emit_alu(&t, i);
+                break;
+        }
+    }
+    if (!ended)
+    {
+        emit_exit(&t, count, pc, start);
+    }
+
+    for (int i = 0; i < t.stub_count; i++)
+    {
+        emit_stub(&t, &t.stubs[i]);
+    }
+    return !a->overflow;
+}
+
+// the most code one block can need
+#define JIT_BLOCK_BYTES 8192
+
+static void flush(gb_t *gb)
+{
+    blockcache_each(gb, drop_native);
+    drop_code(gb->jit);
+}
+
+void jit_compile(gb_t *gb, code_block *block)
+{
+    if (gb->jit_mode == JIT_OFF || !jit_available())
+    {
+        return;
+    }
+    jit_context *jit = get_context(gb);
+    if (!jit)
+    {
+        return;
+    }
+    // a block has at most two exits that link (a conditional jump's)
+    if (jit->used + JIT_BLOCK_BYTES > JIT_CODE_SIZE || jit->link_count + 2 > JIT_MAX_LINKS)
+    {
+        flush(gb);
+    }
+
+    if (mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_WRITE) != 0)
+    {
+        return;
+    }
+    uint8_t *code = jit->code + jit->used;
+    asm_buf a = { .p = code, .end = code + JIT_BLOCK_BYTES };
+    int links = jit->link_count;
+    const uint8_t *chain = NULL;
+    bool ok = translate(gb, block, &a, &chain);
+    mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_EXEC);
+
+    if (!ok)
+    {
+        jit->link_count = links;
+    }
+    else
+    {
+        block->native = (native_block)code;
+        block->chain = chain;
+        // keep blocks 16 byte aligned
+        jit->used += (a.p - code + 15) & ~(size_t)15;
+    }
+}
+
+#else
+
+bool jit_available(void)
+{
+    return false;
+}
+
+void jit_reset(gb_t *gb)
+{
+}
+
+void jit_free(gb_t *gb)
+{
+}
+
+void jit_compile(gb_t *gb, code_block *block)
+{
+}
+
+int jit_run(gb_t *gb, code_block **block, uint64_t until)
+{
+    return 0;
+}
+
+#endif
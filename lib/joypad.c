@@ -0,0 +1,20 @@
+#include <joypad.h>
+#include <gb.h>
+
+#define P1_SELECT 0x30
+
+void joypad_init(gb_t *gb)
+{
+    gb->joypad.select = 0;
+}
+
+uint8_t joypad_read(gb_t *gb)
+{
+    // the top 2 bits aren't wired and read as 1, nothing is pressed
+    return 0xC0 | gb->joypad.select | 0x0F;
+}
+
+void joypad_write(gb_t *gb, uint8_t value)
+{
+    gb->joypad.select = value & P1_SELECT;
+}
@@ -0,0 +1,503 @@
+#include <gb.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// "GLNK", set once a shared channel is ready to join
+#define LINK_MAGIC 0x4B4E4C47
+// messages each way, a transfer only ever has a couple in flight
+#define LINK_RING_SIZE 16
+
+typedef enum {
+    // the sender clocks a transfer that ends at `when`, `value` is its byte
+    LINK_START,
+    // the transfer the sender was clocking stopped at `when`
+    LINK_CANCEL,
+    // the answer to the transfer ending at `when`
+    LINK_REPLY
+} link_message_type;
+
+typedef struct {
+    uint64_t when;
+    uint8_t type;
+    uint8_t value;
+} link_message;
+
+// one end's half of the channel, only that end writes it (the ring's tail
+// aside). times are link time, T-cycles since the two were connected
+typedef struct {
+    _Alignas(64) _Atomic uint64_t clock;
+    atomic_bool attached;
+    atomic_bool closed;
+
+    // messages from this end, the head is written by this end and the tail
+    // by the other
+    _Alignas(64) atomic_uint head;
+    _Alignas(64) atomic_uint tail;
+    link_message ring[LINK_RING_SIZE];
+} link_end;
+
+// lives in the heap, or in shared memory between two processes
+typedef struct {
+    atomic_uint magic;
+    // ends still using it, the last one frees it (in this process)
+    atomic_int refs;
+    link_end ends[2];
+} link_channel;
+
+struct link_port {
+    link_channel *channel;
+    int side;
+    bool shared;
+    uint64_t slack;
+    // the local clock at link time 0
+    uint64_t base;
+    // the other end left or went quiet, nothing goes through any more
+    bool unplugged;
+
+    // what a wait is for, in link time, and the other end's clock as the
+    // last wait saw it
+    uint64_t target;
+    uint64_t other;
+
+    // the answer to the transfer this end clocks
+    bool replied;
+    uint64_t reply_when;
+    uint8_t reply;
+};
+
+static double now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static link_end *mine(link_port *port)
+{
+    return &port->channel->ends[port->side];
+}
+
+static link_end *theirs(link_port *port)
+{
+    return &port->channel->ends[port->side ^ 1];
+}
+
+static link_port *plugged(gb_t *gb)
+{
+    link_port *port = gb->serial.link;
+    return port && !port->unplugged ? port : NULL;
+}
+
+static uint64_t link_time(gb_t *gb)
+{
+    return gb->scheduler.now - gb->serial.link->base;
+}
+
+// the clock only goes forward, whatever order the waits publish in
+static void publish(link_port *port, uint64_t time)
+{
+    link_end *end = mine(port);
+    if (time > atomic_load_explicit(&end->clock, memory_order_relaxed))
+    {
+        atomic_store_explicit(&end->clock, time, memory_order_release);
+    }
+}
+
+static void unplug(gb_t *gb)
+{
+    gb->serial.link->unplugged = true;
+    scheduler_cancel(gb, EVENT_LINK);
+}
+
+static void push(link_port *port, link_message message)
+{
+    link_end *end = mine(port);
+    unsigned head = atomic_load_explicit(&end->head, memory_order_relaxed);
+    // the other end drains its ring at every barrier, this only waits if
+    // it has gone away with a full ring
+    while (head - atomic_load_explicit(&end->tail, memory_order_acquire) >= LINK_RING_SIZE)
+    {
+        if (atomic_load_explicit(&theirs(port)->closed, memory_order_acquire))
+        {
+            return;
+        }
+        sched_yield();
+    }
+    end->ring[head % LINK_RING_SIZE] = message;
+    atomic_store_explicit(&end->head, head + 1, memory_order_release);
+}
+
+// handles everything the other end has sent so far
+static void drain(gb_t *gb)
+{
+    link_port *port = gb->serial.link;
+    link_end *end = theirs(port);
+    unsigned tail = atomic_load_explicit(&end->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&end->head, memory_order_acquire);
+    while (tail != head)
+    {
+        link_message message = end->ring[tail % LINK_RING_SIZE];
+        atomic_store_explicit(&end->tail, ++tail, memory_order_release);
+
+        if (message.type == LINK_START)
+        {
+            serial_peer_transfer(gb, port->base + message.when, message.value);
+        }
+        else if (message.type == LINK_CANCEL)
+        {
+            serial_peer_cancel(gb);
+        }
+        else
+        {
+            port->replied = true;
+            port->reply_when = message.when;
+            port->reply = message.value;
+        }
+    }
+}
+
+// spins (handling messages) until `done`, false if the other end left or
+// went quiet first, which pulls the cable out. everything the other end
+// sent before the clock `done` saw has been handled by the time it returns
+static bool wait_for(gb_t *gb, bool (*done)(gb_t *gb))
+{
+    link_port *port = gb->serial.link;
+    link_end *end = theirs(port);
+    uint64_t seen = atomic_load_explicit(&end->clock, memory_order_acquire);
+    double since = now_ms();
+    while (true)
+    {
+        drain(gb);
+        if (done(gb))
+        {
+            // a message sent just before that clock may have missed the
+            // drain above
+            drain(gb);
+            return true;
+        }
+        if (atomic_load_explicit(&end->closed, memory_order_acquire))
+        {
+            break;
+        }
+        uint64_t clock = atomic_load_explicit(&end->clock, memory_order_acquire);
+        if (clock != seen)
+        {
+            seen = clock;
+            since = now_ms();
+        }
+        else if (now_ms() - since > LINK_TIMEOUT_MS)
+        {
+            break;
+        }
+        sched_yield();
+    }
+    unplug(gb);
+    return false;
+}
+
+static bool within_slack(gb_t *gb)
+{
+    link_port *port = gb->serial.link;
+    port->other = atomic_load_explicit(&theirs(port)->clock, memory_order_acquire);
+    return link_time(gb) < port->other + port->slack;
+}
+
+static bool reached_target(gb_t *gb)
+{
+    link_port *port = gb->serial.link;
+    port->other = atomic_load_explicit(&theirs(port)->clock, memory_order_acquire);
+    return port->other >= port->target;
+}
+
+static bool replied(gb_t *gb)
+{
+    link_port *port = gb->serial.link;
+    return port->replied && port->reply_when == port->target;
+}
+
+// or the other end clocks a transfer too, one that ends no later than this
+// end's and so waits on this end's answer the same way (see link_receive())
+static bool replied_or_crossed(gb_t *gb)
+{
+    link_port *port = gb->serial.link;
+    serial_context *serial = &gb->serial;
+    return replied(gb) || (serial->peer_transfer && serial->peer_when <= port->base + port->target);
+}
+
+// the barrier: this end may run up to `slack` past the other's clock
+static void link_event(gb_t *gb, uint64_t when)
+{
+    link_port *port = plugged(gb);
+    if (!port)
+    {
+        return;
+    }
+    publish(port, link_time(gb));
+    if (wait_for(gb, within_slack))
+    {
+        // only as far as the clock the messages were handled up to
+        scheduler_schedule(gb, EVENT_LINK, port->base + port->other + port->slack);
+    }
+}
+
+void link_init(gb_t *gb)
+{
+    link_disconnect(gb);
+    scheduler_set_handler(gb, EVENT_LINK, link_event);
+}
+
+static void attach(gb_t *gb, link_port *port)
+{
+    link_disconnect(gb);
+    port->base = gb->scheduler.now;
+    gb->serial.link = port;
+
+    link_end *end = mine(port);
+    atomic_store_explicit(&end->clock, 0, memory_order_release);
+    atomic_store_explicit(&end->attached, true, memory_order_release);
+    scheduler_schedule(gb, EVENT_LINK, port->base + port->slack);
+
+    // a transfer this end was already clocking was never sent, the other
+    // end has to hear about it before the event waits on its answer
+    if (scheduler_is_scheduled(gb, EVENT_SERIAL))
+    {
+        link_send(gb, gb->scheduler.when[EVENT_SERIAL], gb->serial.state.sb);
+    }
+}
+
+static link_port *new_port(link_channel *channel, int side, bool shared, uint32_t slack)
+{
+    link_port *port = calloc(1, sizeof(link_port));
+    if (port)
+    {
+        port->channel = channel;
+        port->side = side;
+        port->shared = shared;
+        port->slack = slack ? slack : LINK_DEFAULT_SLACK;
+    }
+    return port;
+}
+
+bool link_connect(gb_t *a, gb_t *b, uint32_t slack)
+{
+    if (a == b)
+    {
+        return false;
+    }
+    link_channel *channel = calloc(1, sizeof(link_channel));
+    link_port *port_a = new_port(channel, 0, false, slack);
+    link_port *port_b = new_port(channel, 1, false, slack);
+    if (!channel || !port_a || !port_b)
+    {
+        free(channel);
+        free(port_a);
+        free(port_b);
+        return false;
+    }
+    atomic_store(&channel->refs, 2);
+    atomic_store(&channel->magic, LINK_MAGIC);
+
+    attach(a, port_a);
+    attach(b, port_b);
+    return true;
+}
+
+// side 1's view of side 0's channel, once side 0 has made it
+static link_channel *join_shared(const char *name)
+{
+    double start = now_ms();
+    while (now_ms() - start < LINK_TIMEOUT_MS)
+    {
+        int fd = shm_open(name, O_RDWR, 0);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(link_channel))
+        {
+            link_channel *channel = mmap(NULL, sizeof(link_channel), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if (channel == MAP_FAILED)
+            {
+                return NULL;
+            }
+            if (atomic_load_explicit(&channel->magic, memory_order_acquire) == LINK_MAGIC &&
+                !atomic_load(&channel->ends[1].attached))
+            {
+                // the name isn't needed once both ends have it mapped
+                shm_unlink(name);
+                return channel;
+            }
+            munmap(channel, sizeof(link_channel));
+        }
+        else if (fd >= 0)
+        {
+            close(fd);
+        }
+        struct timespec ts = { 0, 1000000 };
+        nanosleep(&ts, NULL);
+    }
+    printf("Nothing to join at %s\n", name);
+    return NULL;
+}
+
+static link_channel *create_shared(const char *name)
+{
+    // left behind by a run that didn't get as far as joining
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0 || ftruncate(fd, sizeof(link_channel)) != 0)
+    {
+        printf("Failed to create shared memory %s\n", name);
+        if (fd >= 0)
+        {
+            close(fd);
+            shm_unlink(name);
+        }
+        return NULL;
+    }
+    link_channel *channel = mmap(NULL, sizeof(link_channel), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (channel == MAP_FAILED)
+    {
+        shm_unlink(name);
+        return NULL;
+    }
+    // a new object is all zeroes, only the magic is left to set
+    atomic_store(&channel->refs, 2);
+    atomic_store_explicit(&channel->magic, LINK_MAGIC, memory_order_release);
+    return channel;
+}
+
+bool link_connect_shared(gb_t *gb, const char *name, int side, uint32_t slack)
+{
+    if (side != 0 && side != 1)
+    {
+        return false;
+    }
+    link_channel *channel = side == 0 ? create_shared(name) : join_shared(name);
+    if (!channel)
+    {
+        return false;
+    }
+    link_port *port = new_port(channel, side, true, slack);
+    if (!port)
+    {
+        munmap(channel, sizeof(link_channel));
+        return false;
+    }
+    attach(gb, port);
+    return true;
+}
+
+void link_disconnect(gb_t *gb)
+{
+    // a transfer from the other end won't be finished now
+    serial_peer_cancel(gb);
+    link_port *port = gb->serial.link;
+    if (!port)
+    {
+        return;
+    }
+    atomic_store_explicit(&mine(port)->closed, true, memory_order_release);
+    scheduler_cancel(gb, EVENT_LINK);
+
+    link_channel *channel = port->channel;
+    bool last = atomic_fetch_sub(&channel->refs, 1) == 1;
+    if (port->shared)
+    {
+        munmap(channel, sizeof(link_channel));
+    }
+    else if (last)
+    {
+        free(channel);
+    }
+    free(port);
+    gb->serial.link = NULL;
+}
+
+void link_send(gb_t *gb, uint64_t when, uint8_t value)
+{
+    link_port *port = plugged(gb);
+    if (port)
+    {
+        push(port, (link_message){ .when = when - port->base, .type = LINK_START, .value = value });
+    }
+}
+
+void link_cancel(gb_t *gb)
+{
+    link_port *port = plugged(gb);
+    if (port)
+    {
+        push(port, (link_message){ .when = link_time(gb), .type = LINK_CANCEL });
+    }
+}
+
+bool link_sync(gb_t *gb, uint64_t when)
+{
+    link_port *port = plugged(gb);
+    if (!port)
+    {
+        return false;
+    }
+    port->target = when - port->base;
+    publish(port, port->target);
+    return wait_for(gb, reached_target);
+}
+
+uint8_t link_receive(gb_t *gb, uint64_t when)
+{
+    link_port *port = plugged(gb);
+    if (!port)
+    {
+        return 0xFF;
+    }
+    // the other end has to get to the end of the transfer to answer
+    port->target = when - port->base;
+    publish(port, port->target);
+    while (true)
+    {
+        if (!wait_for(gb, replied_or_crossed))
+        {
+            return 0xFF;
+        }
+        if (replied(gb))
+        {
+            break;
+        }
+        // both ends clock a transfer and the other one's ends first (or
+        // with this one), whichever order the events came in. it gets its
+        // 0xFF now, the other end won't get on to answering this one before
+        serial_peer_finish(gb);
+        if (!plugged(gb))
+        {
+            return 0xFF;
+        }
+        port->target = when - port->base;
+    }
+    port->replied = false;
+    return port->reply;
+}
+
+void link_reply(gb_t *gb, uint64_t when, uint8_t value)
+{
+    link_port *port = plugged(gb);
+    if (port)
+    {
+        push(port, (link_message){ .when = when - port->base, .type = LINK_REPLY, .value = value });
+    }
+}
+
+void link_publish(gb_t *gb)
+{
+    link_port *port = plugged(gb);
+    if (port)
+    {
+        publish(port, link_time(gb));
+    }
+}
@@ -1,149 +1,364 @@
-#include <memorymap.h>
-#include <cartridge.h>
-#include <ram.h>
-#include <cpu.h>
-
-// **Memory Map Address Bus**
-// 0x0000 - 0x3FFF : ROM Bank 0
-// 0x4000 - 0x7FFF : ROM Bank 1 - Switchable
-// 0x8000 - 0x97FF : CHR RAM
-// 0x9800 - 0x9BFF : BG Map 1
-// 0x9C00 - 0x9FFF : BG Map 2
-// 0xA000 - 0xBFFF : Cartridge RAM
-// 0xC000 - 0xCFFF : RAM Bank 0
-// 0xD000 - 0xDFFF : RAM Bank 1-7 - switchable - Color only
-// 0xE000 - 0xFDFF : Reserved - Echo RAM
-// 0xFE00 - 0xFE9F : Object Attribute Memory
-// 0xFEA0 - 0xFEFF : Reserved - Unusable
-// 0xFF00 - 0xFF7F : I/O Registers
-// 0xFF80 - 0xFFFE : High RAM (HRAM) or Zero Page
-// 0xFFFF - 0xFFFF : Interrupt ENable register
-
-uint8_t read_address_bus(uint16_t address)
-{
-    if (address < 0x8000) 
-    {
-        // ROM Data
-        return read_cartridge(address);
-    }
-    else if (address < 0xA000)
-    {
-        // Char/Map Data
-        printf("UNSUPPORTED bus read(%04X)\n", address);
-        NO_IMPL
-    }
-    else if (address < 0xC000)
-    {
-        //Cartridge RAM
-        return read_cartridge(address);
-    }
-    else if (address < 0xE000)
-    {
-        // WRAM (Work RAM)
-        return read_wram(address);
-    }
-    else if (address < 0xFE00)
-    {
-        // Reserved - Echo RAM
-        return 0;
-    }
-    else if (address < 0xFEA0)
-    {
-        // OAM (Object Attribute Memory)
-        printf("UNSUPPORTED bus read(%04X)\n", address);
-        NO_IMPL
-    }
-    else if (address < 0xFF00)
-    {
-        // reserved - ususable
-        return 0;
-    }
-    else if (address < 0xFF80)
-    {
-        // I/O Registers
-        printf("UNSUPPORTED bus read(%04X)\n", address);
-        NO_IMPL
-    }
-    else if (address < 0xFFFF)
-    {
-        // HRAM (High RAM)
-        return read_hram(address);
-    }
-    else if (address == 0xFFFF)
-    {
-        // CPU Interrupt ENable register
-        return cpu_get_ie_register();
-    }
-    printf("UNSUPPORTED bus read(%04X)\n", address);
-    exit(-5);
-}
-
-void write_address_bus(uint16_t address, uint8_t value)
-{
-    if (address < 0x8000)
-    {
-        // ROM Data
-        write_cartridge(address, value);
-    }
-    else if (address < 0xA000)
-    {
-        // Char/Map Data
-        printf("UNSUPPORTED bus write(%04X)\n", address);
-        NO_IMPL
-    }
-    else if (address < 0xC000)
-    {
-        //Cartridge RAM
-        write_cartridge(address, value);
-    }
-    else if (address < 0xE000)
-    {
-        // WRAM (Working RAM)
-        write_wram(address, value);
-    }
-    else if (address < 0xFE00)
-    {
-        // Reserved - Echo RAM
-        return;
-    }
-    else if (address < 0xFEA0)
-    {
-        // OAM (Object Attribute Memory)
-        printf("UNSUPPORTED bus write(%04X)\n", address);
-        NO_IMPL
-    }
-    else if (address < 0xFF00)
-    {
-        // reserved - ususable
-        return;
-    }
-    else if (address < 0xFF80)
-    {
-        // I/O Registers
-        printf("UNSUPPORTED bus write(%04X)\n", address);
-    }
-    else if (address < 0xFFFF)
-    {
-        // HRAM (High RAM)
-        write_hram(address, value);
-    }
-    else if (address == 0xFFFF)
-    {
-        // CPU Interrupt Enable register
-        cpu_set_ie_register(value);
-    }
-}
-
-uint16_t read16_address_bus(uint16_t address)
-{
-    uint16_t lo = read_address_bus(address);
-    uint16_t hi = read_address_bus(address + 1);
-
-    return lo | (hi << 8);
-}
-
-void write16_address_bus(uint16_t address, uint16_t value)
-{
-    write_address_bus(address, value & 0xFF);
-    write_address_bus(address + 1, (value >> 8) & 0xFF);
+#include <memorymap.h>
+#include <apu.h>
+#include <cartridge.h>
+#include <ram.h>
+#include <cpu.h>
+#include <dma.h>
+#include <joypad.h>
+#include <ppu.h>
+#include <serial.h>
+#include <timer.h>
+#include <gb.h>
+#include <string.h>
+
+// **Memory Map Address Bus**
+// 0x0000 - 0x3FFF : ROM Bank 0
+// 0x4000 - 0x7FFF : ROM Bank 1 - Switchable
+// 0x8000 - 0x97FF : CHR RAM
+// 0x9800 - 0x9BFF : BG Map 1
+// 0x9C00 - 0x9FFF : BG Map 2
+// 0xA000 - 0xBFFF : Cartridge RAM
+// 0xC000 - 0xCFFF : RAM Bank 0
+// 0xD000 - 0xDFFF : RAM Bank 1-7 - switchable - Color only
+// 0xE000 - 0xFDFF : Reserved - Echo RAM
+// 0xFE00 - 0xFE9F : Object Attribute Memory
+// 0xFEA0 - 0xFEFF : Reserved - Unusable
+// 0xFF00 - 0xFF7F : I/O Registers
+// 0xFF80 - 0xFFFE : High RAM (HRAM) or Zero Page
+// 0xFFFF - 0xFFFF : Interrupt ENable register
+
+void memorymap_map(gb_t *gb, uint16_t address, uint16_t page_count, uint8_t *read, uint8_t *write)
+{
+    memorymap_context *bus = &gb->bus;
+    uint16_t first = address >> BUS_PAGE_SHIFT;
+    for (uint16_t i = 0; i < page_count && first + i < BUS_PAGE_COUNT; i++)
+    {
+        uint16_t page = first + i;
+        uint8_t *page_read = read ? read + i * BUS_PAGE_SIZE : NULL;
+        uint8_t *page_write = write ? write + i * BUS_PAGE_SIZE : NULL;
+        // the same memory again, what was decoded from it still holds
+        uint8_t *current_write = bus->code[page] ? bus->code_write[page] : bus->write[page];
+        if (bus->read[page] == page_read && current_write == page_write)
+        {
+            continue;
+        }
+        bus->read[page] = page_read;
+        bus->write[page] = page_write;
+
+        // whatever was decoded from the old mapping is stale
+        bus->code[page] = false;
+        bus->code_write[page] = NULL;
+        bus->code_gen[page]++;
+    }
+}
+
+void memorymap_protect_code(gb_t *gb, uint16_t address)
+{
+    memorymap_context *bus = &gb->bus;
+    uint16_t page = address >> BUS_PAGE_SHIFT;
+    if (!bus->code[page])
+    {
+        bus->code[page] = true;
+        bus->code_write[page] = bus->write[page];
+        bus->write[page] = NULL;
+    }
+}
+
+// the first write to a page holding decoded code, returns the direct
+// pointer the page had (if any) so the write can go straight there
+static uint8_t *code_written(memorymap_context *bus, uint16_t page)
+{
+    bus->code[page] = false;
+    bus->code_gen[page]++;
+    bus->write[page] = bus->code_write[page];
+    bus->code_write[page] = NULL;
+    return bus->write[page];
+}
+
+// fills in the direct pointers, on a table that starts out all handlers
+static void map_all(gb_t *gb)
+{
+    memorymap_context *bus = &gb->bus;
+    memset(bus->read, 0, sizeof(bus->read));
+    memset(bus->write, 0, sizeof(bus->write));
+    memset(bus->code, 0, sizeof(bus->code));
+    memset(bus->code_write, 0, sizeof(bus->code_write));
+
+    // everything stays on the handlers while OAM DMA has the bus, see dma.h
+    if (!gb->dma.active)
+    {
+        // the current ROM banks are read directly, writes go to the
+        // cartridge (MBC registers). cartridge RAM is direct both ways
+        // while it's enabled
+        cartridge_map(gb);
+
+        // WRAM is plain memory both ways, except pages shared with a fork
+        ram_map(gb);
+
+        // VRAM is read direct, tile data writes go to the PPU for its cache
+        ppu_map(gb);
+
+        // echo RAM, OAM, I/O and HRAM (which shares its page with I/O) stay
+        // on the handlers
+    }
+}
+
+void memorymap_init(gb_t *gb)
+{
+    // the memory may have been written behind the bus (power on, loading a
+    // state), so nothing decoded before holds
+    map_all(gb);
+    for (int page = 0; page < BUS_PAGE_COUNT; page++)
+    {
+        gb->bus.code_gen[page]++;
+    }
+}
+
+void memorymap_remap(gb_t *gb)
+{
+    // pages that come out the same as before get their code_gen and code
+    // protection back, OAM DMA and forks don't change most of them
+    memorymap_context *bus = &gb->bus;
+    memorymap_context old = *bus;
+    map_all(gb);
+
+    for (int page = 0; page < BUS_PAGE_COUNT; page++)
+    {
+        uint8_t *old_write = old.code[page] ? old.code_write[page] : old.write[page];
+        if (bus->read[page] == old.read[page] && bus->write[page] == old_write)
+        {
+            bus->code[page] = old.code[page];
+            bus->code_write[page] = old.code_write[page];
+            if (bus->code[page])
+            {
+                bus->write[page] = NULL;
+            }
+            bus->code_gen[page] = old.code_gen[page];
+        }
+        else
+        {
+            bus->code_gen[page] = old.code_gen[page] + 1;
+        }
+    }
+}
+
+// the slow path for pages without a direct pointer
+uint8_t read_address_bus_handler(gb_t *gb, uint16_t address)
+{
+    if (address >= 0xFF80 && address < 0xFFFF)
+    {
+        // HRAM shares its page with I/O so it always lands here, check it
+        // first since the stack usually lives in it
+        return read_hram(gb, address);
+    }
+
+    if (gb->dma.active && address < 0xFF00)
+    {
+        // OAM DMA has the bus
+        return 0xFF;
+    }
+
+    if (address < 0x8000) 
+    {
+        // ROM Data
+        return read_cartridge(gb, address);
+    }
+    else if (address < 0xA000)
+    {
+        // Char/Map Data
+        return read_vram(gb, address);
+    }
+    else if (address < 0xC000)
+    {
+        //Cartridge RAM
+        return read_cartridge(gb, address);
+    }
+    else if (address < 0xE000)
+    {
+        // WRAM (Work RAM)
+        return read_wram(gb, address);
+    }
+    else if (address < 0xFE00)
+    {
+        // Reserved - Echo RAM
+        return 0;
+    }
+    else if (address < 0xFEA0)
+    {
+        // OAM (Object Attribute Memory)
+        return read_oam(gb, address);
+    }
+    else if (address < 0xFF00)
+    {
+        // reserved - ususable
+        return 0;
+    }
+    else if (address < 0xFF80)
+    {
+        // I/O Registers
+        if (address == 0xFF00)
+        {
+            return joypad_read(gb);
+        }
+        if (address == 0xFF0F)
+        {
+            return cpu_get_int_flags(gb);
+        }
+        if (address == 0xFF01 || address == 0xFF02)
+        {
+            return serial_read(gb, address);
+        }
+        if (address >= 0xFF04 && address <= 0xFF07)
+        {
+            return timer_read(gb, address);
+        }
+        if (address >= 0xFF10 && address <= 0xFF3F)
+        {
+            return apu_read(gb, address);
+        }
+        if (address == 0xFF46)
+        {
+            return dma_read(gb);
+        }
+        if (address >= 0xFF40 && address <= 0xFF4B)
+        {
+            return ppu_read_io(gb, address);
+        }
+        gb_fault(gb, "unsupported bus read(%04X)", address);
+        return 0xFF;
+    }
+    else if (address < 0xFFFF)
+    {
+        // HRAM (High RAM)
+        return read_hram(gb, address);
+    }
+    else if (address == 0xFFFF)
+    {
+        // CPU Interrupt ENable register
+        return cpu_get_ie_register(gb);
+    }
+    gb_fault(gb, "unsupported bus read(%04X)", address);
+    return 0xFF;
+}
+
+void write_address_bus_handler(gb_t *gb, uint16_t address, uint8_t value)
+{
+    uint16_t page = address >> BUS_PAGE_SHIFT;
+    if (gb->bus.code[page])
+    {
+        uint8_t *direct = code_written(&gb->bus, page);
+        if (direct)
+        {
+            direct[address & BUS_PAGE_MASK] = value;
+            return;
+        }
+    }
+
+    if (address >= 0xFF80 && address < 0xFFFF)
+    {
+        write_hram(gb, address, value);
+        return;
+    }
+
+    if (gb->dma.active && address < 0xFF00)
+    {
+        // OAM DMA has the bus
+        return;
+    }
+
+    if (address < 0x8000)
+    {
+        // ROM Data
+        write_cartridge(gb, address, value);
+    }
+    else if (address < 0xA000)
+    {
+        // Char/Map Data
+        write_vram(gb, address, value);
+    }
+    else if (address < 0xC000)
+    {
+        //Cartridge RAM
+        write_cartridge(gb, address, value);
+    }
+    else if (address < 0xE000)
+    {
+        // WRAM (Working RAM)
+        write_wram(gb, address, value);
+    }
+    else if (address < 0xFE00)
+    {
+        // Reserved - Echo RAM
+        return;
+    }
+    else if (address < 0xFEA0)
+    {
+        // OAM (Object Attribute Memory)
+        write_oam(gb, address, value);
+    }
+    else if (address < 0xFF00)
+    {
+        // reserved - ususable
+        return;
+    }
+    else if (address < 0xFF80)
+    {
+        // I/O Registers
+        if (address == 0xFF00)
+        {
+            joypad_write(gb, value);
+        }
+        else if (address == 0xFF0F)
+        {
+            cpu_set_int_flags(gb, value);
+        }
+        else if (address == 0xFF01 || address == 0xFF02)
+        {
+            serial_write(gb, address, value);
+        }
+        else if (address >= 0xFF04 && address <= 0xFF07)
+        {
+            timer_write(gb, address, value);
+        }
+        else if (address >= 0xFF10 && address <= 0xFF3F)
+        {
+            apu_write(gb, address, value);
+        }
+        else if (address == 0xFF46)
+        {
+            dma_write(gb, value);
+        }
+        else if (address >= 0xFF40 && address <= 0xFF4B)
+        {
+            ppu_write_io(gb, address, value);
+        }
+        else if (gb->log)
+        {
+            printf("UNSUPPORTED bus write(%04X)\n", address);
+        }
+    }
+    else if (address < 0xFFFF)
+    {
+        // HRAM (High RAM)
+        write_hram(gb, address, value);
+    }
+    else if (address == 0xFFFF)
+    {
+        // CPU Interrupt Enable register
+        cpu_set_ie_register(gb, value);
+    }
+}
+
+uint16_t read16_address_bus(gb_t *gb, uint16_t address)
+{
+    uint16_t lo = read_address_bus(gb, address);
+    uint16_t hi = read_address_bus(gb, address + 1);
+
+    return lo | (hi << 8);
+}
+
+void write16_address_bus(gb_t *gb, uint16_t address, uint16_t value)
+{
+    write_address_bus(gb, address, value & 0xFF);
+    write_address_bus(gb, address + 1, (value >> 8) & 0xFF);
 }   
\ No newline at end of file
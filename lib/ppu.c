@@ -0,0 +1,679 @@
+#include <ppu.h>
+#include <gb.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && !defined(GBEMU_NO_SIMD)
+#include <immintrin.h>
+#define PPU_X86_SIMD
+#endif
+
+// expands `count` color indices into ARGB pixels through `colors`
+typedef void (*expand_fn)(const uint8_t *line, const uint32_t *colors, uint32_t *out, int count);
+
+struct ppu_cache {
+    // every tile decoded to one color index (0-3) per pixel
+    uint8_t tiles[PPU_TILE_COUNT][8][8];
+    bool dirty[PPU_TILE_COUNT];
+
+    // lines are drawn into the back buffer, it becomes the front one once
+    // the frame is done
+    uint32_t framebuffer[2][LCD_HEIGHT * LCD_WIDTH];
+    int front;
+    expand_fn expand;
+};
+
+// DMG shades, lightest first
+static const uint32_t SHADES[4] = { 0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555, 0xFF000000 };
+
+// sprites beyond this many on a line aren't drawn
+#define LINE_SPRITES 10
+
+// **Palette expansion**
+
+static void expand_scalar(const uint8_t *line, const uint32_t *colors, uint32_t *out, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        out[i] = colors[line[i]];
+    }
+}
+
+#ifdef PPU_X86_SIMD
+
+// SSE2 has no lane shuffle, so each of the 4 colors is picked by compare
+// and mask, 16 pixels at a time
+static void expand_sse2(const uint8_t *line, const uint32_t *colors, uint32_t *out, int count)
+{
+    __m128i c0 = _mm_set1_epi32(colors[0]);
+    __m128i c1 = _mm_set1_epi32(colors[1]);
+    __m128i c2 = _mm_set1_epi32(colors[2]);
+    __m128i c3 = _mm_set1_epi32(colors[3]);
+    __m128i one = _mm_set1_epi8(1);
+    __m128i two = _mm_set1_epi8(2);
+    __m128i three = _mm_set1_epi8(3);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i idx = _mm_loadu_si128((const __m128i *)(line + i));
+        __m128i m1 = _mm_cmpeq_epi8(idx, one);
+        __m128i m2 = _mm_cmpeq_epi8(idx, two);
+        __m128i m3 = _mm_cmpeq_epi8(idx, three);
+
+        // widen the byte masks to 32 bit lanes, 4 pixels per store
+        __m128i m1w[2] = { _mm_unpacklo_epi8(m1, m1), _mm_unpackhi_epi8(m1, m1) };
+        __m128i m2w[2] = { _mm_unpacklo_epi8(m2, m2), _mm_unpackhi_epi8(m2, m2) };
+        __m128i m3w[2] = { _mm_unpacklo_epi8(m3, m3), _mm_unpackhi_epi8(m3, m3) };
+        for (int half = 0; half < 2; half++)
+        {
+            __m128i a1[2] = { _mm_unpacklo_epi16(m1w[half], m1w[half]), _mm_unpackhi_epi16(m1w[half], m1w[half]) };
+            __m128i a2[2] = { _mm_unpacklo_epi16(m2w[half], m2w[half]), _mm_unpackhi_epi16(m2w[half], m2w[half]) };
+            __m128i a3[2] = { _mm_unpacklo_epi16(m3w[half], m3w[half]), _mm_unpackhi_epi16(m3w[half], m3w[half]) };
+            for (int q = 0; q < 2; q++)
+            {
+                __m128i px = _mm_andnot_si128(_mm_or_si128(_mm_or_si128(a1[q], a2[q]), a3[q]), c0);
+                px = _mm_or_si128(px, _mm_and_si128(a1[q], c1));
+                px = _mm_or_si128(px, _mm_and_si128(a2[q], c2));
+                px = _mm_or_si128(px, _mm_and_si128(a3[q], c3));
+                _mm_storeu_si128((__m128i *)(out + i + half * 8 + q * 4), px);
+            }
+        }
+    }
+    expand_scalar(line + i, colors, out + i, count - i);
+}
+
+// a single lane permute is a 4 entry table lookup, 8 pixels at a time
+__attribute__((target("avx2")))
+static void expand_avx2(const uint8_t *line, const uint32_t *colors, uint32_t *out, int count)
+{
+    __m256i palette = _mm256_setr_epi32(colors[0], colors[1], colors[2], colors[3],
+        colors[0], colors[1], colors[2], colors[3]);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(line + i)));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_permutevar8x32_epi32(palette, idx));
+    }
+    expand_scalar(line + i, colors, out + i, count - i);
+}
+
+#endif
+
+static expand_fn pick_expand()
+{
+#ifdef PPU_X86_SIMD
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return expand_avx2;
+    }
+    return expand_sse2;
+#else
+    return expand_scalar;
+#endif
+}
+
+// **Tile cache**
+
+static ppu_cache *get_cache(gb_t *gb)
+{
+    ppu_context *ctx = &gb->ppu;
+    if (!ctx->cache)
+    {
+        ctx->cache = malloc(sizeof(ppu_cache));
+        if (!ctx->cache)
+        {
+            gb_fault(gb, "out of memory allocating the tile cache");
+            return NULL;
+        }
+        memset(ctx->cache->dirty, true, sizeof(ctx->cache->dirty));
+        for (int i = 0; i < LCD_WIDTH * LCD_HEIGHT; i++)
+        {
+            ctx->cache->framebuffer[0][i] = SHADES[0];
+            ctx->cache->framebuffer[1][i] = SHADES[0];
+        }
+        ctx->cache->front = 0;
+        ctx->cache->expand = pick_expand();
+    }
+    return ctx->cache;
+}
+
+static void decode_tile(ppu_cache *cache, const uint8_t *vram, int tile)
+{
+    const uint8_t *data = vram + tile * 16;
+    for (int row = 0; row < 8; row++)
+    {
+        uint8_t lo = data[row * 2];
+        uint8_t hi = data[row * 2 + 1];
+        for (int px = 0; px < 8; px++)
+        {
+            int bit = 7 - px;
+            cache->tiles[tile][row][px] = ((lo >> bit) & 1) | (((hi >> bit) & 1) << 1);
+        }
+    }
+    cache->dirty[tile] = false;
+}
+
+static inline const uint8_t *tile_row(ppu_cache *cache, const uint8_t *vram, int tile, int row)
+{
+    if (cache->dirty[tile])
+    {
+        decode_tile(cache, vram, tile);
+    }
+    return cache->tiles[tile][row];
+}
+
+// tile map entries are unsigned from 0x8000, or signed from 0x9000
+static inline int tile_index(uint8_t lcdc, uint8_t entry)
+{
+    return (lcdc & LCDC_TILE_DATA) ? entry : 256 + (int8_t)entry;
+}
+
+static void palette_colors(uint8_t palette, uint32_t *colors)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        colors[i] = SHADES[(palette >> (i * 2)) & 3];
+    }
+}
+
+// **Scanline compositor**
+
+// 32 tile map entries from `map_row`, starting at tile `first`, `count` tiles
+static void copy_tiles(ppu_cache *cache, const uint8_t *vram, uint8_t lcdc, const uint8_t *map_row,
+    int first, int row, int count, uint8_t *out)
+{
+    for (int t = 0; t < count; t++)
+    {
+        int tile = tile_index(lcdc, map_row[(first + t) & 31]);
+        memcpy(out + t * 8, tile_row(cache, vram, tile, row), 8);
+    }
+}
+
+// mode 2: the first 10 sprites in OAM order that cover the line
+static int scan_oam(gb_t *gb, int *found)
+{
+    ppu_context *ctx = &gb->ppu;
+    ppu_state *s = &ctx->state;
+    int height = (s->lcdc & LCDC_OBJ_TALL) ? 16 : 8;
+
+    int count = 0;
+    for (int i = 0; i < 40 && count < LINE_SPRITES; i++)
+    {
+        int y = ctx->oam[i * 4] - 16;
+        if (s->ly >= y && s->ly < y + height)
+        {
+            found[count++] = i;
+        }
+    }
+    return count;
+}
+
+static void draw_sprites(gb_t *gb, ppu_cache *cache, int *found, int count, const uint8_t *line, uint32_t *out)
+{
+    ppu_context *ctx = &gb->ppu;
+    ppu_state *s = &ctx->state;
+    int height = (s->lcdc & LCDC_OBJ_TALL) ? 16 : 8;
+
+    // lower x wins, then lower OAM index. found is in OAM order so a stable
+    // sort on x is enough
+    for (int i = 1; i < count; i++)
+    {
+        int sprite = found[i];
+        int j = i;
+        while (j > 0 && ctx->oam[found[j - 1] * 4 + 1] > ctx->oam[sprite * 4 + 1])
+        {
+            found[j] = found[j - 1];
+            j--;
+        }
+        found[j] = sprite;
+    }
+
+    uint32_t obp[2][4];
+    palette_colors(s->obp0, obp[0]);
+    palette_colors(s->obp1, obp[1]);
+
+    // a pixel belongs to the highest priority sprite that isn't transparent
+    // there, even if that sprite is then hidden behind the background
+    bool taken[LCD_WIDTH] = { false };
+    for (int i = 0; i < count; i++)
+    {
+        const uint8_t *entry = &ctx->oam[found[i] * 4];
+        int x = entry[1] - 8;
+        uint8_t attributes = entry[3];
+
+        int row = s->ly - (entry[0] - 16);
+        if (attributes & 0x40)
+        {
+            row = height - 1 - row;
+        }
+        int tile = height == 16 ? (entry[2] & 0xFE) + (row >> 3) : entry[2];
+        const uint8_t *pixels = tile_row(cache, ctx->vram, tile, row & 7);
+
+        const uint32_t *colors = obp[(attributes >> 4) & 1];
+        bool behind_bg = attributes & 0x80;
+        bool flip_x = attributes & 0x20;
+
+        for (int px = 0; px < 8; px++)
+        {
+            int sx = x + px;
+            if (sx < 0 || sx >= LCD_WIDTH || taken[sx])
+            {
+                continue;
+            }
+            uint8_t color = pixels[flip_x ? 7 - px : px];
+            if (!color)
+            {
+                continue;
+            }
+            taken[sx] = true;
+            if (!behind_bg || !line[sx])
+            {
+                out[sx] = colors[color];
+            }
+        }
+    }
+}
+
+static bool window_visible(ppu_state *s)
+{
+    return (s->lcdc & LCDC_BG_ENABLE) && (s->lcdc & LCDC_WINDOW_ENABLE) && s->wy <= s->ly && s->wx <= 166;
+}
+
+static void render_line(gb_t *gb, int *sprites, int sprite_count)
+{
+    ppu_context *ctx = &gb->ppu;
+    ppu_state *s = &ctx->state;
+    ppu_cache *cache = get_cache(gb);
+    if (!cache)
+    {
+        return;
+    }
+
+    // 21 tiles so there's a whole extra one to fine scroll into
+    uint8_t tiles[21 * 8];
+    uint8_t *line = tiles;
+
+    if (s->lcdc & LCDC_BG_ENABLE)
+    {
+        uint8_t y = s->scy + s->ly;
+        const uint8_t *map = ctx->vram + ((s->lcdc & LCDC_BG_MAP) ? 0x1C00 : 0x1800) + (y / 8) * 32;
+        copy_tiles(cache, ctx->vram, s->lcdc, map, s->scx / 8, y & 7, 21, tiles);
+        line = tiles + (s->scx & 7);
+
+        // the window covers everything right of wx - 7
+        if (window_visible(s))
+        {
+            int start = s->wx - 7;
+            int skip = start < 0 ? -start : 0;
+            start += skip;
+
+            uint8_t window[21 * 8];
+            const uint8_t *wmap = ctx->vram + ((s->lcdc & LCDC_WINDOW_MAP) ? 0x1C00 : 0x1800) + (s->window_line / 8) * 32;
+            copy_tiles(cache, ctx->vram, s->lcdc, wmap, 0, s->window_line & 7, 21, window);
+            memcpy(line + start, window + skip, LCD_WIDTH - start);
+        }
+    }
+    else
+    {
+        memset(tiles, 0, LCD_WIDTH);
+    }
+
+    uint32_t bg[4];
+    palette_colors(s->bgp, bg);
+    uint32_t *out = cache->framebuffer[cache->front ^ 1] + s->ly * LCD_WIDTH;
+    cache->expand(line, bg, out, LCD_WIDTH);
+
+    if ((s->lcdc & LCDC_OBJ_ENABLE) && sprite_count)
+    {
+        draw_sprites(gb, cache, sprites, sprite_count, line, out);
+    }
+}
+
+// **LCD timing**
+
+static void update_stat(gb_t *gb)
+{
+    ppu_state *s = &gb->ppu.state;
+    bool line = ((s->stat & STAT_LYC_INT) && s->ly == s->lyc) ||
+        ((s->stat & STAT_HBLANK_INT) && s->mode == MODE_HBLANK) ||
+        ((s->stat & STAT_VBLANK_INT) && s->mode == MODE_VBLANK) ||
+        ((s->stat & STAT_OAM_INT) && s->mode == MODE_OAM);
+
+    // all the sources share one line, so a source coming on while another
+    // one already holds it high doesn't interrupt again
+    if (line && !s->stat_line)
+    {
+        cpu_request_interrupt(gb, IT_LCD_STAT);
+    }
+    s->stat_line = line;
+}
+
+// decides whether the frame that's starting gets drawn
+static void start_frame(gb_t *gb)
+{
+    ppu_context *ctx = &gb->ppu;
+    uint64_t frame = ctx->state.frames;
+
+    ctx->rendering = ctx->render_interval && frame % ctx->render_interval == 0;
+
+    // requests for this frame are used up, ones for earlier frames were
+    // missed and are dropped
+    int kept = 0;
+    for (int i = 0; i < ctx->request_count; i++)
+    {
+        if (ctx->requests[i] == frame)
+        {
+            ctx->rendering = true;
+        }
+        else if (ctx->requests[i] > frame)
+        {
+            ctx->requests[kept++] = ctx->requests[i];
+        }
+    }
+    ctx->request_count = kept;
+}
+
+static void end_frame(gb_t *gb)
+{
+    ppu_context *ctx = &gb->ppu;
+    ctx->state.frames++;
+    if (ctx->rendering && ctx->cache)
+    {
+        ctx->cache->front ^= 1;
+    }
+    ctx->rendering = false;
+}
+
+// one event per mode change, `when` is when the mode that's ending was due
+// to end
+static void lcd_event(gb_t *gb, uint64_t when)
+{
+    ppu_context *ctx = &gb->ppu;
+    ppu_state *s = &ctx->state;
+    uint64_t next;
+
+    switch (s->mode)
+    {
+        case MODE_OAM:
+        {
+            int sprites[LINE_SPRITES];
+            // OAM reads as 0xFF during DMA, which puts every sprite off screen
+            int sprite_count = (s->lcdc & LCDC_OBJ_ENABLE) && !gb->dma.active ? scan_oam(gb, sprites) : 0;
+
+            // the fetcher stalls for the fine scroll and for each sprite
+            s->mode = MODE_DRAW;
+            s->draw_cycles = LCD_DRAW_CYCLES + (s->scx & 7) + sprite_count * 6;
+            next = when + s->draw_cycles;
+
+            if (ctx->rendering)
+            {
+                render_line(gb, sprites, sprite_count);
+            }
+            if (window_visible(s))
+            {
+                s->window_line++;
+            }
+            break;
+        }
+        case MODE_DRAW:
+            s->mode = MODE_HBLANK;
+            next = when + LCD_LINE_CYCLES - LCD_OAM_CYCLES - s->draw_cycles;
+            break;
+
+        case MODE_HBLANK:
+            s->ly++;
+            if (s->ly == LCD_HEIGHT)
+            {
+                s->mode = MODE_VBLANK;
+                next = when + LCD_LINE_CYCLES;
+                cpu_request_interrupt(gb, IT_VBLANK);
+                end_frame(gb);
+            }
+            else
+            {
+                s->mode = MODE_OAM;
+                next = when + LCD_OAM_CYCLES;
+            }
+            break;
+
+        case MODE_VBLANK:
+        default:
+            s->ly++;
+            if (s->ly == LCD_LINES)
+            {
+                s->ly = 0;
+                s->window_line = 0;
+                s->mode = MODE_OAM;
+                next = when + LCD_OAM_CYCLES;
+                start_frame(gb);
+            }
+            else
+            {
+                next = when + LCD_LINE_CYCLES;
+            }
+            break;
+    }
+
+    update_stat(gb);
+    scheduler_schedule(gb, EVENT_LCD, next);
+}
+
+// line 0, mode 2, from LCD on
+static void lcd_start(gb_t *gb)
+{
+    ppu_state *s = &gb->ppu.state;
+    s->ly = 0;
+    s->window_line = 0;
+    s->mode = MODE_OAM;
+    start_frame(gb);
+    update_stat(gb);
+    scheduler_schedule_in(gb, EVENT_LCD, LCD_OAM_CYCLES);
+}
+
+static void lcd_stop(gb_t *gb)
+{
+    ppu_state *s = &gb->ppu.state;
+    s->ly = 0;
+    s->window_line = 0;
+    s->mode = MODE_HBLANK;
+    s->stat_line = false;
+    gb->ppu.rendering = false;
+    scheduler_cancel(gb, EVENT_LCD);
+}
+
+void ppu_init(gb_t *gb)
+{
+    ppu_context *ctx = &gb->ppu;
+    memset(ctx->vram, 0, sizeof(ctx->vram));
+    memset(ctx->oam, 0, sizeof(ctx->oam));
+
+    // what the boot rom leaves behind
+    ctx->state = (ppu_state){0};
+    ctx->state.lcdc = 0x91;
+    ctx->state.bgp = 0xFC;
+    ctx->state.obp0 = 0xFF;
+    ctx->state.obp1 = 0xFF;
+
+    ctx->request_count = 0;
+    ppu_invalidate(gb);
+    scheduler_set_handler(gb, EVENT_LCD, lcd_event);
+    lcd_start(gb);
+}
+
+void ppu_release(gb_t *gb)
+{
+    free(gb->ppu.cache);
+    gb->ppu.cache = NULL;
+}
+
+void ppu_fork(gb_t *parent, gb_t *child)
+{
+    // the child builds its own cache when it first draws
+    child->ppu.cache = NULL;
+}
+
+void ppu_map(gb_t *gb)
+{
+    uint8_t *vram = gb->ppu.vram;
+    memorymap_map(gb, 0x8000, 0x1800 / BUS_PAGE_SIZE, vram, NULL);
+    // the tile maps aren't cached, those can be written direct
+    memorymap_map(gb, 0x9800, 0x800 / BUS_PAGE_SIZE, vram + 0x1800, vram + 0x1800);
+}
+
+void ppu_invalidate(gb_t *gb)
+{
+    if (gb->ppu.cache)
+    {
+        memset(gb->ppu.cache->dirty, true, sizeof(gb->ppu.cache->dirty));
+    }
+    // lines already drawn belong to some other state
+    gb->ppu.rendering = false;
+}
+
+uint8_t read_vram(gb_t *gb, uint16_t address)
+{
+    return gb->ppu.vram[address - 0x8000];
+}
+
+void write_vram(gb_t *gb, uint16_t address, uint8_t value)
+{
+    ppu_context *ctx = &gb->ppu;
+    address -= 0x8000;
+    ctx->vram[address] = value;
+    if (address < 0x1800 && ctx->cache)
+    {
+        ctx->cache->dirty[address / 16] = true;
+    }
+}
+
+uint8_t read_oam(gb_t *gb, uint16_t address)
+{
+    return gb->ppu.oam[address - 0xFE00];
+}
+
+void write_oam(gb_t *gb, uint16_t address, uint8_t value)
+{
+    gb->ppu.oam[address - 0xFE00] = value;
+}
+
+uint8_t ppu_read_io(gb_t *gb, uint16_t address)
+{
+    ppu_state *s = &gb->ppu.state;
+    switch (address)
+    {
+        case 0xFF40: return s->lcdc;
+        // bit 7 always reads set
+        case 0xFF41: return 0x80 | (s->stat & 0x78) | (s->ly == s->lyc ? 0x04 : 0) | s->mode;
+        case 0xFF42: return s->scy;
+        case 0xFF43: return s->scx;
+        case 0xFF44: return gb->ppu.ly_fixed ? gb->ppu.fixed_ly : s->ly;
+        case 0xFF45: return s->lyc;
+        case 0xFF47: return s->bgp;
+        case 0xFF48: return s->obp0;
+        case 0xFF49: return s->obp1;
+        case 0xFF4A: return s->wy;
+        case 0xFF4B: return s->wx;
+    }
+    return 0xFF;
+}
+
+void ppu_write_io(gb_t *gb, uint16_t address, uint8_t value)
+{
+    ppu_state *s = &gb->ppu.state;
+    switch (address)
+    {
+        case 0xFF40:
+        {
+            bool was_on = s->lcdc & LCDC_LCD_ENABLE;
+            s->lcdc = value;
+            if (was_on && !(value & LCDC_LCD_ENABLE))
+            {
+                lcd_stop(gb);
+            }
+            else if (!was_on && (value & LCDC_LCD_ENABLE))
+            {
+                lcd_start(gb);
+            }
+            break;
+        }
+        case 0xFF41:
+            s->stat = value & 0x78;
+            if (s->lcdc & LCDC_LCD_ENABLE)
+            {
+                update_stat(gb);
+            }
+            break;
+        case 0xFF42: s->scy = value; break;
+        case 0xFF43: s->scx = value; break;
+        // LY is read only
+        case 0xFF44: break;
+        case 0xFF45:
+            s->lyc = value;
+            if (s->lcdc & LCDC_LCD_ENABLE)
+            {
+                update_stat(gb);
+            }
+            break;
+        case 0xFF47: s->bgp = value; break;
+        case 0xFF48: s->obp0 = value; break;
+        case 0xFF49: s->obp1 = value; break;
+        case 0xFF4A: s->wy = value; break;
+        case 0xFF4B: s->wx = value; break;
+    }
+}
+
+void ppu_set_render_interval(gb_t *gb, uint32_t interval)
+{
+    gb->ppu.render_interval = interval;
+}
+
+void ppu_set_fixed_ly(gb_t *gb, int ly)
+{
+    gb->ppu.ly_fixed = ly >= 0;
+    gb->ppu.fixed_ly = ly >= 0 ? ly : 0;
+}
+
+bool ppu_request_frame(gb_t *gb, uint64_t frame)
+{
+    ppu_context *ctx = &gb->ppu;
+    ppu_state *s = &ctx->state;
+
+    // the frame count's frame is under way from line 0 until vblank
+    bool started = (s->lcdc & LCDC_LCD_ENABLE) && s->ly < LCD_HEIGHT;
+    if (frame < s->frames || (frame == s->frames && started))
+    {
+        return false;
+    }
+    for (int i = 0; i < ctx->request_count; i++)
+    {
+        if (ctx->requests[i] == frame)
+        {
+            return true;
+        }
+    }
+    if (ctx->request_count == PPU_FRAME_REQUESTS)
+    {
+        return false;
+    }
+    ctx->requests[ctx->request_count++] = frame;
+    return true;
+}
+
+const uint32_t *ppu_framebuffer(gb_t *gb)
+{
+    ppu_cache *cache = get_cache(gb);
+    return cache ? cache->framebuffer[cache->front] : NULL;
+}
+
+uint64_t ppu_framebuffer_hash(gb_t *gb)
+{
+    const uint32_t *pixels = ppu_framebuffer(gb);
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (int i = 0; pixels && i < LCD_WIDTH * LCD_HEIGHT; i++)
+    {
+        hash = (hash ^ pixels[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
@@ -1,36 +1,224 @@
-#include <ram.h>
-
-typedef struct {
-    uint8_t wram[0x2000];
-    uint8_t hram[0x80];
-} ram_context;
-
-static ram_context ctx;
-
-uint8_t read_wram(uint16_t address)
-{
-    // remove offset from memory map
-    address -= 0xC000;
-    return ctx.wram[address];
-}
-
-void write_wram(uint16_t address, uint8_t value)
-{
-    // remove offset from memory map
-    address -= 0xC000;
-    ctx.wram[address] = value;
-}
-
-uint8_t read_hram(uint8_t address)
-{
-    // remove the offset from memory map
-    address -= 0xFF80;
-    return ctx.hram[address];
-}
-
-void write_hram(uint16_t address, uint8_t value)
-{
-    // remove offset from memory map
-    address -= 0xFF80;
-    ctx.hram[address] = value;
+#include <ram.h>
+#include <gb.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct ram_page {
+    // instances holding the page, they can be on different threads
+    atomic_int refs;
+    // storage, unless the page was made over someone else's memory
+    uint8_t *data;
+    uint8_t storage[RAM_PAGE_SIZE];
+};
+
+ram_page *ram_page_new()
+{
+    ram_page *page = calloc(1, sizeof(ram_page));
+    if (page)
+    {
+        atomic_init(&page->refs, 1);
+        page->data = page->storage;
+    }
+    return page;
+}
+
+ram_page *ram_page_wrap(uint8_t *data)
+{
+    ram_page *page = ram_page_new();
+    if (page)
+    {
+        page->data = data;
+    }
+    return page;
+}
+
+ram_page *ram_page_share(ram_page *page)
+{
+    atomic_fetch_add_explicit(&page->refs, 1, memory_order_relaxed);
+    return page;
+}
+
+ram_page *ram_page_fork(ram_page *page)
+{
+    if (page->data == page->storage)
+    {
+        return ram_page_share(page);
+    }
+
+    ram_page *copy = ram_page_new();
+    if (copy)
+    {
+        memcpy(copy->data, page->data, RAM_PAGE_SIZE);
+    }
+    return copy;
+}
+
+void ram_page_release(ram_page *page)
+{
+    // whoever drops the last reference frees it, this also covers two
+    // sharers copying the same page at once
+    if (page && atomic_fetch_sub_explicit(&page->refs, 1, memory_order_acq_rel) == 1)
+    {
+        free(page);
+    }
+}
+
+uint8_t *ram_page_data(ram_page *page)
+{
+    return page->data;
+}
+
+bool ram_page_is_shared(ram_page *page)
+{
+    return atomic_load_explicit(&page->refs, memory_order_acquire) > 1;
+}
+
+uint8_t *ram_page_own(ram_page **slot)
+{
+    ram_page *page = *slot;
+    if (ram_page_is_shared(page))
+    {
+        ram_page *copy = malloc(sizeof(ram_page));
+        if (!copy)
+        {
+            return NULL;
+        }
+        atomic_init(&copy->refs, 1);
+        copy->data = copy->storage;
+        memcpy(copy->data, page->data, RAM_PAGE_SIZE);
+        ram_page_release(page);
+        *slot = copy;
+        page = copy;
+    }
+    return page->data;
+}
+
+bool ram_init(gb_t *gb)
+{
+    for (int i = 0; i < WRAM_PAGES; i++)
+    {
+        gb->ram.wram[i] = ram_page_new();
+        if (!gb->ram.wram[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ram_reset(gb_t *gb)
+{
+    for (int i = 0; i < WRAM_PAGES; i++)
+    {
+        if (ram_page_is_shared(gb->ram.wram[i]))
+        {
+            ram_page *fresh = ram_page_new();
+            if (!fresh)
+            {
+                continue;
+            }
+            ram_page_release(gb->ram.wram[i]);
+            gb->ram.wram[i] = fresh;
+        }
+        else
+        {
+            memset(gb->ram.wram[i]->data, 0, RAM_PAGE_SIZE);
+        }
+    }
+    memset(gb->ram.hram, 0, sizeof(gb->ram.hram));
+}
+
+void ram_release(gb_t *gb)
+{
+    for (int i = 0; i < WRAM_PAGES; i++)
+    {
+        ram_page_release(gb->ram.wram[i]);
+        gb->ram.wram[i] = NULL;
+    }
+}
+
+void ram_fork(gb_t *parent, gb_t *child)
+{
+    for (int i = 0; i < WRAM_PAGES; i++)
+    {
+        child->ram.wram[i] = ram_page_share(parent->ram.wram[i]);
+    }
+}
+
+void ram_map(gb_t *gb)
+{
+    for (int i = 0; i < WRAM_PAGES; i++)
+    {
+        ram_page *page = gb->ram.wram[i];
+        memorymap_map(gb, 0xC000 + i * RAM_PAGE_SIZE, 1, page->data, ram_page_is_shared(page) ? NULL : page->data);
+    }
+}
+
+void ram_save_wram(gb_t *gb, uint8_t *out)
+{
+    for (int i = 0; i < WRAM_PAGES; i++)
+    {
+        memcpy(out + i * RAM_PAGE_SIZE, gb->ram.wram[i]->data, RAM_PAGE_SIZE);
+    }
+}
+
+void ram_load_wram(gb_t *gb, const uint8_t *in)
+{
+    for (int i = 0; i < WRAM_PAGES; i++)
+    {
+        const uint8_t *src = in + i * RAM_PAGE_SIZE;
+        if (memcmp(gb->ram.wram[i]->data, src, RAM_PAGE_SIZE) == 0)
+        {
+            // unchanged pages stay shared
+            continue;
+        }
+
+        uint8_t *data = ram_page_own(&gb->ram.wram[i]);
+        if (!data)
+        {
+            gb_fault(gb, "out of memory copying a ram page");
+            return;
+        }
+        memcpy(data, src, RAM_PAGE_SIZE);
+    }
+}
+
+uint8_t read_wram(gb_t *gb, uint16_t address)
+{
+    // remove offset from memory map
+    address -= 0xC000;
+    return gb->ram.wram[address / RAM_PAGE_SIZE]->data[address % RAM_PAGE_SIZE];
+}
+
+void write_wram(gb_t *gb, uint16_t address, uint8_t value)
+{
+    // remove offset from memory map
+    address -= 0xC000;
+
+    // only shared pages get here, take our own copy and map it writable so
+    // the rest of the writes to it go direct
+    int index = address / RAM_PAGE_SIZE;
+    uint8_t *data = ram_page_own(&gb->ram.wram[index]);
+    if (!data)
+    {
+        gb_fault(gb, "out of memory copying a ram page");
+        return;
+    }
+    data[address % RAM_PAGE_SIZE] = value;
+    memorymap_map(gb, 0xC000 + index * RAM_PAGE_SIZE, 1, data, data);
+}
+
+uint8_t read_hram(gb_t *gb, uint16_t address)
+{
+    // remove the offset from memory map
+    address -= 0xFF80;
+    return gb->ram.hram[address];
+}
+
+void write_hram(gb_t *gb, uint16_t address, uint8_t value)
+{
+    // remove offset from memory map
+    address -= 0xFF80;
+    gb->ram.hram[address] = value;
 }
\ No newline at end of file
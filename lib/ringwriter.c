@@ -0,0 +1,136 @@
+#include <ringwriter.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+struct ring_writer {
+    // written by the emulator thread only. `reserved` runs ahead of head
+    // until the slots are published
+    _Alignas(64) atomic_size_t head;
+    size_t reserved;
+    size_t cached_tail;
+
+    // written by the writer thread only
+    _Alignas(64) atomic_size_t tail;
+
+    atomic_bool stopping;
+    pthread_t thread;
+    ring_write_fn write;
+    void *context;
+    size_t slot_size;
+    size_t mask;
+    size_t batch;
+    uint8_t *slots;
+};
+
+static void *writer_thread(void *arg)
+{
+    ring_writer *ring = arg;
+    size_t size = ring->mask + 1;
+
+    while (true)
+    {
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        if (head == tail)
+        {
+            if (atomic_load_explicit(&ring->stopping, memory_order_acquire))
+            {
+                // the producer is done, one last look at head before leaving
+                if (atomic_load_explicit(&ring->head, memory_order_acquire) == tail)
+                {
+                    break;
+                }
+                continue;
+            }
+            struct timespec ts = { 0, 1000000 };
+            nanosleep(&ts, NULL);
+            continue;
+        }
+
+        // write out the contiguous run up to the end of the ring
+        size_t count = head - tail;
+        size_t start = tail & ring->mask;
+        if (count > size - start)
+        {
+            count = size - start;
+        }
+        if (ring->batch && count > ring->batch)
+        {
+            count = ring->batch;
+        }
+
+        ring->write(ring->context, ring->slots + start * ring->slot_size, count);
+        atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+    }
+
+    return NULL;
+}
+
+ring_writer *ring_writer_open(size_t slot_size, size_t slot_count, size_t batch, ring_write_fn write, void *context)
+{
+    ring_writer *ring = calloc(1, sizeof(ring_writer));
+    uint8_t *slots = ring ? malloc(slot_size * slot_count) : NULL;
+    if (!slots)
+    {
+        free(ring);
+        return NULL;
+    }
+    ring->write = write;
+    ring->context = context;
+    ring->slot_size = slot_size;
+    ring->mask = slot_count - 1;
+    ring->batch = batch;
+    ring->slots = slots;
+
+    if (pthread_create(&ring->thread, NULL, writer_thread, ring) != 0)
+    {
+        free(slots);
+        free(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+void *ring_writer_reserve(ring_writer *ring)
+{
+    size_t next = ring->reserved;
+    if (next - ring->cached_tail > ring->mask)
+    {
+        // only go back to the shared tail when our copy says we're full,
+        // and wait for the writer thread if we really are. what has been
+        // filled in so far is handed over first
+        ring_writer_publish(ring);
+        ring->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        while (next - ring->cached_tail > ring->mask)
+        {
+            sched_yield();
+            ring->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        }
+    }
+    ring->reserved = next + 1;
+    return ring->slots + (next & ring->mask) * ring->slot_size;
+}
+
+void ring_writer_publish(ring_writer *ring)
+{
+    atomic_store_explicit(&ring->head, ring->reserved, memory_order_release);
+}
+
+void ring_writer_close(ring_writer *ring)
+{
+    if (!ring)
+    {
+        return;
+    }
+
+    atomic_store_explicit(&ring->stopping, true, memory_order_release);
+    pthread_join(ring->thread, NULL);
+    free(ring->slots);
+    free(ring);
+}
@@ -0,0 +1,88 @@
+#include <romcache.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define ROMCACHE_MAGIC 0x43484247 // "GBHC"
+#define ROMCACHE_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    cartridge_info info;
+} romcache_entry;
+
+static bool entry_path(char *buf, size_t size, uint16_t global_checksum, uint32_t file_size, uint8_t header_checksum)
+{
+    const char *dir = getenv(ROMCACHE_ENV);
+    if (!dir || !*dir)
+    {
+        return false;
+    }
+
+    int n = snprintf(buf, size, "%s/%04X-%08X-%02X.gbhc", dir, global_checksum, file_size, header_checksum);
+    return n > 0 && n < size;
+}
+
+bool romcache_lookup(uint16_t global_checksum, uint32_t file_size, uint8_t header_checksum, cartridge_info *info)
+{
+    char path[1024];
+    if (!entry_path(path, sizeof(path), global_checksum, file_size, header_checksum))
+    {
+        return false;
+    }
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+    {
+        return false;
+    }
+
+    romcache_entry entry;
+    bool ok = fread(&entry, sizeof(entry), 1, fp) == 1 &&
+        entry.magic == ROMCACHE_MAGIC &&
+        entry.version == ROMCACHE_VERSION &&
+        entry.info.global_checksum == global_checksum &&
+        entry.info.file_size == file_size &&
+        entry.info.header_checksum == header_checksum;
+    fclose(fp);
+
+    if (ok)
+    {
+        *info = entry.info;
+    }
+    return ok;
+}
+
+void romcache_store(const cartridge_info *info)
+{
+    char path[1024];
+    if (!entry_path(path, sizeof(path), info->global_checksum, info->file_size, info->header_checksum))
+    {
+        return;
+    }
+
+    mkdir(getenv(ROMCACHE_ENV), 0755);
+
+    // write to a temp file and rename it in so other instances never see a
+    // half written entry
+    char tmp_path[1100];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+
+    FILE *fp = fopen(tmp_path, "wb");
+    if (!fp)
+    {
+        return;
+    }
+
+    romcache_entry entry = { .magic = ROMCACHE_MAGIC, .version = ROMCACHE_VERSION, .info = *info };
+    bool ok = fwrite(&entry, sizeof(entry), 1, fp) == 1;
+    ok = fclose(fp) == 0 && ok;
+
+    if (!ok || rename(tmp_path, path) != 0)
+    {
+        unlink(tmp_path);
+    }
+}
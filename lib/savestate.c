@@ -0,0 +1,312 @@
+#include <savestate.h>
+#include <gb.h>
+#include <instructions.h>
+#include <ringwriter.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// sections are either copied straight out of gb_t, or for state that
+// isn't flat (shared ram pages) go through save/load functions
+typedef struct {
+    char id[4];
+    size_t offset;
+    size_t size;
+    void (*save)(gb_t *gb, uint8_t *out);
+    void (*load)(gb_t *gb, const uint8_t *in);
+} savestate_section;
+
+#define SECTION(id, member) { id, offsetof(gb_t, member), sizeof(((gb_t *)0)->member) }
+
+// the parts of gb_t that are emulated state, everything else is either
+// host side or derived from these
+static const savestate_section SECTIONS[] = {
+    SECTION("CPU ", cpu),
+    SECTION("SCHD", scheduler),
+    SECTION("HRAM", ram.hram),
+    { "WRAM", 0, WRAM_PAGES * RAM_PAGE_SIZE, ram_save_wram, ram_load_wram },
+    SECTION("VRAM", ppu.vram),
+    SECTION("OAM ", ppu.oam),
+    SECTION("PPU ", ppu.state),
+    SECTION("TIMR", timer),
+    SECTION("DMA ", dma),
+    SECTION("SERL", serial.state),
+    SECTION("JOYP", joypad),
+    SECTION("APU ", apu.state),
+    SECTION("MBC ", cart.mbc),
+    { "CRAM", 0, CART_RAM_MAX, cartridge_save_ram, cartridge_load_ram },
+};
+
+#define SECTION_COUNT (sizeof(SECTIONS) / sizeof(SECTIONS[0]))
+
+// keeps every section 8 byte aligned in the buffer
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+size_t savestate_size()
+{
+    size_t size = ALIGN8(sizeof(savestate_header));
+    for (int i = 0; i < SECTION_COUNT; i++)
+    {
+        size += sizeof(savestate_section_header) + ALIGN8(SECTIONS[i].size);
+    }
+    return size;
+}
+
+static void rom_identity(gb_t *gb, savestate_header *header)
+{
+    header->rom_size = gb->cart.rom_size;
+    header->rom_global_checksum = gb->cart.rom_size >= 0x150 ?
+        (gb->cart.rom_data[0x14E] << 8) | gb->cart.rom_data[0x14F] : 0;
+    header->rom_header_checksum = gb->cart.header.header_checksum;
+}
+
+size_t savestate_save(gb_t *gb, void *buffer, size_t size)
+{
+    size_t total = savestate_size();
+    if (size < total)
+    {
+        return 0;
+    }
+
+    uint8_t *out = buffer;
+    savestate_header *header = buffer;
+    memset(header, 0, ALIGN8(sizeof(savestate_header)));
+    memcpy(header->magic, SAVESTATE_MAGIC, sizeof(header->magic));
+    header->version = SAVESTATE_VERSION;
+    header->section_count = SECTION_COUNT;
+    header->size = total;
+    header->ticks = gb->scheduler.now;
+    header->instructions = gb->instructions;
+    rom_identity(gb, header);
+    out += ALIGN8(sizeof(savestate_header));
+
+    for (int i = 0; i < SECTION_COUNT; i++)
+    {
+        savestate_section_header *section = (savestate_section_header *)out;
+        memcpy(section->id, SECTIONS[i].id, sizeof(section->id));
+        section->size = SECTIONS[i].size;
+        out += sizeof(savestate_section_header);
+
+        if (SECTIONS[i].save)
+        {
+            SECTIONS[i].save(gb, out);
+        }
+        else
+        {
+            memcpy(out, (uint8_t *)gb + SECTIONS[i].offset, SECTIONS[i].size);
+        }
+        out += ALIGN8(SECTIONS[i].size);
+    }
+    return total;
+}
+
+static bool check_snapshot(gb_t *gb, const void *buffer, size_t size)
+{
+    const savestate_header *header = buffer;
+    if (size < sizeof(savestate_header) || memcmp(header->magic, SAVESTATE_MAGIC, sizeof(header->magic)) != 0)
+    {
+        return false;
+    }
+    if (header->version != SAVESTATE_VERSION || header->section_count != SECTION_COUNT ||
+        header->size != savestate_size() || size < header->size)
+    {
+        return false;
+    }
+
+    savestate_header rom = {0};
+    rom_identity(gb, &rom);
+    if (!gb->cart.rom_data || header->rom_size != rom.rom_size ||
+        header->rom_global_checksum != rom.rom_global_checksum ||
+        header->rom_header_checksum != rom.rom_header_checksum)
+    {
+        return false;
+    }
+
+    const uint8_t *in = (const uint8_t *)buffer + ALIGN8(sizeof(savestate_header));
+    for (int i = 0; i < SECTION_COUNT; i++)
+    {
+        const savestate_section_header *section = (const savestate_section_header *)in;
+        if (memcmp(section->id, SECTIONS[i].id, sizeof(section->id)) != 0 || section->size != SECTIONS[i].size)
+        {
+            return false;
+        }
+        in += sizeof(savestate_section_header) + ALIGN8(SECTIONS[i].size);
+    }
+    return true;
+}
+
+bool savestate_load(gb_t *gb, const void *buffer, size_t size)
+{
+    // everything is checked up front so a bad snapshot changes nothing
+    if (!check_snapshot(gb, buffer, size))
+    {
+        return false;
+    }
+
+    // host side, these stay as they are
+    trace_writer *trace = gb->cpu.trace;
+    event_handler handlers[EVENT_COUNT];
+    memcpy(handlers, gb->scheduler.handlers, sizeof(handlers));
+
+    const savestate_header *header = buffer;
+    gb->instructions = header->instructions;
+    gb->stopped = false;
+    gb->fault[0] = 0;
+
+    const uint8_t *in = (const uint8_t *)buffer + ALIGN8(sizeof(savestate_header));
+    for (int i = 0; i < SECTION_COUNT; i++)
+    {
+        in += sizeof(savestate_section_header);
+        if (SECTIONS[i].load)
+        {
+            SECTIONS[i].load(gb, in);
+        }
+        else
+        {
+            memcpy((uint8_t *)gb + SECTIONS[i].offset, in, SECTIONS[i].size);
+        }
+        in += ALIGN8(SECTIONS[i].size);
+    }
+
+    gb->cpu.trace = trace;
+    gb->cpu.current_instruction = get_instruction_by_opcode(gb->cpu.current_opcode);
+    memcpy(gb->scheduler.handlers, handlers, sizeof(handlers));
+
+    // VRAM was copied in behind the tile cache's back, and the sound state
+    // behind the synthesis'
+    ppu_invalidate(gb);
+    apu_invalidate(gb);
+
+    // the page table only holds pointers derived from the state above, and
+    // ram was copied in behind its back too so whatever was decoded from it
+    // is stale
+    memorymap_init(gb);
+
+    // a lockstep copy would still be running the old state
+    jit_reset(gb);
+
+    // the other end's clock has nothing to do with the loaded one, so this
+    // pulls the cable out
+    link_disconnect(gb);
+    return true;
+}
+
+bool savestate_save_file(gb_t *gb, const char *path)
+{
+    size_t size = savestate_size();
+    void *buffer = malloc(size);
+    FILE *fp = fopen(path, "wb");
+    if (!buffer || !fp)
+    {
+        printf("Failed to open: %s\n", path);
+        free(buffer);
+        if (fp)
+        {
+            fclose(fp);
+        }
+        return false;
+    }
+
+    savestate_save(gb, buffer, size);
+    bool ok = fwrite(buffer, size, 1, fp) == 1;
+    ok = fclose(fp) == 0 && ok;
+    free(buffer);
+    return ok;
+}
+
+bool savestate_load_file(gb_t *gb, const char *path, long index)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+    {
+        printf("Failed to open: %s\n", path);
+        return false;
+    }
+
+    size_t size = savestate_size();
+    void *buffer = malloc(size);
+
+    bool ok = buffer != NULL;
+    if (ok && index < 0)
+    {
+        ok = fseek(fp, 0, SEEK_END) == 0;
+        index += ok ? ftell(fp) / (long)size : 0;
+    }
+    ok = ok && index >= 0 && fseek(fp, index * (long)size, SEEK_SET) == 0;
+    ok = ok && fread(buffer, size, 1, fp) == 1;
+    ok = ok && savestate_load(gb, buffer, size);
+
+    if (!ok)
+    {
+        printf("No usable snapshot %ld in %s\n", index, path);
+    }
+    free(buffer);
+    fclose(fp);
+    return ok;
+}
+
+// **Snapshot stream**
+
+// must be a power of 2
+#define STREAM_RING_SIZE 64
+
+struct savestate_writer {
+    ring_writer *ring;
+    FILE *fp;
+    size_t slot_size;
+};
+
+static void write_snapshots(void *context, const void *snapshots, size_t count)
+{
+    savestate_writer *writer = context;
+    fwrite(snapshots, writer->slot_size, count, writer->fp);
+}
+
+savestate_writer *savestate_writer_open(const char *path)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+    {
+        printf("Failed to open snapshot file: %s\n", path);
+        return NULL;
+    }
+
+    savestate_writer *writer = calloc(1, sizeof(savestate_writer));
+    if (!writer)
+    {
+        fclose(fp);
+        return NULL;
+    }
+    writer->fp = fp;
+    // slots are exactly one snapshot so the ring can be written out as is
+    writer->slot_size = savestate_size();
+
+    writer->ring = ring_writer_open(writer->slot_size, STREAM_RING_SIZE, 0, write_snapshots, writer);
+    if (!writer->ring)
+    {
+        printf("Failed to start snapshot writer thread\n");
+        fclose(fp);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+void savestate_writer_push(savestate_writer *writer, gb_t *gb)
+{
+    savestate_save(gb, ring_writer_reserve(writer->ring), writer->slot_size);
+    ring_writer_publish(writer->ring);
+}
+
+void savestate_writer_close(savestate_writer *writer)
+{
+    if (!writer)
+    {
+        return;
+    }
+
+    ring_writer_close(writer->ring);
+    fclose(writer->fp);
+    free(writer);
+}
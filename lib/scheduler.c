@@ -0,0 +1,160 @@
+#include <scheduler.h>
+#include <gb.h>
+#include <string.h>
+
+static void swap(scheduler_context *sched, int a, int b)
+{
+    event_type ta = sched->heap[a];
+    event_type tb = sched->heap[b];
+    sched->heap[a] = tb;
+    sched->heap[b] = ta;
+    sched->heap_index[tb] = a;
+    sched->heap_index[ta] = b;
+}
+
+static bool earlier(scheduler_context *sched, int a, int b)
+{
+    return sched->when[sched->heap[a]] < sched->when[sched->heap[b]];
+}
+
+static void sift_up(scheduler_context *sched, int i)
+{
+    while (i > 0)
+    {
+        int parent = (i - 1) / 2;
+        if (!earlier(sched, i, parent))
+        {
+            break;
+        }
+        swap(sched, i, parent);
+        i = parent;
+    }
+}
+
+static void sift_down(scheduler_context *sched, int i)
+{
+    while (true)
+    {
+        int smallest = i;
+        int left = i * 2 + 1;
+        int right = left + 1;
+
+        if (left < sched->count && earlier(sched, left, smallest))
+        {
+            smallest = left;
+        }
+        if (right < sched->count && earlier(sched, right, smallest))
+        {
+            smallest = right;
+        }
+        if (smallest == i)
+        {
+            break;
+        }
+        swap(sched, i, smallest);
+        i = smallest;
+    }
+}
+
+static void update_next(scheduler_context *sched)
+{
+    sched->next = sched->count ? sched->when[sched->heap[0]] : UINT64_MAX;
+}
+
+void scheduler_init(gb_t *gb)
+{
+    scheduler_context *sched = &gb->scheduler;
+    memset(sched, 0, sizeof(*sched));
+    for (int i = 0; i < EVENT_COUNT; i++)
+    {
+        sched->heap_index[i] = -1;
+    }
+    update_next(sched);
+}
+
+void scheduler_set_handler(gb_t *gb, event_type type, event_handler handler)
+{
+    gb->scheduler.handlers[type] = handler;
+}
+
+void scheduler_schedule(gb_t *gb, event_type type, uint64_t when)
+{
+    scheduler_context *sched = &gb->scheduler;
+    int i = sched->heap_index[type];
+    if (i < 0)
+    {
+        i = sched->count++;
+        sched->heap[i] = type;
+        sched->heap_index[type] = i;
+        sched->when[type] = when;
+        sift_up(sched, i);
+    }
+    else
+    {
+        uint64_t old = sched->when[type];
+        sched->when[type] = when;
+        if (when < old)
+        {
+            sift_up(sched, i);
+        }
+        else
+        {
+            sift_down(sched, i);
+        }
+    }
+    update_next(sched);
+}
+
+void scheduler_cancel(gb_t *gb, event_type type)
+{
+    scheduler_context *sched = &gb->scheduler;
+    int i = sched->heap_index[type];
+    if (i < 0)
+    {
+        return;
+    }
+
+    int last = --sched->count;
+    if (i != last)
+    {
+        swap(sched, i, last);
+    }
+    sched->heap_index[type] = -1;
+
+    if (i != last)
+    {
+        // the old last element could belong either above or below here
+        sift_down(sched, i);
+        sift_up(sched, i);
+    }
+    update_next(sched);
+}
+
+void scheduler_schedule_in(gb_t *gb, event_type type, uint64_t t_cycles)
+{
+    scheduler_schedule(gb, type, gb->scheduler.now + t_cycles);
+}
+
+bool scheduler_is_scheduled(gb_t *gb, event_type type)
+{
+    return gb->scheduler.heap_index[type] >= 0;
+}
+
+void scheduler_run_due(gb_t *gb)
+{
+    scheduler_context *sched = &gb->scheduler;
+    while (sched->count && sched->when[sched->heap[0]] <= sched->now)
+    {
+        event_type type = sched->heap[0];
+        uint64_t when = sched->when[type];
+
+        // take it off the queue first so the handler can reschedule itself
+        scheduler_cancel(gb, type);
+
+        if (sched->handlers[type])
+        {
+            sched->handlers[type](gb, when);
+        }
+    }
+    update_next(sched);
+}
@@ -0,0 +1,188 @@
+#include <gb.h>
+#include <string.h>
+
+// keeps the byte and ends the run if that finished one of the stop texts.
+// the output is checked after every byte, so only its end can match
+static void capture(gb_t *gb, uint8_t value)
+{
+    serial_context *s = &gb->serial;
+    if (s->length == SERIAL_CAPTURE_SIZE)
+    {
+        // drop the older half
+        memmove(s->output, s->output + SERIAL_CAPTURE_SIZE / 2, SERIAL_CAPTURE_SIZE / 2);
+        s->length = SERIAL_CAPTURE_SIZE / 2;
+    }
+    s->output[s->length++] = value;
+    s->sent++;
+    s->output[s->length] = 0;
+
+    for (int i = 0; i < s->stop_rule_count; i++)
+    {
+        size_t length = strlen(s->stop_rules[i]);
+        if (length <= s->length && memcmp(s->output + s->length - length, s->stop_rules[i], length) == 0)
+        {
+            s->stopped_by = i;
+            gb->run_break = true;
+            break;
+        }
+    }
+}
+
+static void serial_event(gb_t *gb, uint64_t when)
+{
+    serial_state *s = &gb->serial.state;
+    uint8_t sent = s->sb;
+    // with nothing on the other end the line stays high
+    s->sb = gb->serial.link ? link_receive(gb, when) : 0xFF;
+    s->sc &= ~SC_START;
+    cpu_request_interrupt(gb, IT_SERIAL);
+    capture(gb, sent);
+}
+
+// the end of a transfer the other end clocks
+static void serial_peer_event(gb_t *gb, uint64_t when)
+{
+    serial_context *serial = &gb->serial;
+    if (!serial->peer_transfer)
+    {
+        return;
+    }
+    // the other end could still stop or restart it before it gets here,
+    // which takes it off or moves the event
+    when = serial->peer_when;
+    if (!link_sync(gb, when))
+    {
+        serial->peer_transfer = false;
+        return;
+    }
+    if (!serial->peer_transfer || scheduler_is_scheduled(gb, EVENT_SERIAL_PEER))
+    {
+        return;
+    }
+    serial->peer_transfer = false;
+
+    serial_state *s = &serial->state;
+    if ((s->sc & (SC_START | SC_INTERNAL_CLOCK)) != SC_START)
+    {
+        // not listening, or clocking a transfer of its own
+        link_reply(gb, when, 0xFF);
+        return;
+    }
+    uint8_t sent = s->sb;
+    s->sb = serial->peer_byte;
+    s->sc &= ~SC_START;
+    cpu_request_interrupt(gb, IT_SERIAL);
+    link_reply(gb, when, sent);
+    capture(gb, sent);
+}
+
+// the 8th falling edge of the counter's bit 8 from now. a DIV write during
+// the transfer doesn't move it
+static uint64_t transfer_end(gb_t *gb)
+{
+    uint64_t counter = gb->scheduler.now - gb->timer.div_base;
+    uint64_t first = (counter | (SERIAL_BIT_CYCLES - 1)) + 1;
+    return gb->timer.div_base + first + 7 * SERIAL_BIT_CYCLES;
+}
+
+void serial_init(gb_t *gb)
+{
+    serial_context *s = &gb->serial;
+    s->state = (serial_state){0};
+    s->output[0] = 0;
+    s->length = 0;
+    s->sent = 0;
+    s->stopped_by = -1;
+    s->peer_transfer = false;
+    scheduler_set_handler(gb, EVENT_SERIAL, serial_event);
+    scheduler_set_handler(gb, EVENT_SERIAL_PEER, serial_peer_event);
+    scheduler_cancel(gb, EVENT_SERIAL);
+}
+
+void serial_fork(gb_t *parent, gb_t *child)
+{
+    child->serial.link = NULL;
+    child->serial.peer_transfer = false;
+    scheduler_cancel(child, EVENT_SERIAL_PEER);
+    scheduler_cancel(child, EVENT_LINK);
+}
+
+uint8_t serial_read(gb_t *gb, uint16_t address)
+{
+    serial_state *s = &gb->serial.state;
+    if (address == 0xFF01)
+    {
+        return s->sb;
+    }
+    // the bits in between aren't there
+    return s->sc | 0x7E;
+}
+
+void serial_write(gb_t *gb, uint16_t address, uint8_t value)
+{
+    serial_state *s = &gb->serial.state;
+    if (address == 0xFF01)
+    {
+        s->sb = value;
+        return;
+    }
+
+    bool clocking = scheduler_is_scheduled(gb, EVENT_SERIAL);
+    s->sc = value & (SC_START | SC_INTERNAL_CLOCK);
+    if ((s->sc & SC_START) && (s->sc & SC_INTERNAL_CLOCK))
+    {
+        // (re)starting a transfer restarts its count
+        uint64_t end = transfer_end(gb);
+        scheduler_schedule(gb, EVENT_SERIAL, end);
+        link_send(gb, end, s->sb);
+    }
+    else
+    {
+        // stopped, or waiting on the other end's clock
+        scheduler_cancel(gb, EVENT_SERIAL);
+        if (clocking)
+        {
+            link_cancel(gb);
+        }
+    }
+}
+
+void serial_peer_transfer(gb_t *gb, uint64_t when, uint8_t value)
+{
+    serial_context *s = &gb->serial;
+    s->peer_transfer = true;
+    s->peer_byte = value;
+    s->peer_when = when;
+    // only late if the slack is past LINK_SAFE_SLACK
+    scheduler_schedule(gb, EVENT_SERIAL_PEER, when > gb->scheduler.now ? when : gb->scheduler.now);
+}
+
+void serial_peer_cancel(gb_t *gb)
+{
+    gb->serial.peer_transfer = false;
+    scheduler_cancel(gb, EVENT_SERIAL_PEER);
+}
+
+void serial_peer_finish(gb_t *gb)
+{
+    // the same as the event firing, which takes itself off first
+    scheduler_cancel(gb, EVENT_SERIAL_PEER);
+    serial_peer_event(gb, gb->serial.peer_when);
+}
+
+bool serial_stop_on(gb_t *gb, const char *text)
+{
+    serial_context *s = &gb->serial;
+    if (!text)
+    {
+        s->stop_rule_count = 0;
+        s->stopped_by = -1;
+        return true;
+    }
+    if (s->stop_rule_count == SERIAL_STOP_RULES || !*text || strlen(text) >= SERIAL_STOP_TEXT)
+    {
+        return false;
+    }
+    strcpy(s->stop_rules[s->stop_rule_count++], text);
+    return true;
+}
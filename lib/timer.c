@@ -0,0 +1,186 @@
+#include <timer.h>
+#include <apu.h>
+#include <gb.h>
+
+#define TAC_ENABLE 0x04
+
+// the counter bit whose falling edge ticks TIMA, for each TAC clock select
+// (4096, 262144, 65536 and 16384 Hz)
+static const uint8_t TAC_BITS[4] = { 9, 3, 5, 7 };
+
+// the internal counter DIV is the top of, the boot rom leaves it here
+#define DIV_POWER_ON 0xABCC
+
+static inline uint64_t counter(timer_context *t, uint64_t when)
+{
+    return when - t->div_base;
+}
+
+// T-cycles between falling edges of the selected bit
+static inline uint64_t tima_period(timer_context *t)
+{
+    return (uint64_t)2 << TAC_BITS[t->tac & 0x03];
+}
+
+// TIMA ticks between `from` and `to`
+static uint64_t edges(timer_context *t, uint64_t from, uint64_t to)
+{
+    if (!(t->tac & TAC_ENABLE))
+    {
+        return 0;
+    }
+    uint64_t period = tima_period(t);
+    return counter(t, to) / period - counter(t, from) / period;
+}
+
+// the selected bit is set and the timer is on, taking it away is a falling
+// edge
+static bool tima_input(timer_context *t, uint64_t when)
+{
+    return (t->tac & TAC_ENABLE) && (counter(t, when) >> TAC_BITS[t->tac & 0x03] & 1);
+}
+
+// folds the ticks so far into tima so the counter or TAC can change
+static void catch_up(gb_t *gb)
+{
+    timer_context *t = &gb->timer;
+    uint64_t now = gb->scheduler.now;
+    if (!t->reloading)
+    {
+        // the overflow event runs before anything can see TIMA past 0xFF
+        t->tima += edges(t, t->tima_base, now);
+    }
+    t->tima_base = now;
+}
+
+static void schedule_overflow(gb_t *gb)
+{
+    timer_context *t = &gb->timer;
+    if (t->reloading)
+    {
+        // the reload is already on its way
+        return;
+    }
+    if (!(t->tac & TAC_ENABLE))
+    {
+        scheduler_cancel(gb, EVENT_TIMER);
+        return;
+    }
+
+    // the (256 - tima)th falling edge after tima_base
+    uint64_t period = tima_period(t);
+    uint64_t edge = (counter(t, t->tima_base) / period + 256 - t->tima) * period;
+    scheduler_schedule(gb, EVENT_TIMER, t->div_base + edge);
+}
+
+static void overflow(gb_t *gb, uint64_t when)
+{
+    timer_context *t = &gb->timer;
+    t->tima = 0;
+    t->tima_base = when;
+    t->reloading = true;
+    scheduler_schedule(gb, EVENT_TIMER, when + 4);
+}
+
+// one tick outside the counter, from the DIV and TAC glitches
+static void tick(gb_t *gb)
+{
+    timer_context *t = &gb->timer;
+    if (t->reloading)
+    {
+        return;
+    }
+    if (++t->tima == 0)
+    {
+        overflow(gb, gb->scheduler.now);
+    }
+}
+
+static void timer_event(gb_t *gb, uint64_t when)
+{
+    timer_context *t = &gb->timer;
+    if (!t->reloading)
+    {
+        overflow(gb, when);
+        return;
+    }
+
+    t->reloading = false;
+    t->tima = t->tma;
+    t->tima_base = when;
+    cpu_request_interrupt(gb, IT_TIMER);
+    schedule_overflow(gb);
+}
+
+void timer_init(gb_t *gb)
+{
+    timer_context *t = &gb->timer;
+    *t = (timer_context){0};
+    // unsigned, so this wraps to the counter the boot rom leaves
+    t->div_base = gb->scheduler.now - DIV_POWER_ON;
+    t->tima_base = gb->scheduler.now;
+    scheduler_set_handler(gb, EVENT_TIMER, timer_event);
+    scheduler_cancel(gb, EVENT_TIMER);
+}
+
+uint8_t timer_read(gb_t *gb, uint16_t address)
+{
+    timer_context *t = &gb->timer;
+    uint64_t now = gb->scheduler.now;
+    switch (address)
+    {
+        case 0xFF04:
+            return counter(t, now) >> 8;
+        case 0xFF05:
+            return t->reloading ? t->tima : t->tima + edges(t, t->tima_base, now);
+        case 0xFF06:
+            return t->tma;
+        case 0xFF07:
+            // the top 5 bits aren't wired and read as 1
+            return 0xF8 | t->tac;
+    }
+    return 0xFF;
+}
+
+void timer_write(gb_t *gb, uint16_t address, uint8_t value)
+{
+    timer_context *t = &gb->timer;
+    uint64_t now = gb->scheduler.now;
+    catch_up(gb);
+
+    switch (address)
+    {
+        case 0xFF04:
+        {
+            // any write resets the whole counter, the APU's frame
+            // sequencer runs off it too
+            apu_div_write(gb);
+            bool was_set = tima_input(t, now);
+            t->div_base = now;
+            if (was_set)
+            {
+                tick(gb);
+            }
+            break;
+        }
+        case 0xFF05:
+            // a write during the 4 cycles before the reload cancels it
+            t->reloading = false;
+            t->tima = value;
+            break;
+        case 0xFF06:
+            t->tma = value;
+            break;
+        case 0xFF07:
+        {
+            bool was_set = tima_input(t, now);
+            t->tac = value & 0x07;
+            if (was_set && !tima_input(t, now))
+            {
+                tick(gb);
+            }
+            break;
+        }
+    }
+    schedule_overflow(gb);
+}
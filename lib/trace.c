@@ -0,0 +1,88 @@
+#include <trace.h>
+#include <instructions.h>
+#include <ringwriter.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// must be a power of 2
+#define TRACE_RING_SIZE (1 << 16)
+
+// how many records the writer thread hands to fwrite at once
+#define TRACE_BATCH 4096
+
+struct trace_writer {
+    ring_writer *ring;
+    FILE *fp;
+};
+
+static void write_records(void *context, const void *records, size_t count)
+{
+    trace_writer *writer = context;
+    fwrite(records, sizeof(trace_record), count, writer->fp);
+}
+
+trace_writer *trace_open(const char *path)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+    {
+        printf("Failed to open trace file: %s\n", path);
+        return NULL;
+    }
+
+    trace_file_header header = { .version = TRACE_VERSION, .record_size = sizeof(trace_record) };
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    fwrite(&header, sizeof(header), 1, fp);
+
+    trace_writer *writer = calloc(1, sizeof(trace_writer));
+    if (!writer)
+    {
+        fclose(fp);
+        return NULL;
+    }
+    writer->fp = fp;
+
+    writer->ring = ring_writer_open(sizeof(trace_record), TRACE_RING_SIZE, TRACE_BATCH, write_records, writer);
+    if (!writer->ring)
+    {
+        printf("Failed to start trace writer thread\n");
+        fclose(fp);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+void trace_push(trace_writer *writer, const trace_record *record)
+{
+    trace_record *slot = ring_writer_reserve(writer->ring);
+    *slot = *record;
+    ring_writer_publish(writer->ring);
+}
+
+void trace_close(trace_writer *writer)
+{
+    if (!writer)
+    {
+        return;
+    }
+
+    ring_writer_close(writer->ring);
+    fclose(writer->fp);
+    free(writer);
+}
+
+int trace_format(const trace_record *record, char *buf, size_t size)
+{
+    return snprintf(buf, size,
+        "%08lX - %04X: %-7s (%02X %02X %02X) A: %02X F: %c%c%c%c BC: %02X%02X DE: %02X%02X HL: %02X%02X",
+        (unsigned long)record->ticks, record->pc,
+        get_instruction_name(get_instruction_by_opcode(record->opcode)->type), record->opcode,
+        record->operands[0], record->operands[1], record->a,
+        record->f & (1 << 7) ? 'Z' : '-',
+        record->f & (1 << 6) ? 'N' : '-',
+        record->f & (1 << 5) ? 'H' : '-',
+        record->f & (1 << 4) ? 'C' : '-',
+        record->b, record->c, record->d, record->e, record->h, record->l);
+}
@@ -0,0 +1,190 @@
+// Generates lib/cpu_dispatch_gen.c (in the build directory) from the
+// instructions[] table in lib/instructions.c.
+//
+// Every opcode gets its own handler with its instruction baked in as a
+// constant, so the shared code in cpu_exec.h folds down to just the work that
+// opcode does. The 256 CB opcodes get the same treatment with the op byte as
+// the constant.
+//
+// Each opcode also gets a block cache variant (blk_XX, see blockcache.h)
+// that takes its immediate operands already decoded instead of reading
+// them off the bus, CB opcodes get theirs with the CB op resolved too.
+//
+// usage: gen_dispatch <output file>
+
+#include <stdio.h>
+#include <instructions.h>
+
+static const char *TYPE_NAMES[] = {
+    "IN_NONE", "IN_NOP", "IN_LD", "IN_INC", "IN_DEC", "IN_RLCA", "IN_ADD",
+    "IN_RRCA", "IN_STOP", "IN_RLA", "IN_JR", "IN_RRA", "IN_DAA", "IN_CPL",
+    "IN_SCF", "IN_CCF", "IN_HALT", "IN_ADC", "IN_SUB", "IN_SBC", "IN_AND",
+    "IN_XOR", "IN_OR", "IN_CP", "IN_POP", "IN_JP", "IN_PUSH", "IN_RET",
+    "IN_CB", "IN_CALL", "IN_RETI", "IN_LDH", "IN_JPHL", "IN_DI", "IN_EI",
+    "IN_RST", "IN_ERR", "IN_RLC", "IN_RRC", "IN_RL", "IN_RR", "IN_SLA",
+    "IN_SRA", "IN_SWAP", "IN_SRL", "IN_BIT", "IN_RES", "IN_SET"
+};
+
+static const char *MODE_NAMES[] = {
+    "AM_IMP", "AM_R_N16", "AM_R_R", "AM_MR_R", "AM_R", "AM_R_N8", "AM_R_MR",
+    "AM_R_HLI", "AM_R_HLD", "AM_HLI_R", "AM_HLD_R", "AM_R_A8", "AM_A8_R",
+    "AM_HL_SPR", "AM_N16", "AM_N8", "AM_N16_R", "AM_MR_N8", "AM_MR",
+    "AM_A16_R", "AM_R_A16"
+};
+
+static const char *REG_NAMES[] = {
+    "RT_NONE", "RT_A", "RT_F", "RT_B", "RT_C", "RT_D", "RT_E", "RT_H",
+    "RT_L", "RT_AF", "RT_BC", "RT_DE", "RT_HL", "RT_SP", "RT_PC"
+};
+
+static const char *COND_NAMES[] = {
+    "CT_NONE", "CT_NZ", "CT_Z", "CT_NC", "CT_C"
+};
+
+#define COUNT(a) (sizeof(a) / sizeof(a[0]))
+
+static void write_opcode_handler(FILE *fp, int opcode)
+{
+    const instruction *inst = get_instruction_by_opcode(opcode);
+
+    fprintf(fp, "// %s\n", get_instruction_name(inst->type));
+    fprintf(fp, "static void op_%02X(gb_t *gb)\n{\n", opcode);
+    fprintf(fp, "    static const instruction inst = { %s, %s, %s, %s, %s, 0x%02X };\n",
+        TYPE_NAMES[inst->type], MODE_NAMES[inst->mode], REG_NAMES[inst->reg_1],
+        REG_NAMES[inst->reg_2], COND_NAMES[inst->cond], inst->param);
+    fprintf(fp, "    fetch_data(gb, &inst);\n");
+
+    if (inst->type == IN_CB)
+    {
+        // jump straight into the specialized CB handler
+        fprintf(fp, "    cpu_cb_handlers[gb->cpu.fetched_data & 0xFF](gb);\n");
+    }
+    else
+    {
+        fprintf(fp, "    cpu_execute(gb, &inst);\n");
+    }
+    fprintf(fp, "}\n\n");
+}
+
+static void write_block_handler(FILE *fp, int opcode)
+{
+    const instruction *inst = get_instruction_by_opcode(opcode);
+
+    // the CB prefix is resolved when the block is decoded, see below
+    if (inst->type == IN_CB)
+    {
+        fprintf(fp, "#define blk_%02X blk_CB_00\n\n", opcode);
+        return;
+    }
+
+    fprintf(fp, "static void blk_%02X(gb_t *gb, uint16_t imm)\n{\n", opcode);
+    fprintf(fp, "    static const instruction inst = { %s, %s, %s, %s, %s, 0x%02X };\n",
+        TYPE_NAMES[inst->type], MODE_NAMES[inst->mode], REG_NAMES[inst->reg_1],
+        REG_NAMES[inst->reg_2], COND_NAMES[inst->cond], inst->param);
+    fprintf(fp, "    fetch_operands(gb, &inst, true, imm);\n");
+    fprintf(fp, "    cpu_execute(gb, &inst);\n");
+    fprintf(fp, "}\n\n");
+}
+
+static void write_block_cb_handler(FILE *fp, int op)
+{
+    const instruction *inst = get_instruction_by_opcode(0xCB);
+
+    fprintf(fp, "static void blk_CB_%02X(gb_t *gb, uint16_t imm)\n{\n", op);
+    fprintf(fp, "    static const instruction inst = { %s, %s, %s, %s, %s, 0x%02X };\n",
+        TYPE_NAMES[inst->type], MODE_NAMES[inst->mode], REG_NAMES[inst->reg_1],
+        REG_NAMES[inst->reg_2], COND_NAMES[inst->cond], inst->param);
+    fprintf(fp, "    fetch_operands(gb, &inst, true, 0x%02X);\n", op);
+    fprintf(fp, "    cb_exec(gb, 0x%02X);\n", op);
+    fprintf(fp, "}\n\n");
+}
+
+static void write_cb_handler(FILE *fp, int op)
+{
+    fprintf(fp, "static void cb_%02X(gb_t *gb)\n{\n", op);
+    fprintf(fp, "    cb_exec(gb, 0x%02X);\n", op);
+    fprintf(fp, "}\n\n");
+}
+
+static void write_table(FILE *fp, const char *type, const char *name, const char *prefix)
+{
+    fprintf(fp, "const %s %s[0x100] = {\n", type, name);
+    for (int i = 0; i < 0x100; i++)
+    {
+        fprintf(fp, "    %s%02X,\n", prefix, i);
+    }
+    fprintf(fp, "};\n\n");
+}
+
+static int check_tables()
+{
+    for (int i = 0; i < 0x100; i++)
+    {
+        const instruction *inst = get_instruction_by_opcode(i);
+        if (inst->type >= COUNT(TYPE_NAMES) || inst->mode >= COUNT(MODE_NAMES) ||
+            inst->reg_1 >= COUNT(REG_NAMES) || inst->reg_2 >= COUNT(REG_NAMES) ||
+            inst->cond >= COUNT(COND_NAMES))
+        {
+            fprintf(stderr, "gen_dispatch: opcode %02X has a value missing from the name tables\n", i);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <output file>\n", argv[0]);
+        return 1;
+    }
+
+    if (!check_tables())
+    {
+        return 1;
+    }
+
+    FILE *fp = fopen(argv[1], "w");
+    if (!fp)
+    {
+        fprintf(stderr, "gen_dispatch: failed to open %s\n", argv[1]);
+        return 1;
+    }
+
+    fprintf(fp, "// generated by tools/gen_dispatch.c from lib/instructions.c - do not edit\n\n");
+    fprintf(fp, "#include <cpu.h>\n");
+    fprintf(fp, "#include <gb.h>\n");
+    fprintf(fp, "#include \"cpu_exec.h\"\n\n");
+
+    for (int op = 0; op < 0x100; op++)
+    {
+        write_cb_handler(fp, op);
+    }
+    write_table(fp, "IN_PROC", "cpu_cb_handlers", "cb_");
+
+    for (int opcode = 0; opcode < 0x100; opcode++)
+    {
+        write_opcode_handler(fp, opcode);
+    }
+    write_table(fp, "IN_PROC", "cpu_opcode_handlers", "op_");
+
+    for (int op = 0; op < 0x100; op++)
+    {
+        write_block_cb_handler(fp, op);
+    }
+    write_table(fp, "BLOCK_PROC", "cpu_block_cb_handlers", "blk_CB_");
+
+    for (int opcode = 0; opcode < 0x100; opcode++)
+    {
+        write_block_handler(fp, opcode);
+    }
+    write_table(fp, "BLOCK_PROC", "cpu_block_handlers", "blk_");
+
+    if (fclose(fp) != 0)
+    {
+        fprintf(stderr, "gen_dispatch: failed to write %s\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}